@@ -43,9 +43,6 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize.h"
-
 // #endif
 
 #if !defined(_WIN32) && !defined(_WIN64)
@@ -118,7 +118,23 @@ static void init_embree_bvh(bvh_shape* shape, const bvh_params& params) {
     rtcSetSceneFlags(escene, RTC_SCENE_FLAG_COMPACT);
   if (params.bvh == bvh_build_type::embree_highquality)
     rtcSetSceneBuildQuality(escene, RTC_BUILD_QUALITY_HIGH);
-  if (!shape->points.empty()) {
+  if (shape->compact) {
+    auto& compact   = *shape->compact;
+    auto  egeometry = rtcNewGeometry(edevice, RTC_GEOMETRY_TYPE_TRIANGLE);
+    rtcSetGeometryVertexAttributeCount(egeometry, 1);
+    auto embree_positions = (vec3f*)rtcSetNewGeometryBuffer(egeometry,
+        RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, 3 * 4,
+        compact.positions.size());
+    auto embree_triangles = (vec3i*)rtcSetNewGeometryBuffer(egeometry,
+        RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3, 3 * 4,
+        compact.triangles.size());
+    for (auto idx = 0; idx < compact.positions.size(); idx++)
+      embree_positions[idx] = compact_position(compact, idx);
+    for (auto idx = 0; idx < compact.triangles.size(); idx++)
+      embree_triangles[idx] = compact_triangle(compact, idx);
+    rtcCommitGeometry(egeometry);
+    rtcAttachGeometryByID(escene, egeometry, 0);
+  } else if (!shape->points.empty()) {
     throw std::runtime_error("embree does not support points");
   } else if (!shape->lines.empty()) {
     auto elines     = vector<int>{};
@@ -324,6 +340,108 @@ void set_shape(bvh_scene* bvh, int shape_id, const vector<int>& points,
                                   : bvh_span{shape->positions_data};
   shape->radius_data    = as_view ? vector<float>{} : radius;
   shape->radius = as_view ? bvh_span{radius} : bvh_span{shape->radius_data};
+  shape->compact_data = {};
+  shape->compact      = nullptr;
+}
+int add_shape(bvh_scene* bvh, const bvh_compact_shape& compact, bool as_view) {
+  bvh->shapes.push_back(new bvh_shape{});
+  set_shape(bvh, (int)bvh->shapes.size() - 1, compact, as_view);
+  return (int)bvh->shapes.size() - 1;
+}
+void set_shape(bvh_scene* bvh, int shape_id, const bvh_compact_shape& compact,
+    bool as_view) {
+  auto shape = bvh->shapes[shape_id];
+  set_shape(bvh, shape_id, {}, {}, {}, {}, {}, {}, false);
+  shape->compact_data = as_view ? bvh_compact_shape{} : compact;
+  shape->compact      = as_view ? &compact : &shape->compact_data;
+}
+
+// Make compact triangle geometry
+bvh_compact_shape make_compact_shape(const vector<vec3i>& triangles,
+    const vector<vec3f>& positions, const vector<vec3f>& normals,
+    const vector<vec2f>& texcoords) {
+  auto compact        = bvh_compact_shape{};
+  auto vertex_cluster = bvh_compact_shape::vertex_cluster;
+  auto num_clusters   = ((int)positions.size() + vertex_cluster - 1) /
+                      vertex_cluster;
+  auto quantize = [](float value, float min, float max) -> uint16_t {
+    if (max <= min) return 0;
+    return (uint16_t)clamp(
+        (int)round((value - min) / (max - min) * 65535), 0, 65535);
+  };
+
+  // positions
+  compact.position_bounds = vector<bbox3f>(num_clusters);
+  compact.positions       = vector<array<uint16_t, 3>>(positions.size());
+  for (auto vertex = 0; vertex < positions.size(); vertex++) {
+    auto& bounds = compact.position_bounds[vertex / vertex_cluster];
+    bounds       = merge(bounds, positions[vertex]);
+  }
+  for (auto vertex = 0; vertex < positions.size(); vertex++) {
+    auto& bounds = compact.position_bounds[vertex / vertex_cluster];
+    auto& p      = positions[vertex];
+    compact.positions[vertex] = {quantize(p.x, bounds.min.x, bounds.max.x),
+        quantize(p.y, bounds.min.y, bounds.max.y),
+        quantize(p.z, bounds.min.z, bounds.max.z)};
+  }
+
+  // normals in octahedral coordinates
+  compact.normals = vector<array<int16_t, 2>>(normals.size());
+  for (auto vertex = 0; vertex < normals.size(); vertex++) {
+    auto n = normals[vertex] /
+             (abs(normals[vertex].x) + abs(normals[vertex].y) +
+                 abs(normals[vertex].z));
+    if (n.z < 0) {
+      auto x = n.x;
+      n.x    = (1 - abs(n.y)) * (n.x >= 0 ? 1 : -1);
+      n.y    = (1 - abs(x)) * (n.y >= 0 ? 1 : -1);
+    }
+    compact.normals[vertex] = {(int16_t)round(clamp(n.x, -1.0f, 1.0f) * 32767),
+        (int16_t)round(clamp(n.y, -1.0f, 1.0f) * 32767)};
+  }
+
+  // texcoords
+  if (!texcoords.empty()) {
+    compact.texcoord_bounds = vector<bbox2f>(num_clusters);
+    compact.texcoords       = vector<array<uint16_t, 2>>(texcoords.size());
+    for (auto vertex = 0; vertex < texcoords.size(); vertex++) {
+      auto& bounds = compact.texcoord_bounds[vertex / vertex_cluster];
+      bounds       = merge(bounds, texcoords[vertex]);
+    }
+    for (auto vertex = 0; vertex < texcoords.size(); vertex++) {
+      auto& bounds = compact.texcoord_bounds[vertex / vertex_cluster];
+      auto& uv     = texcoords[vertex];
+      compact.texcoords[vertex] = {quantize(uv.x, bounds.min.x, bounds.max.x),
+          quantize(uv.y, bounds.min.y, bounds.max.y)};
+    }
+  }
+
+  // triangles as offsets from the smallest vertex of their cluster
+  auto triangle_cluster = bvh_compact_shape::triangle_cluster;
+  compact.triangles     = vector<array<uint16_t, 3>>(triangles.size());
+  for (auto start = 0; start < triangles.size(); start += triangle_cluster) {
+    auto end  = std::min(start + triangle_cluster, (int)triangles.size());
+    auto base = int_max, last = 0;
+    for (auto idx = start; idx < end; idx++) {
+      base = min(base, min(triangles[idx]));
+      last = max(last, max(triangles[idx]));
+    }
+    if (last - base <= 65535) {
+      compact.triangle_bases.push_back({base, -1});
+      for (auto idx = start; idx < end; idx++) {
+        auto& t                = triangles[idx];
+        compact.triangles[idx] = {(uint16_t)(t.x - base),
+            (uint16_t)(t.y - base), (uint16_t)(t.z - base)};
+      }
+    } else {
+      compact.triangle_bases.push_back(
+          {base, (int)compact.wide_triangles.size()});
+      compact.wide_triangles.insert(compact.wide_triangles.end(),
+          triangles.begin() + start, triangles.begin() + end);
+    }
+  }
+
+  return compact;
 }
 
 // Set instances
@@ -512,28 +630,17 @@ static pair<int, int> split_nodes(vector<int>& primitives,
 // Maximum number of primitives per BVH node.
 const int bvh_max_prims = 4;
 
-// Build BVH nodes
-static void build_bvh_serial(
-    bvh_tree& bvh, const vector<bbox3f>& bboxes, const bvh_params& params) {
-  // get values
-  auto& nodes      = bvh.nodes;
-  auto& primitives = bvh.primitives;
-
+// Build the nodes of the subtree over primitives[start, end). Nodes are
+// stored level by level in a separate array, with the root first.
+static vector<bvh_node> build_bvh_nodes(vector<int>& primitives,
+    const vector<bbox3f>& bboxes, const vector<vec3f>& centers, int start,
+    int end, const bvh_params& params) {
   // prepare to build nodes
-  nodes.clear();
-  nodes.reserve(bboxes.size() * 2);
-
-  // prepare primitives
-  bvh.primitives.resize(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++) bvh.primitives[idx] = idx;
-
-  // prepare centers
-  auto centers = vector<vec3f>(bboxes.size());
-  for (auto idx = 0; idx < bboxes.size(); idx++)
-    centers[idx] = center(bboxes[idx]);
+  auto nodes = vector<bvh_node>{};
+  nodes.reserve((end - start) * 2);
 
   // queue up first node
-  auto queue = deque<vec3i>{{0, 0, (int)bboxes.size()}};
+  auto queue = deque<vec3i>{{0, start, end}};
   nodes.emplace_back();
 
   // create nodes until the queue is empty
@@ -576,6 +683,52 @@ static void build_bvh_serial(
 
   // cleanup
   nodes.shrink_to_fit();
+  return nodes;
+}
+
+// Surface area used for SAH costs, kept positive for degenerate boxes
+static float bvh_area(const bbox3f& bbox) {
+  if (bbox.min.x > bbox.max.x) return 1e-12f;
+  auto size = bbox.max - bbox.min;
+  return 1e-12f + 2 * (size.x * size.y + size.x * size.z + size.y * size.z);
+}
+
+// SAH cost of a node, given the unnormalized costs of its children, using
+// unit costs for both traversal and intersection.
+static float bvh_cost(const bvh_node& node, const vector<float>& costs) {
+  auto area = bvh_area(node.bbox);
+  if (!node.internal) return area * node.num;
+  return area + costs[node.start + 0] + costs[node.start + 1];
+}
+
+// Compute the SAH costs of all subtrees relative to their areas
+static vector<float> eval_bvh_costs(const vector<bvh_node>& nodes) {
+  auto costs = vector<float>(nodes.size());
+  for (auto nodeid = (int)nodes.size() - 1; nodeid >= 0; nodeid--)
+    costs[nodeid] = bvh_cost(nodes[nodeid], costs);
+  for (auto nodeid = 0; nodeid < (int)nodes.size(); nodeid++)
+    costs[nodeid] /= bvh_area(nodes[nodeid].bbox);
+  return costs;
+}
+
+// Build BVH nodes
+static void build_bvh_serial(
+    bvh_tree& bvh, const vector<bbox3f>& bboxes, const bvh_params& params) {
+  // prepare primitives
+  bvh.primitives.resize(bboxes.size());
+  for (auto idx = 0; idx < bboxes.size(); idx++) bvh.primitives[idx] = idx;
+
+  // prepare centers
+  auto centers = vector<vec3f>(bboxes.size());
+  for (auto idx = 0; idx < bboxes.size(); idx++)
+    centers[idx] = center(bboxes[idx]);
+
+  // build nodes
+  bvh.nodes = build_bvh_nodes(
+      bvh.primitives, bboxes, centers, 0, (int)bboxes.size(), params);
+
+  // keep costs to detect degradation on update
+  bvh.build_costs = eval_bvh_costs(bvh.nodes);
 }
 
 #if 0
@@ -680,62 +833,193 @@ static void build_bvh_parallel(
 
 #endif
 
-// Update bvh
-static void update_bvh(bvh_tree& bvh, const vector<bbox3f>& bboxes) {
-  for (auto nodeid = (int)bvh.nodes.size() - 1; nodeid >= 0; nodeid--) {
-    auto& node = bvh.nodes[nodeid];
+// Minimum number of nodes to refit a bvh level in parallel.
+const int bvh_parallel_level = 4096;
+
+// Update bvh by refitting its nodes. Subtrees whose SAH cost grew by more
+// than params.rebuild times their build cost are rebuilt and spliced back.
+static void update_bvh(bvh_tree& bvh, const vector<bbox3f>& bboxes,
+    const bvh_params& params) {
+  auto& nodes = bvh.nodes;
+  if (nodes.empty()) return;
+  if (bvh.build_costs.size() != nodes.size())
+    bvh.build_costs = vector<float>(nodes.size(), flt_max);
+
+  // find levels, since the children of a level follow it in order
+  auto levels = vector<vec2i>{{0, 1}};
+  while (true) {
+    auto [start, end] = levels.back();
+    auto num_children = 0;
+    for (auto nodeid = start; nodeid < end; nodeid++)
+      if (nodes[nodeid].internal) num_children += 2;
+    if (num_children == 0) break;
+    levels.push_back({end, end + num_children});
+  }
+
+  // refit bottom up, also computing costs and primitive ranges
+  auto costs  = vector<float>(nodes.size());
+  auto ranges = vector<vec2i>(nodes.size());
+  auto refit  = [&](int nodeid) {
+    auto& node = nodes[nodeid];
     node.bbox  = invalidb3f;
     if (node.internal) {
       for (auto idx = 0; idx < 2; idx++) {
-        node.bbox = merge(node.bbox, bvh.nodes[node.start + idx].bbox);
+        node.bbox = merge(node.bbox, nodes[node.start + idx].bbox);
       }
+      ranges[nodeid] = {ranges[node.start].x, ranges[node.start + 1].y};
     } else {
       for (auto idx = 0; idx < node.num; idx++) {
         node.bbox = merge(node.bbox, bboxes[bvh.primitives[node.start + idx]]);
       }
+      ranges[nodeid] = {node.start, node.start + node.num};
+    }
+    costs[nodeid] = bvh_cost(node, costs);
+  };
+  for (auto level = (int)levels.size() - 1; level >= 0; level--) {
+    auto range = levels[level];
+    if (params.noparallel || range.y - range.x < bvh_parallel_level) {
+      for (auto nodeid = range.x; nodeid < range.y; nodeid++) refit(nodeid);
+    } else {
+      parallel_for(range.y - range.x, [&](int idx) { refit(range.x + idx); });
     }
   }
-}
 
-static void build_bvh(bvh_shape* shape, const bvh_params& params) {
-#ifdef YOCTO_EMBREE
-  if (params.bvh == bvh_build_type::embree_default ||
-      params.bvh == bvh_build_type::embree_highquality ||
-      params.bvh == bvh_build_type::embree_compact) {
-    return init_embree_bvh(shape, params);
+  // find the largest degraded subtrees
+  if (params.rebuild <= 0) return;
+  auto degraded = vector<int>{};
+  auto stack    = vector<int>{0};
+  while (!stack.empty()) {
+    auto nodeid = stack.back();
+    stack.pop_back();
+    auto& node = nodes[nodeid];
+    if (!node.internal) continue;
+    auto cost = costs[nodeid] / bvh_area(node.bbox);
+    if (cost > params.rebuild * bvh.build_costs[nodeid]) {
+      degraded.push_back(nodeid);
+    } else {
+      stack.push_back(node.start + 0);
+      stack.push_back(node.start + 1);
+    }
   }
-#endif
+  if (degraded.empty()) return;
 
-  // build primitives
+  // rebuild degraded subtrees over their primitive ranges
+  auto centers = vector<vec3f>(bboxes.size());
+  for (auto idx = 0; idx < bboxes.size(); idx++)
+    centers[idx] = center(bboxes[idx]);
+  auto subtrees = vector<vector<bvh_node>>(degraded.size());
+  auto rebuild  = [&](int idx) {
+    auto [start, end] = ranges[degraded[idx]];
+    subtrees[idx]     = build_bvh_nodes(
+        bvh.primitives, bboxes, centers, start, end, params);
+  };
+  if (params.noparallel || degraded.size() == 1) {
+    for (auto idx = 0; idx < degraded.size(); idx++) rebuild(idx);
+  } else {
+    parallel_for((int)degraded.size(), rebuild);
+  }
+
+  // the whole tree was rebuilt
+  if (degraded.front() == 0) {
+    bvh.nodes       = std::move(subtrees.front());
+    bvh.build_costs = eval_bvh_costs(bvh.nodes);
+    return;
+  }
+
+  // splice subtrees, laying out nodes level by level again
+  auto subtree_ids = vector<int>(nodes.size(), -1);
+  for (auto idx = 0; idx < degraded.size(); idx++)
+    subtree_ids[degraded[idx]] = idx;
+  auto subtree_costs = vector<vector<float>>(subtrees.size());
+  for (auto idx = 0; idx < subtrees.size(); idx++)
+    subtree_costs[idx] = eval_bvh_costs(subtrees[idx]);
+  auto spliced       = vector<bvh_node>{};
+  auto spliced_costs = vector<float>{};
+  spliced.reserve(nodes.size());
+  spliced_costs.reserve(nodes.size());
+  // queue of source subtree (-1 for the refitted tree) and node index
+  auto queue = deque<vec2i>{{-1, 0}};
+  while (!queue.empty()) {
+    auto [subtree, nodeid] = queue.front();
+    queue.pop_front();
+    if (subtree < 0 && subtree_ids[nodeid] >= 0) {
+      subtree = subtree_ids[nodeid];
+      nodeid  = 0;
+    }
+    auto& node = subtree < 0 ? nodes[nodeid] : subtrees[subtree][nodeid];
+    spliced.push_back(node);
+    spliced_costs.push_back(subtree < 0 ? bvh.build_costs[nodeid]
+                                        : subtree_costs[subtree][nodeid]);
+    if (node.internal) {
+      spliced.back().start = (int)(spliced.size() + queue.size());
+      queue.push_back({subtree, node.start + 0});
+      queue.push_back({subtree, node.start + 1});
+    }
+  }
+  bvh.nodes       = std::move(spliced);
+  bvh.build_costs = std::move(spliced_costs);
+}
+
+// Compute primitive bounds of a shape
+static vector<bbox3f> shape_bboxes(
+    const bvh_shape* shape, const bvh_params& params) {
   auto bboxes = vector<bbox3f>{};
-  if (!shape->points.empty()) {
+  auto eval   = function<void(int)>{};
+  if (shape->compact) {
+    auto& compact = *shape->compact;
+    bboxes        = vector<bbox3f>(compact.triangles.size());
+    eval          = [&](int idx) {
+      auto t      = compact_triangle(compact, idx);
+      bboxes[idx] = triangle_bounds(compact_position(compact, t.x),
+          compact_position(compact, t.y), compact_position(compact, t.z));
+    };
+  } else if (!shape->points.empty()) {
     bboxes = vector<bbox3f>(shape->points.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
+    eval   = [&](int idx) {
       auto& p     = shape->points[idx];
       bboxes[idx] = point_bounds(shape->positions[p], shape->radius[p]);
-    }
+    };
   } else if (!shape->lines.empty()) {
     bboxes = vector<bbox3f>(shape->lines.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
+    eval   = [&](int idx) {
       auto& l     = shape->lines[idx];
       bboxes[idx] = line_bounds(shape->positions[l.x], shape->positions[l.y],
           shape->radius[l.x], shape->radius[l.y]);
-    }
+    };
   } else if (!shape->triangles.empty()) {
     bboxes = vector<bbox3f>(shape->triangles.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
+    eval   = [&](int idx) {
       auto& t     = shape->triangles[idx];
       bboxes[idx] = triangle_bounds(
           shape->positions[t.x], shape->positions[t.y], shape->positions[t.z]);
-    }
+    };
   } else if (!shape->quads.empty()) {
     bboxes = vector<bbox3f>(shape->quads.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
+    eval   = [&](int idx) {
       auto& q     = shape->quads[idx];
       bboxes[idx] = quad_bounds(shape->positions[q.x], shape->positions[q.y],
           shape->positions[q.z], shape->positions[q.w]);
-    }
+    };
+  }
+  if (params.noparallel || bboxes.size() < bvh_parallel_level) {
+    for (auto idx = 0; idx < bboxes.size(); idx++) eval(idx);
+  } else {
+    parallel_for((int)bboxes.size(), eval);
   }
+  return bboxes;
+}
+
+static void build_bvh(bvh_shape* shape, const bvh_params& params) {
+#ifdef YOCTO_EMBREE
+  if (params.bvh == bvh_build_type::embree_default ||
+      params.bvh == bvh_build_type::embree_highquality ||
+      params.bvh == bvh_build_type::embree_compact) {
+    return init_embree_bvh(shape, params);
+  }
+#endif
+
+  // build primitives
+  auto bboxes = shape_bboxes(shape, params);
 
   // build nodes
   build_bvh_serial(shape->bvh, bboxes, params);
@@ -784,7 +1068,7 @@ void init_bvh(bvh_scene* scene, const bvh_params& params,
   if (progress_cb) progress_cb("build bvh", progress.x++, progress.y);
 }
 
-static void update_bvh(bvh_shape* shape) {
+static void update_bvh(bvh_shape* shape, const bvh_params& params) {
 #ifdef YOCTO_EMBREE
   if (shape->embree_bvh) {
     throw std::runtime_error("embree shape refit not supported");
@@ -792,41 +1076,14 @@ static void update_bvh(bvh_shape* shape) {
 #endif
 
   // build primitives
-  auto bboxes = vector<bbox3f>{};
-  if (!shape->points.empty()) {
-    bboxes = vector<bbox3f>(shape->points.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
-      auto& p     = shape->points[idx];
-      bboxes[idx] = point_bounds(shape->positions[p], shape->radius[p]);
-    }
-  } else if (!shape->lines.empty()) {
-    bboxes = vector<bbox3f>(shape->lines.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
-      auto& l     = shape->lines[idx];
-      bboxes[idx] = line_bounds(shape->positions[l.x], shape->positions[l.y],
-          shape->radius[l.x], shape->radius[l.y]);
-    }
-  } else if (!shape->triangles.empty()) {
-    bboxes = vector<bbox3f>(shape->triangles.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
-      auto& t     = shape->triangles[idx];
-      bboxes[idx] = triangle_bounds(
-          shape->positions[t.x], shape->positions[t.y], shape->positions[t.z]);
-    }
-  } else if (!shape->quads.empty()) {
-    bboxes = vector<bbox3f>(shape->quads.size());
-    for (auto idx = 0; idx < bboxes.size(); idx++) {
-      auto& q     = shape->quads[idx];
-      bboxes[idx] = quad_bounds(shape->positions[q.x], shape->positions[q.y],
-          shape->positions[q.z], shape->positions[q.w]);
-    }
-  }
+  auto bboxes = shape_bboxes(shape, params);
 
   // update nodes
-  update_bvh(shape->bvh, bboxes);
+  update_bvh(shape->bvh, bboxes, params);
 }
 
-void update_bvh(bvh_scene* scene, const vector<int>& updated_instances) {
+static void update_bvh(bvh_scene* scene, const vector<int>& updated_instances,
+    const bvh_params& params) {
 #ifdef YOCTO_EMBREE
   if (scene->embree_bvh) {
     return update_embree_bvh(scene, updated_instances);
@@ -842,23 +1099,24 @@ void update_bvh(bvh_scene* scene, const vector<int>& updated_instances) {
   }
 
   // update nodes
-  update_bvh(scene->bvh, bboxes);
+  update_bvh(scene->bvh, bboxes, params);
 }
 
 void update_bvh(bvh_scene* scene, const vector<int>& updated_instances,
-    const vector<int>& updated_shapes, const progress_callback& progress_cb) {
+    const vector<int>& updated_shapes, const bvh_params& params,
+    const progress_callback& progress_cb) {
   // handle progress
   auto progress = vec2i{0, 1 + (int)updated_shapes.size()};
 
   // update shapes
   for (auto shape : updated_shapes) {
     if (progress_cb) progress_cb("update shape bvh", progress.x++, progress.y);
-    update_bvh(scene->shapes[shape]);
+    update_bvh(scene->shapes[shape], params);
   }
 
   // handle instances
   if (progress_cb) progress_cb("update scene bvh", progress.x++, progress.y);
-  update_bvh(scene, updated_instances);
+  update_bvh(scene, updated_instances, params);
 
   // handle progress
   if (progress_cb) progress_cb("update bvh", progress.x++, progress.y);
@@ -871,6 +1129,21 @@ void update_bvh(bvh_scene* scene, const vector<int>& updated_instances,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+#ifdef YOCTO_STATS
+// Traversal statistics of each thread
+static thread_local auto bvh_thread_stats = bvh_stats{};
+#endif
+
+// Get the traversal statistics of the calling thread.
+const bvh_stats& get_bvh_stats() {
+#ifdef YOCTO_STATS
+  return bvh_thread_stats;
+#else
+  static const auto stats = bvh_stats{};
+  return stats;
+#endif
+}
+
 // Intersect ray with a bvh.
 static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
     int& element, vec2f& uv, float& distance, bool find_any) {
@@ -900,14 +1173,24 @@ static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
       (ray_dinv.z < 0) ? 1 : 0};
 
+#ifdef YOCTO_STATS
+  auto& stats = bvh_thread_stats;
+#endif
+
   // walking stack
   while (node_cur != 0) {
     // grab node
     auto& node = shape->bvh.nodes[node_stack[--node_cur]];
+#ifdef YOCTO_STATS
+    stats.nodes += 1;
+#endif
 
     // intersect bbox
     // if (!intersect_bbox(ray, ray_dinv, ray_dsign, node.bbox)) continue;
     if (!intersect_bbox(ray, ray_dinv, node.bbox)) continue;
+#ifdef YOCTO_STATS
+    if (!node.internal) stats.primitives += node.num;
+#endif
 
     // intersect node, switching based on node type
     // for each type, iterate over the the primitive list
@@ -921,6 +1204,18 @@ static bool intersect_bvh(const bvh_shape* shape, const ray3f& ray_,
         node_stack[node_cur++] = node.start + 1;
         node_stack[node_cur++] = node.start + 0;
       }
+    } else if (shape->compact) {
+      auto& compact = *shape->compact;
+      for (auto idx = node.start; idx < node.start + node.num; idx++) {
+        auto t = compact_triangle(compact, shape->bvh.primitives[idx]);
+        if (intersect_triangle(ray, compact_position(compact, t.x),
+                compact_position(compact, t.y), compact_position(compact, t.z),
+                uv, distance)) {
+          hit      = true;
+          element  = shape->bvh.primitives[idx];
+          ray.tmax = distance;
+        }
+      }
     } else if (!shape->points.empty()) {
       for (auto idx = node.start; idx < node.start + node.num; idx++) {
         auto& p = shape->points[shape->bvh.primitives[idx]];
@@ -1001,10 +1296,17 @@ static bool intersect_bvh(const bvh_scene* scene, const ray3f& ray_,
   auto ray_dsign = vec3i{(ray_dinv.x < 0) ? 1 : 0, (ray_dinv.y < 0) ? 1 : 0,
       (ray_dinv.z < 0) ? 1 : 0};
 
+#ifdef YOCTO_STATS
+  auto& stats = bvh_thread_stats;
+#endif
+
   // walking stack
   while (node_cur != 0) {
     // grab node
     auto& node = scene->bvh.nodes[node_stack[--node_cur]];
+#ifdef YOCTO_STATS
+    stats.nodes += 1;
+#endif
 
     // intersect bbox
     // if (!intersect_bbox(ray, ray_dinv, ray_dsign, node.bbox)) continue;
@@ -1088,6 +1390,19 @@ static bool overlap_bvh(const bvh_shape* shape, const vec3f& pos,
       // internal node
       node_stack[node_cur++] = node.start + 0;
       node_stack[node_cur++] = node.start + 1;
+    } else if (shape->compact) {
+      auto& compact = *shape->compact;
+      for (auto idx = 0; idx < node.num; idx++) {
+        auto primitive = shape->bvh.primitives[node.start + idx];
+        auto t         = compact_triangle(compact, primitive);
+        if (overlap_triangle(pos, max_distance, compact_position(compact, t.x),
+                compact_position(compact, t.y), compact_position(compact, t.z),
+                0, 0, 0, uv, distance)) {
+          hit          = true;
+          element      = primitive;
+          max_distance = distance;
+        }
+      }
     } else if (!shape->points.empty()) {
       for (auto idx = 0; idx < node.num; idx++) {
         auto  primitive = shape->bvh.primitives[node.start + idx];
@@ -1260,6 +1575,9 @@ void overlap_bvh_elems(const bvh_data& bvh1, const bvh_data& bvh2,
 
 bvh_intersection intersect_bvh(const bvh_scene* scene, const ray3f& ray,
     bool find_any, bool non_rigid_frames) {
+#ifdef YOCTO_STATS
+  bvh_thread_stats.scene_rays += 1;
+#endif
   auto intersection = bvh_intersection{};
   intersection.hit  = intersect_bvh(scene, ray, intersection.instance,
       intersection.element, intersection.uv, intersection.distance, find_any,
@@ -1268,6 +1586,9 @@ bvh_intersection intersect_bvh(const bvh_scene* scene, const ray3f& ray,
 }
 bvh_intersection intersect_bvh(const bvh_scene* scene, int instance,
     const ray3f& ray, bool find_any, bool non_rigid_frames) {
+#ifdef YOCTO_STATS
+  bvh_thread_stats.instance_rays += 1;
+#endif
   auto intersection = bvh_intersection{};
   intersection.hit  = intersect_bvh(scene, instance, ray, intersection.element,
       intersection.uv, intersection.distance, find_any, non_rigid_frames);
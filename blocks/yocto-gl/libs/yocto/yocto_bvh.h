@@ -84,10 +84,14 @@ struct bvh_node {
 // BVH tree stored as a node array with the tree structure is encoded using
 // array indices. BVH nodes indices refer to either the node array,
 // for internal nodes, or the primitive arrays, for leaf nodes.
+// Nodes are stored level by level, so children follow their parents.
+// For each node, we also keep the SAH cost of its subtree when it was built,
+// relative to its area, to track how much refitting degrades it.
 // Application data is not stored explicitly.
 struct bvh_tree {
-  vector<bvh_node> nodes      = {};
-  vector<int>      primitives = {};
+  vector<bvh_node> nodes       = {};
+  vector<int>      primitives  = {};
+  vector<float>    build_costs = {};
 };
 
 // BVH span to give a view over an array
@@ -108,6 +112,42 @@ struct bvh_span {
   size_t    _size = 0;
 };
 
+// Compact triangle geometry. Positions and texcoords are quantized to 16 bits
+// relative to the bounds of clusters of consecutive vertices, and normals are
+// stored in 16-bit octahedral coordinates. Triangles are grouped in clusters
+// and stored as 16-bit offsets from the first vertex of each cluster. The few
+// clusters whose vertices are too far apart are kept at full precision.
+// Elements are decoded one at a time, so data is accessed at random.
+struct bvh_compact_shape {
+  static const int vertex_cluster   = 256;
+  static const int triangle_cluster = 64;
+
+  // vertex clusters
+  vector<bbox3f> position_bounds = {};
+  vector<bbox2f> texcoord_bounds = {};
+
+  // quantized vertices
+  vector<array<uint16_t, 3>> positions = {};
+  vector<array<int16_t, 2>>  normals   = {};
+  vector<array<uint16_t, 2>> texcoords = {};
+
+  // triangle clusters, as base vertex and start of full precision triangles
+  vector<vec2i>              triangle_bases = {};
+  vector<array<uint16_t, 3>> triangles      = {};
+  vector<vec3i>              wide_triangles = {};
+};
+
+// Make compact triangle geometry. Normals and texcoords are optional.
+bvh_compact_shape make_compact_shape(const vector<vec3i>& triangles,
+    const vector<vec3f>& positions, const vector<vec3f>& normals,
+    const vector<vec2f>& texcoords);
+
+// Decode elements of compact triangle geometry
+inline vec3i compact_triangle(const bvh_compact_shape& compact, int element);
+inline vec3f compact_position(const bvh_compact_shape& compact, int vertex);
+inline vec3f compact_normal(const bvh_compact_shape& compact, int vertex);
+inline vec2f compact_texcoord(const bvh_compact_shape& compact, int vertex);
+
 // BVH data for whole shapes. This interface makes copies of all the data.
 struct bvh_shape {
   // elements
@@ -130,6 +170,10 @@ struct bvh_shape {
   vector<vec3f> positions_data = {};
   vector<float> radius_data    = {};
 
+  // compact triangles, used in place of triangles and positions if set
+  const bvh_compact_shape* compact      = nullptr;
+  bvh_compact_shape        compact_data = {};
+
   // nodes
   bvh_tree bvh = {};
 #ifdef YOCTO_EMBREE
@@ -172,6 +216,10 @@ void set_shape(bvh_scene* bvh, int shape_id, const vector<int>& points,
     const vector<vec2i>& lines, const vector<vec3i>& triangles,
     const vector<vec4i>& quads, const vector<vec3f>& positions,
     const vector<float>& radius, bool as_view = false);
+int  add_shape(
+     bvh_scene* bvh, const bvh_compact_shape& compact, bool as_view = false);
+void set_shape(bvh_scene* bvh, int shape_id, const bvh_compact_shape& compact,
+    bool as_view = false);
 
 // Set instances
 void set_instances(bvh_scene* bvh, int num_instances,
@@ -197,10 +245,12 @@ const auto bvh_build_names = vector<string>{
 #endif
 };
 
-// Bvh parameters
+// Bvh parameters. During updates, subtrees whose SAH cost grows by more
+// than `rebuild` times their cost when built are rebuilt; 0 only refits.
 struct bvh_params {
   bvh_build_type bvh        = bvh_build_type::default_;
   bool           noparallel = false;  // only serial momentarily
+  float          rebuild    = 1.5f;
 };
 
 // Progress report callback
@@ -211,9 +261,9 @@ using progress_callback =
 void init_bvh(bvh_scene* bvh, const bvh_params& params,
     const progress_callback& progress_cb = {});
 
-// Refit bvh data
+// Refit bvh data, rebuilding the subtrees that degraded too much.
 void update_bvh(bvh_scene* bvh, const vector<int>& updated_instances,
-    const vector<int>&       updated_shapes,
+    const vector<int>& updated_shapes, const bvh_params& params = {},
     const progress_callback& progress_cb = {});
 
 // Results of intersect_xxx and overlap_xxx functions that include hit flag,
@@ -237,6 +287,19 @@ bvh_intersection intersect_bvh(const bvh_scene* bvh, const ray3f& ray,
 bvh_intersection intersect_bvh(const bvh_scene* bvh, int instance,
     const ray3f& ray, bool find_any = false, bool non_rigid_frames = true);
 
+// Ray traversal statistics, counted per thread only when compiled with
+// YOCTO_STATS. Counters only grow, so take differences to measure queries.
+// Embree traversals are not counted.
+struct bvh_stats {
+  uint64_t scene_rays    = 0;  // rays intersected with the whole scene
+  uint64_t instance_rays = 0;  // rays intersected with a single instance
+  uint64_t nodes         = 0;  // nodes visited, both scene and shape ones
+  uint64_t primitives    = 0;  // shape elements tested
+};
+
+// Get the traversal statistics of the calling thread.
+const bvh_stats& get_bvh_stats();
+
 // Find a shape element that overlaps a point within a given distance
 // max distance, returning either the closest or any overlap depending on
 // `find_any`. Returns the point distance, the instance id, the shape element
@@ -248,4 +311,53 @@ bvh_intersection overlap_bvh(const bvh_scene* bvh, const vec3f& pos,
 
 }  // namespace yocto
 
+// -----------------------------------------------------------------------------
+//
+//
+// IMPLEMENTATION
+//
+//
+// -----------------------------------------------------------------------------
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF COMPACT SHAPES
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Decode elements of compact triangle geometry
+inline vec3i compact_triangle(const bvh_compact_shape& compact, int element) {
+  auto size         = bvh_compact_shape::triangle_cluster;
+  auto [base, wide] = compact.triangle_bases[element / size];
+  if (wide >= 0) return compact.wide_triangles[wide + element % size];
+  auto& t = compact.triangles[element];
+  return {base + t[0], base + t[1], base + t[2]};
+}
+inline vec3f compact_position(const bvh_compact_shape& compact, int vertex) {
+  auto& bounds =
+      compact.position_bounds[vertex / bvh_compact_shape::vertex_cluster];
+  auto& p     = compact.positions[vertex];
+  auto  scale = (bounds.max - bounds.min) / 65535;
+  return bounds.min + vec3f{(float)p[0], (float)p[1], (float)p[2]} * scale;
+}
+inline vec3f compact_normal(const bvh_compact_shape& compact, int vertex) {
+  auto& n = compact.normals[vertex];
+  auto  x = n[0] / 32767.0f, y = n[1] / 32767.0f;
+  auto  z = 1 - abs(x) - abs(y);
+  if (z < 0) {
+    auto ox = x;
+    x       = (1 - abs(y)) * (x >= 0 ? 1 : -1);
+    y       = (1 - abs(ox)) * (y >= 0 ? 1 : -1);
+  }
+  return normalize(vec3f{x, y, z});
+}
+inline vec2f compact_texcoord(const bvh_compact_shape& compact, int vertex) {
+  auto& bounds =
+      compact.texcoord_bounds[vertex / bvh_compact_shape::vertex_cluster];
+  auto& uv    = compact.texcoords[vertex];
+  auto  scale = (bounds.max - bounds.min) / 65535;
+  return bounds.min + vec2f{(float)uv[0], (float)uv[1]} * scale;
+}
+
+}  // namespace yocto
+
 #endif
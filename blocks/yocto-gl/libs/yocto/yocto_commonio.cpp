@@ -43,6 +43,17 @@
 
 #include "yocto_json.h"
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
 // -----------------------------------------------------------------------------
@@ -301,6 +312,115 @@ bool save_binary(
   return true;
 }
 
+// Cleanup
+mapped_file::~mapped_file() { unmap_file(*this); }
+
+// Move the mapping, leaving the source empty
+mapped_file::mapped_file(mapped_file&& other)
+    : filename{std::move(other.filename)},
+      data{other.data},
+      size{other.size},
+      handle{other.handle} {
+  other.filename = "";
+  other.data     = nullptr;
+  other.size     = 0;
+  other.handle   = nullptr;
+}
+mapped_file& mapped_file::operator=(mapped_file&& other) {
+  if (this == &other) return *this;
+  unmap_file(*this);
+  std::swap(filename, other.filename);
+  std::swap(data, other.data);
+  std::swap(size, other.size);
+  std::swap(handle, other.handle);
+  return *this;
+}
+
+// Map a file in memory for reading
+bool map_file(const string& filename, mapped_file& mapped, string& error) {
+  unmap_file(mapped);
+#ifdef _WIN32
+  auto path8 = std::filesystem::u8path(filename);
+  auto file  = CreateFileW(path8.c_str(), GENERIC_READ, FILE_SHARE_READ,
+      nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    error = filename + ": file not found";
+    return false;
+  }
+  auto length = LARGE_INTEGER{};
+  if (!GetFileSizeEx(file, &length)) {
+    CloseHandle(file);
+    error = filename + ": read error";
+    return false;
+  }
+  if (length.QuadPart == 0) {
+    CloseHandle(file);
+    mapped.filename = filename;
+    return true;
+  }
+  auto mapping = CreateFileMappingW(
+      file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr) {
+    error = filename + ": read error";
+    return false;
+  }
+  auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == nullptr) {
+    CloseHandle(mapping);
+    error = filename + ": read error";
+    return false;
+  }
+  mapped.filename = filename;
+  mapped.data     = (const byte*)view;
+  mapped.size     = (size_t)length.QuadPart;
+  mapped.handle   = mapping;
+#else
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = filename + ": file not found";
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    error = filename + ": read error";
+    return false;
+  }
+  if (info.st_size == 0) {
+    close(fd);
+    mapped.filename = filename;
+    return true;
+  }
+  auto view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED) {
+    error = filename + ": read error";
+    return false;
+  }
+  mapped.filename = filename;
+  mapped.data     = (const byte*)view;
+  mapped.size     = (size_t)info.st_size;
+#endif
+  return true;
+}
+
+// Unmap a file
+void unmap_file(mapped_file& mapped) {
+  if (mapped.data != nullptr) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+    CloseHandle((HANDLE)mapped.handle);
+#else
+    munmap((void*)mapped.data, mapped.size);
+#endif
+  }
+  mapped.filename = "";
+  mapped.data     = nullptr;
+  mapped.size     = 0;
+  mapped.handle   = nullptr;
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -300,6 +300,27 @@ bool load_binary(const string& filename, vector<byte>& data, string& error);
 bool save_binary(
     const string& filename, const vector<byte>& data, string& error);
 
+// Read-only memory mapping of a whole file
+struct mapped_file {
+  // file parameters
+  string      filename = "";
+  const byte* data     = nullptr;
+  size_t      size     = 0;
+  void*       handle   = nullptr;  // platform-specific mapping handle
+
+  // move-only type
+  mapped_file()                   = default;
+  mapped_file(const mapped_file&) = delete;
+  mapped_file(mapped_file&& other);
+  mapped_file& operator=(const mapped_file&) = delete;
+  mapped_file& operator=(mapped_file&& other);
+  ~mapped_file();
+};
+
+// Map/unmap a file in memory for reading
+bool map_file(const string& filename, mapped_file& mapped, string& error);
+void unmap_file(mapped_file& mapped);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -32,11 +32,12 @@
 
 #include "yocto_image.h"
 
+#include <cmath>
+#include <cstring>
 #include <memory>
 #include <stdexcept>
 
 #include "ext/stb_image.h"
-#include "ext/stb_image_resize.h"
 #include "ext/stb_image_write.h"
 #include "ext/tinyexr.h"
 #include "yocto_color.h"
@@ -498,6 +499,108 @@ vec3f eval_image(const image<vec3b>& img, const vec2f& uv, bool as_linear,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Tables used by the image conversions to evaluate the sRGB curves without
+// calling pow. Decoding uses exact values for bytes and interpolates floats
+// over [0,1]. Encoding interpolates floats over a fixed number of segments
+// for each power-of-two octave, and rounds bytes exactly using the linear
+// values where each byte starts.
+struct srgb_tables {
+  static const int decode_size   = 1024;
+  static const int encode_min    = -9;
+  static const int encode_max    = 8;
+  static const int encode_octave = 64;
+  static const int encode_size   = (encode_max - encode_min) * encode_octave;
+  float            decode_bytes[256]       = {};
+  float            decode[decode_size + 1] = {};
+  float            encode[encode_size + 1] = {};
+  float            encode_bytes[256]       = {};
+};
+
+// Build the sRGB tables once
+static const srgb_tables& get_srgb_tables() {
+  static const auto tables = [] {
+    auto tables = srgb_tables{};
+    for (auto idx = 0; idx < 256; idx++) {
+      tables.decode_bytes[idx] = srgb_to_rgb(byte_to_float((byte)idx));
+    }
+    for (auto idx = 0; idx <= srgb_tables::decode_size; idx++) {
+      tables.decode[idx] = srgb_to_rgb(idx / (float)srgb_tables::decode_size);
+    }
+    for (auto idx = 0; idx <= srgb_tables::encode_size; idx++) {
+      auto octave = idx / srgb_tables::encode_octave + srgb_tables::encode_min;
+      auto offset = idx % srgb_tables::encode_octave;
+      tables.encode[idx] = rgb_to_srgb(std::ldexp(
+          1 + offset / (float)srgb_tables::encode_octave, octave));
+    }
+    // smallest values that map to each byte, matching float_to_byte exactly
+    tables.encode_bytes[0] = -flt_max;
+    for (auto idx = 1; idx < 256; idx++) {
+      auto value = srgb_to_rgb(idx / 256.0f);
+      while (float_to_byte(rgb_to_srgb(value)) < idx)
+        value = std::nextafter(value, flt_max);
+      while (float_to_byte(rgb_to_srgb(std::nextafter(value, 0.0f))) >= idx)
+        value = std::nextafter(value, 0.0f);
+      tables.encode_bytes[idx] = value;
+    }
+    return tables;
+  }();
+  return tables;
+}
+
+// Fast sRGB curves, evaluated with the tables
+static inline float srgb_to_rgb(
+    float srgb, const srgb_tables& tables) {
+  if (srgb <= 0.04045f) return srgb / 12.92f;
+  if (!(srgb < 1)) return srgb_to_rgb(srgb);
+  auto value  = srgb * srgb_tables::decode_size;
+  auto idx    = (int)value;
+  auto weight = value - idx;
+  return tables.decode[idx] * (1 - weight) + tables.decode[idx + 1] * weight;
+}
+static inline float rgb_to_srgb(float rgb, const srgb_tables& tables) {
+  if (rgb <= 0.0031308f) return 12.92f * rgb;
+  if (!(rgb < (1 << srgb_tables::encode_max))) return rgb_to_srgb(rgb);
+  // index octaves by exponent and segments by the top bits of the mantissa
+  auto bits = (uint32_t)0;
+  std::memcpy(&bits, &rgb, sizeof(bits));
+  auto octave = (int)(bits >> 23) - 127 - srgb_tables::encode_min;
+  auto offset = (int)(bits >> 17) & (srgb_tables::encode_octave - 1);
+  auto weight = (bits & 0x1ffff) / (float)0x20000;
+  auto idx    = octave * srgb_tables::encode_octave + offset;
+  return tables.encode[idx] * (1 - weight) + tables.encode[idx + 1] * weight;
+}
+static inline byte rgb_to_srgbb(float rgb, const srgb_tables& tables) {
+  // the interpolated curve is off by at most one byte, fixed with the table
+  auto idx = (int)float_to_byte(rgb_to_srgb(rgb, tables));
+  if (idx > 0 && rgb < tables.encode_bytes[idx]) return (byte)(idx - 1);
+  if (idx < 255 && rgb >= tables.encode_bytes[idx + 1]) return (byte)(idx + 1);
+  return (byte)idx;
+}
+static vec3f srgb_to_rgb(const vec3f& srgb, const srgb_tables& tables) {
+  return {srgb_to_rgb(srgb.x, tables), srgb_to_rgb(srgb.y, tables),
+      srgb_to_rgb(srgb.z, tables)};
+}
+static vec4f srgb_to_rgb(const vec4f& srgb, const srgb_tables& tables) {
+  return {srgb_to_rgb(srgb.x, tables), srgb_to_rgb(srgb.y, tables),
+      srgb_to_rgb(srgb.z, tables), srgb.w};
+}
+static vec3f rgb_to_srgb(const vec3f& rgb, const srgb_tables& tables) {
+  return {rgb_to_srgb(rgb.x, tables), rgb_to_srgb(rgb.y, tables),
+      rgb_to_srgb(rgb.z, tables)};
+}
+static vec4f rgb_to_srgb(const vec4f& rgb, const srgb_tables& tables) {
+  return {rgb_to_srgb(rgb.x, tables), rgb_to_srgb(rgb.y, tables),
+      rgb_to_srgb(rgb.z, tables), rgb.w};
+}
+static vec3b rgb_to_srgbb(const vec3f& rgb, const srgb_tables& tables) {
+  return {rgb_to_srgbb(rgb.x, tables), rgb_to_srgbb(rgb.y, tables),
+      rgb_to_srgbb(rgb.z, tables)};
+}
+static vec4b rgb_to_srgbb(const vec4f& rgb, const srgb_tables& tables) {
+  return {rgb_to_srgbb(rgb.x, tables), rgb_to_srgbb(rgb.y, tables),
+      rgb_to_srgbb(rgb.z, tables), float_to_byte(rgb.w)};
+}
+
 template <typename T>
 inline void set_region(
     image<T>& img, const image<T>& region, const vec2i& offset) {
@@ -570,73 +673,97 @@ image<vec4s> float_to_ushort(const image<vec4f>& fl) {
 
 // Conversion between linear and gamma-encoded images.
 image<vec4f> srgb_to_rgb(const image<vec4f>& srgb) {
-  auto rgb = image<vec4f>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = srgb_to_rgb(srgb[i]);
+  auto& tables = get_srgb_tables();
+  auto  rgb    = image<vec4f>{srgb.imsize()};
+  for (auto i = 0ull; i < rgb.count(); i++)
+    rgb[i] = srgb_to_rgb(srgb[i], tables);
   return rgb;
 }
 image<vec4f> rgb_to_srgb(const image<vec4f>& rgb) {
-  auto srgb = image<vec4f>{rgb.imsize()};
-  for (auto i = 0ull; i < srgb.count(); i++) srgb[i] = rgb_to_srgb(rgb[i]);
+  auto& tables = get_srgb_tables();
+  auto  srgb   = image<vec4f>{rgb.imsize()};
+  for (auto i = 0ull; i < srgb.count(); i++)
+    srgb[i] = rgb_to_srgb(rgb[i], tables);
   return srgb;
 }
 image<vec4f> srgb_to_rgb(const image<vec4b>& srgb) {
-  auto rgb = image<vec4f>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = srgb_to_rgb(byte_to_float(srgb[i]));
+  auto& tables = get_srgb_tables();
+  auto  rgb    = image<vec4f>{srgb.imsize()};
+  for (auto i = 0ull; i < rgb.count(); i++) {
+    auto& c = srgb[i];
+    rgb[i]  = {tables.decode_bytes[c.x], tables.decode_bytes[c.y],
+        tables.decode_bytes[c.z], byte_to_float(c.w)};
+  }
   return rgb;
 }
 image<vec4b> rgb_to_srgbb(const image<vec4f>& rgb) {
-  auto srgb = image<vec4b>{rgb.imsize()};
+  auto& tables = get_srgb_tables();
+  auto  srgb   = image<vec4b>{rgb.imsize()};
   for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = float_to_byte(rgb_to_srgb(rgb[i]));
+    srgb[i] = rgb_to_srgbb(rgb[i], tables);
   return srgb;
 }
 
 // Conversion between linear and gamma-encoded images.
 image<vec3f> srgb_to_rgb(const image<vec3f>& srgb) {
-  auto rgb = image<vec3f>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = srgb_to_rgb(srgb[i]);
+  auto& tables = get_srgb_tables();
+  auto  rgb    = image<vec3f>{srgb.imsize()};
+  for (auto i = 0ull; i < rgb.count(); i++)
+    rgb[i] = srgb_to_rgb(srgb[i], tables);
   return rgb;
 }
 image<vec3f> rgb_to_srgb(const image<vec3f>& rgb) {
-  auto srgb = image<vec3f>{rgb.imsize()};
-  for (auto i = 0ull; i < srgb.count(); i++) srgb[i] = rgb_to_srgb(rgb[i]);
+  auto& tables = get_srgb_tables();
+  auto  srgb   = image<vec3f>{rgb.imsize()};
+  for (auto i = 0ull; i < srgb.count(); i++)
+    srgb[i] = rgb_to_srgb(rgb[i], tables);
   return srgb;
 }
 image<vec3f> srgb_to_rgb(const image<vec3b>& srgb) {
-  auto rgb = image<vec3f>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = srgb_to_rgb(byte_to_float(srgb[i]));
+  auto& tables = get_srgb_tables();
+  auto  rgb    = image<vec3f>{srgb.imsize()};
+  for (auto i = 0ull; i < rgb.count(); i++) {
+    auto& c = srgb[i];
+    rgb[i]  = {tables.decode_bytes[c.x], tables.decode_bytes[c.y],
+        tables.decode_bytes[c.z]};
+  }
   return rgb;
 }
 image<vec3b> rgb_to_srgbb(const image<vec3f>& rgb) {
-  auto srgb = image<vec3b>{rgb.imsize()};
+  auto& tables = get_srgb_tables();
+  auto  srgb   = image<vec3b>{rgb.imsize()};
   for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = float_to_byte(rgb_to_srgb(rgb[i]));
+    srgb[i] = rgb_to_srgbb(rgb[i], tables);
   return srgb;
 }
 
 // Conversion between linear and gamma-encoded images.
 image<float> srgb_to_rgb(const image<float>& srgb) {
-  auto rgb = image<float>{srgb.imsize()};
-  for (auto i = 0ull; i < rgb.count(); i++) rgb[i] = srgb_to_rgb(srgb[i]);
+  auto& tables = get_srgb_tables();
+  auto  rgb    = image<float>{srgb.imsize()};
+  for (auto i = 0ull; i < rgb.count(); i++)
+    rgb[i] = srgb_to_rgb(srgb[i], tables);
   return rgb;
 }
 image<float> rgb_to_srgb(const image<float>& rgb) {
-  auto srgb = image<float>{rgb.imsize()};
-  for (auto i = 0ull; i < srgb.count(); i++) srgb[i] = rgb_to_srgb(rgb[i]);
+  auto& tables = get_srgb_tables();
+  auto  srgb   = image<float>{rgb.imsize()};
+  for (auto i = 0ull; i < srgb.count(); i++)
+    srgb[i] = rgb_to_srgb(rgb[i], tables);
   return srgb;
 }
 image<float> srgb_to_rgb(const image<byte>& srgb) {
-  auto rgb = image<float>{srgb.imsize()};
+  auto& tables = get_srgb_tables();
+  auto  rgb    = image<float>{srgb.imsize()};
   for (auto i = 0ull; i < rgb.count(); i++)
-    rgb[i] = srgb_to_rgb(byte_to_float(srgb[i]));
+    rgb[i] = tables.decode_bytes[srgb[i]];
   return rgb;
 }
 image<byte> rgb_to_srgbb(const image<float>& rgb) {
-  auto srgb = image<byte>{rgb.imsize()};
+  auto& tables = get_srgb_tables();
+  auto  srgb   = image<byte>{rgb.imsize()};
   for (auto i = 0ull; i < srgb.count(); i++)
-    srgb[i] = float_to_byte(rgb_to_srgb(rgb[i]));
+    srgb[i] = rgb_to_srgbb(rgb[i], tables);
   return srgb;
 }
 
@@ -702,37 +829,91 @@ image<byte> rgba_to_gray(const image<vec4b>& rgba) {
   return gray;
 }
 
+// Tone map a row of pixels, with the exposure scale computed once and the
+// sRGB curve evaluated with tables.
+static void tonemap_row(vec4f* ldr, const vec4f* hdr, int num, float scale,
+    bool filmic, bool srgb, const srgb_tables& tables) {
+  for (auto i = 0; i < num; i++) {
+    auto rgb = xyz(hdr[i]) * scale;
+    if (filmic) rgb = tonemap_filmic(rgb);
+    if (srgb) rgb = rgb_to_srgb(rgb, tables);
+    ldr[i] = {rgb.x, rgb.y, rgb.z, hdr[i].w};
+  }
+}
+static void tonemap_row(vec4b* ldr, const vec4f* hdr, int num, float scale,
+    bool filmic, bool srgb, const srgb_tables& tables) {
+  for (auto i = 0; i < num; i++) {
+    auto rgb = xyz(hdr[i]) * scale;
+    if (filmic) rgb = tonemap_filmic(rgb);
+    auto rgba = vec4f{rgb.x, rgb.y, rgb.z, hdr[i].w};
+    ldr[i]    = srgb ? rgb_to_srgbb(rgba, tables) : float_to_byte(rgba);
+  }
+}
+
 // Apply exposure and filmic tone mapping
 image<vec4f> tonemap_image(
     const image<vec4f>& hdr, float exposure, bool filmic, bool srgb) {
   auto ldr = image<vec4f>{hdr.imsize()};
-  for (auto i = 0ull; i < hdr.count(); i++)
-    ldr[i] = tonemap(hdr[i], exposure, filmic, srgb);
+  tonemap_row(ldr.data(), hdr.data(), (int)hdr.count(),
+      exposure != 0 ? exp2(exposure) : 1, filmic, srgb, get_srgb_tables());
   return ldr;
 }
 image<vec4b> tonemap_imageb(
     const image<vec4f>& hdr, float exposure, bool filmic, bool srgb) {
   auto ldr = image<vec4b>{hdr.imsize()};
-  for (auto i = 0ull; i < hdr.count(); i++)
-    ldr[i] = float_to_byte(tonemap(hdr[i], exposure, filmic, srgb));
+  tonemap_row(ldr.data(), hdr.data(), (int)hdr.count(),
+      exposure != 0 ? exp2(exposure) : 1, filmic, srgb, get_srgb_tables());
   return ldr;
 }
 
 void tonemap_image_mt(image<vec4f>& ldr, const image<vec4f>& hdr,
     float exposure, bool filmic, bool srgb) {
-  parallel_for(hdr.width(), hdr.height(), [&](int i, int j) {
-    ldr[{i, j}] = tonemap(hdr[{i, j}], exposure, filmic, srgb);
+  auto  scale  = exposure != 0 ? exp2(exposure) : 1;
+  auto& tables = get_srgb_tables();
+  parallel_for(hdr.height(), [&](int j) {
+    tonemap_row(&ldr[{0, j}], &hdr[{0, j}], hdr.width(), scale, filmic, srgb,
+        tables);
   });
 }
 void tonemap_image_mt(image<vec4b>& ldr, const image<vec4f>& hdr,
     float exposure, bool filmic, bool srgb) {
-  parallel_for(hdr.width(), hdr.height(), [&](int i, int j) {
-    ldr[{i, j}] = float_to_byte(tonemap(hdr[{i, j}], exposure, filmic, srgb));
+  auto  scale  = exposure != 0 ? exp2(exposure) : 1;
+  auto& tables = get_srgb_tables();
+  parallel_for(hdr.height(), [&](int j) {
+    tonemap_row(&ldr[{0, j}], &hdr[{0, j}], hdr.width(), scale, filmic, srgb,
+        tables);
   });
 }
 
-vec3f colorgrade(
-    const vec3f& rgb_, bool linear, const colorgrade_params& params) {
+// Lift, gamma and gain used by colorgrade, that only depend on the params
+struct colorgrade_curve {
+  bool  enabled   = false;
+  vec3f lift      = {0, 0, 0};
+  vec3f inv_gamma = {1, 1, 1};
+  vec3f gain      = {1, 1, 1};
+};
+static colorgrade_curve make_colorgrade_curve(
+    const colorgrade_params& params) {
+  if (params.shadows == 0.5f && params.midtones == 0.5f &&
+      params.highlights == 0.5f && params.shadows_color == vec3f{1, 1, 1} &&
+      params.midtones_color == vec3f{1, 1, 1} &&
+      params.highlights_color == vec3f{1, 1, 1})
+    return {};
+  auto lift  = params.shadows_color;
+  auto gamma = params.midtones_color;
+  auto gain  = params.highlights_color;
+
+  lift      = lift - mean(lift) + params.shadows - (float)0.5;
+  gain      = gain - mean(gain) + params.highlights + (float)0.5;
+  auto grey = gamma - mean(gamma) + params.midtones;
+  gamma     = log(((float)0.5 - lift) / (gain - lift)) / log(grey);
+  return {true, lift, 1 / gamma, gain};
+}
+
+// Apply color grading, with the sRGB curve evaluated with tables if given
+static vec3f colorgrade(const vec3f& rgb_, bool linear,
+    const colorgrade_params& params, const colorgrade_curve& curve,
+    const srgb_tables* tables) {
   auto rgb = rgb_;
   if (params.exposure != 0) rgb *= exp2(params.exposure);
   if (params.tint != vec3f{1, 1, 1}) rgb *= params.tint;
@@ -742,54 +923,65 @@ vec3f colorgrade(
     rgb = logcontrast(rgb, params.logcontrast, linear ? 0.18f : 0.5f);
   if (params.linsaturation != 0.5f) rgb = saturate(rgb, params.linsaturation);
   if (params.filmic) rgb = tonemap_filmic(rgb);
-  if (linear && params.srgb) rgb = rgb_to_srgb(rgb);
+  if (linear && params.srgb)
+    rgb = tables != nullptr ? rgb_to_srgb(rgb, *tables) : rgb_to_srgb(rgb);
   if (params.contrast != 0.5f) rgb = contrast(rgb, params.contrast);
   if (params.saturation != 0.5f) rgb = saturate(rgb, params.saturation);
-  if (params.shadows != 0.5f || params.midtones != 0.5f ||
-      params.highlights != 0.5f || params.shadows_color != vec3f{1, 1, 1} ||
-      params.midtones_color != vec3f{1, 1, 1} ||
-      params.highlights_color != vec3f{1, 1, 1}) {
-    auto lift  = params.shadows_color;
-    auto gamma = params.midtones_color;
-    auto gain  = params.highlights_color;
-
-    lift      = lift - mean(lift) + params.shadows - (float)0.5;
-    gain      = gain - mean(gain) + params.highlights + (float)0.5;
-    auto grey = gamma - mean(gamma) + params.midtones;
-    gamma     = log(((float)0.5 - lift) / (gain - lift)) / log(grey);
-
+  if (curve.enabled) {
     // apply_image
-    auto lerp_value = clamp(pow(rgb, 1 / gamma), 0, 1);
-    rgb             = gain * lerp_value + lift * (1 - lerp_value);
+    auto lerp_value = clamp(pow(rgb, curve.inv_gamma), 0, 1);
+    rgb = curve.gain * lerp_value + curve.lift * (1 - lerp_value);
   }
   return rgb;
 }
+static vec4f colorgrade(const vec4f& rgba, bool linear,
+    const colorgrade_params& params, const colorgrade_curve& curve,
+    const srgb_tables* tables) {
+  auto graded = colorgrade(xyz(rgba), linear, params, curve, tables);
+  return {graded.x, graded.y, graded.z, rgba.w};
+}
+
+vec3f colorgrade(
+    const vec3f& rgb, bool linear, const colorgrade_params& params) {
+  return colorgrade(
+      rgb, linear, params, make_colorgrade_curve(params), nullptr);
+}
 vec4f colorgrade(
     const vec4f& rgba, bool linear, const colorgrade_params& params) {
-  auto graded = colorgrade(xyz(rgba), linear, params);
-  return {graded.x, graded.y, graded.z, rgba.w};
+  return colorgrade(
+      rgba, linear, params, make_colorgrade_curve(params), nullptr);
 }
 
 // Apply exposure and filmic tone mapping
 image<vec4f> colorgrade_image(
     const image<vec4f>& img, bool linear, const colorgrade_params& params) {
-  auto corrected = image<vec4f>{img.imsize()};
+  auto  curve     = make_colorgrade_curve(params);
+  auto& tables    = get_srgb_tables();
+  auto  corrected = image<vec4f>{img.imsize()};
   for (auto i = 0ull; i < img.count(); i++)
-    corrected[i] = colorgrade(img[i], linear, params);
+    corrected[i] = colorgrade(img[i], linear, params, curve, &tables);
   return corrected;
 }
 
 // Apply exposure and filmic tone mapping
 void colorgrade_image_mt(image<vec4f>& corrected, const image<vec4f>& img,
     bool linear, const colorgrade_params& params) {
-  parallel_for(img.width(), img.height(), [&](int i, int j) {
-    corrected[{i, j}] = colorgrade(img[{i, j}], linear, params);
+  auto  curve  = make_colorgrade_curve(params);
+  auto& tables = get_srgb_tables();
+  parallel_for(img.height(), [&](int j) {
+    for (auto i = 0; i < img.width(); i++)
+      corrected[{i, j}] = colorgrade(
+          img[{i, j}], linear, params, curve, &tables);
   });
 }
 void colorgrade_image_mt(image<vec4b>& corrected, const image<vec4f>& img,
     bool linear, const colorgrade_params& params) {
-  parallel_for(img.width(), img.height(), [&](int i, int j) {
-    corrected[{i, j}] = float_to_byte(colorgrade(img[{i, j}], linear, params));
+  auto  curve  = make_colorgrade_curve(params);
+  auto& tables = get_srgb_tables();
+  parallel_for(img.height(), [&](int j) {
+    for (auto i = 0; i < img.width(); i++)
+      corrected[{i, j}] = float_to_byte(
+          colorgrade(img[{i, j}], linear, params, curve, &tables));
   });
 }
 
@@ -820,22 +1012,130 @@ image<vec4f> resize_image(const image<vec4f>& img, int width, int height) {
 image<vec4b> resize_image(const image<vec4b>& img, int width, int height) {
   return resize_image(img, {width, height});
 }
+// Cubic filters used for resizing, Catmull-Rom when upsampling and
+// Mitchell-Netravali when downsampling, both with support [-2, 2].
+static float resize_catmullrom(float x) {
+  x = abs(x);
+  if (x < 1) return 1 - x * x * (2.5f - 1.5f * x);
+  if (x < 2) return 2 - x * (4 - x * (2.5f - 0.5f * x));
+  return 0;
+}
+static float resize_mitchell(float x) {
+  x = abs(x);
+  if (x < 1) return (16 + x * x * (21 * x - 36)) / 18;
+  if (x < 2) return (32 + x * (-60 + x * (36 - 7 * x))) / 18;
+  return 0;
+}
+
+// Filter taps for resizing an image axis. Each output pixel has the same
+// number of taps, with indices clamped to the edge and normalized weights.
+struct resize_taps {
+  int           count   = 0;
+  vector<int>   indices = {};
+  vector<float> weights = {};
+};
+static resize_taps make_resize_taps(int size, int resized) {
+  auto scale  = resized / (float)size;
+  auto fscale = min(scale, 1.0f);
+  auto radius = 2 / fscale;
+  auto filter = scale >= 1 ? resize_catmullrom : resize_mitchell;
+  auto taps   = resize_taps{};
+  taps.count  = (int)ceil(radius) * 2 + 1;
+  taps.indices.assign((size_t)resized * taps.count, 0);
+  taps.weights.assign((size_t)resized * taps.count, 0);
+  for (auto idx = 0; idx < resized; idx++) {
+    auto center = (idx + 0.5f) / scale - 0.5f;
+    auto start  = (int)ceil(center - radius);
+    auto sum    = 0.0f;
+    for (auto tap = 0; tap < taps.count; tap++) {
+      auto weight = filter((start + tap - center) * fscale);
+      taps.indices[idx * taps.count + tap] = clamp(start + tap, 0, size - 1);
+      taps.weights[idx * taps.count + tap] = weight;
+      sum += weight;
+    }
+    for (auto tap = 0; tap < taps.count; tap++)
+      taps.weights[idx * taps.count + tap] /= sum;
+  }
+  return taps;
+}
+
+// Resize an image with a separable filter, first along rows and then along
+// columns, both in parallel over rows. The vertical pass accumulates whole
+// rows, so that it reads memory contiguously. Colors are weighted by alpha,
+// while pixels that end up fully transparent keep their unweighted color.
+static image<vec4f> resize_image_separable(
+    const image<vec4f>& img, const vec2i& size) {
+  auto htaps      = make_resize_taps(img.width(), size.x);
+  auto vtaps      = make_resize_taps(img.height(), size.y);
+  auto horizontal = image<vec4f>{{size.x, img.height()}};
+  auto hcolors    = image<vec3f>{{size.x, img.height()}};
+  parallel_for(img.height(), [&](int j) {
+    auto row    = vector<vec4f>(img.width());
+    auto colors = &img[{0, j}];
+    for (auto i = 0; i < img.width(); i++) {
+      auto& pixel = colors[i];
+      row[i] = {pixel.x * pixel.w, pixel.y * pixel.w, pixel.z * pixel.w,
+          pixel.w};
+    }
+    auto resized  = &horizontal[{0, j}];
+    auto rcolors  = &hcolors[{0, j}];
+    auto indices  = htaps.indices.data();
+    auto weights  = htaps.weights.data();
+    for (auto i = 0; i < size.x; i++) {
+      auto sum   = zero4f;
+      auto color = zero3f;
+      for (auto tap = 0; tap < htaps.count; tap++) {
+        sum += row[indices[tap]] * weights[tap];
+        color += xyz(colors[indices[tap]]) * weights[tap];
+      }
+      resized[i] = sum;
+      rcolors[i] = color;
+      indices += htaps.count;
+      weights += htaps.count;
+    }
+  });
+  auto resized = image<vec4f>{size};
+  parallel_for(size.y, [&](int j) {
+    auto row    = &resized[{0, j}];
+    auto colors = vector<vec3f>(size.x, zero3f);
+    for (auto tap = 0; tap < vtaps.count; tap++) {
+      auto index   = vtaps.indices[j * vtaps.count + tap];
+      auto source  = &horizontal[{0, index}];
+      auto scolors = &hcolors[{0, index}];
+      auto weight  = vtaps.weights[j * vtaps.count + tap];
+      for (auto i = 0; i < size.x; i++) {
+        row[i] += source[i] * weight;
+        colors[i] += scolors[i] * weight;
+      }
+    }
+    for (auto i = 0; i < size.x; i++) {
+      if (row[i].w != 0) {
+        auto scale = 1 / row[i].w;
+        row[i]     = {row[i].x * scale, row[i].y * scale, row[i].z * scale,
+            row[i].w};
+      } else {
+        row[i] = {colors[i].x, colors[i].y, colors[i].z, 0};
+      }
+    }
+  });
+  return resized;
+}
+
 image<vec4f> resize_image(const image<vec4f>& img, const vec2i& size_) {
-  auto size    = resize_size(img.imsize(), size_);
-  auto res_img = image<vec4f>{size};
-  stbir_resize_float_generic((float*)img.data(), img.width(), img.height(),
-      sizeof(vec4f) * img.width(), (float*)res_img.data(), res_img.width(),
-      res_img.height(), sizeof(vec4f) * res_img.width(), 4, 3, 0,
-      STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, nullptr);
-  return res_img;
+  auto size = resize_size(img.imsize(), size_);
+  return resize_image_separable(img, size);
 }
 image<vec4b> resize_image(const image<vec4b>& img, const vec2i& size_) {
   auto size    = resize_size(img.imsize(), size_);
+  auto resized = resize_image_separable(byte_to_float(img), size);
   auto res_img = image<vec4b>{size};
-  stbir_resize_uint8_generic((byte*)img.data(), img.width(), img.height(),
-      sizeof(vec4b) * img.width(), (byte*)res_img.data(), res_img.width(),
-      res_img.height(), sizeof(vec4b) * res_img.width(), 4, 3, 0,
-      STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, nullptr);
+  for (auto i = 0ull; i < res_img.count(); i++) {
+    auto& c    = resized[i];
+    res_img[i] = {(byte)clamp((int)(c.x * 255 + 0.5f), 0, 255),
+        (byte)clamp((int)(c.y * 255 + 0.5f), 0, 255),
+        (byte)clamp((int)(c.z * 255 + 0.5f), 0, 255),
+        (byte)clamp((int)(c.w * 255 + 0.5f), 0, 255)};
+  }
   return res_img;
 }
 
@@ -30,13 +30,490 @@
 #include "yocto_json.h"
 
 #include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 
 #include "ext/json.hpp"
 #include "yocto_commonio.h"
 
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF JSON STREAMING READER
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Initialize a reader over a text
+void init_json_reader(json_reader& reader, string_view text) {
+  reader.text    = text;
+  reader.pos     = 0;
+  reader.token   = json_token::none;
+  reader.value   = {};
+  reader.boolean = false;
+  reader.first   = true;
+  reader.started = false;
+  reader.stack.clear();
+  reader.buffer.clear();
+  reader.error.clear();
+}
+
+// Set an error, reporting the line of the current position
+static bool set_json_error(json_reader& reader, const string& message) {
+  auto end  = reader.text.begin() + std::min(reader.pos, reader.text.size());
+  auto line = 1 + std::count(reader.text.begin(), end, '\n');
+  reader.error = message + " at line " + std::to_string(line);
+  reader.token = json_token::none;
+  return false;
+}
+
+// Structural characters are scanned eight bytes at a time, checking
+// whether any byte of a word is a quote, a backslash or a control character
+// with the usual bit tricks.
+static inline bool has_json_special(uint64_t word) {
+  const auto ones    = (uint64_t)0x0101010101010101;
+  const auto highs   = (uint64_t)0x8080808080808080;
+  auto       quotes  = word ^ (ones * '"');
+  auto       slashes = word ^ (ones * '\\');
+  auto       special = ((quotes - ones) & ~quotes) |
+                 ((slashes - ones) & ~slashes) |
+                 ((word - ones * 0x20) & ~word);
+  return (special & highs) != 0;
+}
+
+// Skip whitespaces, eight spaces at a time for indentation
+static inline void skip_json_whitespace(json_reader& reader) {
+  const auto spaces = (uint64_t)0x2020202020202020;
+  auto&      text   = reader.text;
+  auto       pos    = reader.pos;
+  while (pos < text.size()) {
+    auto word = (uint64_t)0;
+    if (pos + 8 <= text.size()) {
+      memcpy(&word, text.data() + pos, sizeof(word));
+      if (word == spaces) {
+        pos += 8;
+        continue;
+      }
+    }
+    auto c = text[pos];
+    if (c != ' ' && c != '\n' && c != '\r' && c != '\t') break;
+    pos += 1;
+  }
+  reader.pos = pos;
+}
+
+// Read four hex digits of an unicode escape
+static inline bool read_json_hex(string_view text, size_t pos, uint32_t& code) {
+  if (pos + 4 > text.size()) return false;
+  code = 0;
+  for (auto idx = pos; idx < pos + 4; idx++) {
+    auto c = text[idx];
+    code <<= 4;
+    if (c >= '0' && c <= '9') {
+      code |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      code |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      code |= c - 'A' + 10;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Append an unicode code point encoded as utf8
+static inline void append_utf8(string& str, uint32_t code) {
+  if (code < 0x80) {
+    str.push_back((char)code);
+  } else if (code < 0x800) {
+    str.push_back((char)(0xc0 | (code >> 6)));
+    str.push_back((char)(0x80 | (code & 0x3f)));
+  } else if (code < 0x10000) {
+    str.push_back((char)(0xe0 | (code >> 12)));
+    str.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+    str.push_back((char)(0x80 | (code & 0x3f)));
+  } else {
+    str.push_back((char)(0xf0 | (code >> 18)));
+    str.push_back((char)(0x80 | ((code >> 12) & 0x3f)));
+    str.push_back((char)(0x80 | ((code >> 6) & 0x3f)));
+    str.push_back((char)(0x80 | (code & 0x3f)));
+  }
+}
+
+// Read a string starting at a quote. Strings without escapes are returned
+// as views into the text, the others are unescaped in the reader buffer.
+static bool read_json_string(json_reader& reader) {
+  auto& text  = reader.text;
+  auto  start = reader.pos + 1;
+  auto  pos   = start;
+  while (pos + 8 <= text.size()) {
+    auto word = (uint64_t)0;
+    memcpy(&word, text.data() + pos, sizeof(word));
+    if (has_json_special(word)) break;
+    pos += 8;
+  }
+  while (pos < text.size() && text[pos] != '"' && text[pos] != '\\' &&
+         (unsigned char)text[pos] >= 0x20)
+    pos += 1;
+  if (pos < text.size() && text[pos] == '"') {
+    reader.value = text.substr(start, pos - start);
+    reader.pos   = pos + 1;
+    return true;
+  }
+
+  // unescape
+  auto& buffer = reader.buffer;
+  buffer.assign(text.data() + start, pos - start);
+  while (pos < text.size() && text[pos] != '"') {
+    reader.pos = pos;
+    auto c     = text[pos];
+    if ((unsigned char)c < 0x20)
+      return set_json_error(reader, "invalid character in string");
+    if (c != '\\') {
+      buffer.push_back(c);
+      pos += 1;
+      continue;
+    }
+    if (pos + 1 >= text.size()) break;
+    auto escape = text[pos + 1];
+    pos += 2;
+    switch (escape) {
+      case '"': buffer.push_back('"'); break;
+      case '\\': buffer.push_back('\\'); break;
+      case '/': buffer.push_back('/'); break;
+      case 'b': buffer.push_back('\b'); break;
+      case 'f': buffer.push_back('\f'); break;
+      case 'n': buffer.push_back('\n'); break;
+      case 'r': buffer.push_back('\r'); break;
+      case 't': buffer.push_back('\t'); break;
+      case 'u': {
+        auto code = (uint32_t)0;
+        if (!read_json_hex(text, pos, code))
+          return set_json_error(reader, "invalid unicode escape");
+        pos += 4;
+        if (code >= 0xd800 && code < 0xdc00) {
+          auto low = (uint32_t)0;
+          if (pos + 2 > text.size() || text[pos] != '\\' ||
+              text[pos + 1] != 'u' || !read_json_hex(text, pos + 2, low) ||
+              low < 0xdc00 || low >= 0xe000)
+            return set_json_error(reader, "invalid unicode surrogate");
+          pos += 6;
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        } else if (code >= 0xdc00 && code < 0xe000) {
+          return set_json_error(reader, "invalid unicode surrogate");
+        }
+        append_utf8(buffer, code);
+      } break;
+      default: return set_json_error(reader, "invalid escape in string");
+    }
+  }
+  if (pos >= text.size()) {
+    reader.pos = pos;
+    return set_json_error(reader, "unterminated string");
+  }
+  reader.value = buffer;
+  reader.pos   = pos + 1;
+  return true;
+}
+
+// Read a number, checking the Json grammar
+static bool read_json_number(json_reader& reader) {
+  auto& text     = reader.text;
+  auto  start    = reader.pos;
+  auto  pos      = start;
+  auto  is_digit = [&text](size_t pos) {
+    return pos < text.size() && text[pos] >= '0' && text[pos] <= '9';
+  };
+  auto skip_digits = [&]() {
+    if (!is_digit(pos)) return false;
+    while (is_digit(pos)) pos += 1;
+    return true;
+  };
+  if (text[pos] == '-') pos += 1;
+  if (pos < text.size() && text[pos] == '0') {
+    pos += 1;
+  } else if (!skip_digits()) {
+    return set_json_error(reader, "invalid number");
+  }
+  if (pos < text.size() && text[pos] == '.') {
+    pos += 1;
+    if (!skip_digits()) return set_json_error(reader, "invalid number");
+  }
+  if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+    pos += 1;
+    if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) pos += 1;
+    if (!skip_digits()) return set_json_error(reader, "invalid number");
+  }
+  reader.value = text.substr(start, pos - start);
+  reader.pos   = pos;
+  return true;
+}
+
+// Read a literal
+static bool read_json_literal(json_reader& reader, string_view literal) {
+  if (reader.text.substr(reader.pos, literal.size()) != literal)
+    return set_json_error(reader, "unexpected character");
+  reader.pos += literal.size();
+  return true;
+}
+
+// Read a value starting at the current position
+static bool read_json_item(json_reader& reader) {
+  switch (reader.text[reader.pos]) {
+    case '{':
+    case '[':
+      reader.stack.push_back(reader.text[reader.pos]);
+      reader.token = reader.text[reader.pos] == '{' ? json_token::begin_object
+                                                    : json_token::begin_array;
+      reader.pos += 1;
+      reader.first = true;
+      return true;
+    case '"':
+      if (!read_json_string(reader)) return false;
+      reader.token = json_token::string;
+      return true;
+    case 't':
+      if (!read_json_literal(reader, "true")) return false;
+      reader.token   = json_token::boolean;
+      reader.boolean = true;
+      return true;
+    case 'f':
+      if (!read_json_literal(reader, "false")) return false;
+      reader.token   = json_token::boolean;
+      reader.boolean = false;
+      return true;
+    case 'n':
+      if (!read_json_literal(reader, "null")) return false;
+      reader.token = json_token::null;
+      return true;
+    default:
+      if (reader.text[reader.pos] != '-' &&
+          (reader.text[reader.pos] < '0' || reader.text[reader.pos] > '9'))
+        return set_json_error(reader, "unexpected character");
+      if (!read_json_number(reader)) return false;
+      reader.token = json_token::number;
+      return true;
+  }
+}
+
+// Read the next token
+bool read_json_token(json_reader& reader) {
+  if (!reader.error.empty()) return false;
+  auto& text = reader.text;
+  skip_json_whitespace(reader);
+
+  // root value
+  if (reader.stack.empty()) {
+    if (reader.started) {
+      reader.token = json_token::none;
+      if (reader.pos < text.size())
+        return set_json_error(reader, "unexpected character");
+      return false;
+    }
+    reader.started = true;
+    if (reader.pos >= text.size())
+      return set_json_error(reader, "unexpected end of text");
+    return read_json_item(reader);
+  }
+
+  // values of objects, after their key
+  if (reader.pos >= text.size())
+    return set_json_error(reader, "unexpected end of text");
+  if (reader.token == json_token::key) return read_json_item(reader);
+
+  // end of arrays and objects
+  auto is_object = reader.stack.back() == '{';
+  if (text[reader.pos] == (is_object ? '}' : ']')) {
+    reader.stack.pop_back();
+    reader.token = is_object ? json_token::end_object : json_token::end_array;
+    reader.pos += 1;
+    reader.first = false;
+    return true;
+  }
+
+  // separators
+  if (!reader.first) {
+    if (text[reader.pos] != ',')
+      return set_json_error(
+          reader, is_object ? "expected , or }" : "expected , or ]");
+    reader.pos += 1;
+    skip_json_whitespace(reader);
+    if (reader.pos >= text.size())
+      return set_json_error(reader, "unexpected end of text");
+  }
+  reader.first = false;
+
+  // array values
+  if (!is_object) return read_json_item(reader);
+
+  // object keys
+  if (text[reader.pos] != '"') return set_json_error(reader, "expected key");
+  if (!read_json_string(reader)) return false;
+  skip_json_whitespace(reader);
+  if (reader.pos >= text.size() || text[reader.pos] != ':')
+    return set_json_error(reader, "expected :");
+  reader.pos += 1;
+  reader.token = json_token::key;
+  return true;
+}
+
+// Skip the value starting at the current token
+bool skip_json_value(json_reader& reader) {
+  if (!reader.error.empty()) return false;
+  if (reader.token != json_token::begin_array &&
+      reader.token != json_token::begin_object)
+    return true;
+  auto depth = reader.stack.size();
+  while (read_json_token(reader)) {
+    if (reader.stack.size() < depth) return true;
+  }
+  return false;
+}
+
+// Check whether a number is an integer
+static inline bool is_json_integer(string_view number) {
+  return number.find_first_of(".eE") == string_view::npos;
+}
+
+// Parse a number as a double. Out of range values saturate to infinity or
+// zero as in strtod, which is also used on standard libraries that do not
+// implement floating point from_chars.
+static bool parse_json_real(string_view number, double& value) {
+#if defined(__cpp_lib_to_chars)
+  auto result = std::from_chars(
+      number.data(), number.data() + number.size(), value);
+  if (result.ec == std::errc{})
+    return result.ptr == number.data() + number.size();
+  if (result.ec != std::errc::result_out_of_range) return false;
+#endif
+  auto  buffer = string{number};
+  char* end    = nullptr;
+  value        = strtod(buffer.c_str(), &end);
+  return !buffer.empty() && end == buffer.c_str() + buffer.size();
+}
+
+// Read the value starting at the current token into a json_value
+bool read_json_value(json_reader& reader, json_value& json) {
+  switch (reader.token) {
+    case json_token::null: json = json_value{}; return true;
+    case json_token::boolean: json = reader.boolean; return true;
+    case json_token::number: {
+      auto& number = reader.value;
+      if (is_json_integer(number)) {
+        if (number[0] == '-') {
+          auto value  = (int64_t)0;
+          auto result = std::from_chars(
+              number.data(), number.data() + number.size(), value);
+          if (result.ec == std::errc{}) {
+            json = value;
+            return true;
+          }
+        } else {
+          auto value  = (uint64_t)0;
+          auto result = std::from_chars(
+              number.data(), number.data() + number.size(), value);
+          if (result.ec == std::errc{}) {
+            json = value;
+            return true;
+          }
+        }
+      }
+      auto value = 0.0;
+      if (!parse_json_real(number, value))
+        return set_json_error(reader, "invalid number");
+      json = value;
+      return true;
+    }
+    case json_token::string: json = json_value{reader.value}; return true;
+    case json_token::begin_array: {
+      json        = json_array{};
+      auto& array = json.get_ref<json_array>();
+      while (read_json_token(reader)) {
+        if (reader.token == json_token::end_array) return true;
+        if (!read_json_value(reader, array.emplace_back())) return false;
+      }
+      return false;
+    }
+    case json_token::begin_object: {
+      json         = json_object{};
+      auto& object = json.get_ref<json_object>();
+      while (read_json_token(reader)) {
+        if (reader.token == json_token::end_object) return true;
+        auto& [key, value] = object.emplace_back(
+            string{reader.value}, json_value{});
+        if (!read_json_token(reader) || !read_json_value(reader, value))
+          return false;
+      }
+      return false;
+    }
+    default: return set_json_error(reader, "unexpected token");
+  }
+}
+
+// Get the value of the current token
+template <typename T>
+static bool get_json_integer(json_reader& reader, T& value) {
+  if (reader.token != json_token::number || !is_json_integer(reader.value))
+    return set_json_error(reader, "integer expected");
+  auto& number = reader.value;
+  auto  result = std::from_chars_result{};
+  if (number[0] == '-') {
+    auto integer = (int64_t)0;
+    result       = std::from_chars(
+        number.data(), number.data() + number.size(), integer);
+    value = (T)integer;
+  } else {
+    auto integer = (uint64_t)0;
+    result       = std::from_chars(
+        number.data(), number.data() + number.size(), integer);
+    value = (T)integer;
+  }
+  if (result.ec != std::errc{})
+    return set_json_error(reader, "integer expected");
+  return true;
+}
+bool get_value(json_reader& reader, int64_t& value) {
+  return get_json_integer(reader, value);
+}
+bool get_value(json_reader& reader, int32_t& value) {
+  return get_json_integer(reader, value);
+}
+bool get_value(json_reader& reader, uint64_t& value) {
+  return get_json_integer(reader, value);
+}
+bool get_value(json_reader& reader, uint32_t& value) {
+  return get_json_integer(reader, value);
+}
+bool get_value(json_reader& reader, double& value) {
+  if (reader.token != json_token::number)
+    return set_json_error(reader, "number expected");
+  if (!parse_json_real(reader.value, value))
+    return set_json_error(reader, "invalid number");
+  return true;
+}
+bool get_value(json_reader& reader, float& value) {
+  auto real = 0.0;
+  if (!get_value(reader, real)) return false;
+  value = (float)real;
+  return true;
+}
+bool get_value(json_reader& reader, bool& value) {
+  if (reader.token != json_token::boolean)
+    return set_json_error(reader, "boolean expected");
+  value = reader.boolean;
+  return true;
+}
+bool get_value(json_reader& reader, string& value) {
+  if (reader.token != json_token::string)
+    return set_json_error(reader, "string expected");
+  value.assign(reader.value);
+  return true;
+}
+
+}  // namespace yocto
+
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION OF JSON IO
 // -----------------------------------------------------------------------------
@@ -120,104 +597,15 @@ void from_json(const json_value& json, njson& njs) {
 
 // load json
 bool load_json(const string& filename, json_value& json, string& error) {
-  // error helpers
-  auto parse_error = [filename, &error]() {
-    error = filename + ": parse error in json";
-    return false;
-  };
-
-  // sax handler
-  struct sax_handler {
-    // stack
-    yocto::json_value*              root  = nullptr;
-    std::vector<yocto::json_value*> stack = {};
-    std::string                     current_key;
-    explicit sax_handler(yocto::json_value* root_) {
-      *root_ = yocto::json_value{};
-      root   = root_;
-      stack.push_back(root);
-    }
-
-    // get current value
-    yocto::json_value& next_value() {
-      if (stack.size() == 1) return *root;
-      if (stack.back()->is_array()) return (*stack.back()).emplace_back();
-      if (stack.back()->is_object()) return (*stack.back())[current_key];
-      throw yocto::json_error{"bad json type"};
-    }
-
-    // values
-    bool null() {
-      next_value() = yocto::json_value{};
-      return true;
-    }
-    bool boolean(bool value) {
-      next_value() = value;
-      return true;
-    }
-    bool number_integer(int64_t value) {
-      next_value() = value;
-      return true;
-    }
-    bool number_unsigned(uint64_t value) {
-      next_value() = value;
-      return true;
-    }
-    bool number_float(double value, const std::string&) {
-      next_value() = value;
-      return true;
-    }
-    bool string(std::string& value) {
-      next_value() = value;
-      return true;
-    }
-    bool binary(std::vector<uint8_t>& value) {
-      next_value() = value;
-      return true;
-    }
-
-    // objects
-    bool start_object(size_t elements) {
-      next_value() = yocto::json_object{};
-      stack.push_back(&next_value());
-      return true;
-    }
-    bool end_object() {
-      stack.pop_back();
-      return true;
-    }
-    bool key(std::string& value) {
-      current_key = value;
-      return true;
-    }
-
-    // arrays
-    bool start_array(size_t elements) {
-      next_value() = yocto::json_array{};
-      stack.push_back(&next_value());
-      return true;
-    }
-    bool end_array() {
-      stack.pop_back();
-      return true;
-    }
-
-    bool parse_error(size_t position, const std::string& last_token,
-        const nlohmann::detail::exception&) {
-      return false;
-    }
-  };
-
-  // set up parsing
-  json         = json_value{};
-  auto handler = sax_handler{&json};
-
   // load text
   auto text = ""s;
   if (!load_text(filename, text, error)) return false;
 
   // parse json
-  if (!njson::sax_parse(text, &handler)) return parse_error();
+  if (!parse_json(text, json, error)) {
+    error = filename + ": " + error;
+    return false;
+  }
   return true;
 }
 
@@ -236,6 +624,19 @@ bool load_json(const string& filename, json_value& json, string& error) {
 
 #endif
 
+// Parse a Json string with the streaming reader
+bool parse_json(const string& text, json_value& json, string& error) {
+  auto reader = json_reader{};
+  init_json_reader(reader, text);
+  json = json_value{};
+  if (!read_json_token(reader) || !read_json_value(reader, json) ||
+      read_json_token(reader) || !reader.error.empty()) {
+    error = "parse error in json: " + reader.error;
+    return false;
+  }
+  return true;
+}
+
 // save json
 bool save_json(const string& filename, const json_value& json, string& error) {
   // convert
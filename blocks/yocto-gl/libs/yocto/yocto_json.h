@@ -260,6 +260,65 @@ bool   parse_json(const string& text, json_value& json, string& error);
 bool   format_json(string& text, const json_value& json, string& error);
 string format_json(const json_value& json);
 
+// Parse a Json string directly into a value, using the streaming reader
+template <typename T>
+inline bool parse_json(const string& text, T& value, string& error);
+
+}  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// JSON STREAMING READER
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Json tokens
+enum struct json_token {
+  // clang-format off
+  none, null, boolean, number, string, key,
+  begin_array, end_array, begin_object, end_object
+  // clang-format on
+};
+
+// Streaming Json reader, that pulls one token at a time from a text without
+// building a json_value. Numbers, keys and strings without escapes are
+// returned as views into the text, so reading does not allocate. The text
+// must outlive the reader.
+struct json_reader {
+  string_view  text    = {};
+  size_t       pos     = 0;
+  json_token   token   = json_token::none;
+  string_view  value   = {};  // number, key or string
+  bool         boolean = false;
+  bool         first   = true;   // first item of the current array or object
+  bool         started = false;  // root value started
+  vector<char> stack   = {};     // open arrays and objects
+  string       buffer  = {};     // unescaped strings
+  string       error   = {};
+};
+
+// Initialize a reader over a text
+void init_json_reader(json_reader& reader, string_view text);
+
+// Read the next token. Returns false at the end of the text or on error,
+// in which case the error is set.
+bool read_json_token(json_reader& reader);
+
+// Skip the value starting at the current token
+bool skip_json_value(json_reader& reader);
+
+// Read the value starting at the current token into a json_value
+bool read_json_value(json_reader& reader, json_value& json);
+
+// Get the value of the current token, setting the error on type mismatch
+bool get_value(json_reader& reader, int64_t& value);
+bool get_value(json_reader& reader, int32_t& value);
+bool get_value(json_reader& reader, uint64_t& value);
+bool get_value(json_reader& reader, uint32_t& value);
+bool get_value(json_reader& reader, double& value);
+bool get_value(json_reader& reader, float& value);
+bool get_value(json_reader& reader, bool& value);
+bool get_value(json_reader& reader, string& value);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -369,6 +428,33 @@ template <typename T>
 inline void serialize_property(json_mode mode, json_value& json, T& value,
     const string& name, const string& description, bool required = false);
 
+// Conversion from a streaming reader to values, starting at the current
+// token. Numbers, strings, arrays and vectors are read directly from the
+// tokens, so large numeric arrays are parsed straight into typed vectors.
+// Other types are read into a json_value and converted from it.
+inline void serialize_value(json_reader& reader, int64_t& value);
+inline void serialize_value(json_reader& reader, int32_t& value);
+inline void serialize_value(json_reader& reader, uint64_t& value);
+inline void serialize_value(json_reader& reader, uint32_t& value);
+inline void serialize_value(json_reader& reader, double& value);
+inline void serialize_value(json_reader& reader, float& value);
+inline void serialize_value(json_reader& reader, bool& value);
+inline void serialize_value(json_reader& reader, string& value);
+template <typename T>
+inline void serialize_value(json_reader& reader, vector<T>& value);
+template <typename T, size_t N>
+inline void serialize_value(json_reader& reader, array<T, N>& value);
+template <typename T>
+inline void serialize_value(json_reader& reader, T& value);
+
+// Conversion from a streaming reader to objects. `property` is called with
+// each key, and either reads its value with serialize_property() or leaves
+// it to be skipped.
+template <typename Property>
+inline void serialize_object(json_reader& reader, Property&& property);
+template <typename T>
+inline void serialize_property(json_reader& reader, T& value);
+
 // Support for CLI
 template <typename T>
 inline void serialize_command(json_mode mode, json_value& json, T& value,
@@ -1507,6 +1593,104 @@ inline void serialize_clialternates(json_mode mode, json_value& json,
   }
 }
 
+// Conversion from a streaming reader to values
+template <typename T>
+inline void serialize_json_base(json_reader& reader, T& value) {
+  if (!get_value(reader, value)) throw json_error{reader.error};
+}
+inline void serialize_value(json_reader& reader, int64_t& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, int32_t& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, uint64_t& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, uint32_t& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, double& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, float& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, bool& value) {
+  return serialize_json_base(reader, value);
+}
+inline void serialize_value(json_reader& reader, string& value) {
+  return serialize_json_base(reader, value);
+}
+template <typename T>
+inline void serialize_value(json_reader& reader, vector<T>& value) {
+  if (reader.token != json_token::begin_array)
+    throw json_error{"array expected"};
+  value.clear();
+  while (true) {
+    if (!read_json_token(reader)) throw json_error{reader.error};
+    if (reader.token == json_token::end_array) break;
+    serialize_value(reader, value.emplace_back());
+  }
+}
+template <typename T, size_t N>
+inline void serialize_value(json_reader& reader, array<T, N>& value) {
+  if (reader.token != json_token::begin_array)
+    throw json_error{"array expected"};
+  for (auto& item : value) {
+    if (!read_json_token(reader)) throw json_error{reader.error};
+    if (reader.token == json_token::end_array)
+      throw json_error{"wrong array size"};
+    serialize_value(reader, item);
+  }
+  if (!read_json_token(reader)) throw json_error{reader.error};
+  if (reader.token != json_token::end_array)
+    throw json_error{"wrong array size"};
+}
+template <typename T>
+inline void serialize_value(json_reader& reader, T& value) {
+  auto json = json_value{};
+  if (!read_json_value(reader, json)) throw json_error{reader.error};
+  from_json(json, value);
+}
+
+// Conversion from a streaming reader to objects
+template <typename Property>
+inline void serialize_object(json_reader& reader, Property&& property) {
+  if (reader.token != json_token::begin_object)
+    throw json_error{"object expected"};
+  while (true) {
+    if (!read_json_token(reader)) throw json_error{reader.error};
+    if (reader.token == json_token::end_object) break;
+    property(reader.value);
+    if (reader.token != json_token::key) continue;
+    if (!read_json_token(reader) || !skip_json_value(reader))
+      throw json_error{reader.error};
+  }
+}
+template <typename T>
+inline void serialize_property(json_reader& reader, T& value) {
+  if (!read_json_token(reader)) throw json_error{reader.error};
+  serialize_value(reader, value);
+}
+
+// Parse a Json string directly into a value
+template <typename T>
+inline bool parse_json(const string& text, T& value, string& error) {
+  auto reader = json_reader{};
+  init_json_reader(reader, text);
+  try {
+    if (!read_json_token(reader)) throw json_error{reader.error};
+    serialize_value(reader, value);
+    if (read_json_token(reader) || !reader.error.empty())
+      throw json_error{reader.error};
+    return true;
+  } catch (json_error& err) {
+    error = "parse error in json: "s + err.what();
+    return false;
+  }
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -37,6 +37,7 @@
 #include "yocto_mesh.h"
 
 #include <cassert>
+#include <cstring>
 #include <deque>
 #include <filesystem>
 #include <memory>
@@ -48,6 +49,7 @@
 #include "yocto_commonio.h"
 #include "yocto_geometry.h"
 #include "yocto_modelio.h"
+#include "yocto_parallel.h"
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
@@ -610,11 +612,6 @@ void meandering_triangles(const vector<float>& field, float isoline,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-static void connect_nodes(geodesic_solver& solver, int a, int b, float length) {
-  solver.graph[a].push_back({b, length});
-  solver.graph[b].push_back({a, length});
-}
-
 static float opposite_nodes_arc_length(
     const vector<vec3f>& positions, int a, int c, const vec2i& edge) {
   // Triangles (a, b, d) and (b, d, c) are connected by (b, d) edge
@@ -644,44 +641,67 @@ static float opposite_nodes_arc_length(
     return sqrt(len);
 }
 
-static void connect_opposite_nodes(geodesic_solver& solver,
-    const vector<vec3f>& positions, const vec3i& tr0, const vec3i& tr1,
-    const vec2i& edge) {
-  auto opposite_vertex = [](const vec3i& tr, const vec2i& edge) -> int {
-    for (auto i = 0; i < 3; ++i) {
-      if (tr[i] != edge.x && tr[i] != edge.y) return tr[i];
-    }
-    return -1;
-  };
+static int opposite_node(const vec3i& tr, const vec2i& edge) {
+  for (auto i = 0; i < 3; ++i) {
+    if (tr[i] != edge.x && tr[i] != edge.y) return tr[i];
+  }
+  return -1;
+}
 
-  auto v0 = opposite_vertex(tr0, edge);
-  auto v1 = opposite_vertex(tr1, edge);
-  if (v0 == -1 || v1 == -1) return;
-  auto length = opposite_nodes_arc_length(positions, v0, v1, edge);
-  connect_nodes(solver, v0, v1, length);
+// Undirected arc of the geodesic graph, connecting two nodes
+struct geodesic_arc {
+  int   a      = -1;
+  int   b      = -1;
+  float length = flt_max;
+};
+
+// Build the flat arrays of a geodesic graph from undirected arcs, with a
+// counting sort by node that keeps the order in which arcs are given.
+static void make_geodesic_graph(geodesic_solver& solver, int num_nodes,
+    const vector<geodesic_arc>& arcs) {
+  auto counts = vector<int>(num_nodes + 1, 0);
+  for (auto& arc : arcs) {
+    if (arc.a < 0) continue;
+    counts[arc.a + 1] += 1;
+    counts[arc.b + 1] += 1;
+  }
+  for (auto node = 0; node < num_nodes; node++)
+    counts[node + 1] += counts[node];
+  solver.offsets = counts;
+  solver.arcs.resize(solver.offsets.back());
+  for (auto& arc : arcs) {
+    if (arc.a < 0) continue;
+    solver.arcs[counts[arc.a]++] = {arc.b, arc.length};
+    solver.arcs[counts[arc.b]++] = {arc.a, arc.length};
+  }
 }
 
 geodesic_solver make_geodesic_solver(const vector<vec3i>& triangles,
     const vector<vec3i>& adjacencies, const vector<vec3f>& positions) {
-  auto solver = geodesic_solver{};
-  solver.graph.resize(positions.size());
-  for (auto face = 0; face < triangles.size(); face++) {
+  // collect mesh edges and arcs between opposite nodes, two slots per side
+  auto arcs = vector<geodesic_arc>(triangles.size() * 6);
+  parallel_for((int)triangles.size(), [&](int face) {
     for (auto k = 0; k < 3; k++) {
       auto a = triangles[face][k];
       auto b = triangles[face][mod3(k + 1)];
 
       // connect mesh edges
       auto len = length(positions[a] - positions[b]);
-      if (a < b) connect_nodes(solver, a, b, len);
+      if (a < b) arcs[face * 6 + k * 2 + 0] = {a, b, len};
 
       // connect opposite nodes
       auto neighbor = adjacencies[face][k];
       if (face < neighbor) {
-        connect_opposite_nodes(
-            solver, positions, triangles[face], triangles[neighbor], {a, b});
+        auto v0 = opposite_node(triangles[face], {a, b});
+        auto v1 = opposite_node(triangles[neighbor], {a, b});
+        if (v0 == -1 || v1 == -1) continue;
+        auto length = opposite_nodes_arc_length(positions, v0, v1, {a, b});
+        arcs[face * 6 + k * 2 + 1] = {v0, v1, length};
       }
     }
-  }
+  });
+  auto solver = geodesic_solver{};
+  make_geodesic_graph(solver, (int)positions.size(), arcs);
   return solver;
 }
 
@@ -720,20 +740,23 @@ geodesic_solver make_geodesic_solver(const vector<vec3i>& triangles,
     const vector<vec3f>& positions, const vector<vec3i>& adjacencies,
     const vector<vector<int>>& v2t) {
   auto solver = geodesic_solver{};
-  solver.graph.resize(positions.size());
-  for (auto i = 0; i < positions.size(); ++i) {
+  solver.offsets.assign(positions.size() + 1, 0);
+  for (auto i = 0; i < positions.size(); ++i)
+    solver.offsets[i + 1] = solver.offsets[i] + (int)v2t[i].size() * 2;
+  solver.arcs.resize(solver.offsets.back());
+  parallel_for((int)positions.size(), [&](int i) {
     auto& star = v2t[i];
     auto& vert = positions[i];
-    if (star.size() == 0) continue;
+    auto  arcs = solver.arcs.data() + solver.offsets[i];
     for (auto j = 0; j < star.size(); ++j) {
-      auto tid    = star[j];
-      auto offset = find_in_vec(triangles[tid], i);
-      auto p      = triangles[tid][(offset + 1) % 3];
-      auto e      = positions[p] - vert;
-      solver.graph[i].push_back({p, length(e)});
-      auto opp   = opposite_face(triangles, adjacencies, tid, i);
-      auto strip = vector<int>{tid, opp};
-      auto k     = find_in_vec(
+      auto tid        = star[j];
+      auto offset     = find_in_vec(triangles[tid], i);
+      auto p          = triangles[tid][(offset + 1) % 3];
+      auto e          = positions[p] - vert;
+      arcs[j * 2 + 0] = {p, length(e)};
+      auto opp        = opposite_face(triangles, adjacencies, tid, i);
+      auto strip      = vector<int>{tid, opp};
+      auto k          = find_in_vec(
           adjacencies[tid], opp);  // TODO(fabio): this is not needeed
       assert(k != -1);
       auto a       = opposite_vertex(triangles, adjacencies, tid, k);
@@ -742,9 +765,9 @@ geodesic_solver make_geodesic_solver(const vector<vec3i>& triangles,
       bary[offset] = 1;
       auto l       = length_by_flattening(
           triangles, positions, adjacencies, {opp, {bary.y, bary.z}}, strip);
-      solver.graph[i].push_back({a, l});
+      arcs[j * 2 + 1] = {a, l};
     }
-  }
+  });
   return solver;
 }
 
@@ -836,7 +859,7 @@ void visit_geodesic_graph(vector<float>& field, const geodesic_solver& solver,
      the end of the queue.
   */
 
-  auto in_queue = vector<bool>(solver.graph.size(), false);
+  auto in_queue = vector<bool>(num_nodes(solver), false);
 
   // Cumulative weights of elements in queue. Used to keep track of the
   // average weight of the queue.
@@ -871,10 +894,11 @@ void visit_geodesic_graph(vector<float>& field, const geodesic_solver& solver,
     if (exit(node)) break;
     if (stop(node)) continue;
 
-    for (auto i = 0; i < (int)solver.graph[node].size(); i++) {
+    for (auto i = 0; i < num_arcs(solver, node); i++) {
       // Distance of neighbor through this node
-      auto new_distance = field[node] + solver.graph[node][i].length;
-      auto neighbor     = solver.graph[node][i].node;
+      auto& arc          = get_arc(solver, node, i);
+      auto  new_distance = field[node] + arc.length;
+      auto  neighbor     = arc.node;
 
       auto old_distance = field[neighbor];
       if (new_distance >= old_distance) continue;
@@ -903,8 +927,155 @@ void visit_geodesic_graph(vector<float>& field, const geodesic_solver& solver,
   }
 }
 
-// Compute geodesic distances
-void update_geodesic_distances(vector<float>& distances,
+// Graphs with at least this many nodes are solved with parallel
+// Delta-stepping on multicore machines. Frontiers are relaxed in parallel, in chunks, only when
+// large enough to pay for the threads.
+const auto geodesic_parallel_nodes    = 65536;
+const auto geodesic_parallel_frontier = 4096;
+const auto geodesic_frontier_chunk    = 1024;
+
+// Distances and labels are packed in a single word, so that both are updated
+// with one atomic min. Non-negative floats are ordered as their bits, and
+// ties are broken by the smallest label.
+static inline uint64_t make_geodesic_state(float distance, int label) {
+  auto bits = (uint32_t)0;
+  memcpy(&bits, &distance, sizeof(bits));
+  return ((uint64_t)bits << 32) | (uint32_t)label;
+}
+static inline float geodesic_state_distance(uint64_t state) {
+  auto bits     = (uint32_t)(state >> 32);
+  auto distance = 0.0f;
+  memcpy(&distance, &bits, sizeof(distance));
+  return distance;
+}
+static inline int geodesic_state_label(uint64_t state) {
+  return (int)(uint32_t)state;
+}
+
+// Delta-stepping geodesic solver. Nodes are kept in buckets of width `delta`
+// by distance, and buckets are processed in order. The nodes of the current
+// bucket are relaxed in parallel until none falls back into it. Labels, if
+// given, are propagated from the sources together with the distances. As in
+// the serial solver, nodes farther than `max_distance` are not expanded.
+static void update_geodesic_stepping(vector<float>& distances,
+    vector<int>& labels, const geodesic_solver& solver,
+    const vector<int>& sources, float max_distance) {
+  // bucket width from the arcs around the sources
+  auto delta = 0.0f;
+  auto count = 0;
+  for (auto source : sources) {
+    for (auto arc = 0; arc < num_arcs(solver, source); arc++) {
+      delta += get_arc(solver, source, arc).length;
+      count += 1;
+    }
+    if (count > 256) break;
+  }
+  delta = (count != 0 && delta > 0) ? 4 * delta / count : 1;
+
+  // packed states
+  auto states = vector<atomic<uint64_t>>(num_nodes(solver));
+  for (auto node = 0; node < num_nodes(solver); node++) {
+    states[node] = make_geodesic_state(
+        distances[node], labels.empty() ? 0 : labels[node]);
+  }
+
+  // relax all arcs of a node, collecting the updated neighbors
+  auto relax = [&](int node, vector<int>& updated) {
+    auto state    = states[node].load(std::memory_order_relaxed);
+    auto distance = geodesic_state_distance(state);
+    auto label    = geodesic_state_label(state);
+    for (auto arc = 0; arc < num_arcs(solver, node); arc++) {
+      auto& [neighbor, length] = get_arc(solver, node, arc);
+      auto new_state = make_geodesic_state(distance + length, label);
+      auto old_state = states[neighbor].load(std::memory_order_relaxed);
+      while (new_state < old_state) {
+        if (states[neighbor].compare_exchange_weak(
+                old_state, new_state, std::memory_order_relaxed)) {
+          updated.push_back(neighbor);
+          break;
+        }
+      }
+    }
+  };
+
+  // buckets
+  auto get_bucket = [delta](float distance) {
+    return (size_t)(distance / delta);
+  };
+  auto buckets = vector<vector<int>>{};
+  auto push    = [&](int node) {
+    auto distance = geodesic_state_distance(states[node]);
+    if (distance > max_distance) return;
+    auto bucket = get_bucket(distance);
+    if (bucket >= buckets.size()) buckets.resize(bucket + 1);
+    buckets[bucket].push_back(node);
+  };
+  for (auto source : sources) push(source);
+
+  // process buckets in order
+  auto marks    = vector<int>(num_nodes(solver), 0);
+  auto phase    = 0;
+  auto frontier = vector<int>{};
+  auto updated  = vector<vector<int>>{};
+  for (auto bucket = (size_t)0; bucket < buckets.size(); bucket++) {
+    auto current = vector<int>{};
+    std::swap(current, buckets[bucket]);
+    while (!current.empty()) {
+      // skip duplicates and nodes that moved to a lower bucket
+      phase += 1;
+      frontier.clear();
+      for (auto node : current) {
+        if (marks[node] == phase) continue;
+        marks[node] = phase;
+        if (get_bucket(geodesic_state_distance(states[node])) != bucket)
+          continue;
+        frontier.push_back(node);
+      }
+
+      // relax the frontier
+      if (frontier.size() < geodesic_parallel_frontier) {
+        updated.resize(1);
+        updated[0].clear();
+        for (auto node : frontier) relax(node, updated[0]);
+      } else {
+        auto num_chunks = ((int)frontier.size() + geodesic_frontier_chunk - 1) /
+                          geodesic_frontier_chunk;
+        updated.resize(num_chunks);
+        parallel_for(num_chunks, [&](int chunk) {
+          updated[chunk].clear();
+          auto start = (size_t)chunk * geodesic_frontier_chunk;
+          auto end = std::min(start + geodesic_frontier_chunk, frontier.size());
+          for (auto idx = start; idx < end; idx++)
+            relax(frontier[idx], updated[chunk]);
+        });
+      }
+
+      // requeue updated nodes
+      current.clear();
+      for (auto& nodes : updated) {
+        for (auto node : nodes) {
+          auto distance = geodesic_state_distance(states[node]);
+          if (distance > max_distance) continue;
+          if (get_bucket(distance) == bucket) {
+            current.push_back(node);
+          } else {
+            push(node);
+          }
+        }
+      }
+    }
+  }
+
+  // unpack states
+  for (auto node = 0; node < num_nodes(solver); node++) {
+    auto state      = states[node].load(std::memory_order_relaxed);
+    distances[node] = geodesic_state_distance(state);
+    if (!labels.empty()) labels[node] = geodesic_state_label(state);
+  }
+}
+
+// Serial geodesic solver
+static void update_geodesic_serial(vector<float>& distances,
     const geodesic_solver& solver, const vector<int>& sources,
     float max_distance) {
   auto update = [](int node, int neighbor, float new_distance) {};
@@ -913,9 +1084,22 @@ void update_geodesic_distances(vector<float>& distances,
   visit_geodesic_graph(distances, solver, sources, update, stop, exit);
 }
 
+// Compute geodesic distances
+void update_geodesic_distances(vector<float>& distances,
+    const geodesic_solver& solver, const vector<int>& sources,
+    float max_distance) {
+  if (num_nodes(solver) < geodesic_parallel_nodes ||
+      std::thread::hardware_concurrency() <= 1) {
+    update_geodesic_serial(distances, solver, sources, max_distance);
+  } else {
+    auto labels = vector<int>{};
+    update_geodesic_stepping(distances, labels, solver, sources, max_distance);
+  }
+}
+
 vector<float> compute_geodesic_distances(const geodesic_solver& solver,
     const vector<int>& sources, float max_distance) {
-  auto distances = vector<float>(solver.graph.size(), flt_max);
+  auto distances = vector<float>(num_nodes(solver), flt_max);
   for (auto source : sources) distances[source] = 0.0f;
   update_geodesic_distances(distances, solver, sources, max_distance);
   return distances;
@@ -926,8 +1110,8 @@ vector<float> compute_geodesic_distances(const geodesic_solver& solver,
 // in the path. Graph search early exits when reching end_vertex.
 vector<int> compute_geodesic_paths(
     const geodesic_solver& solver, const vector<int>& sources, int end_vertex) {
-  auto parents   = vector<int>(solver.graph.size(), -1);
-  auto distances = vector<float>(solver.graph.size(), flt_max);
+  auto parents   = vector<int>(num_nodes(solver), -1);
+  auto distances = vector<float>(num_nodes(solver), flt_max);
   auto update    = [&parents](int node, int neighbor, float new_distance) {
     parents[neighbor] = node;
   };
@@ -945,7 +1129,7 @@ vector<int> sample_vertices_poisson(
     const geodesic_solver& solver, int num_samples) {
   auto verts = vector<int>{};
   verts.reserve(num_samples);
-  auto distances = vector<float>(solver.graph.size(), flt_max);
+  auto distances = vector<float>(num_nodes(solver), flt_max);
   while (true) {
     auto max_index =
         (int)(std::max_element(distances.begin(), distances.end()) -
@@ -966,17 +1150,37 @@ vector<vector<float>> compute_voronoi_fields(
   // Find max distance from a generator to set an early exit condition for the
   // following distance field computations. This optimization makes
   // computation time weakly dependant on the number of generators.
+  // Since each field is bounded, the fields are computed in parallel, each
+  // with the serial solver.
   auto total = compute_geodesic_distances(solver, generators);
   auto max   = *std::max_element(total.begin(), total.end());
-  // @Speed: use parallel_for
-  for (auto i = 0; i < generators.size(); ++i) {
-    fields[i]                = vector<float>(solver.graph.size(), flt_max);
+  parallel_for((int)generators.size(), [&](int i) {
+    fields[i]                = vector<float>(num_nodes(solver), flt_max);
     fields[i][generators[i]] = 0;
-    fields[i] = compute_geodesic_distances(solver, {generators[i]}, max);
-  }
+    update_geodesic_serial(fields[i], solver, {generators[i]}, max);
+  });
   return fields;
 }
 
+// Compute the voronoi regions of a set of generators, by labelling each
+// vertex with the index of its closest generator, in a single sweep.
+vector<int> compute_voronoi_labels(const geodesic_solver& solver,
+    const vector<int>& generators, vector<float>& distances) {
+  distances   = vector<float>(num_nodes(solver), flt_max);
+  auto labels = vector<int>(num_nodes(solver), -1);
+  for (auto i = 0; i < generators.size(); i++) {
+    distances[generators[i]] = 0;
+    if (labels[generators[i]] < 0) labels[generators[i]] = i;
+  }
+  update_geodesic_stepping(distances, labels, solver, generators, flt_max);
+  return labels;
+}
+vector<int> compute_voronoi_labels(
+    const geodesic_solver& solver, const vector<int>& generators) {
+  auto distances = vector<float>{};
+  return compute_voronoi_labels(solver, generators, distances);
+}
+
 vector<vec3f> colors_from_field(
     const vector<float>& field, float scale, const vec3f& c0, const vec3f& c1) {
   auto colors = vector<vec3f>{field.size()};
@@ -1502,7 +1706,7 @@ vector<float> solve_with_parents(const geodesic_solver& solver,
     const vector<pair<int, float>>&                     sources_and_dist,
     const vector<pair<int, float>>& targets, vector<int>& parents,
     bool with_parents = false) {
-  parents.assign(solver.graph.size(), -1);
+  parents.assign(num_nodes(solver), -1);
   auto update = [&parents](int node, int neighbor, float new_distance) {
     parents[neighbor] = node;
   };
@@ -1520,7 +1724,7 @@ vector<float> solve_with_parents(const geodesic_solver& solver,
     return exit_verts.empty();
   };
 
-  auto distances  = vector<float>(solver.graph.size(), flt_max);
+  auto distances  = vector<float>(num_nodes(solver), flt_max);
   auto sources_id = vector<int>(sources_and_dist.size());
   for (auto i = 0; i < sources_and_dist.size(); ++i) {
     sources_id[i]                        = sources_and_dist[i].first;
@@ -1609,8 +1813,8 @@ vector<int> point_to_point_geodesic_path(const geodesic_solver& solver,
 // parameters are the same
 vector<int> compute_pruned_geodesic_paths(
     const geodesic_solver& solver, const vector<int>& sources, int end_vertex) {
-  auto parents   = vector<int>(solver.graph.size(), -1);
-  auto distances = vector<float>(solver.graph.size(), flt_max);
+  auto parents   = vector<int>(num_nodes(solver), -1);
+  auto distances = vector<float>(num_nodes(solver), flt_max);
   auto update    = [&parents](int node, int neighbor, float new_distance) {
     parents[neighbor] = node;
   };
@@ -1667,7 +1871,7 @@ static vector<float> solve(const geodesic_solver& solver,
   auto exit   = [](int node) { return false; };
 
   auto distances = vector<float>{};
-  distances.assign(solver.graph.size(), flt_max);
+  distances.assign(num_nodes(solver), flt_max);
   auto sources_id = vector<int>(sources_and_dist.size());
   for (auto i = 0; i < sources_and_dist.size(); ++i) {
     sources_id[i]                        = sources_and_dist[i].first;
@@ -1684,7 +1888,7 @@ static vector<float> solve_with_parents(const geodesic_solver& solver,
     const vector<pair<int, float>>&                     sources_and_dist,
     const vector<pair<int, float>>& targets, vector<int>& parents,
     bool with_parents = false) {
-  parents.assign(solver.graph.size(), -1);
+  parents.assign(num_nodes(solver), -1);
   auto update = [&parents](int node, int neighbor, float new_distance) {
     parents[neighbor] = node;
   };
@@ -1702,7 +1906,7 @@ static vector<float> solve_with_parents(const geodesic_solver& solver,
     return exit_verts.empty();
   };
   vector<float> distances;
-  distances.assign(solver.graph.size(), flt_max);
+  distances.assign(num_nodes(solver), flt_max);
   vector<int> sources_id(sources_and_dist.size());
   for (int i = 0; i < sources_and_dist.size(); ++i) {
     sources_id[i]                        = sources_and_dist[i].first;
@@ -1937,9 +2141,8 @@ vector<int> strip_on_dual_graph(const dual_geodesic_solver& solver,
 
 // TODO: cleanup
 static int node_is_neighboor(const geodesic_solver& solver, int vid, int node) {
-  auto nbr = solver.graph[vid];
-  for (auto i = 0; i < nbr.size(); ++i) {
-    if (nbr[i].node == node) {
+  for (auto i = 0; i < num_arcs(solver, vid); ++i) {
+    if (get_arc(solver, vid, i).node == node) {
       return i;
     }
   }
@@ -98,20 +98,31 @@ vector<int> triangle_fan(
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Data structure used for geodesic computation
+// Data structure used for geodesic computation. Arcs are stored in flat
+// arrays, so that the arcs leaving node `i` are `arcs[offsets[i]]` to
+// `arcs[offsets[i + 1] - 1]`.
 struct geodesic_solver {
   static const int min_arcs = 12;
   struct graph_edge {
     int   node   = -1;
     float length = flt_max;
   };
-#ifdef YOCTO_ABSEIL
-  vector<short_vector<adjancency_list, min_arcs>> graph = {};
-#else
-  vector<vector<graph_edge>> graph = {};
-#endif
+  vector<int>        offsets = {};
+  vector<graph_edge> arcs    = {};
 };
 
+// Number of nodes and arcs of a node in the geodesic graph
+inline int num_nodes(const geodesic_solver& solver) {
+  return solver.offsets.empty() ? 0 : (int)solver.offsets.size() - 1;
+}
+inline int num_arcs(const geodesic_solver& solver, int node) {
+  return solver.offsets[node + 1] - solver.offsets[node];
+}
+inline const geodesic_solver::graph_edge& get_arc(
+    const geodesic_solver& solver, int node, int arc) {
+  return solver.arcs[solver.offsets[node] + arc];
+}
+
 // Construct a graph to compute geodesic distances
 geodesic_solver make_geodesic_solver(const vector<vec3i>& triangles,
     const vector<vec3i>& adjacencies, const vector<vec3f>& positions);
@@ -151,6 +162,14 @@ vector<int> sample_vertices_poisson(
 vector<vector<float>> compute_voronoi_fields(
     const geodesic_solver& solver, const vector<int>& generators);
 
+// Compute the voronoi regions of a set of generators in a single sweep,
+// returning for each vertex the index of its closest generator and,
+// optionally, the distance from it.
+vector<int> compute_voronoi_labels(
+    const geodesic_solver& solver, const vector<int>& generators);
+vector<int> compute_voronoi_labels(const geodesic_solver& solver,
+    const vector<int>& generators, vector<float>& distances);
+
 // Convert distances to colors
 vector<vec3f> colors_from_field(const vector<float>& field, float scale = 1,
     const vec3f& c0 = {1, 1, 1}, const vec3f& c1 = {1, 0.1f, 0.1f});
@@ -28,7 +28,10 @@
 
 #include "yocto_modelio.h"
 
+#include <atomic>
+#include <charconv>
 #include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <memory>
 #include <stdexcept>
@@ -39,6 +42,7 @@
 
 #include "yocto_color.h"
 #include "yocto_commonio.h"
+#include "yocto_parallel.h"
 
 // -----------------------------------------------------------------------------
 // USING DIRECTIVES
@@ -272,10 +276,330 @@ ply_element::~ply_element() {
 }
 ply_model::~ply_model() {
   for (auto element : elements) delete element;
+  delete mapping;
+}
+
+// Size of ply types in bytes
+static size_t ply_type_size(ply_type type) {
+  switch (type) {
+    case ply_type::i8: return 1;
+    case ply_type::i16: return 2;
+    case ply_type::i32: return 4;
+    case ply_type::i64: return 8;
+    case ply_type::u8: return 1;
+    case ply_type::u16: return 2;
+    case ply_type::u32: return 4;
+    case ply_type::u64: return 8;
+    case ply_type::f32: return 4;
+    case ply_type::f64: return 8;
+  }
+  return 0;
+}
+
+// Parse ply ascii values with from_chars. Floats fall back to strtod on
+// standard libraries that do not implement floating point from_chars.
+template <typename T>
+static bool parse_ply_value(string_view& str, T& value) {
+  skip_whitespace(str);
+  if (!str.empty() && str.front() == '+') str.remove_prefix(1);
+  if (str.empty()) return false;
+#if !defined(__cpp_lib_to_chars)
+  if constexpr (std::is_floating_point_v<T>) {
+    auto buffer = array<char, 64>{};
+    auto size   = std::min(str.size(), buffer.size() - 1);
+    memcpy(buffer.data(), str.data(), size);
+    char* end = nullptr;
+    value     = (T)strtod(buffer.data(), &end);
+    if (end == buffer.data()) return false;
+    str.remove_prefix(end - buffer.data());
+    return true;
+  }
+#endif
+  auto [end, ec] = std::from_chars(str.data(), str.data() + str.size(), value);
+  if (ec != std::errc{}) return false;
+  str.remove_prefix(end - str.data());
+  return true;
+}
+
+// Parse a ply ascii record
+static bool parse_ply_record(
+    string_view str, vector<ply_property>& properties) {
+  for (auto& prop : properties) {
+    if (prop.is_list) {
+      if (!parse_ply_value(str, prop.ldata_u8.emplace_back())) return false;
+    }
+    auto vcount = prop.is_list ? prop.ldata_u8.back() : 1;
+    for (auto i = 0; i < vcount; i++) {
+      switch (prop.type) {
+        case ply_type::i8:
+          if (!parse_ply_value(str, prop.data_i8.emplace_back())) return false;
+          break;
+        case ply_type::i16:
+          if (!parse_ply_value(str, prop.data_i16.emplace_back()))
+            return false;
+          break;
+        case ply_type::i32:
+          if (!parse_ply_value(str, prop.data_i32.emplace_back()))
+            return false;
+          break;
+        case ply_type::i64:
+          if (!parse_ply_value(str, prop.data_i64.emplace_back()))
+            return false;
+          break;
+        case ply_type::u8:
+          if (!parse_ply_value(str, prop.data_u8.emplace_back())) return false;
+          break;
+        case ply_type::u16:
+          if (!parse_ply_value(str, prop.data_u16.emplace_back()))
+            return false;
+          break;
+        case ply_type::u32:
+          if (!parse_ply_value(str, prop.data_u32.emplace_back()))
+            return false;
+          break;
+        case ply_type::u64:
+          if (!parse_ply_value(str, prop.data_u64.emplace_back()))
+            return false;
+          break;
+        case ply_type::f32:
+          if (!parse_ply_value(str, prop.data_f32.emplace_back()))
+            return false;
+          break;
+        case ply_type::f64:
+          if (!parse_ply_value(str, prop.data_f64.emplace_back()))
+            return false;
+          break;
+      }
+    }
+  }
+  return true;
+}
+
+// Append parsed ply data
+template <typename T>
+static void append_ply_values(vector<T>& values, const vector<T>& other) {
+  values.insert(values.end(), other.begin(), other.end());
+}
+static void append_ply_property(ply_property* prop, const ply_property& other) {
+  append_ply_values(prop->data_i8, other.data_i8);
+  append_ply_values(prop->data_i16, other.data_i16);
+  append_ply_values(prop->data_i32, other.data_i32);
+  append_ply_values(prop->data_i64, other.data_i64);
+  append_ply_values(prop->data_u8, other.data_u8);
+  append_ply_values(prop->data_u16, other.data_u16);
+  append_ply_values(prop->data_u32, other.data_u32);
+  append_ply_values(prop->data_u64, other.data_u64);
+  append_ply_values(prop->data_f32, other.data_f32);
+  append_ply_values(prop->data_f64, other.data_f64);
+  append_ply_values(prop->ldata_u8, other.ldata_u8);
+}
+
+// Parse ply ascii data. Records are split in chunks of lines that are parsed
+// in parallel and then merged in order.
+static bool parse_ply_ascii(ply_model* ply, string_view data) {
+  for (auto elem : ply->elements) {
+    // split lines in chunks
+    auto chunk_size = std::max(elem->count / 256, (size_t)4096);
+    auto chunks     = vector<pair<string_view, size_t>>{};
+    for (auto idx = (size_t)0; idx < elem->count; idx += chunk_size) {
+      auto count = std::min(chunk_size, elem->count - idx);
+      auto size  = (size_t)0;
+      for (auto line = (size_t)0; line < count; line++) {
+        auto next = data.find('\n', size);
+        if (next == string_view::npos) {
+          if (line + 1 != count || size == data.size()) return false;
+          next = data.size() - 1;
+        }
+        size = next + 1;
+      }
+      chunks.push_back({data.substr(0, size), count});
+      data.remove_prefix(size);
+    }
+
+    // parse chunks
+    auto parsed = vector<vector<ply_property>>(chunks.size());
+    auto failed = atomic<bool>{false};
+    parallel_for(chunks.size(), [&](size_t chunk) {
+      auto& properties = parsed[chunk];
+      for (auto prop : elem->properties) {
+        auto& cprop   = properties.emplace_back();
+        cprop.name    = prop->name;
+        cprop.type    = prop->type;
+        cprop.is_list = prop->is_list;
+      }
+      auto [str, count] = chunks[chunk];
+      for (auto line = (size_t)0; line < count; line++) {
+        auto end = std::min(str.find('\n'), str.size());
+        if (!parse_ply_record(str.substr(0, end), properties)) {
+          failed = true;
+          return;
+        }
+        str.remove_prefix(std::min(end + 1, str.size()));
+      }
+    });
+    if (failed) return false;
+
+    // merge chunks
+    for (auto& properties : parsed) {
+      for (auto pidx = (size_t)0; pidx < properties.size(); pidx++) {
+        append_ply_property(elem->properties[pidx], properties[pidx]);
+      }
+    }
+  }
+  return true;
+}
+
+// Read a binary value from memory
+template <typename T>
+static bool read_ply_value(
+    const byte*& ptr, const byte* end, T& value, bool big_endian) {
+  if (end - ptr < (ptrdiff_t)sizeof(T)) return false;
+  memcpy(&value, ptr, sizeof(T));
+  ptr += sizeof(T);
+  if (big_endian) value = swap_endian(value);
+  return true;
+}
+
+// Read a binary ply record, copying its values
+static bool read_ply_record(const byte*& ptr, const byte* end,
+    ply_element* elem, bool big_endian) {
+  for (auto prop : elem->properties) {
+    if (prop->is_list) {
+      if (!read_ply_value(ptr, end, prop->ldata_u8.emplace_back(), big_endian))
+        return false;
+    }
+    auto vcount = prop->is_list ? prop->ldata_u8.back() : 1;
+    for (auto i = 0; i < vcount; i++) {
+      switch (prop->type) {
+        case ply_type::i8:
+          if (!read_ply_value(ptr, end, prop->data_i8.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::i16:
+          if (!read_ply_value(
+                  ptr, end, prop->data_i16.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::i32:
+          if (!read_ply_value(
+                  ptr, end, prop->data_i32.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::i64:
+          if (!read_ply_value(
+                  ptr, end, prop->data_i64.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::u8:
+          if (!read_ply_value(ptr, end, prop->data_u8.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::u16:
+          if (!read_ply_value(
+                  ptr, end, prop->data_u16.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::u32:
+          if (!read_ply_value(
+                  ptr, end, prop->data_u32.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::u64:
+          if (!read_ply_value(
+                  ptr, end, prop->data_u64.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::f32:
+          if (!read_ply_value(
+                  ptr, end, prop->data_f32.emplace_back(), big_endian))
+            return false;
+          break;
+        case ply_type::f64:
+          if (!read_ply_value(
+                  ptr, end, prop->data_f64.emplace_back(), big_endian))
+            return false;
+          break;
+      }
+    }
+  }
+  return true;
+}
+
+// Read ply binary data. If `mapped` is set, elements whose records have a
+// fixed size are exposed as strided views, while the others are copied.
+static bool read_ply_binary(
+    ply_model* ply, const byte* ptr, const byte* end, bool mapped) {
+  auto big_endian = ply->format == ply_format::binary_big_endian;
+  for (auto elem : ply->elements) {
+    // check whether records have a fixed size, scanning list sizes
+    auto start   = ptr;
+    auto lsizes  = vector<int>(elem->properties.size(), -1);
+    auto uniform = mapped;
+    if (mapped) {
+      auto cur = ptr;
+      for (auto idx = (size_t)0; idx < elem->count && uniform; idx++) {
+        for (auto pidx = (size_t)0; pidx < elem->properties.size(); pidx++) {
+          auto prop  = elem->properties[pidx];
+          auto lsize = (uint8_t)1;
+          if (prop->is_list) {
+            if (!read_ply_value(cur, end, lsize, big_endian)) return false;
+            if (lsizes[pidx] < 0) lsizes[pidx] = lsize;
+            if (lsizes[pidx] != lsize) uniform = false;
+          }
+          auto size = lsize * ply_type_size(prop->type);
+          if ((size_t)(end - cur) < size) return false;
+          cur += size;
+        }
+      }
+      if (uniform) ptr = cur;
+    }
+
+    // make views
+    if (uniform) {
+      auto stride = elem->count ? (size_t)(ptr - start) / elem->count : 0;
+      auto offset = (size_t)0;
+      for (auto pidx = (size_t)0; pidx < elem->properties.size(); pidx++) {
+        auto prop = elem->properties[pidx];
+        if (prop->is_list) offset += 1;
+        prop->view_data   = start + offset;
+        prop->view_count  = elem->count;
+        prop->view_stride = stride;
+        prop->view_lsize  = (uint8_t)std::max(lsizes[pidx], 0);
+        prop->view_swap   = big_endian;
+        offset += (prop->is_list ? prop->view_lsize : 1) *
+                  ply_type_size(prop->type);
+      }
+      continue;
+    }
+
+    // copy values
+    for (auto prop : elem->properties) {
+      auto count = prop->is_list ? elem->count * 3 : elem->count;
+      switch (prop->type) {
+        case ply_type::i8: prop->data_i8.reserve(count); break;
+        case ply_type::i16: prop->data_i16.reserve(count); break;
+        case ply_type::i32: prop->data_i32.reserve(count); break;
+        case ply_type::i64: prop->data_i64.reserve(count); break;
+        case ply_type::u8: prop->data_u8.reserve(count); break;
+        case ply_type::u16: prop->data_u16.reserve(count); break;
+        case ply_type::u32: prop->data_u32.reserve(count); break;
+        case ply_type::u64: prop->data_u64.reserve(count); break;
+        case ply_type::f32: prop->data_f32.reserve(count); break;
+        case ply_type::f64: prop->data_f64.reserve(count); break;
+      }
+      if (prop->is_list) prop->ldata_u8.reserve(elem->count);
+    }
+    ptr = start;
+    for (auto idx = (size_t)0; idx < elem->count; idx++) {
+      if (!read_ply_record(ptr, end, elem, big_endian)) return false;
+    }
+  }
+  return true;
 }
 
 // Load ply
-bool load_ply(const string& filename, ply_model* ply, string& error) {
+bool load_ply(
+    const string& filename, ply_model* ply, string& error, bool mapped) {
   // ply type names
   static auto type_map = unordered_map<string, ply_type>{{"char", ply_type::i8},
       {"short", ply_type::i16}, {"int", ply_type::i32}, {"long", ply_type::i64},
@@ -291,6 +615,8 @@ bool load_ply(const string& filename, ply_model* ply, string& error) {
   // initialize data
   ply->comments.clear();
   ply->elements.clear();
+  delete ply->mapping;
+  ply->mapping = nullptr;
 
   // error helpers
   auto open_error = [filename, &error]() {
@@ -390,146 +716,72 @@ bool load_ply(const string& filename, ply_model* ply, string& error) {
 
   // check exit
   if (!end_header) return parse_error();
+  auto header_size = (size_t)ftell(fs.fs);
+  close_file(fs);
 
-  // allocate data ---------------------------------
-  for (auto element : ply->elements) {
-    for (auto property : element->properties) {
-      auto count = property->is_list ? element->count * 3 : element->count;
-      switch (property->type) {
-        case ply_type::i8: property->data_i8.reserve(count); break;
-        case ply_type::i16: property->data_i16.reserve(count); break;
-        case ply_type::i32: property->data_i32.reserve(count); break;
-        case ply_type::i64: property->data_i64.reserve(count); break;
-        case ply_type::u8: property->data_u8.reserve(count); break;
-        case ply_type::u16: property->data_u16.reserve(count); break;
-        case ply_type::u32: property->data_u32.reserve(count); break;
-        case ply_type::u64: property->data_u64.reserve(count); break;
-        case ply_type::f32: property->data_f32.reserve(count); break;
-        case ply_type::f64: property->data_f64.reserve(count); break;
-      }
-      if (property->is_list) property->ldata_u8.reserve(element->count);
-    }
-  }
+  // map file
+  auto mapping = std::make_unique<mapped_file>();
+  if (!map_file(filename, *mapping, error)) return false;
+  if (mapping->size < header_size) return read_error();
+  auto data = mapping->data + header_size;
+  auto size = mapping->size - header_size;
 
-  // read data -------------------------------------
+  // read data
   if (ply->format == ply_format::ascii) {
-    auto buffer = array<char, 4096>{};
-    for (auto elem : ply->elements) {
-      for (auto idx = 0; idx < elem->count; idx++) {
-        if (!read_line(fs, buffer)) return read_error();
-        auto str = string_view{buffer.data()};
-        for (auto prop : elem->properties) {
-          if (prop->is_list) {
-            if (!parse_value(str, prop->ldata_u8.emplace_back()))
-              return parse_error();
-          }
-          auto vcount = prop->is_list ? prop->ldata_u8.back() : 1;
-          for (auto i = 0; i < vcount; i++) {
-            switch (prop->type) {
-              case ply_type::i8:
-                if (!parse_value(str, prop->data_i8.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::i16:
-                if (!parse_value(str, prop->data_i16.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::i32:
-                if (!parse_value(str, prop->data_i32.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::i64:
-                if (!parse_value(str, prop->data_i64.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u8:
-                if (!parse_value(str, prop->data_u8.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u16:
-                if (!parse_value(str, prop->data_u16.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u32:
-                if (!parse_value(str, prop->data_u32.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::u64:
-                if (!parse_value(str, prop->data_u64.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::f32:
-                if (!parse_value(str, prop->data_f32.emplace_back()))
-                  return parse_error();
-                break;
-              case ply_type::f64:
-                if (!parse_value(str, prop->data_f64.emplace_back()))
-                  return parse_error();
-                break;
-            }
-          }
-        }
-      }
-    }
+    if (!parse_ply_ascii(ply, {(const char*)data, size})) return parse_error();
   } else {
-    auto big_endian = ply->format == ply_format::binary_big_endian;
-    for (auto elem : ply->elements) {
-      for (auto idx = 0; idx < elem->count; idx++) {
-        for (auto prop : elem->properties) {
-          if (prop->is_list) {
-            if (!read_value(fs, prop->ldata_u8.emplace_back(), big_endian))
-              return read_error();
-          }
-          auto vcount = prop->is_list ? prop->ldata_u8.back() : 1;
-          for (auto i = 0; i < vcount; i++) {
-            switch (prop->type) {
-              case ply_type::i8:
-                if (!read_value(fs, prop->data_i8.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::i16:
-                if (!read_value(fs, prop->data_i16.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::i32:
-                if (!read_value(fs, prop->data_i32.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::i64:
-                if (!read_value(fs, prop->data_i64.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u8:
-                if (!read_value(fs, prop->data_u8.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u16:
-                if (!read_value(fs, prop->data_u16.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u32:
-                if (!read_value(fs, prop->data_u32.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::u64:
-                if (!read_value(fs, prop->data_u64.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::f32:
-                if (!read_value(fs, prop->data_f32.emplace_back(), big_endian))
-                  return read_error();
-                break;
-              case ply_type::f64:
-                if (!read_value(fs, prop->data_f64.emplace_back(), big_endian))
-                  return read_error();
-                break;
-            }
-          }
-        }
+    if (!read_ply_binary(ply, data, data + size, mapped)) return read_error();
+    if (mapped) ply->mapping = mapping.release();
+  }
+  return true;
+}
+
+// Copy the values of memory-mapped views in a ply model with owned data
+template <typename T>
+static void copy_ply_view(const ply_property* prop, vector<T>& values) {
+  auto size = prop->is_list ? (size_t)prop->view_lsize : (size_t)1;
+  values    = vector<T>(prop->view_count * size);
+  for (auto i = (size_t)0; i < prop->view_count; i++) {
+    auto data = prop->view_data + i * prop->view_stride;
+    for (auto c = (size_t)0; c < size; c++) {
+      memcpy(&values[i * size + c], data + c * sizeof(T), sizeof(T));
+      if (prop->view_swap) values[i * size + c] = swap_endian(values[i * size + c]);
+    }
+  }
+}
+static std::unique_ptr<ply_model> copy_ply_views(const ply_model* ply) {
+  auto copy      = std::make_unique<ply_model>();
+  copy->format   = ply->format;
+  copy->comments = ply->comments;
+  for (auto elem : ply->elements) {
+    auto celem   = copy->elements.emplace_back(new ply_element{});
+    celem->name  = elem->name;
+    celem->count = elem->count;
+    for (auto prop : elem->properties) {
+      auto cprop = celem->properties.emplace_back(new ply_property{});
+      if (prop->view_data == nullptr) {
+        *cprop = *prop;
+        continue;
+      }
+      cprop->name    = prop->name;
+      cprop->type    = prop->type;
+      cprop->is_list = prop->is_list;
+      if (prop->is_list) cprop->ldata_u8.assign(prop->view_count, prop->view_lsize);
+      switch (prop->type) {
+        case ply_type::i8: copy_ply_view(prop, cprop->data_i8); break;
+        case ply_type::i16: copy_ply_view(prop, cprop->data_i16); break;
+        case ply_type::i32: copy_ply_view(prop, cprop->data_i32); break;
+        case ply_type::i64: copy_ply_view(prop, cprop->data_i64); break;
+        case ply_type::u8: copy_ply_view(prop, cprop->data_u8); break;
+        case ply_type::u16: copy_ply_view(prop, cprop->data_u16); break;
+        case ply_type::u32: copy_ply_view(prop, cprop->data_u32); break;
+        case ply_type::u64: copy_ply_view(prop, cprop->data_u64); break;
+        case ply_type::f32: copy_ply_view(prop, cprop->data_f32); break;
+        case ply_type::f64: copy_ply_view(prop, cprop->data_f64); break;
       }
     }
   }
-  return true;
+  return copy;
 }
 
 // Save ply
@@ -555,6 +807,13 @@ bool save_ply(const string& filename, const ply_model* ply, string& error) {
     return false;
   };
 
+  // copy memory-mapped views since writing uses the data vectors
+  auto copy_guard = std::unique_ptr<ply_model>{};
+  if (ply->mapping != nullptr) {
+    copy_guard = copy_ply_views(ply);
+    ply        = copy_guard.get();
+  }
+
   // open file
   auto fs = open_file(filename, "wb");
   if (!fs) return open_error();
@@ -592,7 +851,8 @@ bool save_ply(const string& filename, const ply_model* ply, string& error) {
     for (auto elem : ply->elements) {
       auto cur = vector<size_t>(elem->properties.size(), 0);
       for (auto idx = 0; idx < elem->count; idx++) {
-        for (auto prop : elem->properties) {
+        for (auto pidx = 0; pidx < elem->properties.size(); pidx++) {
+          auto prop = elem->properties[pidx];
           if (prop->is_list)
             if (!format_values(fs, "{} ", (int)prop->ldata_u8[idx]))
               return write_error();
@@ -600,49 +860,49 @@ bool save_ply(const string& filename, const ply_model* ply, string& error) {
           for (auto i = 0; i < vcount; i++) {
             switch (prop->type) {
               case ply_type::i8:
-                if (!format_values(fs, "{} ", prop->data_i8[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_i8[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::i16:
-                if (!format_values(fs, "{} ", prop->data_i16[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_i16[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::i32:
-                if (!format_values(fs, "{} ", prop->data_i32[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_i32[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::i64:
-                if (!format_values(fs, "{} ", prop->data_i64[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_i64[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::u8:
-                if (!format_values(fs, "{} ", prop->data_u8[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_u8[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::u16:
-                if (!format_values(fs, "{} ", prop->data_u16[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_u16[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::u32:
-                if (!format_values(fs, "{} ", prop->data_u32[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_u32[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::u64:
-                if (!format_values(fs, "{} ", prop->data_u64[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_u64[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::f32:
-                if (!format_values(fs, "{} ", prop->data_f32[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_f32[cur[pidx]++]))
                   return write_error();
                 break;
               case ply_type::f64:
-                if (!format_values(fs, "{} ", prop->data_f64[cur[idx]++]))
+                if (!format_values(fs, "{} ", prop->data_f64[cur[pidx]++]))
                   return write_error();
                 break;
             }
           }
-          if (!format_values(fs, "\n")) return write_error();
         }
+        if (!format_values(fs, "\n")) return write_error();
       }
     }
   } else {
@@ -735,8 +995,37 @@ inline bool convert_property(const vector<T1>& prop, vector<T>& values) {
   for (auto i = (size_t)0; i < prop.size(); i++) values[i] = (T)prop[i];
   return true;
 }
+template <typename T, typename T1>
+inline bool convert_view(const ply_property* prop, vector<T>& values) {
+  auto size = prop->is_list ? (size_t)prop->view_lsize : (size_t)1;
+  values    = vector<T>(prop->view_count * size);
+  for (auto i = (size_t)0; i < prop->view_count; i++) {
+    auto data = prop->view_data + i * prop->view_stride;
+    for (auto c = (size_t)0; c < size; c++) {
+      auto value = T1{};
+      memcpy(&value, data + c * sizeof(T1), sizeof(T1));
+      if (prop->view_swap) value = swap_endian(value);
+      values[i * size + c] = (T)value;
+    }
+  }
+  return true;
+}
 template <typename T>
 inline bool convert_property(ply_property* prop, vector<T>& values) {
+  if (prop->view_data != nullptr) {
+    switch (prop->type) {
+      case ply_type::i8: return convert_view<T, int8_t>(prop, values);
+      case ply_type::i16: return convert_view<T, int16_t>(prop, values);
+      case ply_type::i32: return convert_view<T, int32_t>(prop, values);
+      case ply_type::i64: return convert_view<T, int64_t>(prop, values);
+      case ply_type::u8: return convert_view<T, uint8_t>(prop, values);
+      case ply_type::u16: return convert_view<T, uint16_t>(prop, values);
+      case ply_type::u32: return convert_view<T, uint32_t>(prop, values);
+      case ply_type::u64: return convert_view<T, uint64_t>(prop, values);
+      case ply_type::f32: return convert_view<T, float>(prop, values);
+      case ply_type::f64: return convert_view<T, double>(prop, values);
+    }
+  }
   switch (prop->type) {
     case ply_type::i8: return convert_property(prop->data_i8, values);
     case ply_type::i16: return convert_property(prop->data_i16, values);
@@ -816,8 +1105,9 @@ bool get_lists(ply_model* ply, const string& element, const string& property,
   if (!has_property(ply, element, property)) return false;
   auto prop = get_property(ply, element, property);
   if (!prop->is_list) return false;
-  auto& sizes  = prop->ldata_u8;
+  auto  sizes  = vector<byte>{};
   auto  values = vector<int>{};
+  if (!get_list_sizes(ply, element, property, sizes)) return false;
   if (!convert_property(prop, values)) return false;
   lists    = vector<vector<int>>(sizes.size());
   auto cur = (size_t)0;
@@ -834,7 +1124,11 @@ bool get_list_sizes(ply_model* ply, const string& element,
   if (!has_property(ply, element, property)) return {};
   auto prop = get_property(ply, element, property);
   if (!prop->is_list) return {};
-  sizes = prop->ldata_u8;
+  if (prop->view_data != nullptr) {
+    sizes.assign(prop->view_count, prop->view_lsize);
+  } else {
+    sizes = prop->ldata_u8;
+  }
   return true;
 }
 bool get_list_values(ply_model* ply, const string& element,
@@ -952,6 +1246,10 @@ bool get_points(ply_model* ply, vector<int>& values) {
   return get_list_values(ply, "point", "vertex_indices", values);
 }
 bool has_quads(ply_model* ply) {
+  if (has_property(ply, "face", "vertex_indices")) {
+    auto prop = get_property(ply, "face", "vertex_indices");
+    if (prop->view_data != nullptr) return prop->view_lsize == 4;
+  }
   auto sizes = vector<uint8_t>{};
   if (!get_list_sizes(ply, "face", "vertex_indices", sizes)) return false;
   for (auto size : sizes)
@@ -976,7 +1274,9 @@ inline ply_property* add_property(ply_model* ply, const string& element_name,
   for (auto elem : ply->elements) {
     if (elem->name != element_name) continue;
     for (auto prop : elem->properties) {
-      if (prop->name == property_name) return prop;
+      if (prop->name != property_name) continue;
+      prop->view_data = nullptr;
+      return prop;
     }
     auto prop     = elem->properties.emplace_back(new ply_property{});
     prop->name    = property_name;
@@ -1746,7 +2046,8 @@ bool load_obj(const string& filename, obj_scene* obj, string& error,
       if (!parse_value(str, mtllib)) return parse_error();
       if (std::find(mtllibs.begin(), mtllibs.end(), mtllib) == mtllibs.end()) {
         mtllibs.push_back(mtllib);
-        if (!load_mtl(path_join(path_dirname(filename), mtllib), obj, error))
+        obj->includes.push_back(path_join(path_dirname(filename), mtllib));
+        if (!load_mtl(obj->includes.back(), obj, error))
           return dependent_error();
         for (auto material : obj->materials)
           material_map[material->name] = material;
@@ -1796,6 +2097,7 @@ bool load_obj(const string& filename, obj_scene* obj, string& error,
   // load extensions
   auto extfilename = replace_extension(filename, ".objx");
   if (path_exists(extfilename)) {
+    obj->includes.push_back(extfilename);
     if (!load_objx(extfilename, obj, error)) return dependent_error();
   }
 
@@ -4694,9 +4996,10 @@ inline bool load_pbrt(const string& filename, pbrt_scene* pbrt, string& error,
     } else if (cmd == "Include") {
       auto includename = ""s;
       if (!parse_param(str, includename)) return parse_error();
-      if (!load_pbrt(path_join(path_dirname(filename), includename), pbrt,
-              error, ctx, material_map, named_materials, named_textures,
-              named_mediums, ply_dirname))
+      auto includepath = path_join(path_dirname(filename), includename);
+      pbrt->includes.push_back(includepath);
+      if (!load_pbrt(includepath, pbrt, error, ctx, material_map,
+              named_materials, named_textures, named_mediums, ply_dirname))
         return dependent_error();
     } else {
       return command_error(cmd);
@@ -86,6 +86,15 @@ struct ply_property {
 
   // list length
   vector<uint8_t> ldata_u8 = {};
+
+  // [experimental] strided view into a memory-mapped binary file, used in
+  // place of the data above when loading with `mapped`. Values are converted
+  // only when requested. Lists in views have all the same length.
+  const byte* view_data   = nullptr;
+  size_t      view_count  = 0;
+  size_t      view_stride = 0;
+  uint8_t     view_lsize  = 0;
+  bool        view_swap   = false;
 };
 
 // Ply elements
@@ -102,6 +111,9 @@ struct ply_element {
 // Ply format
 enum struct ply_format { ascii, binary_little_endian, binary_big_endian };
 
+// Memory mapping used by ply views
+struct mapped_file;
+
 // Ply model
 struct ply_model {
   // ply content
@@ -109,12 +121,18 @@ struct ply_model {
   vector<string>       comments = {};
   vector<ply_element*> elements = {};
 
+  // [experimental] memory mapping referenced by property views
+  mapped_file* mapping = nullptr;
+
   // cleanup
   ~ply_model();
 };
 
-// Load and save ply
-bool load_ply(const string& filename, ply_model* ply, string& error);
+// Load and save ply. If `mapped` is set, binary files are memory-mapped and
+// properties are exposed as views into the mapping instead of being copied.
+// ASCII files are parsed in parallel chunks.
+bool load_ply(const string& filename, ply_model* ply, string& error,
+    bool mapped = false);
 bool save_ply(const string& filename, const ply_model* ply, string& error);
 
 // Get ply properties
@@ -346,6 +364,7 @@ struct obj_scene {
   vector<obj_material*>    materials    = {};
   vector<obj_camera*>      cameras      = {};
   vector<obj_environment*> environments = {};
+  vector<string>           includes     = {};  // loaded mtl and objx files
   ~obj_scene();
 };
 
@@ -568,6 +587,7 @@ struct pbrt_scene {
   vector<pbrt_environment*> environments = {};
   vector<pbrt_light*>       lights       = {};
   vector<pbrt_material*>    materials    = {};
+  vector<string>            includes     = {};  // loaded include files
 
   // cleanup
   ~pbrt_scene();
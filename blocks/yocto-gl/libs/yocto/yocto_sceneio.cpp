@@ -34,9 +34,11 @@
 #include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <memory>
 #include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "ext/cgltf.h"
 #include "yocto_color.h"
@@ -56,6 +58,7 @@ namespace yocto {
 // using directives
 using std::deque;
 using std::unique_ptr;
+using std::unordered_set;
 using namespace std::string_literals;
 
 }  // namespace yocto
@@ -536,17 +539,31 @@ void tesselate_shape(sceneio_shape* shape) {
   }
 }  // namespace yocto
 
-void tesselate_shapes(
-    sceneio_scene* scene, const progress_callback& progress_cb) {
+void tesselate_shapes(sceneio_scene* scene,
+    const progress_callback& progress_cb, bool noparallel) {
   // handle progress
   auto progress = vec2i{0, (int)scene->shapes.size()};
 
-  // tesselate shapes
-  for (auto shape : scene->shapes) {
+  // tesselate shapes in order
+  if (noparallel) {
+    for (auto shape : scene->shapes) {
+      if (progress_cb) progress_cb("tesselate shape", progress.x++, progress.y);
+      tesselate_shape(shape);
+    }
     if (progress_cb) progress_cb("tesselate shape", progress.x++, progress.y);
-    tesselate_shape(shape);
+    return;
   }
 
+  // tesselate shapes concurrently since they are independent
+  auto progress_mutex = std::mutex{};
+  parallel_for((int)scene->shapes.size(), [&](int idx) {
+    if (progress_cb) {
+      auto lock = std::lock_guard<std::mutex>{progress_mutex};
+      progress_cb("tesselate shape", progress.x++, progress.y);
+    }
+    tesselate_shape(scene->shapes[idx]);
+  });
+
   // done
   if (progress_cb) progress_cb("tesselate shape", progress.x++, progress.y);
 }
@@ -1013,15 +1030,27 @@ void make_cornellbox(sceneio_scene* scene) {
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Run independent asset loads in parallel, or in order if `noparallel` is set.
+// Loads report errors in their own slots and serialize progress callbacks.
+static void run_loads(const vector<function<void()>>& loads, bool noparallel) {
+  if (noparallel) {
+    for (auto& load : loads) load();
+  } else {
+    parallel_for((int)loads.size(), [&loads](int idx) { loads[idx](); });
+  }
+}
+
 // Load/save a scene in the builtin JSON format.
 static bool load_json_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel);
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel);
 static bool save_json_scene(const string& filename, const sceneio_scene* scene,
     string& error, const progress_callback& progress_cb, bool noparallel);
 
 // Load/save a scene from/to OBJ.
 static bool load_obj_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel);
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel);
 static bool save_obj_scene(const string& filename, const sceneio_scene* scene,
     string& error, const progress_callback& progress_cb, bool noparallel);
 
@@ -1039,7 +1068,8 @@ static bool save_stl_scene(const string& filename, const sceneio_scene* scene,
 
 // Load/save a scene from/to glTF.
 static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel);
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel);
 static bool save_gltf_scene(const string& filename, const sceneio_scene* scene,
     string& error, const progress_callback& progress_cb, bool noparallel);
 
@@ -1047,36 +1077,60 @@ static bool save_gltf_scene(const string& filename, const sceneio_scene* scene,
 // works on scene that have been previously adapted since the two renderers
 // are too different to match.
 static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel);
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel);
 static bool save_pbrt_scene(const string& filename, const sceneio_scene* scene,
     string& error, const progress_callback& progress_cb, bool noparallel);
 
-// Load a scene
-bool load_scene(const string& filename, sceneio_scene* scene, string& error,
+// Load/save a scene from/to the binary cache format.
+static bool load_binary_scene(const string& filename, sceneio_scene* scene,
+    string& error, const progress_callback& progress_cb, bool noparallel);
+static bool save_binary_scene(const string& filename,
+    const sceneio_scene* scene, string& error,
+    const progress_callback& progress_cb, bool noparallel);
+
+// Load a scene, recording the files it reads in `dependencies`.
+static bool load_scene(const string& filename, sceneio_scene* scene,
+    vector<string>& dependencies, string& error,
     const progress_callback& progress_cb, bool noparallel) {
   auto format_error = [filename, &error]() {
     error = filename + ": unknown format";
     return false;
   };
 
+  dependencies.push_back(filename);
   auto ext = path_extension(filename);
   if (ext == ".json" || ext == ".JSON") {
-    return load_json_scene(filename, scene, error, progress_cb, noparallel);
+    return load_json_scene(
+        filename, scene, dependencies, error, progress_cb, noparallel);
   } else if (ext == ".obj" || ext == ".OBJ") {
-    return load_obj_scene(filename, scene, error, progress_cb, noparallel);
+    return load_obj_scene(
+        filename, scene, dependencies, error, progress_cb, noparallel);
   } else if (ext == ".gltf" || ext == ".GLTF") {
-    return load_gltf_scene(filename, scene, error, progress_cb, noparallel);
+    return load_gltf_scene(
+        filename, scene, dependencies, error, progress_cb, noparallel);
   } else if (ext == ".pbrt" || ext == ".PBRT") {
-    return load_pbrt_scene(filename, scene, error, progress_cb, noparallel);
+    return load_pbrt_scene(
+        filename, scene, dependencies, error, progress_cb, noparallel);
   } else if (ext == ".ply" || ext == ".PLY") {
     return load_ply_scene(filename, scene, error, progress_cb, noparallel);
   } else if (ext == ".stl" || ext == ".STL") {
     return load_stl_scene(filename, scene, error, progress_cb, noparallel);
+  } else if (ext == ".ybin" || ext == ".YBIN") {
+    return load_binary_scene(filename, scene, error, progress_cb, noparallel);
   } else {
     return format_error();
   }
 }
 
+// Load a scene
+bool load_scene(const string& filename, sceneio_scene* scene, string& error,
+    const progress_callback& progress_cb, bool noparallel) {
+  auto dependencies = vector<string>{};
+  return load_scene(
+      filename, scene, dependencies, error, progress_cb, noparallel);
+}
+
 // Save a scene
 bool save_scene(const string& filename, const sceneio_scene* scene,
     string& error, const progress_callback& progress_cb, bool noparallel) {
@@ -1098,6 +1152,8 @@ bool save_scene(const string& filename, const sceneio_scene* scene,
     return save_ply_scene(filename, scene, error, progress_cb, noparallel);
   } else if (ext == ".stl" || ext == ".STL") {
     return save_stl_scene(filename, scene, error, progress_cb, noparallel);
+  } else if (ext == ".ybin" || ext == ".YBIN") {
+    return save_binary_scene(filename, scene, error, progress_cb, noparallel);
   } else {
     return format_error();
   }
@@ -1120,7 +1176,7 @@ static bool load_instance(
   auto ext = path_extension(filename);
   if (ext == ".ply" || ext == ".PLY") {
     auto ply = ply_model{};
-    if (!load_ply(filename, &ply, error)) return false;
+    if (!load_ply(filename, &ply, error, true)) return false;
     get_values(&ply, "instance",
         {"xx", "xy", "xz", "yx", "yy", "yz", "zx", "zy", "zz", "ox", "oy",
             "oz"},
@@ -1221,7 +1277,8 @@ namespace yocto {
 
 // Save a scene in the builtin JSON format.
 static bool load_json_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel) {
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel) {
   auto json_error = [filename]() {
     // error does not need setting
     return false;
@@ -1530,36 +1587,66 @@ static bool load_json_scene(const string& filename, sceneio_scene* scene,
     return path_join(path_dirname(filename), group, name + extensions.front());
   };
 
-  // load shapes
+  // load shapes, textures and instances concurrently
   shape_map.erase("");
+  texture_map.erase("");
+  ply_instance_map.erase("");
+  auto loads  = vector<function<void()>>{};
+  auto errors = vector<string>(
+      shape_map.size() + texture_map.size() + ply_instance_map.size());
+  auto progress_mutex = std::mutex{};
+  auto report_progress = [&progress_mutex, &progress, &progress_cb](
+                             const string& message) {
+    if (!progress_cb) return;
+    auto lock = std::lock_guard<std::mutex>{progress_mutex};
+    progress_cb(message, progress.x++, progress.y);
+  };
+
+  // load shapes
   for (auto [name, value] : shape_map) {
     auto shape = value.first;
-    if (progress_cb) progress_cb("load shape", progress.x++, progress.y);
-    auto path = make_filename(name, "shapes", {".ply", ".obj"});
-    if (!load_shape(path, shape->points, shape->lines, shape->triangles,
-            shape->quads, shape->quadspos, shape->quadsnorm,
-            shape->quadstexcoord, shape->positions, shape->normals,
-            shape->texcoords, shape->colors, shape->radius, error,
-            shape->catmullclark && shape->subdivisions > 0))
-      return dependent_error();
+    auto path  = make_filename(name, "shapes", {".ply", ".obj"});
+    dependencies.push_back(path);
+    auto& shape_error = errors[loads.size()];
+    loads.push_back([shape, path, &shape_error, &report_progress]() {
+      report_progress("load shape");
+      load_shape(path, shape->points, shape->lines, shape->triangles,
+          shape->quads, shape->quadspos, shape->quadsnorm,
+          shape->quadstexcoord, shape->positions, shape->normals,
+          shape->texcoords, shape->colors, shape->radius, shape_error,
+          shape->catmullclark && shape->subdivisions > 0);
+    });
   }
   // load textures
-  texture_map.erase("");
   for (auto [name, value] : texture_map) {
     auto texture = value.first;
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    auto path = make_filename(
+    auto path    = make_filename(
         name, "textures", {".hdr", ".exr", ".png", ".jpg"});
-    if (!load_image(path, texture->hdr, texture->ldr, error))
-      return dependent_error();
+    dependencies.push_back(path);
+    auto& texture_error = errors[loads.size()];
+    loads.push_back([texture, path, &texture_error, &report_progress]() {
+      report_progress("load texture");
+      load_image(path, texture->hdr, texture->ldr, texture_error);
+    });
   }
-
   // load instances
-  ply_instance_map.erase("");
   for (auto [name, instance] : ply_instance_map) {
-    if (progress_cb) progress_cb("load instance", progress.x++, progress.y);
-    auto path = make_filename(name, "instances", {".ply"});
-    if (!load_instance(path, instance->frames, error)) return dependent_error();
+    auto path   = make_filename(name, "instances", {".ply"});
+    dependencies.push_back(path);
+    auto& instance_error = errors[loads.size()];
+    loads.push_back(
+        [instance = instance, path, &instance_error, &report_progress]() {
+          report_progress("load instance");
+          load_instance(path, instance->frames, instance_error);
+        });
+  }
+
+  // run loads and report the first error in loading order
+  run_loads(loads, noparallel);
+  for (auto& task_error : errors) {
+    if (task_error.empty()) continue;
+    error = task_error;
+    return dependent_error();
   }
 
   // apply instances
@@ -1851,9 +1938,41 @@ static bool save_json_scene(const string& filename, const sceneio_scene* scene,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
+// Load textures concurrently. Paths are computed by `make_filename` and
+// recorded in `dependencies`. The first error in loading order is returned.
+static bool load_textures(
+    const vector<pair<string, sceneio_texture*>>& textures,
+    const function<string(const string&)>& make_filename,
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, vec2i& progress, bool noparallel) {
+  auto loads          = vector<function<void()>>{};
+  auto errors         = vector<string>(textures.size());
+  auto progress_mutex = std::mutex{};
+  for (auto idx = 0; idx < (int)textures.size(); idx++) {
+    auto path = make_filename(textures[idx].first);
+    dependencies.push_back(path);
+    loads.push_back([&, idx, path]() {
+      if (progress_cb) {
+        auto lock = std::lock_guard<std::mutex>{progress_mutex};
+        progress_cb("load texture", progress.x++, progress.y);
+      }
+      auto texture = textures[idx].second;
+      load_image(path, texture->hdr, texture->ldr, errors[idx]);
+    });
+  }
+  run_loads(loads, noparallel);
+  for (auto& texture_error : errors) {
+    if (texture_error.empty()) continue;
+    error = texture_error;
+    return false;
+  }
+  return true;
+}
+
 // Loads an OBJ
 static bool load_obj_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel) {
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel) {
   auto shape_error = [filename, &error]() {
     error = filename + ": empty shape";
     return false;
@@ -1875,6 +1994,8 @@ static bool load_obj_scene(const string& filename, sceneio_scene* scene,
   auto obj_guard = std::make_unique<obj_scene>();
   auto obj       = obj_guard.get();
   if (!load_obj(filename, obj, error, false, true, false)) return false;
+  dependencies.insert(
+      dependencies.end(), obj->includes.begin(), obj->includes.end());
 
   // handle progress
   if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
@@ -2011,19 +2132,13 @@ static bool load_obj_scene(const string& filename, sceneio_scene* scene,
 
   // load textures
   ctexture_map.erase("");
-  for (auto [name, texture] : ctexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
-      return dependent_error();
-  }
-
-  // load textures
   stexture_map.erase("");
-  for (auto [name, texture] : stexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
-      return dependent_error();
-  }
+  auto textures = vector<pair<string, sceneio_texture*>>{};
+  textures.insert(textures.end(), ctexture_map.begin(), ctexture_map.end());
+  textures.insert(textures.end(), stexture_map.begin(), stexture_map.end());
+  if (!load_textures(textures, make_filename, dependencies, error,
+          progress_cb, progress, noparallel))
+    return dependent_error();
 
   // fix scene
   if (scene->name.empty()) scene->name = path_basename(filename);
@@ -2307,7 +2422,8 @@ namespace yocto {
 
 // Load a scene
 static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel) {
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel) {
   auto read_error = [filename, &error]() {
     error = filename + ": read error";
     return false;
@@ -2343,6 +2459,11 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
   if (cgltf_load_buffers(&params, data, dirname.c_str()) !=
       cgltf_result_success)
     return read_error();
+  for (auto bid = 0; bid < gltf->buffers_count; bid++) {
+    auto uri = gltf->buffers[bid].uri;
+    if (uri == nullptr || strncmp(uri, "data:", 5) == 0) continue;
+    dependencies.push_back(path_join(path_dirname(filename), uri));
+  }
 
   // handle progress
   if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
@@ -2672,8 +2793,8 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
   ctexture_map.erase("");
   for (auto [tpath, texture] : ctexture_map) {
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    if (!load_image(path_join(path_dirname(filename), tpath), texture->hdr,
-            texture->ldr, error))
+    dependencies.push_back(path_join(path_dirname(filename), tpath));
+    if (!load_image(dependencies.back(), texture->hdr, texture->ldr, error))
       return dependent_error();
   }
 
@@ -2683,8 +2804,9 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto color_opacityf = image<vec4f>{};
     auto color_opacityb = image<vec4b>{};
-    if (!load_image(path_join(path_dirname(filename), tpath), color_opacityf,
-            color_opacityb, error))
+    dependencies.push_back(path_join(path_dirname(filename), tpath));
+    if (!load_image(
+            dependencies.back(), color_opacityf, color_opacityb, error))
       return dependent_error();
     if (!color_opacityf.empty()) {
       auto [ctexture, otexture] = textures;
@@ -2726,8 +2848,9 @@ static bool load_gltf_scene(const string& filename, sceneio_scene* scene,
     if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
     auto metallic_roughnessf = image<vec4f>{};
     auto metallic_roughnessb = image<vec4b>{};
-    if (!load_image(path_join(path_dirname(filename), tpath),
-            metallic_roughnessf, metallic_roughnessb, error))
+    dependencies.push_back(path_join(path_dirname(filename), tpath));
+    if (!load_image(dependencies.back(), metallic_roughnessf,
+            metallic_roughnessb, error))
       return dependent_error();
     if (!metallic_roughnessf.empty()) {
       auto [mtexture, rtexture] = textures;
@@ -3150,7 +3273,8 @@ namespace yocto {
 
 // load pbrt scenes
 static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
-    string& error, const progress_callback& progress_cb, bool noparallel) {
+    vector<string>& dependencies, string& error,
+    const progress_callback& progress_cb, bool noparallel) {
   auto dependent_error = [filename, &error]() {
     error = filename + ": error in " + error;
     return false;
@@ -3164,6 +3288,13 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
   auto pbrt_guard = std::make_unique<pbrt_scene>();
   auto pbrt       = pbrt_guard.get();
   if (!load_pbrt(filename, pbrt, error)) return false;
+  dependencies.insert(
+      dependencies.end(), pbrt->includes.begin(), pbrt->includes.end());
+  for (auto pshape : pbrt->shapes) {
+    if (pshape->filename_.empty()) continue;
+    dependencies.push_back(
+        path_join(path_dirname(filename), pshape->filename_));
+  }
 
   // handle progress
   if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
@@ -3285,28 +3416,20 @@ static bool load_pbrt_scene(const string& filename, sceneio_scene* scene,
     return path_join(path_dirname(filename), name);
   };
 
-  // load texture
+  // load textures
   ctexture_map.erase("");
-  for (auto [name, texture] : ctexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
-      return dependent_error();
-  }
-
-  // load texture
   stexture_map.erase("");
-  for (auto [name, texture] : stexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
-      return dependent_error();
-  }
-
-  // load alpha
   atexture_map.erase("");
+  auto textures = vector<pair<string, sceneio_texture*>>{};
+  textures.insert(textures.end(), ctexture_map.begin(), ctexture_map.end());
+  textures.insert(textures.end(), stexture_map.begin(), stexture_map.end());
+  textures.insert(textures.end(), atexture_map.begin(), atexture_map.end());
+  if (!load_textures(textures, make_filename, dependencies, error,
+          progress_cb, progress, noparallel))
+    return dependent_error();
+
+  // convert alpha
   for (auto [name, texture] : atexture_map) {
-    if (progress_cb) progress_cb("load texture", progress.x++, progress.y);
-    if (!load_image(make_filename(name), texture->hdr, texture->ldr, error))
-      return dependent_error();
     for (auto& c : texture->hdr) {
       c = (max(vec3f{c.x, c.y, c.z}) < 0.01) ? vec4f{0, 0, 0, c.w}
                                              : vec4f{1, 1, 1, c.w};
@@ -3421,3 +3544,619 @@ static bool save_pbrt_scene(const string& filename, const sceneio_scene* scene,
 }
 
 }  // namespace yocto
+
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION OF BINARY SCENE CACHE
+// -----------------------------------------------------------------------------
+namespace yocto {
+
+// Binary scene format. The file starts with a fixed header and the list of
+// source files the scene was loaded from, followed by all scene elements.
+// Arrays are stored as a count followed by raw data aligned to 16 bytes, so
+// that they can be copied straight from a memory mapping without any parsing.
+// Element references are stored as indices.
+struct binary_scene_header {
+  char     magic[8] = {'y', 's', 'c', 'e', 'n', 'e', 'b', 'n'};
+  uint32_t version  = 2;
+  uint32_t endian   = 0x01020304;
+};
+
+// Source file of a cached scene, with the path relative to the directory of
+// the main scene file, which is always the first source.
+struct binary_scene_source {
+  string   filename = "";
+  uint64_t size     = 0;
+  int64_t  mtime    = 0;
+  uint64_t hash     = 0;
+};
+
+// Hash of the source data used to invalidate caches
+static uint64_t hash_binary_scene(const byte* data, size_t size) {
+  // FNV-1a on 64-bit words, with a byte tail
+  auto hash  = (uint64_t)14695981039346656037ull;
+  auto prime = (uint64_t)1099511628211ull;
+  auto words = size / sizeof(uint64_t);
+  for (auto idx = (size_t)0; idx < words; idx++) {
+    auto word = (uint64_t)0;
+    memcpy(&word, data + idx * sizeof(uint64_t), sizeof(word));
+    hash = (hash ^ word) * prime;
+  }
+  for (auto idx = words * sizeof(uint64_t); idx < size; idx++) {
+    hash = (hash ^ data[idx]) * prime;
+  }
+  return hash ^ (uint64_t)size;
+}
+
+// Binary writer that tracks the offset for alignment
+struct binary_scene_writer {
+  file_stream fs     = {};
+  size_t      offset = 0;
+};
+
+static bool write_binary_data(
+    binary_scene_writer& writer, const void* data, size_t size) {
+  if (size == 0) return true;
+  if (!write_data(writer.fs, data, size)) return false;
+  writer.offset += size;
+  return true;
+}
+static bool write_binary_padding(binary_scene_writer& writer) {
+  static const byte padding[16] = {};
+  auto              pad         = (16 - writer.offset % 16) % 16;
+  return write_binary_data(writer, padding, pad);
+}
+template <typename T>
+static bool write_binary_value(binary_scene_writer& writer, const T& value) {
+  return write_binary_data(writer, &value, sizeof(T));
+}
+template <typename T>
+static bool write_binary_array(
+    binary_scene_writer& writer, const T* values, size_t count) {
+  if (!write_binary_value(writer, (uint64_t)count)) return false;
+  if (!write_binary_padding(writer)) return false;
+  return write_binary_data(writer, values, count * sizeof(T));
+}
+template <typename T>
+static bool write_binary_value(
+    binary_scene_writer& writer, const vector<T>& values) {
+  return write_binary_array(writer, values.data(), values.size());
+}
+template <typename T>
+static bool write_binary_value(
+    binary_scene_writer& writer, const image<T>& img) {
+  if (!write_binary_value(writer, img.imsize())) return false;
+  return write_binary_array(writer, img.data(), img.count());
+}
+static bool write_binary_value(
+    binary_scene_writer& writer, const string& value) {
+  return write_binary_array(writer, value.data(), value.size());
+}
+
+// Binary reader over a memory mapping
+struct binary_scene_reader {
+  const byte* data   = nullptr;
+  size_t      size   = 0;
+  size_t      offset = 0;
+};
+
+static const byte* read_binary_data(binary_scene_reader& reader, size_t size) {
+  if (reader.offset + size > reader.size) return nullptr;
+  auto data = reader.data + reader.offset;
+  reader.offset += size;
+  return data;
+}
+static bool read_binary_padding(binary_scene_reader& reader) {
+  auto pad = (16 - reader.offset % 16) % 16;
+  return read_binary_data(reader, pad) != nullptr;
+}
+template <typename T>
+static bool read_binary_value(binary_scene_reader& reader, T& value) {
+  auto data = read_binary_data(reader, sizeof(T));
+  if (!data) return false;
+  memcpy(&value, data, sizeof(T));
+  return true;
+}
+template <typename T>
+static const byte* read_binary_array(
+    binary_scene_reader& reader, size_t& count) {
+  auto count64 = (uint64_t)0;
+  if (!read_binary_value(reader, count64)) return nullptr;
+  if (!read_binary_padding(reader)) return nullptr;
+  if (count64 > (reader.size - reader.offset) / sizeof(T)) return nullptr;
+  count = (size_t)count64;
+  return read_binary_data(reader, count * sizeof(T));
+}
+template <typename T>
+static bool read_binary_value(binary_scene_reader& reader, vector<T>& values) {
+  auto count = (size_t)0;
+  auto data  = read_binary_array<T>(reader, count);
+  if (!data) return false;
+  values.assign((const T*)data, (const T*)data + count);
+  return true;
+}
+template <typename T>
+static bool read_binary_value(binary_scene_reader& reader, image<T>& img) {
+  auto size = zero2i;
+  if (!read_binary_value(reader, size)) return false;
+  auto count = (size_t)0;
+  auto data  = read_binary_array<T>(reader, count);
+  if (!data || count != (size_t)size.x * (size_t)size.y) return false;
+  img = count ? image<T>{size, (const T*)data} : image<T>{};
+  return true;
+}
+static bool read_binary_value(binary_scene_reader& reader, string& value) {
+  auto count = (size_t)0;
+  auto data  = read_binary_array<char>(reader, count);
+  if (!data) return false;
+  value.assign((const char*)data, count);
+  return true;
+}
+
+// Write a binary scene, storing the given source hash in the header.
+static bool write_binary_scene(binary_scene_writer& writer,
+    const sceneio_scene* scene, const vector<binary_scene_source>& sources) {
+  // element indices
+  auto texture_map = unordered_map<const sceneio_texture*, int>{{nullptr, -1}};
+  for (auto idx = 0; idx < (int)scene->textures.size(); idx++)
+    texture_map[scene->textures[idx]] = idx;
+  auto material_map =
+      unordered_map<const sceneio_material*, int>{{nullptr, -1}};
+  for (auto idx = 0; idx < (int)scene->materials.size(); idx++)
+    material_map[scene->materials[idx]] = idx;
+  auto shape_map = unordered_map<const sceneio_shape*, int>{{nullptr, -1}};
+  for (auto idx = 0; idx < (int)scene->shapes.size(); idx++)
+    shape_map[scene->shapes[idx]] = idx;
+
+  // header
+  auto header = binary_scene_header{};
+  if (!write_binary_value(writer, header)) return false;
+  if (!write_binary_value(writer, (uint64_t)sources.size())) return false;
+  for (auto& source : sources) {
+    if (!write_binary_value(writer, source.filename)) return false;
+    if (!write_binary_value(writer, source.size)) return false;
+    if (!write_binary_value(writer, source.mtime)) return false;
+    if (!write_binary_value(writer, source.hash)) return false;
+  }
+  if (!write_binary_value(writer, scene->name)) return false;
+  if (!write_binary_value(writer, scene->copyright)) return false;
+
+  // element counts
+  auto counts = array<uint64_t, 6>{scene->cameras.size(),
+      scene->textures.size(), scene->materials.size(), scene->shapes.size(),
+      scene->instances.size(), scene->environments.size()};
+  if (!write_binary_value(writer, counts)) return false;
+
+  // cameras
+  for (auto camera : scene->cameras) {
+    if (!write_binary_value(writer, camera->name)) return false;
+    if (!write_binary_value(writer, camera->frame)) return false;
+    if (!write_binary_value(writer, camera->orthographic)) return false;
+    if (!write_binary_value(writer, camera->lens)) return false;
+    if (!write_binary_value(writer, camera->film)) return false;
+    if (!write_binary_value(writer, camera->aspect)) return false;
+    if (!write_binary_value(writer, camera->focus)) return false;
+    if (!write_binary_value(writer, camera->aperture)) return false;
+  }
+
+  // textures
+  for (auto texture : scene->textures) {
+    if (!write_binary_value(writer, texture->name)) return false;
+    if (!write_binary_value(writer, texture->hdr)) return false;
+    if (!write_binary_value(writer, texture->ldr)) return false;
+  }
+
+  // materials
+  for (auto material : scene->materials) {
+    if (!write_binary_value(writer, material->name)) return false;
+    auto values = array<float, 23>{material->emission.x, material->emission.y,
+        material->emission.z, material->color.x, material->color.y,
+        material->color.z, material->specular, material->roughness,
+        material->metallic, material->ior, material->spectint.x,
+        material->spectint.y, material->spectint.z, material->coat,
+        material->transmission, material->translucency,
+        material->scattering.x, material->scattering.y,
+        material->scattering.z, material->scanisotropy, material->trdepth,
+        material->opacity, material->thin ? 1.0f : 0.0f};
+    if (!write_binary_value(writer, values)) return false;
+    auto textures = array<int, 12>{texture_map.at(material->emission_tex),
+        texture_map.at(material->color_tex),
+        texture_map.at(material->specular_tex),
+        texture_map.at(material->metallic_tex),
+        texture_map.at(material->roughness_tex),
+        texture_map.at(material->transmission_tex),
+        texture_map.at(material->translucency_tex),
+        texture_map.at(material->spectint_tex),
+        texture_map.at(material->scattering_tex),
+        texture_map.at(material->coat_tex),
+        texture_map.at(material->opacity_tex),
+        texture_map.at(material->normal_tex)};
+    if (!write_binary_value(writer, textures)) return false;
+  }
+
+  // shapes
+  for (auto shape : scene->shapes) {
+    if (!write_binary_value(writer, shape->name)) return false;
+    if (!write_binary_value(writer, shape->points)) return false;
+    if (!write_binary_value(writer, shape->lines)) return false;
+    if (!write_binary_value(writer, shape->triangles)) return false;
+    if (!write_binary_value(writer, shape->quads)) return false;
+    if (!write_binary_value(writer, shape->quadspos)) return false;
+    if (!write_binary_value(writer, shape->quadsnorm)) return false;
+    if (!write_binary_value(writer, shape->quadstexcoord)) return false;
+    if (!write_binary_value(writer, shape->positions)) return false;
+    if (!write_binary_value(writer, shape->normals)) return false;
+    if (!write_binary_value(writer, shape->texcoords)) return false;
+    if (!write_binary_value(writer, shape->colors)) return false;
+    if (!write_binary_value(writer, shape->radius)) return false;
+    if (!write_binary_value(writer, shape->tangents)) return false;
+    if (!write_binary_value(writer, shape->subdivisions)) return false;
+    if (!write_binary_value(writer, shape->catmullclark)) return false;
+    if (!write_binary_value(writer, shape->smooth)) return false;
+    if (!write_binary_value(writer, shape->displacement)) return false;
+    if (!write_binary_value(writer, texture_map.at(shape->displacement_tex)))
+      return false;
+  }
+
+  // instances
+  for (auto instance : scene->instances) {
+    if (!write_binary_value(writer, instance->name)) return false;
+    if (!write_binary_value(writer, instance->frame)) return false;
+    if (!write_binary_value(writer, shape_map.at(instance->shape)))
+      return false;
+    if (!write_binary_value(writer, material_map.at(instance->material)))
+      return false;
+  }
+
+  // environments
+  for (auto environment : scene->environments) {
+    if (!write_binary_value(writer, environment->name)) return false;
+    if (!write_binary_value(writer, environment->frame)) return false;
+    if (!write_binary_value(writer, environment->emission)) return false;
+    if (!write_binary_value(writer, texture_map.at(environment->emission_tex)))
+      return false;
+  }
+
+  return true;
+}
+
+// Save a binary scene, storing the given source files in the header. The
+// scene is written to a temporary file that is renamed into place once
+// complete, so that an interrupted save never leaves a truncated scene behind.
+static bool save_binary_scene(const string& filename,
+    const sceneio_scene* scene, const vector<binary_scene_source>& sources,
+    string& error, const progress_callback& progress_cb) {
+  auto tempname    = filename + ".tmp";
+  auto write_error = [filename, tempname, &error]() {
+    auto ec = std::error_code{};
+    std::filesystem::remove(std::filesystem::u8path(tempname), ec);
+    error = filename + ": write error";
+    return false;
+  };
+
+  // handle progress
+  auto progress = vec2i{0, 1};
+  if (progress_cb) progress_cb("save scene", progress.x++, progress.y);
+
+  // write temporary file
+  {
+    auto writer = binary_scene_writer{open_file(tempname, "wb")};
+    if (!writer.fs) {
+      error = filename + ": file not found";
+      return false;
+    }
+    auto ok = write_binary_scene(writer, scene, sources) &&
+              fflush(writer.fs.fs) == 0;
+    close_file(writer.fs);
+    if (!ok) return write_error();
+  }
+
+  // replace file
+  auto ec = std::error_code{};
+  std::filesystem::rename(std::filesystem::u8path(tempname),
+      std::filesystem::u8path(filename), ec);
+  if (ec) return write_error();
+
+  // done
+  if (progress_cb) progress_cb("save scene", progress.x++, progress.y);
+  return true;
+}
+
+// Check whether a source file of a cached scene is unchanged
+static bool check_scene_source(
+    const string& dirname, const binary_scene_source& source);
+
+// Load a binary scene. If `sourcename` is not empty, the load fails before
+// any element is created if the scene was not cached from `sourcename` or
+// any of its source files changed.
+static bool load_binary_scene(const string& filename, sceneio_scene* scene,
+    const string& sourcename, string& error,
+    const progress_callback& progress_cb) {
+  auto read_error = [filename, &error]() {
+    error = filename + ": read error";
+    return false;
+  };
+  auto parse_error = [filename, &error]() {
+    error = filename + ": parse error";
+    return false;
+  };
+
+  // handle progress
+  auto progress = vec2i{0, 1};
+  if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
+
+  // map file
+  auto mapped = mapped_file{};
+  if (!map_file(filename, mapped, error)) return false;
+  auto reader = binary_scene_reader{mapped.data, mapped.size};
+
+  // header
+  auto header   = binary_scene_header{};
+  auto expected = binary_scene_header{};
+  if (!read_binary_value(reader, header)) return read_error();
+  if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+      header.endian != expected.endian)
+    return parse_error();
+  if (header.version != expected.version) {
+    error = filename + ": unsupported version";
+    return false;
+  }
+
+  // sources
+  auto sources = vector<binary_scene_source>{};
+  auto count   = (uint64_t)0;
+  if (!read_binary_value(reader, count)) return read_error();
+  if (count > reader.size) return parse_error();
+  for (auto idx = (uint64_t)0; idx < count; idx++) {
+    auto& source = sources.emplace_back();
+    if (!read_binary_value(reader, source.filename)) return read_error();
+    if (!read_binary_value(reader, source.size)) return read_error();
+    if (!read_binary_value(reader, source.mtime)) return read_error();
+    if (!read_binary_value(reader, source.hash)) return read_error();
+  }
+  if (!sourcename.empty()) {
+    auto outdated = sources.empty() ||
+                    sources.front().filename != path_filename(sourcename);
+    for (auto& source : sources) {
+      if (outdated) break;
+      outdated = !check_scene_source(path_dirname(sourcename), source);
+    }
+    if (outdated) {
+      error = filename + ": outdated cache";
+      return false;
+    }
+  }
+
+  // scene
+  if (!read_binary_value(reader, scene->name)) return read_error();
+  if (!read_binary_value(reader, scene->copyright)) return read_error();
+
+  // element counts
+  auto counts = array<uint64_t, 6>{};
+  if (!read_binary_value(reader, counts)) return read_error();
+  for (auto count : counts) {
+    if (count > reader.size) return parse_error();
+  }
+
+  // element references
+  auto get_texture = [scene](int idx, sceneio_texture*& texture) {
+    if (idx < -1 || idx >= (int)scene->textures.size()) return false;
+    texture = idx >= 0 ? scene->textures[idx] : nullptr;
+    return true;
+  };
+
+  // cameras
+  for (auto idx = (uint64_t)0; idx < counts[0]; idx++) {
+    auto camera = scene->cameras.emplace_back(new sceneio_camera{});
+    if (!read_binary_value(reader, camera->name)) return read_error();
+    if (!read_binary_value(reader, camera->frame)) return read_error();
+    if (!read_binary_value(reader, camera->orthographic)) return read_error();
+    if (!read_binary_value(reader, camera->lens)) return read_error();
+    if (!read_binary_value(reader, camera->film)) return read_error();
+    if (!read_binary_value(reader, camera->aspect)) return read_error();
+    if (!read_binary_value(reader, camera->focus)) return read_error();
+    if (!read_binary_value(reader, camera->aperture)) return read_error();
+  }
+
+  // textures
+  for (auto idx = (uint64_t)0; idx < counts[1]; idx++) {
+    auto texture = scene->textures.emplace_back(new sceneio_texture{});
+    if (!read_binary_value(reader, texture->name)) return read_error();
+    if (!read_binary_value(reader, texture->hdr)) return read_error();
+    if (!read_binary_value(reader, texture->ldr)) return read_error();
+  }
+
+  // materials
+  for (auto idx = (uint64_t)0; idx < counts[2]; idx++) {
+    auto material = scene->materials.emplace_back(new sceneio_material{});
+    if (!read_binary_value(reader, material->name)) return read_error();
+    auto values = array<float, 23>{};
+    if (!read_binary_value(reader, values)) return read_error();
+    material->emission     = {values[0], values[1], values[2]};
+    material->color        = {values[3], values[4], values[5]};
+    material->specular     = values[6];
+    material->roughness    = values[7];
+    material->metallic     = values[8];
+    material->ior          = values[9];
+    material->spectint     = {values[10], values[11], values[12]};
+    material->coat         = values[13];
+    material->transmission = values[14];
+    material->translucency = values[15];
+    material->scattering   = {values[16], values[17], values[18]};
+    material->scanisotropy = values[19];
+    material->trdepth      = values[20];
+    material->opacity      = values[21];
+    material->thin         = values[22] != 0;
+    auto textures          = array<int, 12>{};
+    if (!read_binary_value(reader, textures)) return read_error();
+    if (!get_texture(textures[0], material->emission_tex) ||
+        !get_texture(textures[1], material->color_tex) ||
+        !get_texture(textures[2], material->specular_tex) ||
+        !get_texture(textures[3], material->metallic_tex) ||
+        !get_texture(textures[4], material->roughness_tex) ||
+        !get_texture(textures[5], material->transmission_tex) ||
+        !get_texture(textures[6], material->translucency_tex) ||
+        !get_texture(textures[7], material->spectint_tex) ||
+        !get_texture(textures[8], material->scattering_tex) ||
+        !get_texture(textures[9], material->coat_tex) ||
+        !get_texture(textures[10], material->opacity_tex) ||
+        !get_texture(textures[11], material->normal_tex))
+      return parse_error();
+  }
+
+  // shapes
+  for (auto idx = (uint64_t)0; idx < counts[3]; idx++) {
+    auto shape = scene->shapes.emplace_back(new sceneio_shape{});
+    if (!read_binary_value(reader, shape->name)) return read_error();
+    if (!read_binary_value(reader, shape->points)) return read_error();
+    if (!read_binary_value(reader, shape->lines)) return read_error();
+    if (!read_binary_value(reader, shape->triangles)) return read_error();
+    if (!read_binary_value(reader, shape->quads)) return read_error();
+    if (!read_binary_value(reader, shape->quadspos)) return read_error();
+    if (!read_binary_value(reader, shape->quadsnorm)) return read_error();
+    if (!read_binary_value(reader, shape->quadstexcoord)) return read_error();
+    if (!read_binary_value(reader, shape->positions)) return read_error();
+    if (!read_binary_value(reader, shape->normals)) return read_error();
+    if (!read_binary_value(reader, shape->texcoords)) return read_error();
+    if (!read_binary_value(reader, shape->colors)) return read_error();
+    if (!read_binary_value(reader, shape->radius)) return read_error();
+    if (!read_binary_value(reader, shape->tangents)) return read_error();
+    if (!read_binary_value(reader, shape->subdivisions)) return read_error();
+    if (!read_binary_value(reader, shape->catmullclark)) return read_error();
+    if (!read_binary_value(reader, shape->smooth)) return read_error();
+    if (!read_binary_value(reader, shape->displacement)) return read_error();
+    auto displacement_tex = -1;
+    if (!read_binary_value(reader, displacement_tex)) return read_error();
+    if (!get_texture(displacement_tex, shape->displacement_tex))
+      return parse_error();
+  }
+
+  // instances
+  for (auto idx = (uint64_t)0; idx < counts[4]; idx++) {
+    auto instance = scene->instances.emplace_back(new sceneio_instance{});
+    if (!read_binary_value(reader, instance->name)) return read_error();
+    if (!read_binary_value(reader, instance->frame)) return read_error();
+    auto shape = -1, material = -1;
+    if (!read_binary_value(reader, shape)) return read_error();
+    if (!read_binary_value(reader, material)) return read_error();
+    if (shape < -1 || shape >= (int)scene->shapes.size()) return parse_error();
+    if (material < -1 || material >= (int)scene->materials.size())
+      return parse_error();
+    instance->shape    = shape >= 0 ? scene->shapes[shape] : nullptr;
+    instance->material = material >= 0 ? scene->materials[material] : nullptr;
+  }
+
+  // environments
+  for (auto idx = (uint64_t)0; idx < counts[5]; idx++) {
+    auto environment = scene->environments.emplace_back(
+        new sceneio_environment{});
+    if (!read_binary_value(reader, environment->name)) return read_error();
+    if (!read_binary_value(reader, environment->frame)) return read_error();
+    if (!read_binary_value(reader, environment->emission)) return read_error();
+    auto emission_tex = -1;
+    if (!read_binary_value(reader, emission_tex)) return read_error();
+    if (!get_texture(emission_tex, environment->emission_tex))
+      return parse_error();
+  }
+
+  // done
+  if (progress_cb) progress_cb("load scene", progress.x++, progress.y);
+  return true;
+}
+
+// Load/save a scene in the binary format.
+static bool load_binary_scene(const string& filename, sceneio_scene* scene,
+    string& error, const progress_callback& progress_cb, bool noparallel) {
+  return load_binary_scene(filename, scene, "", error, progress_cb);
+}
+static bool save_binary_scene(const string& filename,
+    const sceneio_scene* scene, string& error,
+    const progress_callback& progress_cb, bool noparallel) {
+  return save_binary_scene(filename, scene, {}, error, progress_cb);
+}
+
+// Stamp a source file of a cached scene with its size and modification time,
+// and, if `content` is set, with the hash of its content.
+static bool stamp_scene_source(
+    const string& filename, binary_scene_source& source, bool content) {
+  auto ec    = std::error_code{};
+  auto path  = std::filesystem::u8path(filename);
+  auto size  = std::filesystem::file_size(path, ec);
+  if (ec) return false;
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) return false;
+  source.size  = (uint64_t)size;
+  source.mtime = (int64_t)mtime.time_since_epoch().count();
+  if (!content) return true;
+  auto mapped = mapped_file{};
+  auto error  = string{};
+  if (!map_file(filename, mapped, error)) return false;
+  source.hash = hash_binary_scene(mapped.data, mapped.size);
+  return true;
+}
+
+// Check whether a source file of a cached scene is unchanged. Files with the
+// recorded size and modification time are not read. Files that were touched
+// but kept their size are accepted if their content hash did not change.
+static bool check_scene_source(
+    const string& dirname, const binary_scene_source& source) {
+  auto filename = path_join(dirname, source.filename);
+  auto current  = binary_scene_source{};
+  if (!stamp_scene_source(filename, current, false)) return false;
+  if (current.size != source.size) return false;
+  if (current.mtime == source.mtime) return true;
+  if (!stamp_scene_source(filename, current, true)) return false;
+  return current.hash == source.hash;
+}
+
+// Load a scene through a binary cache.
+bool load_scene_cached(const string& filename, const string& cachename,
+    sceneio_scene* scene, string& error, const progress_callback& progress_cb,
+    bool noparallel) {
+  // load from cache if up to date
+  auto sizes = array<size_t, 6>{scene->cameras.size(), scene->textures.size(),
+      scene->materials.size(), scene->shapes.size(), scene->instances.size(),
+      scene->environments.size()};
+  auto cache_error = string{};
+  if (path_exists(cachename) &&
+      load_binary_scene(cachename, scene, filename, cache_error, progress_cb))
+    return true;
+
+  // remove elements of a partially loaded cache
+  auto truncate = [](auto& elements, size_t size) {
+    for (auto idx = size; idx < elements.size(); idx++) delete elements[idx];
+    elements.resize(size);
+  };
+  truncate(scene->cameras, sizes[0]);
+  truncate(scene->textures, sizes[1]);
+  truncate(scene->materials, sizes[2]);
+  truncate(scene->shapes, sizes[3]);
+  truncate(scene->instances, sizes[4]);
+  truncate(scene->environments, sizes[5]);
+
+  // load source
+  auto dependencies = vector<string>{};
+  if (!load_scene(
+          filename, scene, dependencies, error, progress_cb, noparallel))
+    return false;
+
+  // stamp the files read, relative to the scene directory, and rebuild the
+  // cache, ignoring cache write errors
+  auto dirname = std::filesystem::u8path(path_dirname(filename));
+  auto sources = vector<binary_scene_source>{};
+  auto visited = unordered_set<string>{};
+  for (auto& dependency : dependencies) {
+    auto& source    = sources.emplace_back();
+    source.filename = std::filesystem::u8path(dependency)
+                          .lexically_relative(dirname)
+                          .generic_u8string();
+    if (dirname.empty()) source.filename = dependency;
+    if (!visited.insert(source.filename).second ||
+        !stamp_scene_source(dependency, source, true))
+      sources.pop_back();
+  }
+  if (!sources.empty() && sources.front().filename == path_filename(filename))
+    save_binary_scene(cachename, scene, sources, cache_error, {});
+  return true;
+}
+
+}  // namespace yocto
@@ -269,13 +269,28 @@ using progress_callback =
     function<void(const string& message, int current, int total)>;
 
 // Load/save a scene in the supported formats. Throws on error.
-// Calls the progress callback, if defined, as we process more data.
+// Calls the progress callback, if defined, as we process more data. When
+// loading in parallel, the callback may be invoked from worker threads, but
+// never concurrently. Shapes, textures and instances are loaded in parallel
+// since they do not depend on each other. Tesselation and BVH builds are not
+// part of loading and are run by the caller once the scene is loaded.
 bool load_scene(const string& filename, sceneio_scene* scene, string& error,
     const progress_callback& progress_cb = {}, bool noparallel = false);
 bool save_scene(const string& filename, const sceneio_scene* scene,
     string& error, const progress_callback& progress_cb = {},
     bool noparallel = false);
 
+// Load a scene through a binary cache stored in `cachename`. The cache, saved
+// in the `.ybin` format, stores decoded shapes and textures that are copied
+// from a memory mapping without parsing. The cache is rebuilt when missing,
+// unreadable, or out of date. The cache records the files read when loading
+// `filename`, i.e. the scene file, its shapes, textures and includes, and is
+// out of date when any of them changed. Files with the same size and
+// modification time are not read, while touched files are checked by content.
+bool load_scene_cached(const string& filename, const string& cachename,
+    sceneio_scene* scene, string& error,
+    const progress_callback& progress_cb = {}, bool noparallel = false);
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -283,9 +298,10 @@ bool save_scene(const string& filename, const sceneio_scene* scene,
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Apply subdivision and displacement rules.
-void tesselate_shapes(
-    sceneio_scene* scene, const progress_callback& progress_cb = {});
+// Apply subdivision and displacement rules. Shapes are tesselated in
+// parallel, or in order if `noparallel` is set.
+void tesselate_shapes(sceneio_scene* scene,
+    const progress_callback& progress_cb = {}, bool noparallel = false);
 void tesselate_shape(sceneio_shape* shape);
 
 }  // namespace yocto
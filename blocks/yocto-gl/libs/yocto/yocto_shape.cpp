@@ -42,6 +42,7 @@
 #include "yocto_geometry.h"
 #include "yocto_modelio.h"
 #include "yocto_noise.h"
+#include "yocto_parallel.h"
 #include "yocto_sampling.h"
 
 // -----------------------------------------------------------------------------
@@ -345,25 +346,95 @@ vector<vec3f> align_vertices(
 // -----------------------------------------------------------------------------
 namespace yocto {
 
-// Initialize an edge map with elements.
-edge_map make_edge_map(const vector<vec3i>& triangles) {
-  auto emap = edge_map{};
-  for (auto& t : triangles) {
-    insert_edge(emap, {t.x, t.y});
-    insert_edge(emap, {t.y, t.z});
-    insert_edge(emap, {t.z, t.x});
+// Exclusive prefix sum of counts, returning the offsets of each group
+static vector<int> make_offsets(const vector<int>& counts) {
+  auto offsets = vector<int>(counts.size() + 1, 0);
+  for (auto idx = (size_t)0; idx < counts.size(); idx++)
+    offsets[idx + 1] = offsets[idx] + counts[idx];
+  return offsets;
+}
+
+// Initialize an edge map from sorted edges, one per face side. Edges are
+// grouped by first vertex with a counting sort, then each group is sorted and
+// deduplicated in parallel. Edges are numbered by first occurrence, as if
+// inserted one side at a time.
+static edge_map make_edge_map(const vector<vec2i>& sides) {
+  auto emap         = edge_map{};
+  auto num_vertices = 0;
+  for (auto& side : sides) num_vertices = max(num_vertices, side.y + 1);
+  auto counts = vector<int>(num_vertices, 0);
+  for (auto& side : sides) counts[side.x] += 1;
+  auto starts  = make_offsets(counts);
+  auto seconds = vector<vec2i>(sides.size());  // second vertex, side
+  auto cursors = vector<int>(starts.begin(), starts.end() - 1);
+  for (auto idx = 0; idx < (int)sides.size(); idx++)
+    seconds[cursors[sides[idx].x]++] = {sides[idx].y, idx};
+  parallel_for(num_vertices, [&](int vertex) {
+    auto begin = seconds.begin() + starts[vertex];
+    auto end   = seconds.begin() + starts[vertex + 1];
+    // stable, so that the first side of each edge comes first
+    std::stable_sort(begin, end,
+        [](const vec2i& a, const vec2i& b) { return a.x < b.x; });
+    counts[vertex] = 0;
+    for (auto it = begin; it != end; ++it)
+      if (it == begin || it->x != (it - 1)->x) counts[vertex] += 1;
+  });
+  emap.offsets = make_offsets(counts);
+  auto num_edges = emap.offsets.back();
+  auto firsts    = vector<int>(num_edges);
+  auto nfaces    = vector<int>(num_edges);
+  parallel_for(num_vertices, [&](int vertex) {
+    auto edge = emap.offsets[vertex];
+    for (auto idx = starts[vertex]; idx < starts[vertex + 1]; idx++) {
+      if (idx > starts[vertex] && seconds[idx].x == seconds[idx - 1].x) {
+        nfaces[edge - 1] += 1;
+      } else {
+        firsts[edge] = seconds[idx].y;
+        nfaces[edge] = 1;
+        edge++;
+      }
+    }
+  });
+  // number edges by their first side
+  auto side_edges = vector<int>(sides.size(), -1);
+  for (auto sorted = 0; sorted < num_edges; sorted++)
+    side_edges[firsts[sorted]] = sorted;
+  emap.sorted.resize(num_edges);
+  emap.edges.resize(num_edges);
+  emap.nfaces.resize(num_edges);
+  auto edge = 0;
+  for (auto idx = 0; idx < (int)sides.size(); idx++) {
+    auto sorted = side_edges[idx];
+    if (sorted < 0) continue;
+    emap.sorted[sorted] = edge;
+    emap.edges[edge]    = sides[idx];
+    emap.nfaces[edge]   = nfaces[sorted];
+    edge++;
   }
   return emap;
 }
+
+// Initialize an edge map with elements.
+edge_map make_edge_map(const vector<vec3i>& triangles) {
+  auto sides = vector<vec2i>(triangles.size() * 3);
+  parallel_for((int)triangles.size(), [&](int idx) {
+    auto& t            = triangles[idx];
+    sides[idx * 3 + 0] = {min(t.x, t.y), max(t.x, t.y)};
+    sides[idx * 3 + 1] = {min(t.y, t.z), max(t.y, t.z)};
+    sides[idx * 3 + 2] = {min(t.z, t.x), max(t.z, t.x)};
+  });
+  return make_edge_map(sides);
+}
 edge_map make_edge_map(const vector<vec4i>& quads) {
-  auto emap = edge_map{};
+  auto sides = vector<vec2i>{};
+  sides.reserve(quads.size() * 4);
   for (auto& q : quads) {
-    insert_edge(emap, {q.x, q.y});
-    insert_edge(emap, {q.y, q.z});
-    if (q.z != q.w) insert_edge(emap, {q.z, q.w});
-    insert_edge(emap, {q.w, q.x});
+    sides.push_back({min(q.x, q.y), max(q.x, q.y)});
+    sides.push_back({min(q.y, q.z), max(q.y, q.z)});
+    if (q.z != q.w) sides.push_back({min(q.z, q.w), max(q.z, q.w)});
+    sides.push_back({min(q.w, q.x), max(q.w, q.x)});
   }
-  return emap;
+  return make_edge_map(sides);
 }
 void insert_edges(edge_map& emap, const vector<vec3i>& triangles) {
   for (auto& t : triangles) {
@@ -382,16 +453,15 @@ void insert_edges(edge_map& emap, const vector<vec4i>& quads) {
 }
 // Insert an edge and return its index
 int insert_edge(edge_map& emap, const vec2i& edge) {
-  auto es = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
-  auto it = emap.index.find(es);
-  if (it == emap.index.end()) {
-    auto idx = (int)emap.edges.size();
-    emap.index.insert(it, {es, idx});
+  auto es  = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
+  auto idx = edge_index(emap, es);
+  if (idx < 0) {
+    idx = (int)emap.edges.size();
+    emap.index.insert({es, idx});
     emap.edges.push_back(es);
     emap.nfaces.push_back(1);
     return idx;
   } else {
-    auto idx = it->second;
     emap.nfaces[idx] += 1;
     return idx;
   }
@@ -400,7 +470,15 @@ int insert_edge(edge_map& emap, const vec2i& edge) {
 int num_edges(const edge_map& emap) { return (int)emap.edges.size(); }
 // Get the edge index
 int edge_index(const edge_map& emap, const vec2i& edge) {
-  auto es       = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
+  auto es = edge.x < edge.y ? edge : vec2i{edge.y, edge.x};
+  if (es.x >= 0 && es.x + 1 < (int)emap.offsets.size()) {
+    auto begin = emap.sorted.begin() + emap.offsets[es.x];
+    auto end   = emap.sorted.begin() + emap.offsets[es.x + 1];
+    auto it    = std::lower_bound(begin, end, es.y,
+        [&emap](int edge, int y) { return emap.edges[edge].y < y; });
+    if (it != end && emap.edges[*it].y == es.y) return *it;
+  }
+  if (emap.index.empty()) return -1;
   auto iterator = emap.index.find(es);
   if (iterator == emap.index.end()) return -1;
   return iterator->second;
@@ -428,125 +506,131 @@ vector<vec2i> get_edges(
   return edges;
 }
 
-// Build adjacencies between faces (sorted counter-clockwise)
+// Build adjacencies between faces (sorted counter-clockwise). Face sides are
+// grouped by their smallest vertex with a counting sort, and matched within
+// each group in parallel.
 vector<vec3i> face_adjacencies(const vector<vec3i>& triangles) {
   auto get_edge = [](const vec3i& triangle, int i) -> vec2i {
     auto x = triangle[i], y = triangle[i < 2 ? i + 1 : 0];
     return x < y ? vec2i{x, y} : vec2i{y, x};
   };
-  auto adjacencies = vector<vec3i>{triangles.size(), vec3i{-1, -1, -1}};
-  auto edge_map    = unordered_map<vec2i, int>();
-  edge_map.reserve((size_t)(triangles.size() * 1.5));
-  for (int i = 0; i < triangles.size(); ++i) {
-    for (int k = 0; k < 3; ++k) {
-      auto edge = get_edge(triangles[i], k);
-      auto it   = edge_map.find(edge);
-      if (it == edge_map.end()) {
-        edge_map.insert(it, {edge, i});
-      } else {
-        auto neighbor     = it->second;
-        adjacencies[i][k] = neighbor;
-        for (int kk = 0; kk < 3; ++kk) {
-          auto edge2 = get_edge(triangles[neighbor], kk);
-          if (edge2 == edge) {
-            adjacencies[neighbor][kk] = i;
-            break;
-          }
-        }
+  auto adjacencies  = vector<vec3i>{triangles.size(), vec3i{-1, -1, -1}};
+  auto num_vertices = 0;
+  for (auto& t : triangles) num_vertices = max(num_vertices, max(t) + 1);
+  auto counts = vector<int>(num_vertices, 0);
+  for (auto& t : triangles)
+    for (auto k = 0; k < 3; k++) counts[get_edge(t, k).x] += 1;
+  auto starts  = make_offsets(counts);
+  auto sides   = vector<int>(triangles.size() * 3);
+  auto cursors = vector<int>(starts.begin(), starts.end() - 1);
+  for (auto i = 0; i < (int)triangles.size(); i++)
+    for (auto k = 0; k < 3; k++)
+      sides[cursors[get_edge(triangles[i], k).x]++] = i * 3 + k;
+  parallel_for(num_vertices, [&](int vertex) {
+    for (auto s0 = starts[vertex]; s0 < starts[vertex + 1]; s0++) {
+      auto face0 = sides[s0] / 3, k0 = sides[s0] % 3;
+      auto edge0 = get_edge(triangles[face0], k0);
+      for (auto s1 = s0 + 1; s1 < starts[vertex + 1]; s1++) {
+        auto face1 = sides[s1] / 3, k1 = sides[s1] % 3;
+        if (get_edge(triangles[face1], k1) != edge0) continue;
+        adjacencies[face0][k0] = face1;
+        adjacencies[face1][k1] = face0;
+        break;
       }
     }
-  }
+  });
   return adjacencies;
 }
 
-// Build adjacencies between vertices (sorted counter-clockwise)
-vector<vector<int>> vertex_adjacencies(
-    const vector<vec3i>& triangles, const vector<vec3i>& adjacencies) {
+// Walk around a vertex starting from one of its faces, calling `visit` with
+// the previous vertex of each face or with each next face
+template <typename Visit>
+static void visit_vertex_fan(const vector<vec3i>& triangles,
+    const vector<vec3i>& adjacencies, int vertex, int first_face,
+    bool to_faces, Visit&& visit) {
   auto find_index = [](const vec3i& v, int x) {
     if (v.x == x) return 0;
     if (v.y == x) return 1;
     if (v.z == x) return 2;
     return -1;
   };
-
+  if (first_face == -1) return;
+  auto face = first_face;
+  while (true) {
+    auto k = find_index(triangles[face], vertex);
+    k      = k != 0 ? k - 1 : 2;
+    if (!to_faces) visit(triangles[face][k]);
+    face = adjacencies[face][k];
+    if (to_faces) visit(face);
+    if (face == -1) break;
+    if (face == first_face) break;
+  }
+}
+
+// Build flat adjacencies by walking around each vertex twice, once to count
+// and once to fill the neighbors
+static flat_adjacencies make_fan_adjacencies(const vector<vec3i>& triangles,
+    const vector<vec3i>& adjacencies, bool to_faces) {
   // For each vertex, find any adjacent face.
-  auto num_vertices     = 0;
-  auto face_from_vertex = vector<int>(triangles.size() * 3, -1);
-
+  auto num_vertices = 0;
+  for (auto& t : triangles) num_vertices = max(num_vertices, max(t) + 1);
+  auto face_from_vertex = vector<int>(num_vertices, -1);
   for (int i = 0; i < triangles.size(); ++i) {
-    for (int k = 0; k < 3; k++) {
-      face_from_vertex[triangles[i][k]] = i;
-      num_vertices                      = max(num_vertices, triangles[i][k]);
-    }
-  }
-
-  // Init result.
-  auto result = vector<vector<int>>(num_vertices);
+    for (int k = 0; k < 3; k++) face_from_vertex[triangles[i][k]] = i;
+  }
+
+  // count neighbors, then fill them
+  auto counts = vector<int>(num_vertices, 0);
+  parallel_for(num_vertices, [&](int vertex) {
+    visit_vertex_fan(triangles, adjacencies, vertex, face_from_vertex[vertex],
+        to_faces, [&](int) { counts[vertex] += 1; });
+  });
+  auto result    = flat_adjacencies{};
+  result.offsets = make_offsets(counts);
+  result.indices.resize(result.offsets.back());
+  parallel_for(num_vertices, [&](int vertex) {
+    auto cursor = result.offsets[vertex];
+    visit_vertex_fan(triangles, adjacencies, vertex, face_from_vertex[vertex],
+        to_faces, [&](int neighbor) { result.indices[cursor++] = neighbor; });
+  });
+  return result;
+}
 
-  // For each vertex, loop around it and build its adjacency.
-  for (int i = 0; i < num_vertices; ++i) {
-    result[i].reserve(6);
-    auto first_face = face_from_vertex[i];
-    if (first_face == -1) continue;
+// Build flat adjacencies between vertices and between vertices and faces.
+flat_adjacencies make_vertex_adjacencies(
+    const vector<vec3i>& triangles, const vector<vec3i>& adjacencies) {
+  return make_fan_adjacencies(triangles, adjacencies, false);
+}
+flat_adjacencies make_vertex_to_faces_adjacencies(
+    const vector<vec3i>& triangles, const vector<vec3i>& adjacencies) {
+  return make_fan_adjacencies(triangles, adjacencies, true);
+}
 
-    auto face = first_face;
-    while (true) {
-      auto k = find_index(triangles[face], i);
-      k      = k != 0 ? k - 1 : 2;
-      result[i].push_back(triangles[face][k]);
-      face = adjacencies[face][k];
-      if (face == -1) break;
-      if (face == first_face) break;
-    }
+// Convert flat adjacencies to nested lists
+vector<vector<int>> unflatten_adjacencies(const flat_adjacencies& adjacencies) {
+  auto result = vector<vector<int>>(num_elements(adjacencies));
+  for (auto idx = 0; idx < (int)result.size(); idx++) {
+    auto neighbors = get_neighbors(adjacencies, idx);
+    result[idx].assign(
+        neighbors, neighbors + num_neighbors(adjacencies, idx));
   }
-
   return result;
 }
 
+// Build adjacencies between vertices (sorted counter-clockwise)
+vector<vector<int>> vertex_adjacencies(
+    const vector<vec3i>& triangles, const vector<vec3i>& adjacencies) {
+  return unflatten_adjacencies(
+      make_vertex_adjacencies(triangles, adjacencies));
+}
+
 // Build adjacencies between each vertex and its adjacent faces.
 // Adjacencies are sorted counter-clockwise and have same starting points as
 // vertex_adjacencies()
 vector<vector<int>> vertex_to_faces_adjacencies(
     const vector<vec3i>& triangles, const vector<vec3i>& adjacencies) {
-  auto find_index = [](const vec3i& v, int x) {
-    if (v.x == x) return 0;
-    if (v.y == x) return 1;
-    if (v.z == x) return 2;
-    return -1;
-  };
-
-  // For each vertex, find any adjacent face.
-  auto num_vertices     = 0;
-  auto face_from_vertex = vector<int>(triangles.size() * 3, -1);
-
-  for (int i = 0; i < triangles.size(); ++i) {
-    for (int k = 0; k < 3; k++) {
-      face_from_vertex[triangles[i][k]] = i;
-      num_vertices                      = max(num_vertices, triangles[i][k]);
-    }
-  }
-
-  // Init result.
-  auto result = vector<vector<int>>(num_vertices);
-
-  // For each vertex, loop around it and build its adjacency.
-  for (int i = 0; i < num_vertices; ++i) {
-    result[i].reserve(6);
-    auto first_face = face_from_vertex[i];
-    if (first_face == -1) continue;
-
-    auto face = first_face;
-    while (true) {
-      auto k = find_index(triangles[face], i);
-      k      = k != 0 ? k - 1 : 2;
-      face   = adjacencies[face][k];
-      result[i].push_back(face);
-      if (face == -1) break;
-      if (face == first_face) break;
-    }
-  }
-
-  return result;
+  return unflatten_adjacencies(
+      make_vertex_to_faces_adjacencies(triangles, adjacencies));
 }
 
 // Compute boundaries as a list of loops (sorted counter-clockwise)
@@ -1214,6 +1298,13 @@ vec3i get_cell_index(const hash_grid& grid, const vec3f& position) {
   return vec3i{(int)scaledpos.x, (int)scaledpos.y, (int)scaledpos.z};
 }
 
+// Gets the bucket of a cell in the flat arrays
+static int get_cell_bucket(const hash_grid& grid, const vec3i& cell) {
+  auto hash = (uint32_t)cell.x * 73856093u ^ (uint32_t)cell.y * 19349663u ^
+              (uint32_t)cell.z * 83492791u;
+  return (int)(hash & (uint32_t)(grid.buckets.size() - 2));
+}
+
 // Create a hash_grid
 hash_grid make_hash_grid(float cell_size) {
   auto grid          = hash_grid{};
@@ -1225,7 +1316,25 @@ hash_grid make_hash_grid(const vector<vec3f>& positions, float cell_size) {
   auto grid          = hash_grid{};
   grid.cell_size     = cell_size;
   grid.cell_inv_size = 1 / cell_size;
-  for (auto& position : positions) insert_vertex(grid, position);
+  grid.positions     = positions;
+  if (positions.empty()) return grid;
+
+  // counting sort of points by cell bucket, with a power of two buckets
+  auto num_buckets = 1;
+  while (num_buckets < (int)positions.size()) num_buckets *= 2;
+  grid.buckets.assign(num_buckets + 1, 0);
+  auto point_buckets = vector<int>(positions.size());
+  parallel_for((int)positions.size(), [&](int vertex) {
+    point_buckets[vertex] = get_cell_bucket(
+        grid, get_cell_index(grid, positions[vertex]));
+  });
+  for (auto bucket : point_buckets) grid.buckets[bucket + 1] += 1;
+  for (auto bucket = 0; bucket < num_buckets; bucket++)
+    grid.buckets[bucket + 1] += grid.buckets[bucket];
+  auto cursors = vector<int>(grid.buckets.begin(), grid.buckets.end() - 1);
+  grid.vertices.resize(positions.size());
+  for (auto vertex = 0; vertex < (int)positions.size(); vertex++)
+    grid.vertices[cursors[point_buckets[vertex]]++] = vertex;
   return grid;
 }
 // Inserts a point into the grid
@@ -1236,17 +1345,31 @@ int insert_vertex(hash_grid& grid, const vec3f& position) {
   grid.positions.push_back(position);
   return vertex_id;
 }
-// Finds the nearest neighbors within a given radius
-void find_neighbors(const hash_grid& grid, vector<int>& neighbors,
-    const vec3f& position, float max_radius, int skip_id) {
-  auto cell        = get_cell_index(grid, position);
-  auto cell_radius = (int)(max_radius * grid.cell_inv_size) + 1;
-  neighbors.clear();
+// Visits the points within a given radius, in the flat arrays and in cells
+template <typename Visit>
+static void visit_neighbors(const hash_grid& grid, const vec3f& position,
+    float max_radius, Visit&& visit) {
+  auto cell               = get_cell_index(grid, position);
+  auto cell_radius        = (int)(max_radius * grid.cell_inv_size) + 1;
   auto max_radius_squared = max_radius * max_radius;
   for (auto k = -cell_radius; k <= cell_radius; k++) {
     for (auto j = -cell_radius; j <= cell_radius; j++) {
       for (auto i = -cell_radius; i <= cell_radius; i++) {
-        auto ncell         = cell + vec3i{i, j, k};
+        auto ncell = cell + vec3i{i, j, k};
+        if (!grid.buckets.empty()) {
+          // buckets are shared by cells with the same hash
+          auto bucket = get_cell_bucket(grid, ncell);
+          for (auto idx = grid.buckets[bucket]; idx < grid.buckets[bucket + 1];
+               idx++) {
+            auto  vertex_id = grid.vertices[idx];
+            auto& vertex    = grid.positions[vertex_id];
+            if (distance_squared(vertex, position) > max_radius_squared)
+              continue;
+            if (get_cell_index(grid, vertex) != ncell) continue;
+            visit(vertex_id);
+          }
+        }
+        if (grid.cells.empty()) continue;
         auto cell_iterator = grid.cells.find(ncell);
         if (cell_iterator == grid.cells.end()) continue;
         auto& ncell_vertices = cell_iterator->second;
@@ -1254,13 +1377,20 @@ void find_neighbors(const hash_grid& grid, vector<int>& neighbors,
           if (distance_squared(grid.positions[vertex_id], position) >
               max_radius_squared)
             continue;
-          if (vertex_id == skip_id) continue;
-          neighbors.push_back(vertex_id);
+          visit(vertex_id);
         }
       }
     }
   }
 }
+// Finds the nearest neighbors within a given radius
+void find_neighbors(const hash_grid& grid, vector<int>& neighbors,
+    const vec3f& position, float max_radius, int skip_id) {
+  neighbors.clear();
+  visit_neighbors(grid, position, max_radius, [&](int vertex_id) {
+    if (vertex_id != skip_id) neighbors.push_back(vertex_id);
+  });
+}
 void find_neighbors(const hash_grid& grid, vector<int>& neighbors,
     const vec3f& position, float max_radius) {
   find_neighbors(grid, neighbors, position, max_radius, -1);
@@ -1388,23 +1518,25 @@ vector<vector<vec4i>> ungroup_quads(
   return ungroup_elems_impl(quads, ids);
 }
 
-// Weld vertices within a threshold.
+// Weld vertices within a threshold. Each vertex is merged with the first
+// earlier vertex that was kept and is within the threshold.
 pair<vector<vec3f>, vector<int>> weld_vertices(
     const vector<vec3f>& positions, float threshold) {
-  auto indices   = vector<int>(positions.size());
-  auto welded    = vector<vec3f>{};
-  auto grid      = make_hash_grid(threshold);
-  auto neighbors = vector<int>{};
+  auto indices = vector<int>(positions.size());
+  auto welded  = vector<vec3f>{};
+  auto kept    = vector<int>(positions.size(), -1);
+  auto grid    = make_hash_grid(positions, threshold);
   for (auto vertex = 0; vertex < positions.size(); vertex++) {
     auto& position = positions[vertex];
-    find_neighbors(grid, neighbors, position, threshold);
-    if (neighbors.empty()) {
+    auto  nearest  = vertex;
+    visit_neighbors(grid, position, threshold, [&](int neighbor) {
+      if (neighbor < nearest && kept[neighbor] >= 0) nearest = neighbor;
+    });
+    if (nearest == vertex) {
       welded.push_back(position);
-      indices[vertex] = (int)welded.size() - 1;
-      insert_vertex(grid, position);
-    } else {
-      indices[vertex] = neighbors.front();
+      kept[vertex] = (int)welded.size() - 1;
     }
+    indices[vertex] = kept[nearest];
   }
   return {welded, indices};
 }
@@ -3560,7 +3692,7 @@ bool load_shape(const string& filename, vector<int>& points,
     // open ply
     auto ply_guard = std::make_unique<ply_model>();
     auto ply       = ply_guard.get();
-    if (!load_ply(filename, ply, error)) return false;
+    if (!load_ply(filename, ply, error, true)) return false;
 
     if (!facevarying) {
       // gets vertex
@@ -180,12 +180,17 @@ namespace yocto {
 
 // Dictionary to store edge information. `index` is the index to the edge
 // array, `edges` the array of edges and `nfaces` the number of adjacent faces.
-// We store only bidirectional edges to keep the dictionary small. Use the
-// functions below to access this data.
+// We store only bidirectional edges to keep the dictionary small. Edges are
+// numbered in order of first occurrence. Maps made from elements also keep
+// edge indices sorted by vertices in `sorted`, with `offsets` pointing to the
+// edges starting at each vertex, and use `index` only for edges inserted
+// later. Use the functions below to access this data.
 struct edge_map {
-  unordered_map<vec2i, int> index  = {};
-  vector<vec2i>             edges  = {};
-  vector<int>               nfaces = {};
+  unordered_map<vec2i, int> index   = {};
+  vector<vec2i>             edges   = {};
+  vector<int>               nfaces  = {};
+  vector<int>               sorted  = {};
+  vector<int>               offsets = {};
 };
 
 // Initialize an edge map with elements.
@@ -209,6 +214,36 @@ vector<vec2i> get_edges(
 // Build adjacencies between faces (sorted counter-clockwise)
 vector<vec3i> face_adjacencies(const vector<vec3i>& triangles);
 
+// Adjacencies stored as compressed rows. The neighbors of element `i` are
+// `indices[offsets[i]]` to `indices[offsets[i + 1] - 1]`.
+struct flat_adjacencies {
+  vector<int> offsets = {};
+  vector<int> indices = {};
+};
+
+// Number of elements and neighbors of an element in flat adjacencies
+inline int num_elements(const flat_adjacencies& adjacencies) {
+  return adjacencies.offsets.empty() ? 0 : (int)adjacencies.offsets.size() - 1;
+}
+inline int num_neighbors(const flat_adjacencies& adjacencies, int element) {
+  return adjacencies.offsets[element + 1] - adjacencies.offsets[element];
+}
+inline const int* get_neighbors(
+    const flat_adjacencies& adjacencies, int element) {
+  return adjacencies.indices.data() + adjacencies.offsets[element];
+}
+
+// Build flat adjacencies between vertices and between vertices and faces.
+// Neighbors are ordered as in vertex_adjacencies() and
+// vertex_to_faces_adjacencies().
+flat_adjacencies make_vertex_adjacencies(
+    const vector<vec3i>& triangles, const vector<vec3i>& adjacencies);
+flat_adjacencies make_vertex_to_faces_adjacencies(
+    const vector<vec3i>& triangles, const vector<vec3i>& adjacencies);
+
+// Convert flat adjacencies to nested lists
+vector<vector<int>> unflatten_adjacencies(const flat_adjacencies& adjacencies);
+
 // Build adjacencies between vertices (sorted counter-clockwise)
 vector<vector<int>> vertex_adjacencies(
     const vector<vec3i>& triangles, const vector<vec3i>& adjacencies);
@@ -330,10 +365,15 @@ namespace yocto {
 
 // A sparse grid of cells, containing list of points. Cells are stored in
 // a dictionary to get sparsity. Helpful for nearest neighboor lookups.
+// Grids made from positions store points in flat arrays sorted by cell hash,
+// so that `vertices[buckets[h]]` to `vertices[buckets[h + 1] - 1]` are the
+// points whose cell hashes to `h`. Points inserted later are kept in `cells`.
 struct hash_grid {
   float                             cell_size     = 0;
   float                             cell_inv_size = 0;
   vector<vec3f>                     positions     = {};
+  vector<int>                       buckets       = {};
+  vector<int>                       vertices      = {};
   unordered_map<vec3i, vector<int>> cells         = {};
 };
 
@@ -33,6 +33,7 @@
 #include <deque>
 #include <memory>
 #include <stdexcept>
+#include <type_traits>
 #include <utility>
 
 #include "yocto_color.h"
@@ -264,6 +265,31 @@ void tesselate_shapes(
   if (progress_cb) progress_cb("tesselate shape", progress.x++, progress.y);
 }
 
+void compact_shape(trace_shape* shape) {
+  if (shape->triangles.empty()) return;
+  shape->compact   = make_compact_shape(shape->triangles, shape->positions,
+      shape->normals, shape->texcoords);
+  shape->triangles = {};
+  shape->positions = {};
+  shape->normals   = {};
+  shape->texcoords = {};
+}
+
+void compact_shapes(trace_scene* scene, const progress_callback& progress_cb) {
+  // handle progress
+  auto progress = vec2i{0, (int)scene->shapes.size() + 1};
+  if (progress_cb) progress_cb("compact shape", progress.x++, progress.y);
+
+  // compact shapes
+  for (auto shape : scene->shapes) {
+    if (progress_cb) progress_cb("compact shape", progress.x++, progress.y);
+    compact_shape(shape);
+  }
+
+  // done
+  if (progress_cb) progress_cb("compact shape", progress.x++, progress.y);
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -330,6 +356,81 @@ vec4f eval_texture(const trace_texture* texture, const vec2f& uv,
          lookup_texture(texture, {ii, jj}, ldr_as_linear) * u * v;
 }
 
+// Spread the bits of a tile coordinate to interleave them
+static int spread_tile_bits(int x) {
+  x = (x | (x << 4)) & 0x0f0f;
+  x = (x | (x << 2)) & 0x3333;
+  x = (x | (x << 1)) & 0x5555;
+  return x;
+}
+
+// Index of a texel in the mipmaps, given its level and coordinates
+static size_t mipmap_index(
+    const trace_texture* texture, int level, const vec2i& ij) {
+  auto tile_mask = trace_texture_tile - 1;
+  auto tiles     = (texture->mip_sizes[level].x + tile_mask) /
+               trace_texture_tile;
+  auto tile   = (ij.y / trace_texture_tile) * tiles + ij.x / trace_texture_tile;
+  auto morton = spread_tile_bits(ij.x & tile_mask) |
+                (spread_tile_bits(ij.y & tile_mask) << 1);
+  return texture->mip_offsets[level] +
+         (size_t)tile * trace_texture_tile * trace_texture_tile + morton;
+}
+
+// Evaluate a mipmap level of a texture, with level 0 being the full image
+static vec4f eval_texture_level(const trace_texture* texture, int level,
+    const vec2f& uv, bool ldr_as_linear) {
+  if (level == 0) return eval_texture(texture, uv, ldr_as_linear);
+
+  // get coordinates normalized for tiling
+  auto size = texture->mip_sizes[level - 1];
+  auto s    = fmod(uv.x, 1.0f) * size.x;
+  if (s < 0) s += size.x;
+  auto t = fmod(uv.y, 1.0f) * size.y;
+  if (t < 0) t += size.y;
+
+  // get image coordinates and residuals
+  auto i = clamp((int)s, 0, size.x - 1), j = clamp((int)t, 0, size.y - 1);
+  auto ii = (i + 1) % size.x, jj = (j + 1) % size.y;
+  auto u = s - i, v = t - j;
+
+  // lookup texels
+  auto lookup = [texture, level, ldr_as_linear](const vec2i& ij) -> vec4f {
+    auto idx = mipmap_index(texture, level - 1, ij);
+    if (!texture->hdr_mips.empty()) {
+      return texture->hdr_mips[idx];
+    } else {
+      auto texel = byte_to_float(texture->ldr_mips[idx]);
+      return ldr_as_linear ? texel : srgb_to_rgb(texel);
+    }
+  };
+
+  // handle interpolation
+  return lookup({i, j}) * (1 - u) * (1 - v) + lookup({i, jj}) * (1 - u) * v +
+         lookup({ii, j}) * u * (1 - v) + lookup({ii, jj}) * u * v;
+}
+
+// Evaluate a texture with trilinear filtering over its mipmaps
+vec4f eval_texture_mipmap(const trace_texture* texture, const vec2f& uv,
+    float footprint, bool ldr_as_linear) {
+  // get texture
+  if (texture == nullptr) return {1, 1, 1, 1};
+  if (texture->mip_sizes.empty() || footprint <= 0)
+    return eval_texture(texture, uv, ldr_as_linear);
+
+  // pick levels from the footprint in texels
+  auto size = texture_size(texture);
+  auto lod  = log2(footprint * max(size.x, size.y));
+  if (lod <= 0) return eval_texture(texture, uv, ldr_as_linear);
+  auto num_levels = (int)texture->mip_sizes.size();
+  if (lod >= num_levels)
+    return eval_texture_level(texture, num_levels, uv, ldr_as_linear);
+  auto level = (int)lod;
+  auto alpha = lod - level;
+  return eval_texture_level(texture, level, uv, ldr_as_linear) * (1 - alpha) +
+         eval_texture_level(texture, level + 1, uv, ldr_as_linear) * alpha;
+}
+
 // Generates a ray from a camera for yimg::image plane coordinate uv and
 // the lens coordinates luv.
 ray3f eval_camera(
@@ -369,11 +470,23 @@ ray3f eval_camera(
   }
 }
 
+// Check whether a shape stores compact triangles
+static bool is_compact(const trace_shape* shape) {
+  return !shape->compact.triangle_bases.empty();
+}
+
 // Eval position
 vec3f eval_position(
     const trace_instance* instance, int element, const vec2f& uv) {
   auto shape = instance->shape;
-  if (!shape->triangles.empty()) {
+  if (is_compact(shape)) {
+    auto& compact = shape->compact;
+    auto  t       = compact_triangle(compact, element);
+    return transform_point(instance->frame,
+        interpolate_triangle(compact_position(compact, t.x),
+            compact_position(compact, t.y), compact_position(compact, t.z),
+            uv));
+  } else if (!shape->triangles.empty()) {
     auto t = shape->triangles[element];
     return transform_point(
         instance->frame, interpolate_triangle(shape->positions[t.x],
@@ -398,7 +511,13 @@ vec3f eval_position(
 // Shape element normal.
 vec3f eval_element_normal(const trace_instance* instance, int element) {
   auto shape = instance->shape;
-  if (!shape->triangles.empty()) {
+  if (is_compact(shape)) {
+    auto& compact = shape->compact;
+    auto  t       = compact_triangle(compact, element);
+    return transform_normal(instance->frame,
+        triangle_normal(compact_position(compact, t.x),
+            compact_position(compact, t.y), compact_position(compact, t.z)));
+  } else if (!shape->triangles.empty()) {
     auto t = shape->triangles[element];
     return transform_normal(
         instance->frame, triangle_normal(shape->positions[t.x],
@@ -423,8 +542,15 @@ vec3f eval_element_normal(const trace_instance* instance, int element) {
 vec3f eval_normal(
     const trace_instance* instance, int element, const vec2f& uv) {
   auto shape = instance->shape;
-  if (shape->normals.empty()) return eval_element_normal(instance, element);
-  if (!shape->triangles.empty()) {
+  if (shape->normals.empty() && shape->compact.normals.empty())
+    return eval_element_normal(instance, element);
+  if (is_compact(shape)) {
+    auto& compact = shape->compact;
+    auto  t       = compact_triangle(compact, element);
+    return transform_normal(instance->frame,
+        normalize(interpolate_triangle(compact_normal(compact, t.x),
+            compact_normal(compact, t.y), compact_normal(compact, t.z), uv)));
+  } else if (!shape->triangles.empty()) {
     auto t = shape->triangles[element];
     return transform_normal(
         instance->frame, normalize(interpolate_triangle(shape->normals[t.x],
@@ -451,8 +577,13 @@ vec3f eval_normal(
 vec2f eval_texcoord(
     const trace_instance* instance, int element, const vec2f& uv) {
   auto shape = instance->shape;
-  if (shape->texcoords.empty()) return uv;
-  if (!shape->triangles.empty()) {
+  if (shape->texcoords.empty() && shape->compact.texcoords.empty()) return uv;
+  if (is_compact(shape)) {
+    auto& compact = shape->compact;
+    auto  t       = compact_triangle(compact, element);
+    return interpolate_triangle(compact_texcoord(compact, t.x),
+        compact_texcoord(compact, t.y), compact_texcoord(compact, t.z), uv);
+  } else if (!shape->triangles.empty()) {
     auto t = shape->triangles[element];
     return interpolate_triangle(shape->texcoords[t.x], shape->texcoords[t.y],
         shape->texcoords[t.z], uv);
@@ -470,6 +601,46 @@ vec2f eval_texcoord(
   }
 }
 
+// Eval texcoord density, in texcoord units per world unit, using the
+// first triangle of an element. Returns zero for lines and points.
+float eval_texcoord_density(const trace_instance* instance, int element) {
+  auto shape = instance->shape;
+  if (is_compact(shape)) {
+    auto& compact = shape->compact;
+    if (compact.texcoords.empty()) return 0;
+    auto t    = compact_triangle(compact, element);
+    auto area = triangle_area(
+        transform_point(instance->frame, compact_position(compact, t.x)),
+        transform_point(instance->frame, compact_position(compact, t.y)),
+        transform_point(instance->frame, compact_position(compact, t.z)));
+    if (area == 0) return 0;
+    auto uv0     = compact_texcoord(compact, t.x);
+    auto uv_area = abs(cross(compact_texcoord(compact, t.y) - uv0,
+                       compact_texcoord(compact, t.z) - uv0)) /
+                   2;
+    return sqrt(uv_area / area);
+  }
+  if (shape->texcoords.empty()) return 0;
+  auto t = vec3i{};
+  if (!shape->triangles.empty()) {
+    t = shape->triangles[element];
+  } else if (!shape->quads.empty()) {
+    auto q = shape->quads[element];
+    t      = {q.x, q.y, q.z};
+  } else {
+    return 0;
+  }
+  auto area = triangle_area(
+      transform_point(instance->frame, shape->positions[t.x]),
+      transform_point(instance->frame, shape->positions[t.y]),
+      transform_point(instance->frame, shape->positions[t.z]));
+  if (area == 0) return 0;
+  auto uv_area = abs(cross(shape->texcoords[t.y] - shape->texcoords[t.x],
+                     shape->texcoords[t.z] - shape->texcoords[t.x])) /
+                 2;
+  return sqrt(uv_area / area);
+}
+
 #if 0
 // Shape element normal.
 static pair<vec3f, vec3f> eval_tangents(
@@ -506,7 +677,16 @@ static pair<vec3f, vec3f> eval_tangents(
 pair<vec3f, vec3f> eval_element_tangents(
     const trace_instance* instance, int element) {
   auto shape = instance->shape;
-  if (!shape->triangles.empty() && !shape->texcoords.empty()) {
+  if (is_compact(shape) && !shape->compact.texcoords.empty()) {
+    auto& compact = shape->compact;
+    auto  t       = compact_triangle(compact, element);
+    auto [tu, tv] = triangle_tangents_fromuv(compact_position(compact, t.x),
+        compact_position(compact, t.y), compact_position(compact, t.z),
+        compact_texcoord(compact, t.x), compact_texcoord(compact, t.y),
+        compact_texcoord(compact, t.z));
+    return {transform_direction(instance->frame, tu),
+        transform_direction(instance->frame, tv)};
+  } else if (!shape->triangles.empty() && !shape->texcoords.empty()) {
     auto t        = shape->triangles[element];
     auto [tu, tv] = triangle_tangents_fromuv(shape->positions[t.x],
         shape->positions[t.y], shape->positions[t.z], shape->texcoords[t.x],
@@ -533,8 +713,9 @@ vec3f eval_normalmap(
   // apply normal mapping
   auto normal   = eval_normal(instance, element, uv);
   auto texcoord = eval_texcoord(instance, element, uv);
-  if (normal_tex != nullptr &&
-      (!shape->triangles.empty() || !shape->quads.empty())) {
+  if (normal_tex != nullptr && (is_compact(shape) ||
+                                   !shape->triangles.empty() ||
+                                   !shape->quads.empty())) {
     auto normalmap = -1 + 2 * xyz(eval_texture(normal_tex, texcoord, true));
     auto [tu, tv]  = eval_element_tangents(instance, element);
     auto frame     = frame3f{tu, tv, normal, zero3f};
@@ -552,7 +733,8 @@ vec3f eval_shading_normal(const trace_instance* instance, int element,
     const vec2f& uv, const vec3f& outgoing) {
   auto shape    = instance->shape;
   auto material = instance->material;
-  if (!shape->triangles.empty() || !shape->quads.empty()) {
+  if (is_compact(shape) || !shape->triangles.empty() ||
+      !shape->quads.empty()) {
     auto normal = eval_normal(instance, element, uv);
     if (material->normal_tex != nullptr) {
       normal = eval_normalmap(instance, element, uv);
@@ -573,7 +755,11 @@ vec3f eval_shading_normal(const trace_instance* instance, int element,
 vec4f eval_color(const trace_instance* instance, int element, const vec2f& uv) {
   auto shape = instance->shape;
   if (shape->colors.empty()) return {1, 1, 1, 1};
-  if (!shape->triangles.empty()) {
+  if (is_compact(shape)) {
+    auto t = compact_triangle(shape->compact, element);
+    return interpolate_triangle(
+        shape->colors[t.x], shape->colors[t.y], shape->colors[t.z], uv);
+  } else if (!shape->triangles.empty()) {
     auto t = shape->triangles[element];
     return interpolate_triangle(
         shape->colors[t.x], shape->colors[t.y], shape->colors[t.z], uv);
@@ -652,45 +838,69 @@ static const auto coat_roughness = 0.03f * 0.03f;
 
 // Eval material to obtain emission, brdf and opacity.
 vec3f eval_emission(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing) {
-  auto material = instance->material;
-  auto texcoord = eval_texcoord(instance, element, uv);
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float cone_width) {
+  auto material  = instance->material;
+  auto texcoord  = eval_texcoord(instance, element, uv);
+  auto footprint = cone_width > 0
+                       ? cone_width * eval_texcoord_density(instance, element)
+                       : 0.0f;
   return material->emission *
-         xyz(eval_texture(material->emission_tex, texcoord));
+         xyz(eval_texture_mipmap(material->emission_tex, texcoord, footprint));
 }
 
 // Eval material to obtain emission, brdf and opacity.
 float eval_opacity(const trace_instance* instance, int element, const vec2f& uv,
-    const vec3f& normal, const vec3f& outgoing) {
-  auto material = instance->material;
-  auto texcoord = eval_texcoord(instance, element, uv);
-  auto opacity  = material->opacity *
-                 eval_texture(material->opacity_tex, texcoord, true).x;
+    const vec3f& normal, const vec3f& outgoing, float cone_width) {
+  auto material  = instance->material;
+  auto texcoord  = eval_texcoord(instance, element, uv);
+  auto footprint = cone_width > 0
+                       ? cone_width * eval_texcoord_density(instance, element)
+                       : 0.0f;
+  auto opacity   = material->opacity *
+                 eval_texture_mipmap(
+                     material->opacity_tex, texcoord, footprint, true)
+                     .x;
   if (opacity > 0.999f) opacity = 1;
   return opacity;
 }
 
 // Evaluate bsdf
 trace_bsdf eval_bsdf(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing) {
-  auto material = instance->material;
-  auto texcoord = eval_texcoord(instance, element, uv);
-  auto color    = material->color * xyz(eval_color(instance, element, uv)) *
-               xyz(eval_texture(material->color_tex, texcoord, false));
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float cone_width) {
+  auto material  = instance->material;
+  auto texcoord  = eval_texcoord(instance, element, uv);
+  auto footprint = cone_width > 0
+                       ? cone_width * eval_texcoord_density(instance, element)
+                       : 0.0f;
+  auto color     = material->color * xyz(eval_color(instance, element, uv)) *
+               xyz(eval_texture_mipmap(
+                   material->color_tex, texcoord, footprint, false));
   auto specular = material->specular *
-                  eval_texture(material->specular_tex, texcoord, true).x;
+                  eval_texture_mipmap(
+                      material->specular_tex, texcoord, footprint, true)
+                      .x;
   auto metallic = material->metallic *
-                  eval_texture(material->metallic_tex, texcoord, true).x;
+                  eval_texture_mipmap(
+                      material->metallic_tex, texcoord, footprint, true)
+                      .x;
   auto roughness = material->roughness *
-                   eval_texture(material->roughness_tex, texcoord, true).x;
+                   eval_texture_mipmap(
+                       material->roughness_tex, texcoord, footprint, true)
+                       .x;
   auto ior  = material->ior;
   auto coat = material->coat *
-              eval_texture(material->coat_tex, texcoord, true).x;
+              eval_texture_mipmap(material->coat_tex, texcoord, footprint, true)
+                  .x;
   auto transmission = material->transmission *
-                      eval_texture(material->emission_tex, texcoord, true).x;
-  auto translucency =
-      material->translucency *
-      eval_texture(material->translucency_tex, texcoord, true).x;
+                      eval_texture_mipmap(
+                          material->emission_tex, texcoord, footprint, true)
+                          .x;
+  auto translucency = material->translucency *
+                      eval_texture_mipmap(
+                          material->translucency_tex, texcoord, footprint, true)
+                          .x;
   auto thin = material->thin || material->transmission == 0;
 
   // factors
@@ -814,6 +1024,13 @@ static ray3f sample_camera(const trace_camera* camera, const vec2i& ij,
   }
 }
 
+// Ray cone of a camera pixel, as width at the camera and spread angle
+static vec2f eval_camera_cone(
+    const trace_camera* camera, const vec2i& image_size) {
+  auto pixel = camera->film / (camera->lens * max(image_size.x, image_size.y));
+  return camera->orthographic ? vec2f{pixel, 0} : vec2f{0, pixel};
+}
+
 }  // namespace yocto
 
 // -----------------------------------------------------------------------------
@@ -826,8 +1043,12 @@ void init_bvh(trace_bvh* bvh, const trace_scene* scene,
     const trace_params& params, const progress_callback& progress_cb) {
   // initialize bvh
   for (auto shape : scene->shapes) {
-    add_shape(bvh, shape->points, shape->lines, shape->triangles, shape->quads,
-        shape->positions, shape->radius, true);
+    if (is_compact(shape)) {
+      add_shape(bvh, shape->compact, true);
+    } else {
+      add_shape(bvh, shape->points, shape->lines, shape->triangles,
+          shape->quads, shape->positions, shape->radius, true);
+    }
   }
   set_instances(
       bvh, (int)scene->instances.size(),
@@ -849,17 +1070,13 @@ void update_bvh(trace_bvh* bvh, const trace_scene* scene,
   auto updated_instances_ids = vector<int>{};
   auto updated_shapes_ids    = vector<int>{};
   for (auto shape : updated_shapes) {
-    updated_shapes_ids.push_back(
-        (int)(std::find(scene->shapes.begin(), scene->shapes.end(), shape) -
-              scene->shapes.begin()));
+    updated_shapes_ids.push_back(shape->shape_id);
   }
   for (auto instance : updated_instances) {
-    updated_instances_ids.push_back(
-        (int)(std::find(
-                  scene->instances.begin(), scene->instances.end(), instance) -
-              scene->instances.begin()));
+    updated_instances_ids.push_back(instance->instance_id);
   }
-  update_bvh(bvh, updated_instances_ids, updated_shapes_ids);
+  update_bvh(bvh, updated_instances_ids, updated_shapes_ids,
+      bvh_params{(bvh_build_type)params.bvh, params.noparallel});
 }
 
 }  // namespace yocto
@@ -1148,9 +1365,11 @@ static vec3f sample_lights(const trace_scene* scene, const trace_lights* lights,
   auto light    = lights->lights[light_id];
   if (light->instance != nullptr) {
     auto instance = light->instance;
+    auto shape    = instance->shape;
     auto element  = sample_discrete_cdf(light->elements_cdf, rel);
-    auto uv       = (!instance->shape->triangles.empty()) ? sample_triangle(ruv)
-                                                          : ruv;
+    auto uv       = (is_compact(shape) || !shape->triangles.empty())
+                        ? sample_triangle(ruv)
+                        : ruv;
     auto lposition = eval_position(light->instance, element, uv);
     return normalize(lposition - position);
   } else if (light->environment != nullptr) {
@@ -1224,14 +1443,40 @@ static float sample_lights_pdf(const trace_scene* scene, const trace_bvh* bvh,
   return pdf;
 }
 
+// Albedo and normal at the first hit, used as denoiser features. Emitters
+// and the environment have unit albedo and misses have zero normal.
+struct trace_features {
+  vec3f albedo = {1, 1, 1};
+  vec3f normal = {0, 0, 0};
+};
+
+// Fill the denoiser features from the shading point of the first hit.
+static void eval_features(trace_features* features,
+    const trace_instance* instance, int element, const vec2f& uv,
+    const vec3f& normal, const vec3f& emission) {
+  features->normal = normal;
+  if (emission != zero3f) {
+    features->albedo = {1, 1, 1};
+    return;
+  }
+  auto material    = instance->material;
+  auto texcoord    = eval_texcoord(instance, element, uv);
+  auto color       = eval_color(instance, element, uv);
+  features->albedo = clamp(
+      material->color * xyz(color) *
+          xyz(eval_texture(material->color_tex, texcoord, false)),
+      0, 1);
+}
+
 // Recursive path tracing.
 static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray_, rng_state& rng,
-    const trace_params& params) {
+    const trace_lights* lights, const ray3f& ray_, const vec2f& cone_,
+    rng_state& rng, const trace_params& params, trace_features* features) {
   // initialize
   auto radiance      = zero3f;
   auto weight        = vec3f{1, 1, 1};
   auto ray           = ray_;
+  auto cone          = cone_;
   auto volume_stack  = vector<trace_vsdf>{};
   auto max_roughness = 0.0f;
   auto hit           = !params.envhidden && !scene->environments.empty();
@@ -1259,6 +1504,9 @@ static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
       intersection.distance = distance;
     }
 
+    // grow the ray cone to the hit point
+    cone.x += cone.y * intersection.distance;
+
     // switch between surface and volume
     if (!in_volume) {
       // prepare shading point
@@ -1268,9 +1516,12 @@ static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
       auto uv       = intersection.uv;
       auto position = eval_position(instance, element, uv);
       auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-      auto emission = eval_emission(instance, element, uv, normal, outgoing);
-      auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-      auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+      auto emission = eval_emission(
+          instance, element, uv, normal, outgoing, cone.x);
+      auto opacity  = eval_opacity(
+          instance, element, uv, normal, outgoing, cone.x);
+      auto bsdf     = eval_bsdf(
+          instance, element, uv, normal, outgoing, cone.x);
 
       // correct roughness
       if (params.nocaustics) {
@@ -1285,6 +1536,8 @@ static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
         continue;
       }
       hit = true;
+      if (bounce == 0 && features)
+        eval_features(features, instance, element, uv, normal, emission);
 
       // accumulate emission
       radiance += weight * eval_emission(emission, normal, outgoing);
@@ -1292,6 +1545,7 @@ static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
       // next direction
       auto incoming = zero3f;
       if (!is_delta(bsdf)) {
+        cone.y = max(cone.y, bsdf.roughness);
         if (rand1f(rng) < 0.5f) {
           incoming = sample_bsdfcos(
               bsdf, normal, outgoing, rand1f(rng), rand2f(rng));
@@ -1367,12 +1621,13 @@ static vec4f trace_path(const trace_scene* scene, const trace_bvh* bvh,
 
 // Recursive path tracing.
 static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray_, rng_state& rng,
-    const trace_params& params) {
+    const trace_lights* lights, const ray3f& ray_, const vec2f& cone_,
+    rng_state& rng, const trace_params& params, trace_features* features) {
   // initialize
   auto radiance = zero3f;
   auto weight   = vec3f{1, 1, 1};
   auto ray      = ray_;
+  auto cone     = cone_;
   auto hit      = !params.envhidden && !scene->environments.empty();
 
   // trace  path
@@ -1385,6 +1640,9 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
       break;
     }
 
+    // grow the ray cone to the hit point
+    cone.x += cone.y * intersection.distance;
+
     // prepare shading point
     auto outgoing = -ray.d;
     auto instance = scene->instances[intersection.instance];
@@ -1392,9 +1650,11 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
     auto uv       = intersection.uv;
     auto position = eval_position(instance, element, uv);
     auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-    auto emission = eval_emission(instance, element, uv, normal, outgoing);
-    auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-    auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+    auto emission = eval_emission(
+        instance, element, uv, normal, outgoing, cone.x);
+    auto opacity = eval_opacity(
+        instance, element, uv, normal, outgoing, cone.x);
+    auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing, cone.x);
 
     // handle opacity
     if (opacity < 1 && rand1f(rng) >= opacity) {
@@ -1403,6 +1663,8 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
       continue;
     }
     hit = true;
+    if (bounce == 0 && features)
+      eval_features(features, instance, element, uv, normal, emission);
 
     // accumulate emission
     radiance += weight * eval_emission(emission, normal, outgoing);
@@ -1410,6 +1672,7 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
     // next direction
     auto incoming = zero3f;
     if (bsdf.roughness != 0) {
+      cone.y   = max(cone.y, bsdf.roughness);
       incoming = sample_bsdfcos(
           bsdf, normal, outgoing, rand1f(rng), rand2f(rng));
       weight *= eval_bsdfcos(bsdf, normal, outgoing, incoming) /
@@ -1439,12 +1702,13 @@ static vec4f trace_naive(const trace_scene* scene, const trace_bvh* bvh,
 
 // Eyelight for quick previewing.
 static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray_, rng_state& rng,
-    const trace_params& params) {
+    const trace_lights* lights, const ray3f& ray_, const vec2f& cone_,
+    rng_state& rng, const trace_params& params, trace_features* features) {
   // initialize
   auto radiance = zero3f;
   auto weight   = vec3f{1, 1, 1};
   auto ray      = ray_;
+  auto cone     = cone_;
   auto hit      = !params.envhidden && !scene->environments.empty();
 
   // trace  path
@@ -1457,6 +1721,9 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
       break;
     }
 
+    // grow the ray cone to the hit point
+    cone.x += cone.y * intersection.distance;
+
     // prepare shading point
     auto outgoing = -ray.d;
     auto instance = scene->instances[intersection.instance];
@@ -1464,9 +1731,11 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
     auto uv       = intersection.uv;
     auto position = eval_position(instance, element, uv);
     auto normal   = eval_shading_normal(instance, element, uv, outgoing);
-    auto emission = eval_emission(instance, element, uv, normal, outgoing);
-    auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
-    auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+    auto emission = eval_emission(
+        instance, element, uv, normal, outgoing, cone.x);
+    auto opacity = eval_opacity(
+        instance, element, uv, normal, outgoing, cone.x);
+    auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing, cone.x);
 
     // handle opacity
     if (opacity < 1 && rand1f(rng) >= opacity) {
@@ -1475,6 +1744,8 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
       continue;
     }
     hit = true;
+    if (bounce == 0 && features)
+      eval_features(features, instance, element, uv, normal, emission);
 
     // accumulate emission
     auto incoming = outgoing;
@@ -1499,8 +1770,8 @@ static vec4f trace_eyelight(const trace_scene* scene, const trace_bvh* bvh,
 
 // False color rendering
 static vec4f trace_falsecolor(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params) {
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    rng_state& rng, const trace_params& params, trace_features* features) {
   // intersect next point
   auto intersection = intersect_bvh(bvh, ray);
   if (!intersection.hit) {
@@ -1520,6 +1791,8 @@ static vec4f trace_falsecolor(const trace_scene* scene, const trace_bvh* bvh,
   auto emission = eval_emission(instance, element, uv, normal, outgoing);
   auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
   auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+  if (features)
+    eval_features(features, instance, element, uv, normal, emission);
 
   // hash color
   auto hashed_color = [](int id) {
@@ -1576,7 +1849,7 @@ static vec4f trace_falsecolor(const trace_scene* scene, const trace_bvh* bvh,
 
 static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
     const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params, int bounce) {
+    const trace_params& params, trace_features* features, int bounce) {
   auto intersection = intersect_bvh(bvh, ray);
   if (!intersection.hit) {
     auto radiance = eval_environment(scene, ray.d);
@@ -1596,6 +1869,8 @@ static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
   auto emission = eval_emission(instance, element, uv, normal, outgoing);
   auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
   auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+  if (features)
+    eval_features(features, instance, element, uv, normal, emission);
 
   if (emission != zero3f) {
     return {emission.x, emission.y, emission.z, 1};
@@ -1607,7 +1882,7 @@ static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
   // handle opacity
   if (opacity < 1.0f) {
     auto blend_albedo = trace_albedo(scene, bvh, lights,
-        ray3f{position + ray.d * 1e-2f, ray.d}, rng, params, bounce);
+        ray3f{position + ray.d * 1e-2f, ray.d}, rng, params, nullptr, bounce);
     return lerp(blend_albedo, vec4f{albedo.x, albedo.y, albedo.z, 1}, opacity);
   }
 
@@ -1615,11 +1890,11 @@ static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
     if (bsdf.transmission != zero3f && material->thin) {
       auto incoming     = -outgoing;
       auto trans_albedo = trace_albedo(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+          ray3f{position, incoming}, rng, params, nullptr, bounce + 1);
 
       incoming         = reflect(outgoing, normal);
       auto spec_albedo = trace_albedo(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+          ray3f{position, incoming}, rng, params, nullptr, bounce + 1);
 
       auto fresnel = fresnel_dielectric(material->ior, outgoing, normal);
       auto dielectric_albedo = lerp(trans_albedo, spec_albedo, fresnel);
@@ -1627,7 +1902,7 @@ static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
     } else if (bsdf.metal != zero3f) {
       auto incoming    = reflect(outgoing, normal);
       auto refl_albedo = trace_albedo(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+          ray3f{position, incoming}, rng, params, nullptr, bounce + 1);
       return refl_albedo * vec4f{albedo.x, albedo.y, albedo.z, 1};
     }
   }
@@ -1636,15 +1911,16 @@ static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
 }
 
 static vec4f trace_albedo(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params) {
-  auto albedo = trace_albedo(scene, bvh, lights, ray, rng, params, 0);
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    rng_state& rng, const trace_params& params, trace_features* features) {
+  auto albedo = trace_albedo(
+      scene, bvh, lights, ray, rng, params, features, 0);
   return clamp(albedo, 0.0, 1.0);
 }
 
 static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
     const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params, int bounce) {
+    const trace_params& params, trace_features* features, int bounce) {
   auto intersection = intersect_bvh(bvh, ray);
   if (!intersection.hit) {
     return {0, 0, 0, 1};
@@ -1660,11 +1936,14 @@ static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
   auto normal   = eval_shading_normal(instance, element, uv, outgoing);
   auto opacity  = eval_opacity(instance, element, uv, normal, outgoing);
   auto bsdf     = eval_bsdf(instance, element, uv, normal, outgoing);
+  if (features)
+    eval_features(features, instance, element, uv, normal,
+        eval_emission(instance, element, uv, normal, outgoing));
 
   // handle opacity
   if (opacity < 1.0f) {
     auto normal = trace_normal(scene, bvh, lights,
-        ray3f{position + ray.d * 1e-2f, ray.d}, rng, params, bounce);
+        ray3f{position + ray.d * 1e-2f, ray.d}, rng, params, nullptr, bounce);
     return lerp(normal, normal, opacity);
   }
 
@@ -1672,18 +1951,18 @@ static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
     if (bsdf.transmission != zero3f && material->thin) {
       auto incoming   = -outgoing;
       auto trans_norm = trace_normal(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+          ray3f{position, incoming}, rng, params, nullptr, bounce + 1);
 
       incoming       = reflect(outgoing, normal);
       auto spec_norm = trace_normal(scene, bvh, lights,
-          ray3f{position, incoming}, rng, params, bounce + 1);
+          ray3f{position, incoming}, rng, params, nullptr, bounce + 1);
 
       auto fresnel = fresnel_dielectric(material->ior, outgoing, normal);
       return lerp(trans_norm, spec_norm, fresnel);
     } else if (bsdf.metal != zero3f) {
       auto incoming = reflect(outgoing, normal);
       return trace_normal(scene, bvh, lights, ray3f{position, incoming}, rng,
-          params, bounce + 1);
+          params, nullptr, bounce + 1);
     }
   }
 
@@ -1691,15 +1970,17 @@ static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
 }
 
 static vec4f trace_normal(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params) {
-  return trace_normal(scene, bvh, lights, ray, rng, params, 0);
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    rng_state& rng, const trace_params& params, trace_features* features) {
+  return trace_normal(scene, bvh, lights, ray, rng, params, features, 0);
 }
 
-// Trace a single ray from the camera using the given algorithm.
+// Trace a single ray from the camera using the given algorithm. The ray cone
+// is given as its width at the ray origin and its spread angle. When features
+// is not null, the sampler also stores the denoiser features of its first hit.
 using sampler_func = vec4f (*)(const trace_scene* scene, const trace_bvh* bvh,
-    const trace_lights* lights, const ray3f& ray, rng_state& rng,
-    const trace_params& params);
+    const trace_lights* lights, const ray3f& ray, const vec2f& cone,
+    rng_state& rng, const trace_params& params, trace_features* features);
 static sampler_func get_trace_sampler_func(const trace_params& params) {
   switch (params.sampler) {
     case trace_sampler_type::path: return trace_path;
@@ -1731,6 +2012,22 @@ bool is_sampler_lit(const trace_params& params) {
   }
 }
 
+#ifdef YOCTO_STATS
+// Accumulate the traversal work done by a sample since the given counters.
+static void accumulate_stats(
+    trace_state* state, const vec2i& ij, const bvh_stats& start) {
+  auto& end    = get_bvh_stats();
+  auto& stats  = state->stats[ij];
+  auto  length = end.scene_rays - start.scene_rays;
+  stats.path_rays += (uint32_t)length;
+  stats.light_rays += (uint32_t)(end.instance_rays - start.instance_rays);
+  stats.nodes += (uint32_t)(end.nodes - start.nodes);
+  stats.primitives += (uint32_t)(end.primitives - start.primitives);
+  state->lengths[min((int)length, trace_stats_lengths - 1)].fetch_add(
+      1, std::memory_order_relaxed);
+}
+#endif
+
 // Trace a block of samples
 void trace_sample(trace_state* state, const trace_scene* scene,
     const trace_camera* camera, const trace_bvh* bvh,
@@ -1738,12 +2035,32 @@ void trace_sample(trace_state* state, const trace_scene* scene,
   auto sampler = get_trace_sampler_func(params);
   auto ray     = sample_camera(camera, ij, state->render.imsize(),
       rand2f(state->rngs[ij]), rand2f(state->rngs[ij]), params.tentfilter);
-  auto sample  = sampler(scene, bvh, lights, ray, state->rngs[ij], params);
+  auto cone    = eval_camera_cone(camera, state->render.imsize());
+#ifdef YOCTO_STATS
+  auto start = get_bvh_stats();
+#endif
+  auto features = trace_features{};
+  auto gather   = !state->albedo.empty() &&
+                state->samples[ij] < trace_denoise_samples;
+  auto sample   = sampler(scene, bvh, lights, ray, cone, state->rngs[ij],
+      params, gather ? &features : nullptr);
+#ifdef YOCTO_STATS
+  accumulate_stats(state, ij, start);
+#endif
   if (!isfinite(xyz(sample))) sample = {0, 0, 0, sample.w};
   if (max(sample) > params.clamp)
     sample = sample * (params.clamp / max(sample));
+  if (gather) {
+    auto [albedo, normal] = features;
+    state->albedo[ij] += {albedo.x, albedo.y, albedo.z, 1};
+    state->normal[ij] += {normal.x, normal.y, normal.z, 1};
+  }
   state->accumulation[ij] += sample;
   state->samples[ij] += 1;
+  if (!state->squares.empty()) {
+    auto lum = luminance(xyz(sample));
+    state->squares[ij] += lum * lum;
+  }
   auto radiance     = state->accumulation[ij].w != 0
                           ? xyz(state->accumulation[ij]) / state->accumulation[ij].w
                           : zero3f;
@@ -1767,6 +2084,276 @@ void init_state(trace_state* state, const trace_scene* scene,
   for (auto& rng : state->rngs) {
     rng = make_rng(params.seed, rand1i(rng_, 1 << 31) / 2 + 1);
   }
+  if (params.adaptive > 0) {
+    auto tiles = (image_size + trace_adaptive_tile - 1) / trace_adaptive_tile;
+    state->squares.assign(image_size, 0);
+    state->errors.assign(tiles, flt_max);
+  } else {
+    state->squares = {};
+    state->errors  = {};
+  }
+  if (params.denoise) {
+    state->albedo.assign(image_size, zero4f);
+    state->normal.assign(image_size, zero4f);
+  } else {
+    state->albedo = {};
+    state->normal = {};
+  }
+#ifdef YOCTO_STATS
+  state->stats.assign(image_size, {});
+  state->lengths = vector<atomic<uint64_t>>(trace_stats_lengths);
+#else
+  state->stats = {};
+  state->lengths.clear();
+#endif
+}
+
+// Sum the statistics collected while rendering.
+trace_stats get_trace_stats(const trace_state* state) {
+  auto stats = trace_stats{};
+  for (auto& pixel : state->stats) {
+    stats.path_rays += pixel.path_rays;
+    stats.light_rays += pixel.light_rays;
+    stats.nodes += pixel.nodes;
+    stats.primitives += pixel.primitives;
+  }
+  stats.lengths = vector<uint64_t>(state->lengths.size());
+  for (auto idx = 0; idx < state->lengths.size(); idx++) {
+    stats.lengths[idx] = state->lengths[idx];
+    stats.samples += stats.lengths[idx];
+  }
+  return stats;
+}
+
+// Make a heatmap of per-sample pixel statistics.
+image<vec4f> make_trace_heatmap(
+    const trace_state* state, trace_stats_type type) {
+  auto values    = image<float>{state->stats.imsize(), 0.0f};
+  auto max_value = 0.0f;
+  for (auto idx = 0; idx < values.count(); idx++) {
+    auto& pixel = state->stats[idx];
+    auto  value = 0.0f;
+    switch (type) {
+      case trace_stats_type::path_rays: value = pixel.path_rays; break;
+      case trace_stats_type::light_rays: value = pixel.light_rays; break;
+      case trace_stats_type::nodes: value = pixel.nodes; break;
+      case trace_stats_type::primitives: value = pixel.primitives; break;
+    }
+    values[idx] = value / max(state->samples[idx], 1);
+    max_value   = max(max_value, values[idx]);
+  }
+  auto scale   = max_value > 0 ? 1 / max_value : 0.0f;
+  auto heatmap = image<vec4f>{values.imsize(), zero4f};
+  for (auto idx = 0; idx < values.count(); idx++) {
+    auto color   = colormap(values[idx] * scale);
+    heatmap[idx] = {color.x, color.y, color.z, 1};
+  }
+  return heatmap;
+}
+
+// Minimum number of samples before a tile can be considered converged
+static const auto trace_adaptive_min = 16;
+
+// Estimate the error of a tile as the maximum relative standard error of the
+// pixel luminance means.
+static float eval_tile_error(const trace_state* state, const vec2i& tile) {
+  auto error = 0.0f;
+  auto start = tile * trace_adaptive_tile;
+  auto end   = min(start + trace_adaptive_tile, state->render.imsize());
+  for (auto j = start.y; j < end.y; j++) {
+    for (auto i = start.x; i < end.x; i++) {
+      auto count = state->samples[{i, j}];
+      if (count < 2) return flt_max;
+      auto mean     = luminance(xyz(state->accumulation[{i, j}])) / count;
+      auto variance = max(state->squares[{i, j}] / count - mean * mean, 0.0f);
+      auto stderr_  = sqrt(variance / count);
+      error         = max(error, stderr_ / max(mean, 0.01f));
+    }
+  }
+  return error;
+}
+
+// Trace one sample for each pixel of the tiles that have not converged yet.
+// Converged tiles are skipped, so that all threads work on the noisy ones.
+// Calls the async callback, if defined, after each traced pixel.
+// Returns the number of tiles traced.
+static int trace_adaptive_pass(trace_state* state, const trace_scene* scene,
+    const trace_camera* camera, const trace_bvh* bvh,
+    const trace_lights* lights, const trace_params& params, int sample,
+    const async_callback& async_cb) {
+  auto min_samples = min(trace_adaptive_min, params.samples);
+  auto tiles       = vector<vec2i>{};
+  for (auto j = 0; j < state->errors.height(); j++) {
+    for (auto i = 0; i < state->errors.width(); i++) {
+      auto count = state->samples[vec2i{i, j} * trace_adaptive_tile];
+      if (count >= params.samples) continue;
+      if (count >= min_samples && state->errors[{i, j}] <= params.adaptive)
+        continue;
+      tiles.push_back({i, j});
+    }
+  }
+  auto trace_tile = [&](const vec2i& tile) {
+    auto start = tile * trace_adaptive_tile;
+    auto end   = min(start + trace_adaptive_tile, state->render.imsize());
+    for (auto j = start.y; j < end.y; j++) {
+      for (auto i = start.x; i < end.x; i++) {
+        if (state->stop) return;
+        trace_sample(state, scene, camera, bvh, lights, {i, j}, params);
+        if (async_cb) async_cb(state->render, sample, params.samples, {i, j});
+      }
+    }
+    state->errors[tile] = state->samples[start] >= min_samples
+                              ? eval_tile_error(state, tile)
+                              : flt_max;
+  };
+  if (params.noparallel) {
+    for (auto& tile : tiles) trace_tile(tile);
+  } else {
+    parallel_for((int)tiles.size(), [&](int idx) { trace_tile(tiles[idx]); });
+  }
+  return (int)tiles.size();
+}
+
+// Denoiser parameters: number of a-trous iterations, color edge-stopping
+// for one sample per pixel, albedo edge-stopping and normal exponent as a
+// power of two.
+static const auto trace_denoise_iterations = 5;
+static const auto trace_denoise_color      = 0.5f;
+static const auto trace_denoise_albedo     = 0.1f;
+static const auto trace_denoise_normal     = 6;
+
+// Tile size used to run the denoiser in parallel
+static const auto trace_denoise_tile = 32;
+
+// Per-pixel denoiser features, packed to visit neighbors with few loads
+struct trace_denoise_feature {
+  vec3f tonemap = {0, 0, 0};
+  vec3f albedo  = {0, 0, 0};
+  vec3f normal  = {0, 0, 0};
+};
+
+// Denoise a render with an a-trous wavelet filter. The illumination is
+// separated from the albedo and filtered with a 5x5 B3-spline kernel whose
+// holes double at each iteration, stopping at color, albedo and normal edges.
+// The color threshold shrinks with the number of samples and iterations.
+static image<vec4f> denoise_image(const image<vec4f>& render,
+    const image<vec4f>& albedo, const image<vec4f>& normal,
+    const image<int>& samples, bool noparallel) {
+  auto size = render.imsize();
+
+  // prepare features and illumination
+  auto features = image<trace_denoise_feature>{size};
+  auto colors   = image<vec3f>{size};
+  auto filtered = image<vec3f>{size};
+  for (auto idx = (size_t)0; idx < render.count(); idx++) {
+    auto& feature  = features[idx];
+    feature.albedo = albedo[idx].w != 0 ? xyz(albedo[idx]) / albedo[idx].w
+                                        : vec3f{1, 1, 1};
+    feature.normal = normal[idx].w != 0 ? xyz(normal[idx]) / normal[idx].w
+                                        : zero3f;
+    if (feature.normal != zero3f) feature.normal = normalize(feature.normal);
+    colors[idx] = xyz(render[idx]) / max(feature.albedo, 0.01f);
+  }
+
+  // filter tiles of pixels
+  static const float kernel[5] = {
+      1 / 16.0f, 1 / 4.0f, 3 / 8.0f, 1 / 4.0f, 1 / 16.0f};
+  const auto albedo_scale = 1 / (trace_denoise_albedo * trace_denoise_albedo);
+  auto       step         = 1;
+  auto       filter_tile  = [&](int ti, int tj) {
+    auto start = vec2i{ti, tj} * trace_denoise_tile;
+    auto end   = min(start + trace_denoise_tile, size);
+    for (auto j = start.y; j < end.y; j++) {
+      for (auto i = start.x; i < end.x; i++) {
+        auto  idx         = (size_t)j * size.x + i;
+        auto& center      = features[idx];
+        auto  color_scale = max(samples[idx], 1) * step /
+                           (trace_denoise_color * trace_denoise_color);
+        auto sum    = zero3f;
+        auto weight = 0.0f;
+        for (auto dj = -2; dj <= 2; dj++) {
+          auto qj = j + dj * step;
+          if (qj < 0 || qj >= size.y) continue;
+          for (auto di = -2; di <= 2; di++) {
+            auto qi = i + di * step;
+            if (qi < 0 || qi >= size.x) continue;
+            auto  qidx     = (size_t)qj * size.x + qi;
+            auto& neighbor = features[qidx];
+            auto  w        = kernel[di + 2] * kernel[dj + 2];
+            if (center.normal != zero3f || neighbor.normal != zero3f) {
+              auto wnormal = max(dot(center.normal, neighbor.normal), 0.0f);
+              for (auto k = 0; k < trace_denoise_normal; k++)
+                wnormal *= wnormal;
+              w *= wnormal;
+            }
+            auto distance =
+                distance_squared(center.tonemap, neighbor.tonemap) *
+                    color_scale +
+                distance_squared(center.albedo, neighbor.albedo) *
+                    albedo_scale;
+            if (w < 1e-4f || distance > 8) continue;
+            // exp(-distance) approximated as (1 - distance / 16)^16
+            auto wdistance = 1 - distance / 16;
+            for (auto k = 0; k < 4; k++) wdistance *= wdistance;
+            w *= wdistance;
+            sum += colors[qidx] * w;
+            weight += w;
+          }
+        }
+        filtered[idx] = weight > 0 ? sum / weight : colors[idx];
+      }
+    }
+  };
+  auto tiles = (size + trace_denoise_tile - 1) / trace_denoise_tile;
+  for (auto iteration = 0; iteration < trace_denoise_iterations; iteration++) {
+    for (auto idx = (size_t)0; idx < colors.count(); idx++)
+      features[idx].tonemap = colors[idx] / (1 + max(colors[idx]));
+    if (noparallel) {
+      for (auto tj = 0; tj < tiles.y; tj++)
+        for (auto ti = 0; ti < tiles.x; ti++) filter_tile(ti, tj);
+    } else {
+      parallel_for(tiles.x, tiles.y, filter_tile);
+    }
+    swap(colors, filtered);
+    step *= 2;
+  }
+
+  // put back albedo
+  auto denoised = render;
+  for (auto idx = (size_t)0; idx < render.count(); idx++) {
+    auto color    = colors[idx] * max(features[idx].albedo, 0.01f);
+    denoised[idx] = {color.x, color.y, color.z, render[idx].w};
+  }
+  return denoised;
+}
+
+// Denoise the current render
+image<vec4f> denoise_image(
+    const trace_state* state, const trace_params& params) {
+  if (state->albedo.empty()) return state->render;
+  return denoise_image(state->render, state->albedo, state->normal,
+      state->samples, params.noparallel);
+}
+
+// Denoise a snapshot of the render while the next samples are traced.
+// Snapshots are skipped while the previous one is still being denoised.
+// Finished snapshots are sent from the worker, on the next call, so that all
+// callbacks come from the same thread.
+static void denoise_async(trace_state* state, const trace_params& params,
+    int sample, const image_callback& image_cb) {
+  if (state->denoiser.valid()) {
+    if (!is_ready(state->denoiser)) return;
+    state->denoiser.get();
+    if (image_cb)
+      image_cb(state->denoised, state->denoised_at, params.samples);
+  }
+  state->denoiser = std::async(std::launch::async,
+      [state, params, sample, render = state->render, albedo = state->albedo,
+          normal = state->normal, samples = state->samples]() {
+        state->denoised    = denoise_image(
+            render, albedo, normal, samples, params.noparallel);
+        state->denoised_at = sample;
+      });
 }
 
 // Forward declaration
@@ -1787,11 +2374,22 @@ void init_lights(trace_lights* lights, const trace_scene* scene,
   for (auto instance : scene->instances) {
     if (instance->material->emission == zero3f) continue;
     auto shape = instance->shape;
-    if (shape->triangles.empty() && shape->quads.empty()) continue;
+    if (!is_compact(shape) && shape->triangles.empty() && shape->quads.empty())
+      continue;
     if (progress_cb) progress_cb("build light", progress.x++, ++progress.y);
     auto light         = add_light(lights);
     light->instance    = instance;
     light->environment = nullptr;
+    if (is_compact(shape)) {
+      auto& compact       = shape->compact;
+      light->elements_cdf = vector<float>(compact.triangles.size());
+      for (auto idx = 0; idx < light->elements_cdf.size(); idx++) {
+        auto t                   = compact_triangle(compact, idx);
+        light->elements_cdf[idx] = triangle_area(compact_position(compact, t.x),
+            compact_position(compact, t.y), compact_position(compact, t.z));
+        if (idx != 0) light->elements_cdf[idx] += light->elements_cdf[idx - 1];
+      }
+    }
     if (!shape->triangles.empty()) {
       light->elements_cdf = vector<float>(shape->triangles.size());
       for (auto idx = 0; idx < light->elements_cdf.size(); idx++) {
@@ -1838,6 +2436,86 @@ void init_lights(trace_lights* lights, const trace_scene* scene,
   if (progress_cb) progress_cb("build light", progress.x++, progress.y);
 }
 
+// Build the mipmap levels of an image, each half the size of the previous,
+// with texels averaged over 2x2 blocks.
+template <typename T>
+static void init_mipmaps(trace_texture* texture, const image<T>& img,
+    vector<T>& mips, bool noparallel) {
+  // compute level sizes and offsets in whole tiles
+  const auto tile_texels = (size_t)trace_texture_tile * trace_texture_tile;
+  auto       size        = img.imsize();
+  auto       total       = (size_t)0;
+  texture->mip_sizes.clear();
+  texture->mip_offsets.clear();
+  while (size.x > 1 || size.y > 1) {
+    size       = max(size / 2, vec2i{1, 1});
+    auto tiles = (size + trace_texture_tile - 1) / trace_texture_tile;
+    texture->mip_sizes.push_back(size);
+    texture->mip_offsets.push_back(total);
+    total += (size_t)tiles.x * tiles.y * tile_texels;
+  }
+  mips.assign(total, T{});
+
+  // fill levels from the previous ones
+  for (auto level = 0; level < (int)texture->mip_sizes.size(); level++) {
+    auto  prev_size = level == 0 ? img.imsize() : texture->mip_sizes[level - 1];
+    auto& size      = texture->mip_sizes[level];
+    auto  fetch     = [&](int i, int j) -> vec4f {
+      auto ij = vec2i{min(i, prev_size.x - 1), min(j, prev_size.y - 1)};
+      auto texel = level == 0 ? img[ij]
+                                   : mips[mipmap_index(texture, level - 1, ij)];
+      if constexpr (std::is_same_v<T, vec4b>) {
+        return byte_to_float(texel);
+      } else {
+        return texel;
+      }
+    };
+    auto fill_row = [&](int j) {
+      for (auto i = 0; i < size.x; i++) {
+        auto texel = (fetch(i * 2, j * 2) + fetch(i * 2 + 1, j * 2) +
+                         fetch(i * 2, j * 2 + 1) +
+                         fetch(i * 2 + 1, j * 2 + 1)) /
+                     4;
+        auto& mip = mips[mipmap_index(texture, level, {i, j})];
+        if constexpr (std::is_same_v<T, vec4b>) {
+          mip = float_to_byte(texel);
+        } else {
+          mip = texel;
+        }
+      }
+    };
+    if (noparallel) {
+      for (auto j = 0; j < size.y; j++) fill_row(j);
+    } else {
+      parallel_for(size.y, fill_row);
+    }
+  }
+}
+
+// Build texture mipmaps
+void init_textures(trace_scene* scene, const trace_params& params,
+    const progress_callback& progress_cb) {
+  // handle progress
+  auto progress = vec2i{0, (int)scene->textures.size()};
+
+  for (auto texture : scene->textures) {
+    if (progress_cb) progress_cb("build mipmaps", progress.x++, progress.y);
+    texture->hdr_mips.clear();
+    texture->ldr_mips.clear();
+    if (!texture->hdr.empty()) {
+      init_mipmaps(texture, texture->hdr, texture->hdr_mips, params.noparallel);
+    } else if (!texture->ldr.empty()) {
+      init_mipmaps(texture, texture->ldr, texture->ldr_mips, params.noparallel);
+    } else {
+      texture->mip_sizes.clear();
+      texture->mip_offsets.clear();
+    }
+  }
+
+  // handle progress
+  if (progress_cb) progress_cb("build mipmaps", progress.x++, progress.y);
+}
+
 // Progressively computes an image.
 image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
     const trace_params& params, const progress_callback& progress_cb,
@@ -1862,6 +2540,18 @@ image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
   auto state       = state_guard.get();
   init_state(state, scene, camera, params);
 
+  if (params.adaptive > 0) {
+    for (auto sample = 0; sample < params.samples; sample++) {
+      if (progress_cb) progress_cb("trace image", sample, params.samples);
+      if (!trace_adaptive_pass(
+              state, scene, camera, bvh, lights, params, sample, {}))
+        break;
+      if (image_cb) image_cb(state->render, sample + 1, params.samples);
+    }
+    if (progress_cb) progress_cb("trace image", params.samples, params.samples);
+    return params.denoise ? denoise_image(state, params) : state->render;
+  }
+
   for (auto sample = 0; sample < params.samples; sample++) {
     if (progress_cb) progress_cb("trace image", sample, params.samples);
     if (params.noparallel) {
@@ -1880,7 +2570,7 @@ image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
   }
 
   if (progress_cb) progress_cb("trace image", params.samples, params.samples);
-  return state->render;
+  return params.denoise ? denoise_image(state, params) : state->render;
 }
 
 // [experimental] Asynchronous interface
@@ -1890,8 +2580,9 @@ void trace_start(trace_state* state, const trace_scene* scene,
     const progress_callback& progress_cb, const image_callback& image_cb,
     const async_callback& async_cb) {
   init_state(state, scene, camera, params);
-  state->worker = {};
-  state->stop   = false;
+  state->worker   = {};
+  state->denoiser = {};
+  state->stop     = false;
 
   // render preview
   if (progress_cb) progress_cb("trace preview", 0, params.samples);
@@ -1913,23 +2604,42 @@ void trace_start(trace_state* state, const trace_scene* scene,
     for (auto sample = 0; sample < params.samples; sample++) {
       if (state->stop) return;
       if (progress_cb) progress_cb("trace image", sample, params.samples);
-      parallel_for(
-          state->render.width(), state->render.height(), [&](int i, int j) {
-            if (state->stop) return;
-            trace_sample(state, scene, camera, bvh, lights, {i, j}, params);
-            if (async_cb)
-              async_cb(state->render, sample, params.samples, {i, j});
-          });
-      if (image_cb) image_cb(state->render, sample + 1, params.samples);
+      if (params.adaptive > 0) {
+        if (!trace_adaptive_pass(
+                state, scene, camera, bvh, lights, params, sample, async_cb))
+          break;
+      } else {
+        parallel_for(
+            state->render.width(), state->render.height(), [&](int i, int j) {
+              if (state->stop) return;
+              trace_sample(state, scene, camera, bvh, lights, {i, j}, params);
+              if (async_cb)
+                async_cb(state->render, sample, params.samples, {i, j});
+            });
+      }
+      if (state->stop) return;
+      if (params.denoise) {
+        denoise_async(state, params, sample + 1, image_cb);
+      } else {
+        if (image_cb) image_cb(state->render, sample + 1, params.samples);
+      }
     }
+    if (state->denoiser.valid()) state->denoiser.get();
     if (progress_cb) progress_cb("trace image", params.samples, params.samples);
-    if (image_cb) image_cb(state->render, params.samples, params.samples);
+    if (image_cb) {
+      if (params.denoise) {
+        image_cb(denoise_image(state, params), params.samples, params.samples);
+      } else {
+        image_cb(state->render, params.samples, params.samples);
+      }
+    }
   });
 }
 void trace_stop(trace_state* state) {
   if (state == nullptr) return;
   state->stop = true;
   if (state->worker.valid()) state->worker.get();
+  if (state->denoiser.valid()) state->denoiser.get();
 }
 
 }  // namespace yocto
@@ -1958,6 +2668,19 @@ namespace yocto {
   serialize_property(mode, json, value.noparallel, "noparallel", "Disable threading.");
   serialize_property(mode, json, value.pratio, "pratio", "Preview ratio.");
   serialize_property(mode, json, value.exposure, "exposure", "Image exposure.");
+  serialize_property(mode, json, value.adaptive, "adaptive", "Adaptive sampling error threshold.");
+  serialize_property(mode, json, value.denoise, "denoise", "Denoise renders.");
+}
+
+void serialize_value(json_mode mode, json_value& json, trace_stats& value,
+    const string& description) {
+  serialize_object(mode, json, value, description);
+  serialize_property(mode, json, value.samples, "samples", "Number of samples.");
+  serialize_property(mode, json, value.path_rays, "path_rays", "Rays traced along paths.");
+  serialize_property(mode, json, value.light_rays, "light_rays", "Rays traced for light pdfs.");
+  serialize_property(mode, json, value.nodes, "nodes", "Bvh nodes visited.");
+  serialize_property(mode, json, value.primitives, "primitives", "Shape elements tested.");
+  serialize_property(mode, json, value.lengths, "lengths", "Path length histogram.");
 }
 
 // Json enum conventions
@@ -93,10 +93,17 @@ struct trace_camera {
 };
 
 // Texture containing either an LDR or HDR image. HdR images are encoded
-// in linear color space, while LDRs are encoded as sRGB.
+// in linear color space, while LDRs are encoded as sRGB. Mipmaps are built
+// by init_textures() and hold the levels below full resolution in the same
+// format as the image. Each level is split in square tiles, stored one after
+// the other, with texels in Morton order within a tile.
 struct trace_texture {
-  image<vec4f> hdr = {};
-  image<vec4b> ldr = {};
+  image<vec4f>   hdr         = {};
+  image<vec4b>   ldr         = {};
+  vector<vec2i>  mip_sizes   = {};  // mipmaps
+  vector<size_t> mip_offsets = {};  // mipmaps
+  vector<vec4f>  hdr_mips    = {};  // mipmaps
+  vector<vec4b>  ldr_mips    = {};  // mipmaps
 };
 
 // Material for surfaces, lines and triangles.
@@ -169,6 +176,9 @@ struct trace_shape {
   float          displacement     = 0;
   trace_texture* displacement_tex = nullptr;
 
+  // compact triangles, replacing triangles, positions, normals and texcoords
+  bvh_compact_shape compact = {};
+
   // shape is assigned at creation
   int shape_id = -1;
 };
@@ -244,6 +254,13 @@ vec4f lookup_texture(
 vec4f eval_texture(const trace_texture* texture, const vec2f& uv,
     bool ldr_as_linear = false, bool no_interpolation = false,
     bool clamp_to_edge = false);
+// Evaluates a texture with trilinear filtering over its mipmaps, for a
+// footprint given in texcoord units. Without mipmaps, same as eval_texture().
+vec4f eval_texture_mipmap(const trace_texture* texture, const vec2f& uv,
+    float footprint, bool ldr_as_linear = false);
+
+// Mipmap tile size, in texels along each side
+const auto trace_texture_tile = 32;
 
 // Evaluate instance properties
 vec3f eval_position(
@@ -252,6 +269,7 @@ vec3f eval_element_normal(const trace_instance* instance, int element);
 vec3f eval_normal(const trace_instance* instance, int element, const vec2f& uv);
 vec2f eval_texcoord(
     const trace_instance* instance, int element, const vec2f& uv);
+float eval_texcoord_density(const trace_instance* instance, int element);
 pair<vec3f, vec3f> eval_element_tangents(
     const trace_instance* instance, int element);
 vec3f eval_normalmap(
@@ -313,14 +331,17 @@ struct trace_bsdf {
   float refraction_pdf   = 0;
 };
 
-// Eval material to obtain emission, brdf and opacity.
+// Eval material to obtain emission, brdf and opacity. Textures are filtered
+// over the width of the ray cone at the shading point, if given.
 vec3f eval_emission(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing);
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float cone_width = 0);
 // Eval material to obatain emission, brdf and opacity.
 trace_bsdf eval_bsdf(const trace_instance* instance, int element,
-    const vec2f& uv, const vec3f& normal, const vec3f& outgoing);
+    const vec2f& uv, const vec3f& normal, const vec3f& outgoing,
+    float cone_width = 0);
 float eval_opacity(const trace_instance* instance, int element, const vec2f& uv,
-    const vec3f& normal, const vec3f& outgoing);
+    const vec3f& normal, const vec3f& outgoing, float cone_width = 0);
 // check if a brdf is a delta
 bool is_delta(const trace_bsdf& bsdf);
 
@@ -394,6 +415,8 @@ struct trace_params {
   bool                  noparallel = false;
   int                   pratio     = 8;
   float                 exposure   = 0;
+  float                 adaptive   = 0;
+  bool                  denoise    = false;
 };
 
 const auto trace_sampler_labels = vector<pair<trace_sampler_type, string>>{
@@ -466,6 +489,13 @@ void tesselate_shapes(
     trace_scene* scene, const progress_callback& progress_cb = {});
 void tesselate_shape(trace_scene* shape);
 
+// Replace triangle meshes with compact quantized geometry, decoded on the fly
+// during intersection and shading. Call after tesselation and before building
+// the bvh. Shapes that are not triangle meshes are left untouched.
+void compact_shapes(
+    trace_scene* scene, const progress_callback& progress_cb = {});
+void compact_shape(trace_shape* shape);
+
 // Progressively computes an image.
 image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
     const trace_params& params, const progress_callback& progress_cb = {},
@@ -498,6 +528,10 @@ struct trace_lights {
 void init_lights(trace_lights* lights, const trace_scene* scene,
     const trace_params& params, const progress_callback& progress_cb = {});
 
+// Build texture mipmaps, used to filter textures over ray cones.
+void init_textures(trace_scene* scene, const trace_params& params,
+    const progress_callback& progress_cb = {});
+
 // Define BVH
 using trace_bvh = bvh_scene;
 
@@ -510,6 +544,19 @@ void update_bvh(trace_bvh* bvh, const trace_scene* scene,
     const vector<trace_instance*>& updated_instances,
     const vector<trace_shape*>& updated_shapes, const trace_params& params);
 
+// Per-pixel rendering statistics, collected only when compiled with
+// YOCTO_STATS. Counts include the work of all samples of the pixel but not
+// the rays traced for denoising features.
+struct trace_pixel_stats {
+  uint32_t path_rays  = 0;  // rays traced along paths
+  uint32_t light_rays = 0;  // rays traced to evaluate light pdfs
+  uint32_t nodes      = 0;  // bvh nodes visited
+  uint32_t primitives = 0;  // shape elements tested
+};
+
+// Number of bins of the path length histogram
+const auto trace_stats_lengths = 33;
+
 // Progressively computes an image.
 image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
     const trace_bvh* bvh, const trace_lights* lights,
@@ -519,16 +566,63 @@ image<vec4f> trace_image(const trace_scene* scene, const trace_camera* camera,
 // Check is a sampler requires lights
 bool is_sampler_lit(const trace_params& params);
 
-// [experimental] Asynchronous state
+// Tile size used by adaptive sampling
+const auto trace_adaptive_tile = 16;
+
+// Number of samples used to gather the denoiser features
+const auto trace_denoise_samples = 8;
+
+// [experimental] Asynchronous state. When adaptive sampling is enabled,
+// the state also tracks per-pixel luminance moments and per-tile errors.
+// When denoising, the state accumulates the albedo and normal at the first
+// hit, used to guide the filter.
 struct trace_state {
-  image<vec4f>     render       = {};
-  image<vec4f>     accumulation = {};
-  image<int>       samples      = {};
-  image<rng_state> rngs         = {};
-  future<void>     worker       = {};  // async
-  atomic<bool>     stop         = {};  // async
+  image<vec4f>             render       = {};
+  image<vec4f>             accumulation = {};
+  image<int>               samples      = {};
+  image<rng_state>         rngs         = {};
+  image<float>             squares      = {};  // adaptive
+  image<float>             errors       = {};  // adaptive
+  image<vec4f>             albedo       = {};  // denoise
+  image<vec4f>             normal       = {};  // denoise
+  image<vec4f>             denoised     = {};  // denoise
+  int                      denoised_at  = 0;   // denoise
+  future<void>             worker       = {};  // async
+  future<void>             denoiser     = {};  // async
+  atomic<bool>             stop         = {};  // async
+  image<trace_pixel_stats> stats        = {};  // statistics
+  vector<atomic<uint64_t>> lengths      = {};  // statistics
+};
+
+// Rendering statistics summed over the image. Path lengths are the number
+// of rays traced along each sample path, and their last histogram bin
+// collects all longer paths. Statistics are zero unless compiled with
+// YOCTO_STATS.
+struct trace_stats {
+  uint64_t         samples    = 0;
+  uint64_t         path_rays  = 0;
+  uint64_t         light_rays = 0;
+  uint64_t         nodes      = 0;
+  uint64_t         primitives = 0;
+  vector<uint64_t> lengths    = {};
 };
 
+// Sum the statistics collected while rendering.
+trace_stats get_trace_stats(const trace_state* state);
+
+// Type of per-pixel statistics shown in heatmaps
+enum struct trace_stats_type { path_rays, light_rays, nodes, primitives };
+
+// Make a heatmap of per-sample pixel statistics, color mapped from zero to
+// the maximum over the image.
+image<vec4f> make_trace_heatmap(
+    const trace_state* state, trace_stats_type type);
+
+// Denoise the current render with an edge-aware a-trous wavelet filter,
+// guided by the albedo and normal features.
+image<vec4f> denoise_image(
+    const trace_state* state, const trace_params& params);
+
 // [experimental] Callback used to report partially computed image
 using async_callback = function<void(
     const image<vec4f>& render, int current, int total, const vec2i& ij)>;
@@ -554,6 +648,8 @@ enum struct json_mode;
 struct json_value;
 void serialize_value(json_mode mode, json_value& json, trace_params& value,
     const string& description);
+void serialize_value(json_mode mode, json_value& json, trace_stats& value,
+    const string& description);
 
 // Serialize enum to json
 const vector<pair<trace_bvh_type, string>>& json_enum_labels(trace_bvh_type);
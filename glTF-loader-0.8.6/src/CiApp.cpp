@@ -3,6 +3,8 @@
 #include "cinder/Camera.h"
 #include "cinder/Json.h"
 #include "cinder/Text.h"
+#include "cinder/Thread.h"
+#include "cinder/Timer.h"
 #include "cinder/Utilities.h"
 
 #include "cinder/ip/Flip.h"
@@ -298,54 +300,265 @@ struct Hero
     struct SkeltonInfo
     {
         vector<JointInfo> joints;
+        vector<size_t> order; // parents come before their children
+
+        // Called once after loading the joints, so that evaluation can walk order linearly.
+        void buildOrder()
+        {
+            order.clear();
+            vector<bool> visited(joints.size(), false);
+            while (order.size() < joints.size())
+            {
+                size_t orderSize = order.size();
+                for (size_t i = 0; i < joints.size(); i++)
+                {
+                    int parentId = joints[i].parentId;
+                    bool parentVisited = parentId >= 0 && parentId < (int)joints.size() && visited[parentId];
+                    if (!visited[i] && (parentId == -1 || parentVisited))
+                    {
+                        visited[i] = true;
+                        order.push_back(i);
+                    }
+                }
+                if (order.size() == orderSize)
+                {
+                    console() << "Skeleton has a cycle or a missing parent" << endl;
+                    for (size_t i = 0; i < joints.size(); i++)
+                    {
+                        if (!visited[i]) joints[i].parentId = -1;
+                    }
+                }
+            }
+        }
     };
 
     struct AnimTrack
     {
-        struct JointPose
+        // Local transforms of all the joints, stored channel by channel.
+        struct Pose
         {
-            Vec3f pos;
-            Vec3f rot;
-            // Vec3f scale;
+            vector<Vec3f> positions;
+            vector<Quatf> rotations;
+            vector<Vec3f> scales;
+
+            void resize(size_t jointCount)
+            {
+                positions.resize(jointCount, Vec3f::zero());
+                rotations.resize(jointCount, Quatf::identity());
+                scales.resize(jointCount, Vec3f::one());
+            }
+
+            // weight 0 keeps this pose, weight 1 gives the other one.
+            void blend(const Pose& other, float weight)
+            {
+                for (size_t i = 0; i < positions.size(); i++)
+                {
+                    positions[i] = positions[i].lerp(weight, other.positions[i]);
+                    rotations[i] = nlerp(rotations[i], other.rotations[i], weight);
+                    scales[i] = scales[i].lerp(weight, other.scales[i]);
+                }
+            }
+
+            void toLocalMatrices(vector<Matrix44f>& localMatrices) const
+            {
+                localMatrices.resize(positions.size());
+                for (size_t i = 0; i < positions.size(); i++)
+                {
+                    localMatrices[i] = rotations[i].toMatrix44();
+                    localMatrices[i].scale(scales[i]);
+                    localMatrices[i].setTranslate(positions[i]);
+                }
+            }
         };
 
-        void interpolate(float timePos, const SkeltonInfo& skeleton, vector<Matrix44f>& localMatrices)
+        // Evaluation state of an animated instance, reused across frames so that updates
+        // do not allocate. Tracks are not modified by evaluation, so instances with their
+        // own buffers can be evaluated concurrently.
+        struct PoseBuffer
         {
-            size_t index = timePos; // TODO
-            index %= poseSamples.size();
-            const vector<JointPose>& poses = poseSamples[index].jointPoses;
+            PoseBuffer() : cursor(0), fromCursor(0) {}
+
+            Pose pose;
+            Pose fromPose;
+            vector<Matrix44f> localMatrices;
+            vector<Matrix44f> globalMatrices;
+            size_t cursor;
+            size_t fromCursor;
+        };
+
+        AnimTrack() : jointCount(0), useSlerp(false) {}
 
-            for (size_t i=0; i<skeleton.joints.size(); i++)
+        // Starts a key at the given time (in frames), initialized with the previous key.
+        void addKey(float time)
+        {
+            keyTimes.push_back(time);
+            if (keyTimes.size() == 1)
             {
-#if 1
-                localMatrices[i] = /*Matrix44f::createTranslation(poses[i].pos) * */Matrix44f::createRotation(poses[i].rot);
-#endif
+                keyPositions.resize(jointCount, Vec3f::zero());
+                keyRotations.resize(jointCount, Quatf::identity());
+                keyScales.resize(jointCount, Vec3f::one());
+            }
+            else
+            {
+                size_t prevKey = (keyTimes.size() - 2) * jointCount;
+                for (size_t i = 0; i < jointCount; i++)
+                {
+                    keyPositions.push_back(keyPositions[prevKey + i]);
+                    keyRotations.push_back(keyRotations[prevKey + i]);
+                    keyScales.push_back(keyScales[prevKey + i]);
+                }
             }
         }
 
-        struct SkeletonPose
+        // Sets a joint of the last key.
+        void setJoint(size_t jointId, const Vec3f& pos, const Quatf& rot, const Vec3f& scale)
         {
-            float time; // TODO: unused
-            vector<JointPose> jointPoses;  
-        };
-        vector<SkeletonPose> poseSamples;
+            if (keyTimes.empty() || jointId >= jointCount) return;
+            size_t offset = (keyTimes.size() - 1) * jointCount + jointId;
+            keyPositions[offset] = pos;
+            keyRotations[offset] = rot;
+            keyScales[offset] = scale;
+        }
+
+        // The track loops, the last key blends back into the first one during a frame.
+        float getDuration() const
+        {
+            return keyTimes.empty() ? 0.0f : keyTimes.back() - keyTimes.front() + 1.0f;
+        }
 
-        void update(float timePos, const SkeltonInfo& skeletonInfo, vector<Matrix44f>& skinMatrices)
+        // Returns the key at or before time. Playback usually stays on the same key
+        // or moves to the next one, so the last key found is checked before falling
+        // back to a binary search.
+        size_t findKey(float time, size_t& cursor) const
         {
-            skinMatrices.resize(skeletonInfo.joints.size());
+            const size_t keyCount = keyTimes.size();
+            if (cursor >= keyCount) cursor = 0;
+            for (size_t i = 0; i < 2 && cursor + i < keyCount; i++)
+            {
+                size_t key = cursor + i;
+                if (keyTimes[key] <= time && (key + 1 == keyCount || time < keyTimes[key + 1]))
+                {
+                    cursor = key;
+                    return cursor;
+                }
+            }
+            vector<float>::const_iterator it = upper_bound(keyTimes.begin(), keyTimes.end(), time);
+            cursor = (it == keyTimes.begin()) ? 0 : (it - keyTimes.begin()) - 1;
+            return cursor;
+        }
 
-            vector<Matrix44f> localMatrices(skeletonInfo.joints.size());
+        void sample(float timePos, Pose& pose, size_t& cursor) const
+        {
+            pose.resize(jointCount);
+            if (keyTimes.empty()) return;
+
+            float time = keyTimes.front() + fmodf(timePos - keyTimes.front(), getDuration());
+            if (time < keyTimes.front()) time += getDuration();
+
+            size_t key0 = findKey(time, cursor);
+            size_t key1 = (key0 + 1 < keyTimes.size()) ? key0 + 1 : 0;
+            float time1 = (key1 != 0) ? keyTimes[key1] : keyTimes.front() + getDuration();
+            float alpha = (time1 > keyTimes[key0]) ? (time - keyTimes[key0]) / (time1 - keyTimes[key0]) : 0.0f;
+
+            const Vec3f* pos0 = &keyPositions[key0 * jointCount];
+            const Vec3f* pos1 = &keyPositions[key1 * jointCount];
+            const Quatf* rot0 = &keyRotations[key0 * jointCount];
+            const Quatf* rot1 = &keyRotations[key1 * jointCount];
+            const Vec3f* scale0 = &keyScales[key0 * jointCount];
+            const Vec3f* scale1 = &keyScales[key1 * jointCount];
+            for (size_t i = 0; i < jointCount; i++)
+            {
+                pose.positions[i] = pos0[i].lerp(alpha, pos1[i]);
+                pose.rotations[i] = useSlerp ? rot0[i].slerp(alpha, rot1[i]) : nlerp(rot0[i], rot1[i], alpha);
+                pose.scales[i] = scale0[i].lerp(alpha, scale1[i]);
+            }
+        }
+
+        void interpolate(float timePos, PoseBuffer& buffer) const
+        {
+            sample(timePos, buffer.pose, buffer.cursor);
+            buffer.pose.toLocalMatrices(buffer.localMatrices);
+        }
 
+        static Quatf nlerp(const Quatf& q0, const Quatf& q1, float alpha)
+        {
+            // take the shortest path
+            float sign = (q0.dot(q1) < 0) ? -1.0f : 1.0f;
+            Quatf q(q0.w + (q1.w * sign - q0.w) * alpha,
+                q0.v.x + (q1.v.x * sign - q0.v.x) * alpha,
+                q0.v.y + (q1.v.y * sign - q0.v.y) * alpha,
+                q0.v.z + (q1.v.z * sign - q0.v.z) * alpha);
+            return q.normalized();
+        }
+
+        // Key times in frames, joints of each key are stored contiguously per channel.
+        vector<float> keyTimes;
+        size_t jointCount;
+        vector<Vec3f> keyPositions;
+        vector<Quatf> keyRotations;
+        vector<Vec3f> keyScales;
+        bool useSlerp;
+
+        void update(float timePos, const SkeltonInfo& skeletonInfo, PoseBuffer& buffer,
+            vector<Matrix44f>& skinMatrices) const
+        {
             // Interpolate all the joints of this clip at the given time instance.
-            interpolate(timePos, skeletonInfo, localMatrices);
+            interpolate(timePos, buffer);
+
+            computeSkinMatrices(skeletonInfo, buffer, skinMatrices);
+        }
+
+        // Cross-fades from another track of the same skeleton, weight 0 gives the other track.
+        void updateBlended(float timePos, const AnimTrack& from, float fromTimePos, float weight,
+            const SkeltonInfo& skeletonInfo, PoseBuffer& buffer, vector<Matrix44f>& skinMatrices) const
+        {
+            if (from.jointCount != jointCount)
+            {
+                update(timePos, skeletonInfo, buffer, skinMatrices);
+                return;
+            }
+
+            from.sample(fromTimePos, buffer.fromPose, buffer.fromCursor);
+            sample(timePos, buffer.pose, buffer.cursor);
+            buffer.fromPose.blend(buffer.pose, weight);
+            buffer.fromPose.toLocalMatrices(buffer.localMatrices);
+
+            computeSkinMatrices(skeletonInfo, buffer, skinMatrices);
+        }
+
+        // Product of two affine transforms, skipping the constant last row.
+        static void multiplyAffine(const Matrix44f& a, const Matrix44f& b, Matrix44f& result)
+        {
+            for (int col = 0; col < 4; col++)
+            {
+                const float* bc = &b.m[col * 4];
+                for (int row = 0; row < 3; row++)
+                {
+                    result.m[col * 4 + row] = a.m[row] * bc[0] + a.m[4 + row] * bc[1] + a.m[8 + row] * bc[2];
+                }
+                result.m[col * 4 + 3] = 0;
+            }
+            result.m[12] += a.m[12];
+            result.m[13] += a.m[13];
+            result.m[14] += a.m[14];
+            result.m[15] = 1;
+        }
+
+        static void computeSkinMatrices(const SkeltonInfo& skeletonInfo, PoseBuffer& buffer,
+            vector<Matrix44f>& skinMatrices)
+        {
+            const size_t jointCount = skeletonInfo.joints.size();
+            const vector<Matrix44f>& localMatrices = buffer.localMatrices;
+            vector<Matrix44f>& globalMatrices = buffer.globalMatrices;
+            skinMatrices.resize(jointCount);
+            globalMatrices.resize(jointCount);
 
             //
             // Traverse the hierarchy and transform all the bones to the root space.
             //
-            vector<Matrix44f> globalMatrices(skeletonInfo.joints.size());
-
-            for (size_t i = 0; i < skeletonInfo.joints.size(); i++)
+            for (size_t k = 0; k < skeletonInfo.order.size(); k++)
             {
+                size_t i = skeletonInfo.order[k];
                 int parentId = skeletonInfo.joints[i].parentId;
                 if (parentId == -1)
                 {
@@ -353,14 +566,14 @@ struct Hero
                 }
                 else
                 {
-                    globalMatrices[i] = globalMatrices[parentId] * localMatrices[i];
+                    multiplyAffine(globalMatrices[parentId], localMatrices[i], globalMatrices[i]);
                 }
             }
 
             // Post-multiply by the joint offset transform to get the final transform.
-            for (size_t i = 0; i < skeletonInfo.joints.size(); i++)
+            for (size_t i = 0; i < jointCount; i++)
             {
-                skinMatrices[i] = globalMatrices[i] * skeletonInfo.joints[i].invBindPose;
+                multiplyAffine(globalMatrices[i], skeletonInfo.joints[i].invBindPose, skinMatrices[i]);
             }
         }
 
@@ -439,6 +652,10 @@ struct CiApp : public AppBasic
         mParams.addParam("CURRENT_HERO", mHeroNames, &CURRENT_HERO);
 
         mCurrentHero = -1;
+        mPrevAnim = -1;
+        mBlendStartTime = 0;
+        mPrefetchHero = -1;
+        mPrefetchOk = false;
 
         // functios
 #define BIND_PAIR(name, handler) do \
@@ -494,6 +711,11 @@ struct CiApp : public AppBasic
 #undef ADD_ENUM
     }
 
+    void shutdown()
+    {
+        finishPrefetch();
+    }
+
     void keyUp(KeyEvent event)
     {
         if (event.getCode() == KeyEvent::KEY_ESCAPE)
@@ -506,6 +728,7 @@ struct CiApp : public AppBasic
     {
         if (mCurrentHero != CURRENT_HERO)
         {
+            finishPrefetch();
             mCurrentHero = CURRENT_HERO;
             if (!loadHero(mHeroNames[mCurrentHero]))
             {
@@ -530,8 +753,12 @@ struct CiApp : public AppBasic
 
         if (mCurrentAnim != CURRENT_ANIM)
         {
+            // cross-fade from the previous animation of the same hero
+            mPrevAnim = mCurrentAnim;
+            mBlendStartTime = getElapsedSeconds();
             mCurrentAnim = CURRENT_ANIM;
             loadAnimTrack(mAnimNames[mCurrentAnim]);
+            prefetchAnimTrack(mAnimNames[(mCurrentAnim + 1) % mAnimNames.size()]);
         }
     }
 
@@ -607,13 +834,23 @@ private:
             gl::disableWireframe();
         }
 
-        vector<Matrix44f> skinMatrices; // MAXBONES = 128?
         Hero::AnimTrack& animTrack = mHero.mAnimTracks[mAnimNames[mCurrentAnim]];
-        animTrack.update(getElapsedSeconds() * FRAME_PER_SEC, mHero.mSkeletonInfo, skinMatrices);
+        float timePos = getElapsedSeconds() * FRAME_PER_SEC;
+        float blendWeight = (BLEND_SECONDS > 0) ? (getElapsedSeconds() - mBlendStartTime) / BLEND_SECONDS : 1.0f;
+        if (mPrevAnim != -1 && blendWeight < 1.0f)
+        {
+            Hero::AnimTrack& prevTrack = mHero.mAnimTracks[mAnimNames[mPrevAnim]];
+            animTrack.updateBlended(timePos, prevTrack, timePos, blendWeight, mHero.mSkeletonInfo,
+                mPoseBuffer, mSkinMatrices);
+        }
+        else
+        {
+            animTrack.update(timePos, mHero.mSkeletonInfo, mPoseBuffer, mSkinMatrices);
+        }
 
         mHero.preDraw();
         gShader.getProg().bind();
-        gShader.getProg().uniform("uBoneMatrices", &skinMatrices[0], skinMatrices.size());
+        gShader.getProg().uniform("uBoneMatrices", &mSkinMatrices[0], mSkinMatrices.size());
 
         if (mCurrentNode == 0)
         {
@@ -1070,21 +1307,12 @@ private:
         mHero.mScenes[tree.getKey()] = scene;
     }
 
-    void loadAnimTrack(const string& name)
+    // The skeleton is shared by all the clips of a hero, so it is read once from the first clip.
+    void loadSkeleton(const string& name)
     {
-        if (mHero.mAnimTracks.find(name) != mHero.mAnimTracks.end())
-        {
-            return;
-        }
-
         mHero.mSkeletonInfo.joints.clear();
 
-        Hero::AnimTrack anim;
-        anim.name = name;
-
-        stringstream ss;
-        ss << mHeroesFolder.generic_string() << "/" << mHeroNames[mCurrentHero] << "/smd/" << name;
-        ifstream ifs(ss.str().c_str());
+        ifstream ifs(getSmdPath(name).string().c_str());
 
         string dummy;
         string line;
@@ -1092,9 +1320,8 @@ private:
         getline(ifs, line); // version 1
         getline(ifs, line); // nodes
         getline(ifs, line); // 0 "root" -1
-        while (line != "end")
+        while (line != "end" && ifs)
         {
-            // TODO: skeleton is unique for every hero, so only needs to be initialized once
             Hero::JointInfo joint;
             string jointName;
             stringstream(line) >> dummy >> jointName >> joint.parentId;
@@ -1103,9 +1330,11 @@ private:
             getline(ifs, line);
         }
 
-        for (size_t i=0; i<mHero.mSkeletonInfo.joints.size(); i++)
+        mHero.mSkeletonInfo.buildOrder();
+
+        for (size_t k=0; k<mHero.mSkeletonInfo.order.size(); k++)
         {
-            Hero::JointInfo& joint = mHero.mSkeletonInfo.joints[i];
+            Hero::JointInfo& joint = mHero.mSkeletonInfo.joints[mHero.mSkeletonInfo.order[k]];
             if (mHero.mNodes.find(joint.name) == mHero.mNodes.end())
             {
                 console() << "Joint " << joint.name << " is missing" << endl;
@@ -1123,35 +1352,255 @@ private:
                 joint.invBindPose = parent.invBindPose * inv;
             }
         }
+    }
+
+    void loadAnimTrack(const string& name)
+    {
+        finishPrefetch();
+
+        if (mHero.mAnimTracks.find(name) != mHero.mAnimTracks.end())
+        {
+            return;
+        }
+
+        Timer timer(true);
+
+        if (mHero.mSkeletonInfo.joints.empty())
+        {
+            loadSkeleton(name);
+        }
+
+        Hero::AnimTrack anim;
+        bool fromCache = loadAnimTrackData(getSmdPath(name), getAnimCachePath(name),
+            mHero.mSkeletonInfo.joints.size(), anim);
+        anim.name = name;
+        mHero.mAnimTracks[name] = anim;
+
+        console() << name << " loaded in " << timer.getSeconds() * 1000 << " ms"
+            << (fromCache ? " from cache" : " from smd") << endl;
+    }
+
+    // Loads the next clip in the background, so that switching to it does not stall.
+    void prefetchAnimTrack(const string& name)
+    {
+        finishPrefetch();
+
+        if (mHero.mAnimTracks.find(name) != mHero.mAnimTracks.end())
+        {
+            return;
+        }
+
+        mPrefetchName = name;
+        mPrefetchHero = mCurrentHero;
+        mPrefetchTrack = Hero::AnimTrack();
+        mPrefetchOk = false;
+        mPrefetchThread = shared_ptr<thread>(new thread(bind(&CiApp::runPrefetch, this,
+            getSmdPath(name), getAnimCachePath(name), mHero.mSkeletonInfo.joints.size())));
+    }
+
+    void runPrefetch(fs::path smdPath, fs::path cachePath, size_t jointCount)
+    {
+        loadAnimTrackData(smdPath, cachePath, jointCount, mPrefetchTrack);
+        mPrefetchOk = !mPrefetchTrack.keyTimes.empty();
+    }
+
+    // Waits for the background load and keeps its result if it is still for the current hero.
+    void finishPrefetch()
+    {
+        if (!mPrefetchThread)
+        {
+            return;
+        }
+
+        mPrefetchThread->join();
+        mPrefetchThread.reset();
+
+        if (mPrefetchOk && mPrefetchHero == mCurrentHero &&
+            mHero.mAnimTracks.find(mPrefetchName) == mHero.mAnimTracks.end())
+        {
+            mPrefetchTrack.name = mPrefetchName;
+            mHero.mAnimTracks[mPrefetchName] = mPrefetchTrack;
+        }
+    }
+
+    //
+    // Binary clip cache, written in the hero "cache" folder on first load:
+    //   AnimCacheHeader
+    //   float   keyTimes[keyCount]
+    //   float   positions[keyCount * jointCount * 3]
+    //   int16_t rotations[keyCount * jointCount * 4] // quaternion components * 32767
+    //
+    struct AnimCacheHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t jointCount;
+        uint32_t keyCount;
+    };
+
+    static const uint32_t kAnimCacheMagic = 0x434d5341; // "ASMC"
+    static const uint32_t kAnimCacheVersion = 1;
+
+    fs::path getSmdPath(const string& name) const
+    {
+        return mHeroesFolder / mHeroNames[mCurrentHero] / "smd" / name;
+    }
+
+    fs::path getAnimCachePath(const string& name) const
+    {
+        return mHeroesFolder / mHeroNames[mCurrentHero] / "cache" / (name + ".bin");
+    }
+
+    // Loads a clip from its binary cache, or parses the SMD and writes the cache.
+    // Returns whether the cache was used. Does not touch the app, so it can run on any thread.
+    static bool loadAnimTrackData(const fs::path& smdPath, const fs::path& cachePath, size_t jointCount,
+        Hero::AnimTrack& anim)
+    {
+        if (fs::exists(cachePath) && fs::exists(smdPath) &&
+            fs::last_write_time(cachePath) >= fs::last_write_time(smdPath) &&
+            readAnimCache(cachePath, jointCount, anim))
+        {
+            return true;
+        }
+
+        anim = Hero::AnimTrack();
+        parseSmdTrack(smdPath, jointCount, anim);
+        if (!anim.keyTimes.empty())
+        {
+            writeAnimCache(cachePath, anim);
+        }
+        return false;
+    }
+
+    static void parseSmdTrack(const fs::path& smdPath, size_t jointCount, Hero::AnimTrack& anim)
+    {
+        ifstream ifs(smdPath.string().c_str());
+
+        string dummy;
+        string line;
+
+        // the skeleton has been read with the first clip
+        while (getline(ifs, line) && line != "skeleton")
+        {
+        }
 
-        getline(ifs, line); // skeleton
         getline(ifs, line); // time 0
-        Hero::AnimTrack::SkeletonPose skelPose;
-        while (line != "end")
+        anim.jointCount = jointCount;
+        while (line != "end" && ifs)
         {
             if (line.find("time") != string::npos)
             {
-                if (!skelPose.jointPoses.empty())
-                {
-                    anim.poseSamples.push_back(skelPose);
-                }
-                skelPose = Hero::AnimTrack::SkeletonPose();
-                stringstream(line) >> dummy >> skelPose.time;
+                float time = 0;
+                stringstream(line) >> dummy >> time;
+                anim.addKey(time);
             }
             else
             {
-                Hero::AnimTrack::JointPose Pose;
-                stringstream(line) >> dummy >> Pose.pos.x >> Pose.pos.y >> Pose.pos.z
-                                    >> Pose.rot.x >> Pose.rot.y >> Pose.rot.z;
-                skelPose.jointPoses.push_back(Pose);
+                size_t jointId;
+                Vec3f pos, rot;
+                stringstream(line) >> jointId >> pos.x >> pos.y >> pos.z
+                                    >> rot.x >> rot.y >> rot.z;
+                anim.setJoint(jointId, pos, Quatf(Matrix44f::createRotation(rot)), Vec3f::one());
             }
 
             getline(ifs, line);
         }
+    }
 
-        anim.poseSamples.push_back(skelPose);
+    static bool readAnimCache(const fs::path& cachePath, size_t jointCount, Hero::AnimTrack& anim)
+    {
+        // one read of the whole file, then decode from memory
+        ifstream ifs(cachePath.string().c_str(), ios::binary);
+        vector<char> data((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
 
-        mHero.mAnimTracks[name] = anim;
+        AnimCacheHeader header;
+        if (data.size() < sizeof(header))
+        {
+            return false;
+        }
+        memcpy(&header, &data[0], sizeof(header));
+
+        const size_t valueCount = (size_t)header.keyCount * header.jointCount;
+        const size_t expectedSize = sizeof(header) + header.keyCount * sizeof(float) +
+            valueCount * 3 * sizeof(float) + valueCount * 4 * sizeof(int16_t);
+        if (header.magic != kAnimCacheMagic || header.version != kAnimCacheVersion ||
+            header.jointCount != jointCount || header.keyCount == 0 || data.size() != expectedSize)
+        {
+            return false;
+        }
+
+        const char* ptr = &data[0] + sizeof(header);
+        anim = Hero::AnimTrack();
+        anim.jointCount = jointCount;
+        anim.keyTimes.resize(header.keyCount);
+        memcpy(&anim.keyTimes[0], ptr, header.keyCount * sizeof(float));
+        ptr += header.keyCount * sizeof(float);
+
+        anim.keyPositions.resize(valueCount);
+        for (size_t i = 0; i < valueCount; i++)
+        {
+            float pos[3];
+            memcpy(pos, ptr, sizeof(pos));
+            ptr += sizeof(pos);
+            anim.keyPositions[i] = Vec3f(pos[0], pos[1], pos[2]);
+        }
+
+        anim.keyRotations.resize(valueCount);
+        for (size_t i = 0; i < valueCount; i++)
+        {
+            int16_t rot[4];
+            memcpy(rot, ptr, sizeof(rot));
+            ptr += sizeof(rot);
+            anim.keyRotations[i] = Quatf(rot[0] / 32767.0f, rot[1] / 32767.0f,
+                rot[2] / 32767.0f, rot[3] / 32767.0f).normalized();
+        }
+
+        anim.keyScales.assign(valueCount, Vec3f::one());
+        return true;
+    }
+
+    static void writeAnimCache(const fs::path& cachePath, const Hero::AnimTrack& anim)
+    {
+        try
+        {
+            fs::create_directories(cachePath.parent_path());
+        }
+        catch (...)
+        {
+            return;
+        }
+
+        ofstream ofs(cachePath.string().c_str(), ios::binary);
+        if (!ofs)
+        {
+            return;
+        }
+
+        AnimCacheHeader header;
+        header.magic = kAnimCacheMagic;
+        header.version = kAnimCacheVersion;
+        header.jointCount = (uint32_t)anim.jointCount;
+        header.keyCount = (uint32_t)anim.keyTimes.size();
+        ofs.write((const char*)&header, sizeof(header));
+        ofs.write((const char*)&anim.keyTimes[0], anim.keyTimes.size() * sizeof(float));
+
+        for (size_t i = 0; i < anim.keyPositions.size(); i++)
+        {
+            float pos[3] = {anim.keyPositions[i].x, anim.keyPositions[i].y, anim.keyPositions[i].z};
+            ofs.write((const char*)pos, sizeof(pos));
+        }
+
+        for (size_t i = 0; i < anim.keyRotations.size(); i++)
+        {
+            const Quatf& q = anim.keyRotations[i];
+            int16_t rot[4] = {quantize(q.w), quantize(q.v.x), quantize(q.v.y), quantize(q.v.z)};
+            ofs.write((const char*)rot, sizeof(rot));
+        }
+    }
+
+    static int16_t quantize(float value)
+    {
+        return (int16_t)floorf(constrain(value, -1.0f, 1.0f) * 32767.0f + 0.5f);
     }
 
 private:
@@ -1228,6 +1677,19 @@ private:
     int                     mCurrentNode;
     vector<string>          mAnimNames;
     int                     mCurrentAnim;
+    int                     mPrevAnim;
+    float                   mBlendStartTime;
+
+    // animation state reused every frame
+    Hero::AnimTrack::PoseBuffer mPoseBuffer;
+    vector<Matrix44f>       mSkinMatrices; // MAXBONES = 128?
+
+    // background clip loading
+    shared_ptr<thread>      mPrefetchThread;
+    string                  mPrefetchName;
+    int                     mPrefetchHero;
+    Hero::AnimTrack         mPrefetchTrack;
+    bool                    mPrefetchOk;
 };
 
 CINDER_APP_BASIC(CiApp, RendererGl)
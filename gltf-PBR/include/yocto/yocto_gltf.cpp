@@ -65,13 +65,17 @@
 //
 
 #include "yocto_gltf.h"
+#include "yocto_utils.h"
 
 #include <cfloat>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <limits>
 #include <memory>
 #include <sstream>
+#include <unordered_map>
 #include <vector>
 
 #ifndef YGLTF_NO_IMAGE
@@ -80,6 +84,404 @@
 
 namespace ygltf {
 
+//
+// Read-only json tree used by the loaders. The whole document is stored in
+// two flat arrays and values point back into the source text, so that
+// parsing does not allocate for each value like nlohmann::json does.
+// Values are walked with json_view that mimics the nlohmann::json interface
+// used by the parsing code below.
+//
+enum struct json_type : unsigned char {
+    null,
+    boolean,
+    integer,
+    number,
+    string,
+    array,
+    object
+};
+
+//
+// Json value. For arrays and objects, children indexes the list of child
+// ids in json_tape::children, that for objects alternates keys and values.
+//
+struct json_node {
+    json_type type = json_type::null;
+    bool escaped = false;
+    int size = 0;
+    int children = 0;
+    double number = 0;
+    const char* begin = nullptr;
+    const char* end = nullptr;
+};
+
+//
+// Json document. The root is the first node.
+//
+struct json_tape {
+    std::vector<json_node> nodes;
+    std::vector<int> children;
+};
+
+//
+// Iterator over object members.
+//
+struct json_view;
+struct json_iterator {
+    const json_tape* tape = nullptr;
+    int pos = 0;
+
+    json_iterator(const json_tape* tape, int pos) : tape(tape), pos(pos) {}
+
+    std::string key() const;
+    json_view value() const;
+    json_view operator*() const;
+    json_iterator& operator++() {
+        pos += 2;
+        return *this;
+    }
+    bool operator==(const json_iterator& b) const { return pos == b.pos; }
+    bool operator!=(const json_iterator& b) const { return pos != b.pos; }
+};
+
+//
+// Reference to a json value in a tape.
+//
+struct json_view {
+    const json_tape* tape = nullptr;
+    int id = 0;
+
+    json_view(const json_tape* tape, int id) : tape(tape), id(id) {}
+
+    const json_node& node() const { return tape->nodes[id]; }
+
+    bool is_object() const { return node().type == json_type::object; }
+    bool is_array() const { return node().type == json_type::array; }
+    bool is_string() const { return node().type == json_type::string; }
+    bool is_boolean() const { return node().type == json_type::boolean; }
+    bool is_number_integer() const {
+        return node().type == json_type::integer;
+    }
+    bool is_number() const {
+        return node().type == json_type::integer ||
+               node().type == json_type::number;
+    }
+
+    size_t size() const {
+        if (is_array() || is_object()) return node().size;
+        return (node().type == json_type::null) ? 0 : 1;
+    }
+
+    json_view operator[](int idx) const {
+        return {tape, tape->children[node().children + idx]};
+    }
+    json_view operator[](const char* name) const { return *find(name); }
+
+    json_iterator begin() const {
+        return {tape, is_object() ? node().children : 0};
+    }
+    json_iterator end() const {
+        return {tape, is_object() ? node().children + node().size * 2 : 0};
+    }
+    json_iterator find(const char* name) const {
+        auto len = strlen(name);
+        for (auto it = begin(); it != end(); ++it) {
+            auto& key = tape->nodes[tape->children[it.pos]];
+            if (key.escaped) {
+                if (it.key() == name) return it;
+            } else {
+                if (key.end - key.begin - 2 == len &&
+                    !memcmp(key.begin + 1, name, len))
+                    return it;
+            }
+        }
+        return end();
+    }
+    int count(const char* name) const { return find(name) != end(); }
+
+    int get_int() const { return (int)node().number; }
+    float get_float() const { return (float)node().number; }
+    bool get_bool() const { return node().number != 0; }
+    std::string get_string() const;
+    json get_json() const { return json::parse(node().begin, node().end); }
+};
+
+inline std::string json_iterator::key() const {
+    return json_view(tape, tape->children[pos]).get_string();
+}
+inline json_view json_iterator::value() const {
+    return json_view(tape, tape->children[pos + 1]);
+}
+inline json_view json_iterator::operator*() const { return value(); }
+
+//
+// Appends a unicode codepoint as utf8.
+//
+static inline void _append_utf8(std::string& str, unsigned int cp) {
+    if (cp < 0x80) {
+        str += (char)cp;
+    } else if (cp < 0x800) {
+        str += (char)(0xc0 | (cp >> 6));
+        str += (char)(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        str += (char)(0xe0 | (cp >> 12));
+        str += (char)(0x80 | ((cp >> 6) & 0x3f));
+        str += (char)(0x80 | (cp & 0x3f));
+    } else {
+        str += (char)(0xf0 | (cp >> 18));
+        str += (char)(0x80 | ((cp >> 12) & 0x3f));
+        str += (char)(0x80 | ((cp >> 6) & 0x3f));
+        str += (char)(0x80 | (cp & 0x3f));
+    }
+}
+
+//
+// Parses the 4 hex digits of an \u escape.
+//
+static inline unsigned int _parse_hex4(const char* s) {
+    auto cp = 0u;
+    for (auto i = 0; i < 4; i++) {
+        auto c = s[i];
+        cp <<= 4;
+        if (c >= '0' && c <= '9') cp |= c - '0';
+        if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+    }
+    return cp;
+}
+
+inline std::string json_view::get_string() const {
+    auto& n = node();
+    if (!n.escaped) return std::string(n.begin + 1, n.end - 1);
+    auto str = std::string();
+    str.reserve(n.end - n.begin);
+    for (auto s = n.begin + 1; s < n.end - 1; s++) {
+        if (*s != '\\') {
+            str += *s;
+            continue;
+        }
+        switch (*++s) {
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u': {
+                auto cp = _parse_hex4(s + 1);
+                s += 4;
+                if (cp >= 0xd800 && cp < 0xdc00 && s + 6 < n.end &&
+                    s[1] == '\\' && s[2] == 'u') {
+                    auto lo = _parse_hex4(s + 3);
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                    s += 6;
+                }
+                _append_utf8(str, cp);
+            } break;
+            default: str += *s; break;
+        }
+    }
+    return str;
+}
+
+//
+// Json parser state.
+//
+struct json_reader {
+    const char* cur = nullptr;
+    const char* end = nullptr;
+    json_tape* tape = nullptr;
+    std::vector<int> stack;
+};
+
+//
+// Skips json whitespace.
+//
+static inline void _skip_ws(json_reader& reader) {
+    while (reader.cur < reader.end &&
+           (*reader.cur == ' ' || *reader.cur == '\n' || *reader.cur == '\r' ||
+               *reader.cur == '\t'))
+        reader.cur++;
+}
+
+//
+// Parses a json number. Numbers with up to 15 significant digits and small
+// exponents are exactly converted with a single floating point operation,
+// others go through strtod.
+//
+static inline bool _parse_json_number(json_reader& reader, json_node& node) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+        1e20, 1e21, 1e22};
+    auto& s = reader.cur;
+    auto end = reader.end;
+    auto neg = (s < end && *s == '-');
+    if (neg) s++;
+    if (s == end || *s < '0' || *s > '9') return false;
+    auto mantissa = (unsigned long long)0;
+    auto digits = 0, exp10 = 0;
+    auto integer = true;
+    while (s < end && *s >= '0' && *s <= '9') {
+        if (mantissa || *s != '0') {
+            mantissa = mantissa * 10 + (*s - '0');
+            digits++;
+        }
+        s++;
+    }
+    if (s < end && *s == '.') {
+        integer = false;
+        s++;
+        if (s == end || *s < '0' || *s > '9') return false;
+        while (s < end && *s >= '0' && *s <= '9') {
+            if (mantissa || *s != '0') {
+                mantissa = mantissa * 10 + (*s - '0');
+                digits++;
+            }
+            exp10--;
+            s++;
+        }
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        integer = false;
+        s++;
+        auto eneg = false;
+        if (s < end && (*s == '-' || *s == '+')) eneg = (*s++ == '-');
+        if (s == end || *s < '0' || *s > '9') return false;
+        auto e = 0;
+        while (s < end && *s >= '0' && *s <= '9') {
+            if (e < 10000) e = e * 10 + (*s - '0');
+            s++;
+        }
+        exp10 += eneg ? -e : e;
+    }
+    if (integer && digits <= 18) {
+        node.type = json_type::integer;
+        node.number = neg ? -(double)(long long)mantissa : (double)mantissa;
+        return true;
+    }
+    node.type = json_type::number;
+    if (mantissa == 0) {
+        node.number = neg ? -0.0 : 0.0;
+    } else if (digits <= 15 && exp10 >= -22 && exp10 <= 22) {
+        node.number = (exp10 < 0) ? (double)mantissa / pow10[-exp10] :
+                                    (double)mantissa * pow10[exp10];
+        if (neg) node.number = -node.number;
+    } else {
+        auto str = std::string(node.begin, s);
+        node.number = strtod(str.c_str(), nullptr);
+    }
+    return true;
+}
+
+//
+// Parses a json value, appending it and all its children to the tape.
+//
+static bool _parse_json_value(json_reader& reader, int depth) {
+    _skip_ws(reader);
+    auto& s = reader.cur;
+    auto end = reader.end;
+    if (s == end || depth > 512) return false;
+
+    auto tape = reader.tape;
+    auto id = (int)tape->nodes.size();
+    tape->nodes.emplace_back();
+    reader.stack.push_back(id);
+
+    auto node = json_node();
+    node.begin = s;
+    switch (*s) {
+        case '{':
+        case '[': {
+            auto object = (*s == '{');
+            auto close = object ? '}' : ']';
+            auto base = reader.stack.size();
+            s++;
+            _skip_ws(reader);
+            if (s < end && *s == close) {
+                s++;
+            } else {
+                while (true) {
+                    if (object) {
+                        _skip_ws(reader);
+                        if (s == end || *s != '"') return false;
+                        if (!_parse_json_value(reader, depth + 1))
+                            return false;
+                        _skip_ws(reader);
+                        if (s == end || *s != ':') return false;
+                        s++;
+                    }
+                    if (!_parse_json_value(reader, depth + 1)) return false;
+                    _skip_ws(reader);
+                    if (s == end) return false;
+                    if (*s == ',') {
+                        s++;
+                    } else if (*s == close) {
+                        s++;
+                        break;
+                    } else {
+                        return false;
+                    }
+                }
+            }
+            auto count = (int)(reader.stack.size() - base);
+            node.type = object ? json_type::object : json_type::array;
+            node.size = object ? count / 2 : count;
+            node.children = (int)tape->children.size();
+            tape->children.insert(tape->children.end(),
+                reader.stack.begin() + base, reader.stack.end());
+            reader.stack.resize(base);
+        } break;
+        case '"': {
+            s++;
+            while (s < end && *s != '"') {
+                if ((unsigned char)*s < 0x20) return false;
+                if (*s == '\\') {
+                    node.escaped = true;
+                    s++;
+                    if (s == end) return false;
+                }
+                s++;
+            }
+            if (s == end) return false;
+            s++;
+            node.type = json_type::string;
+        } break;
+        case 't':
+        case 'f':
+        case 'n': {
+            auto word = (*s == 't') ? "true" : (*s == 'f') ? "false" : "null";
+            auto len = strlen(word);
+            if (end - s < len || memcmp(s, word, len)) return false;
+            s += len;
+            node.type = (*word == 'n') ? json_type::null : json_type::boolean;
+            node.number = (*word == 't') ? 1 : 0;
+        } break;
+        default:
+            if (!_parse_json_number(reader, node)) return false;
+            break;
+    }
+    node.end = s;
+    tape->nodes[id] = node;
+    return true;
+}
+
+//
+// Parses a json document into a tape. Returns false on error.
+//
+static bool parse_json(json_tape& tape, const char* begin, const char* end) {
+    tape.nodes.clear();
+    tape.children.clear();
+    tape.nodes.reserve((end - begin) / 8 + 1);
+    tape.children.reserve((end - begin) / 8 + 1);
+    auto reader = json_reader();
+    reader.cur = begin;
+    reader.end = end;
+    reader.tape = &tape;
+    if (!_parse_json_value(reader, 0)) return false;
+    _skip_ws(reader);
+    while (reader.cur < reader.end && *reader.cur == 0) reader.cur++;
+    return reader.cur == reader.end;
+}
+
 // #codegen begin func ---------------------------------------------------------
 
 // Parse error
@@ -94,7 +496,7 @@ struct parse_stack {
 
 // Parse support function.
 template <typename T>
-static bool parse(std::vector<T>& vals, const json& js, parse_stack& err) {
+static bool parse(std::vector<T>& vals, const json_view& js, parse_stack& err) {
     if (!js.is_array()) return false;
     vals.resize(js.size());
     for (auto i = 0; i < js.size(); i++) {
@@ -108,7 +510,7 @@ static bool parse(std::vector<T>& vals, const json& js, parse_stack& err) {
 
 // Parse support function.
 template <typename T, int N>
-static bool parse(ym::vec<T, N>& vals, const json& js, parse_stack& err) {
+static bool parse(ym::vec<T, N>& vals, const json_view& js, parse_stack& err) {
     if (!js.is_array()) return false;
     if (N != js.size()) return false;
     for (auto i = 0; i < N; i++) {
@@ -119,7 +521,7 @@ static bool parse(ym::vec<T, N>& vals, const json& js, parse_stack& err) {
 
 // Parse support function.
 template <typename T, int N>
-static bool parse(ym::quat<T, N>& vals, const json& js, parse_stack& err) {
+static bool parse(ym::quat<T, N>& vals, const json_view& js, parse_stack& err) {
     if (!js.is_array()) return false;
     if (N != js.size()) return false;
     for (auto i = 0; i < N; i++) {
@@ -130,7 +532,7 @@ static bool parse(ym::quat<T, N>& vals, const json& js, parse_stack& err) {
 
 // Parse support function.
 template <typename T, int N, int M>
-static bool parse(ym::mat<T, N, M>& vals, const json& js, parse_stack& err) {
+static bool parse(ym::mat<T, N, M>& vals, const json_view& js, parse_stack& err) {
     if (!js.is_array()) return false;
     if (N * M != js.size()) return false;
     for (auto j = 0; j < M; j++) {
@@ -144,7 +546,7 @@ static bool parse(ym::mat<T, N, M>& vals, const json& js, parse_stack& err) {
 // Parse support function.
 template <typename T>
 static bool parse(
-    std::map<std::string, T>& vals, const json& js, parse_stack& err) {
+    std::map<std::string, T>& vals, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     for (auto kv = js.begin(); kv != js.end(); ++kv) {
         if (!parse(vals[kv.key()], kv.value(), err)) return false;
@@ -155,7 +557,7 @@ static bool parse(
 // Parse support function.
 template <typename T>
 static bool parse_attr(
-    T& val, const char* name, const json& js, parse_stack& err) {
+    T& val, const char* name, const json_view& js, parse_stack& err) {
     auto iter = js.find(name);
     if (iter == js.end()) return true;
     err.path.push_back(name);
@@ -165,48 +567,52 @@ static bool parse_attr(
 }
 
 // Parse int function.
-static bool parse(int& val, const json& js, parse_stack& err) {
+static bool parse(int& val, const json_view& js, parse_stack& err) {
     if (!js.is_number_integer()) return false;
-    val = js;
+    val = js.get_int();
     return true;
 }
 
 // Parse float function.
-static bool parse(float& val, const json& js, parse_stack& err) {
+static bool parse(float& val, const json_view& js, parse_stack& err) {
     if (!js.is_number()) return false;
-    val = js;
+    val = js.get_float();
     return true;
 }
 
 // Parse bool function.
-static bool parse(bool& val, const json& js, parse_stack& err) {
+static bool parse(bool& val, const json_view& js, parse_stack& err) {
     if (!js.is_boolean()) return false;
-    val = js;
+    val = js.get_bool();
     return true;
 }
 
 // Parse std::string function.
-static bool parse(std::string& val, const json& js, parse_stack& err) {
+static bool parse(std::string& val, const json_view& js, parse_stack& err) {
     if (!js.is_string()) return false;
-    val = js;
+    val = js.get_string();
     return true;
 }
 
 // Parse json function.
-static bool parse(json& val, const json& js, parse_stack& err) {
-    val = js;
+static bool parse(json& val, const json_view& js, parse_stack& err) {
+    try {
+        val = js.get_json();
+    } catch (const std::exception&) {
+        return false;
+    }
     return true;
 }
 
 // Parse id function.
 template <typename T>
-static bool parse(glTFid<T>& val, const json& js, parse_stack& err) {
+static bool parse(glTFid<T>& val, const json_view& js, parse_stack& err) {
     if (!js.is_number_integer()) return false;
-    val = glTFid<T>((int)js);
+    val = glTFid<T>(js.get_int());
     return true;
 }
 // Parses a glTFProperty object
-static bool parse(glTFProperty*& val, const json& js, parse_stack& err) {
+static bool parse(glTFProperty*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFProperty;
     if (!parse_attr(val->extensions, "extensions", js, err)) return false;
@@ -216,7 +622,7 @@ static bool parse(glTFProperty*& val, const json& js, parse_stack& err) {
 
 // Parses a glTFChildOfRootProperty object
 static bool parse(
-    glTFChildOfRootProperty*& val, const json& js, parse_stack& err) {
+    glTFChildOfRootProperty*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFChildOfRootProperty;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -225,7 +631,7 @@ static bool parse(
 }
 
 // Parse a glTFAccessorSparseIndicesComponentType enum
-static bool parse(glTFAccessorSparseIndicesComponentType& val, const json& js,
+static bool parse(glTFAccessorSparseIndicesComponentType& val, const json_view& js,
     parse_stack& err) {
     static std::map<int, glTFAccessorSparseIndicesComponentType> table = {
         {5121, glTFAccessorSparseIndicesComponentType::UnsignedByte},
@@ -241,7 +647,7 @@ static bool parse(glTFAccessorSparseIndicesComponentType& val, const json& js,
 
 // Parses a glTFAccessorSparseIndices object
 static bool parse(
-    glTFAccessorSparseIndices*& val, const json& js, parse_stack& err) {
+    glTFAccessorSparseIndices*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAccessorSparseIndices;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -255,7 +661,7 @@ static bool parse(
 
 // Parses a glTFAccessorSparseValues object
 static bool parse(
-    glTFAccessorSparseValues*& val, const json& js, parse_stack& err) {
+    glTFAccessorSparseValues*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAccessorSparseValues;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -266,7 +672,7 @@ static bool parse(
 }
 
 // Parses a glTFAccessorSparse object
-static bool parse(glTFAccessorSparse*& val, const json& js, parse_stack& err) {
+static bool parse(glTFAccessorSparse*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAccessorSparse;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -281,7 +687,7 @@ static bool parse(glTFAccessorSparse*& val, const json& js, parse_stack& err) {
 
 // Parse a glTFAccessorComponentType enum
 static bool parse(
-    glTFAccessorComponentType& val, const json& js, parse_stack& err) {
+    glTFAccessorComponentType& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFAccessorComponentType> table = {
         {5120, glTFAccessorComponentType::Byte},
         {5121, glTFAccessorComponentType::UnsignedByte},
@@ -298,7 +704,7 @@ static bool parse(
 }
 
 // Parse a glTFAccessorType enum
-static bool parse(glTFAccessorType& val, const json& js, parse_stack& err) {
+static bool parse(glTFAccessorType& val, const json_view& js, parse_stack& err) {
     static std::map<std::string, glTFAccessorType> table = {
         {"SCALAR", glTFAccessorType::Scalar}, {"VEC2", glTFAccessorType::Vec2},
         {"VEC3", glTFAccessorType::Vec3}, {"VEC4", glTFAccessorType::Vec4},
@@ -313,7 +719,7 @@ static bool parse(glTFAccessorType& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFAccessor object
-static bool parse(glTFAccessor*& val, const json& js, parse_stack& err) {
+static bool parse(glTFAccessor*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAccessor;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -334,7 +740,7 @@ static bool parse(glTFAccessor*& val, const json& js, parse_stack& err) {
 
 // Parse a glTFAnimationChannelTargetPath enum
 static bool parse(
-    glTFAnimationChannelTargetPath& val, const json& js, parse_stack& err) {
+    glTFAnimationChannelTargetPath& val, const json_view& js, parse_stack& err) {
     static std::map<std::string, glTFAnimationChannelTargetPath> table = {
         {"translation", glTFAnimationChannelTargetPath::Translation},
         {"rotation", glTFAnimationChannelTargetPath::Rotation},
@@ -350,7 +756,7 @@ static bool parse(
 
 // Parses a glTFAnimationChannelTarget object
 static bool parse(
-    glTFAnimationChannelTarget*& val, const json& js, parse_stack& err) {
+    glTFAnimationChannelTarget*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAnimationChannelTarget;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -363,7 +769,7 @@ static bool parse(
 
 // Parses a glTFAnimationChannel object
 static bool parse(
-    glTFAnimationChannel*& val, const json& js, parse_stack& err) {
+    glTFAnimationChannel*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAnimationChannel;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -376,7 +782,7 @@ static bool parse(
 
 // Parse a glTFAnimationSamplerInterpolation enum
 static bool parse(
-    glTFAnimationSamplerInterpolation& val, const json& js, parse_stack& err) {
+    glTFAnimationSamplerInterpolation& val, const json_view& js, parse_stack& err) {
     static std::map<std::string, glTFAnimationSamplerInterpolation> table = {
         {"LINEAR", glTFAnimationSamplerInterpolation::Linear},
         {"STEP", glTFAnimationSamplerInterpolation::Step},
@@ -393,7 +799,7 @@ static bool parse(
 
 // Parses a glTFAnimationSampler object
 static bool parse(
-    glTFAnimationSampler*& val, const json& js, parse_stack& err) {
+    glTFAnimationSampler*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAnimationSampler;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -406,7 +812,7 @@ static bool parse(
 }
 
 // Parses a glTFAnimation object
-static bool parse(glTFAnimation*& val, const json& js, parse_stack& err) {
+static bool parse(glTFAnimation*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAnimation;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -418,7 +824,7 @@ static bool parse(glTFAnimation*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFAsset object
-static bool parse(glTFAsset*& val, const json& js, parse_stack& err) {
+static bool parse(glTFAsset*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFAsset;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -431,7 +837,7 @@ static bool parse(glTFAsset*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFBuffer object
-static bool parse(glTFBuffer*& val, const json& js, parse_stack& err) {
+static bool parse(glTFBuffer*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFBuffer;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -442,7 +848,7 @@ static bool parse(glTFBuffer*& val, const json& js, parse_stack& err) {
 }
 
 // Parse a glTFBufferViewTarget enum
-static bool parse(glTFBufferViewTarget& val, const json& js, parse_stack& err) {
+static bool parse(glTFBufferViewTarget& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFBufferViewTarget> table = {
         {34962, glTFBufferViewTarget::ArrayBuffer},
         {34963, glTFBufferViewTarget::ElementArrayBuffer},
@@ -455,7 +861,7 @@ static bool parse(glTFBufferViewTarget& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFBufferView object
-static bool parse(glTFBufferView*& val, const json& js, parse_stack& err) {
+static bool parse(glTFBufferView*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFBufferView;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -471,7 +877,7 @@ static bool parse(glTFBufferView*& val, const json& js, parse_stack& err) {
 
 // Parses a glTFCameraOrthographic object
 static bool parse(
-    glTFCameraOrthographic*& val, const json& js, parse_stack& err) {
+    glTFCameraOrthographic*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFCameraOrthographic;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -488,7 +894,7 @@ static bool parse(
 
 // Parses a glTFCameraPerspective object
 static bool parse(
-    glTFCameraPerspective*& val, const json& js, parse_stack& err) {
+    glTFCameraPerspective*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFCameraPerspective;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -502,7 +908,7 @@ static bool parse(
 }
 
 // Parse a glTFCameraType enum
-static bool parse(glTFCameraType& val, const json& js, parse_stack& err) {
+static bool parse(glTFCameraType& val, const json_view& js, parse_stack& err) {
     static std::map<std::string, glTFCameraType> table = {
         {"perspective", glTFCameraType::Perspective},
         {"orthographic", glTFCameraType::Orthographic},
@@ -515,7 +921,7 @@ static bool parse(glTFCameraType& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFCamera object
-static bool parse(glTFCamera*& val, const json& js, parse_stack& err) {
+static bool parse(glTFCamera*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFCamera;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -527,7 +933,7 @@ static bool parse(glTFCamera*& val, const json& js, parse_stack& err) {
 }
 
 // Parse a glTFImageMimeType enum
-static bool parse(glTFImageMimeType& val, const json& js, parse_stack& err) {
+static bool parse(glTFImageMimeType& val, const json_view& js, parse_stack& err) {
     static std::map<std::string, glTFImageMimeType> table = {
         {"image/jpeg", glTFImageMimeType::ImageJpeg},
         {"image/png", glTFImageMimeType::ImagePng},
@@ -540,7 +946,7 @@ static bool parse(glTFImageMimeType& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFImage object
-static bool parse(glTFImage*& val, const json& js, parse_stack& err) {
+static bool parse(glTFImage*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFImage;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -551,7 +957,7 @@ static bool parse(glTFImage*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFTextureInfo object
-static bool parse(glTFTextureInfo*& val, const json& js, parse_stack& err) {
+static bool parse(glTFTextureInfo*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFTextureInfo;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -562,7 +968,7 @@ static bool parse(glTFTextureInfo*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFTexture object
-static bool parse(glTFTexture*& val, const json& js, parse_stack& err) {
+static bool parse(glTFTexture*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFTexture;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -573,7 +979,7 @@ static bool parse(glTFTexture*& val, const json& js, parse_stack& err) {
 
 // Parses a glTFMaterialNormalTextureInfo object
 static bool parse(
-    glTFMaterialNormalTextureInfo*& val, const json& js, parse_stack& err) {
+    glTFMaterialNormalTextureInfo*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMaterialNormalTextureInfo;
     if (!parse((glTFTextureInfo*&)val, js, err)) return false;
@@ -583,7 +989,7 @@ static bool parse(
 
 // Parses a glTFMaterialOcclusionTextureInfo object
 static bool parse(
-    glTFMaterialOcclusionTextureInfo*& val, const json& js, parse_stack& err) {
+    glTFMaterialOcclusionTextureInfo*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMaterialOcclusionTextureInfo;
     if (!parse((glTFTextureInfo*&)val, js, err)) return false;
@@ -593,7 +999,7 @@ static bool parse(
 
 // Parses a glTFMaterialPbrMetallicRoughness object
 static bool parse(
-    glTFMaterialPbrMetallicRoughness*& val, const json& js, parse_stack& err) {
+    glTFMaterialPbrMetallicRoughness*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMaterialPbrMetallicRoughness;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -613,7 +1019,7 @@ static bool parse(
 
 // Parses a glTFMaterialPbrSpecularGlossiness object
 static bool parse(
-    glTFMaterialPbrSpecularGlossiness*& val, const json& js, parse_stack& err) {
+    glTFMaterialPbrSpecularGlossiness*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMaterialPbrSpecularGlossiness;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -632,7 +1038,7 @@ static bool parse(
 
 // Parse a glTFMaterialAlphaMode enum
 static bool parse(
-    glTFMaterialAlphaMode& val, const json& js, parse_stack& err) {
+    glTFMaterialAlphaMode& val, const json_view& js, parse_stack& err) {
     static std::map<std::string, glTFMaterialAlphaMode> table = {
         {"OPAQUE", glTFMaterialAlphaMode::Opaque},
         {"MASK", glTFMaterialAlphaMode::Mask},
@@ -646,7 +1052,7 @@ static bool parse(
 }
 
 // Parses a glTFMaterial object
-static bool parse(glTFMaterial*& val, const json& js, parse_stack& err) {
+static bool parse(glTFMaterial*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMaterial;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -663,7 +1069,7 @@ static bool parse(glTFMaterial*& val, const json& js, parse_stack& err) {
     if (!parse_attr(val->pbrMetallicRoughness, "pbrMetallicRoughness", js, err))
         return false;
     if (js.count("extensions")) {
-        auto& js_ext = js["extensions"];
+        auto js_ext = js["extensions"];
         parse_attr(val->pbrSpecularGlossiness,
             "KHR_materials_pbrSpecularGlossiness", js_ext, err);
     }
@@ -672,7 +1078,7 @@ static bool parse(glTFMaterial*& val, const json& js, parse_stack& err) {
 
 // Parse a glTFMeshPrimitiveMode enum
 static bool parse(
-    glTFMeshPrimitiveMode& val, const json& js, parse_stack& err) {
+    glTFMeshPrimitiveMode& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFMeshPrimitiveMode> table = {
         {0, glTFMeshPrimitiveMode::Points}, {1, glTFMeshPrimitiveMode::Lines},
         {2, glTFMeshPrimitiveMode::LineLoop},
@@ -689,7 +1095,7 @@ static bool parse(
 }
 
 // Parses a glTFMeshPrimitive object
-static bool parse(glTFMeshPrimitive*& val, const json& js, parse_stack& err) {
+static bool parse(glTFMeshPrimitive*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMeshPrimitive;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -703,7 +1109,7 @@ static bool parse(glTFMeshPrimitive*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFMesh object
-static bool parse(glTFMesh*& val, const json& js, parse_stack& err) {
+static bool parse(glTFMesh*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFMesh;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -714,7 +1120,7 @@ static bool parse(glTFMesh*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFNode object
-static bool parse(glTFNode*& val, const json& js, parse_stack& err) {
+static bool parse(glTFNode*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFNode;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -731,7 +1137,7 @@ static bool parse(glTFNode*& val, const json& js, parse_stack& err) {
 }
 
 // Parse a glTFSamplerMagFilter enum
-static bool parse(glTFSamplerMagFilter& val, const json& js, parse_stack& err) {
+static bool parse(glTFSamplerMagFilter& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFSamplerMagFilter> table = {
         {9728, glTFSamplerMagFilter::Nearest},
         {9729, glTFSamplerMagFilter::Linear},
@@ -744,7 +1150,7 @@ static bool parse(glTFSamplerMagFilter& val, const json& js, parse_stack& err) {
 }
 
 // Parse a glTFSamplerMinFilter enum
-static bool parse(glTFSamplerMinFilter& val, const json& js, parse_stack& err) {
+static bool parse(glTFSamplerMinFilter& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFSamplerMinFilter> table = {
         {9728, glTFSamplerMinFilter::Nearest},
         {9729, glTFSamplerMinFilter::Linear},
@@ -761,7 +1167,7 @@ static bool parse(glTFSamplerMinFilter& val, const json& js, parse_stack& err) {
 }
 
 // Parse a glTFSamplerWrapS enum
-static bool parse(glTFSamplerWrapS& val, const json& js, parse_stack& err) {
+static bool parse(glTFSamplerWrapS& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFSamplerWrapS> table = {
         {33071, glTFSamplerWrapS::ClampToEdge},
         {33648, glTFSamplerWrapS::MirroredRepeat},
@@ -775,7 +1181,7 @@ static bool parse(glTFSamplerWrapS& val, const json& js, parse_stack& err) {
 }
 
 // Parse a glTFSamplerWrapT enum
-static bool parse(glTFSamplerWrapT& val, const json& js, parse_stack& err) {
+static bool parse(glTFSamplerWrapT& val, const json_view& js, parse_stack& err) {
     static std::map<int, glTFSamplerWrapT> table = {
         {33071, glTFSamplerWrapT::ClampToEdge},
         {33648, glTFSamplerWrapT::MirroredRepeat},
@@ -789,7 +1195,7 @@ static bool parse(glTFSamplerWrapT& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFSampler object
-static bool parse(glTFSampler*& val, const json& js, parse_stack& err) {
+static bool parse(glTFSampler*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFSampler;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -801,7 +1207,7 @@ static bool parse(glTFSampler*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFScene object
-static bool parse(glTFScene*& val, const json& js, parse_stack& err) {
+static bool parse(glTFScene*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFScene;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -810,7 +1216,7 @@ static bool parse(glTFScene*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTFSkin object
-static bool parse(glTFSkin*& val, const json& js, parse_stack& err) {
+static bool parse(glTFSkin*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTFSkin;
     if (!parse((glTFChildOfRootProperty*&)val, js, err)) return false;
@@ -823,7 +1229,7 @@ static bool parse(glTFSkin*& val, const json& js, parse_stack& err) {
 }
 
 // Parses a glTF object
-static bool parse(glTF*& val, const json& js, parse_stack& err) {
+static bool parse(glTF*& val, const json_view& js, parse_stack& err) {
     if (!js.is_object()) return false;
     if (!val) val = new glTF;
     if (!parse((glTFProperty*&)val, js, err)) return false;
@@ -1993,15 +2399,19 @@ glTF* load_gltf(const std::string& filename, bool load_bin, bool load_image,
     auto gltf = std::unique_ptr<glTF>(new glTF());
 
     // load json
-    auto js = json();
-    try {
-        std::ifstream stream(filename.c_str());
-        if (!stream) {
-            if (err) *err = "could not load json";
-            return nullptr;
-        }
-        stream >> js;
-    } catch (const std::exception&) {
+    auto f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        if (err) *err = "could not load json";
+        return nullptr;
+    }
+    fseek(f, 0, SEEK_END);
+    auto json_bytes = std::vector<char>(ftell(f));
+    fseek(f, 0, SEEK_SET);
+    auto nread = fread(json_bytes.data(), 1, json_bytes.size(), f);
+    fclose(f);
+    auto js = json_tape();
+    if (nread != json_bytes.size() ||
+        !parse_json(js, json_bytes.data(), json_bytes.data() + nread)) {
         if (err) *err = "could not load json";
         return nullptr;
     }
@@ -2009,7 +2419,7 @@ glTF* load_gltf(const std::string& filename, bool load_bin, bool load_image,
     // parse json
     auto stack = parse_stack();
     auto gltf_ = gltf.get();
-    if (!parse(gltf_, js, stack)) {
+    if (!parse(gltf_, json_view(&js, 0), stack)) {
         if (err) *err = "error parsing gltf at " + stack.pathname();
         return nullptr;
     }
@@ -2167,11 +2577,9 @@ glTF* load_binary_gltf(const std::string& filename, bool load_bin,
     }
 
     // load json
-    auto js = json();
-    try {
-        json_bytes.push_back(0);
-        js = json::parse(json_bytes.data());
-    } catch (const std::exception&) {
+    auto js = json_tape();
+    if (!parse_json(
+            js, json_bytes.data(), json_bytes.data() + json_bytes.size())) {
         if (err) *err = "could not load json";
         return nullptr;
     }
@@ -2179,7 +2587,7 @@ glTF* load_binary_gltf(const std::string& filename, bool load_bin,
     // parse json
     auto stack = parse_stack();
     auto gltf_ = gltf.get();
-    if (!parse(gltf_, js, stack)) return nullptr;
+    if (!parse(gltf_, json_view(&js, 0), stack)) return nullptr;
 
     // fix internal buffer
     auto buffer = gltf->buffers.at(0);
@@ -4271,6 +4679,314 @@ void compute_morphing_deformation(const shape* shp,
     }
 }
 
+//
+// Morph target restricted to the vertices it moves, stored as
+// structure-of-arrays.
+//
+struct deformation_morph {
+    int target = 0;               // index in the shape morph targets
+    std::vector<int> vids;        // vertex ids
+    std::vector<float> dpos[3];   // position deltas
+    std::vector<float> dnorm[3];  // normal deltas
+};
+
+//
+// Shape vertex data used for deformation, stored as structure-of-arrays.
+//
+struct deformation_stream {
+    const shape* shp = nullptr;             // shape
+    int nverts = 0;                         // number of vertices
+    bool skinned = false;                   // whether it has skinning data
+    std::vector<float> pos[3];              // positions
+    std::vector<float> norm[3];             // normals
+    std::vector<float> weights[4];          // skinning weights
+    std::vector<int> joints[4];             // skinning joints
+    std::vector<deformation_morph> morphs;  // sparse morph targets
+};
+
+//
+// Node instancing deformed shapes, with its joints as indices in the
+// flattened node hierarchy.
+//
+struct deformation_instance {
+    int nid = -1;                        // node index
+    const skin* skn = nullptr;           // skin
+    std::vector<int> joints;             // joint node indices
+    std::vector<int> shapes;             // deformed shapes ids
+    std::vector<ym::frame3f> palette;    // skinning matrices (4x3)
+    std::vector<float> pos[3], norm[3];  // morphed vertices
+};
+
+//
+// Deformation batch. Nodes are sorted so that parents come before children
+// and transforms can be computed in a single pass.
+//
+struct deformation_batch {
+    std::vector<const node*> nodes;               // nodes in topological order
+    std::vector<int> parents;                     // parent node indices
+    std::vector<ym::mat4f> xforms;                // node transforms
+    std::vector<deformation_stream*> streams;     // shape streams
+    std::vector<int> shape_streams;               // stream per deformed shape
+    std::vector<deformation_instance> instances;  // deformed instances
+    std::vector<deformed_shape> shapes;           // deformed shapes
+
+    ~deformation_batch() {
+        for (auto stream : streams)
+            if (stream) delete stream;
+    }
+};
+
+//
+// Prepare the vertex streams of a shape.
+//
+static deformation_stream* make_deformation_stream(const shape* shp) {
+    auto stream = new deformation_stream();
+    stream->shp = shp;
+    stream->nverts = (int)shp->pos.size();
+    stream->skinned = !shp->skin_weights.empty() && !shp->skin_joints.empty();
+    for (auto c = 0; c < 3; c++) {
+        stream->pos[c].resize(stream->nverts);
+        stream->norm[c].resize(stream->nverts);
+        for (auto i = 0; i < stream->nverts; i++) {
+            stream->pos[c][i] = shp->pos[i][c];
+            stream->norm[c][i] = (shp->norm.empty()) ? 0 : shp->norm[i][c];
+        }
+    }
+    if (stream->skinned) {
+        for (auto k = 0; k < 4; k++) {
+            stream->weights[k].resize(stream->nverts);
+            stream->joints[k].resize(stream->nverts);
+            for (auto i = 0; i < stream->nverts; i++) {
+                stream->weights[k][i] = shp->skin_weights[i][k];
+                stream->joints[k][i] = shp->skin_joints[i][k];
+            }
+        }
+    }
+    for (auto idx = 0; idx < shp->morph_targets.size(); idx++) {
+        auto morph = shp->morph_targets[idx];
+        auto smorph = deformation_morph();
+        smorph.target = idx;
+        for (auto i = 0; i < stream->nverts; i++) {
+            auto dpos = (morph->pos.empty()) ? ym::zero3f : morph->pos[i];
+            auto dnorm = (morph->norm.empty() || shp->norm.empty()) ?
+                             ym::zero3f :
+                             morph->norm[i];
+            if (dpos == ym::zero3f && dnorm == ym::zero3f) continue;
+            smorph.vids.push_back(i);
+            for (auto c = 0; c < 3; c++) {
+                smorph.dpos[c].push_back(dpos[c]);
+                smorph.dnorm[c].push_back(dnorm[c]);
+            }
+        }
+        if (!smorph.vids.empty()) stream->morphs.push_back(smorph);
+    }
+    return stream;
+}
+
+//
+// Make a deformation batch
+//
+deformation_batch* make_deformation_batch(const scene_group* scns) {
+    auto batch = new deformation_batch();
+
+    // flatten node hierarchy in topological order
+    auto parent_map = std::unordered_map<const node*, const node*>();
+    for (auto nde : scns->nodes) {
+        for (auto child : nde->children) parent_map[child] = nde;
+    }
+    auto node_ids = std::unordered_map<const node*, int>();
+    for (auto nde : scns->nodes) {
+        if (parent_map.count(nde)) continue;
+        node_ids[nde] = (int)batch->nodes.size();
+        batch->nodes.push_back(nde);
+        batch->parents.push_back(-1);
+    }
+    for (auto nid = 0; nid < batch->nodes.size(); nid++) {
+        for (auto child : batch->nodes[nid]->children) {
+            node_ids[child] = (int)batch->nodes.size();
+            batch->nodes.push_back(child);
+            batch->parents.push_back(nid);
+        }
+    }
+    batch->xforms.resize(batch->nodes.size(), ym::identity_mat4f);
+
+    // instances and shapes
+    auto stream_ids = std::unordered_map<const shape*, int>();
+    for (auto nid = 0; nid < batch->nodes.size(); nid++) {
+        auto nde = batch->nodes[nid];
+        if (!nde->msh) continue;
+        auto inst = deformation_instance();
+        inst.nid = nid;
+        inst.skn = nde->skn;
+        if (nde->skn) {
+            for (auto joint : nde->skn->joints)
+                inst.joints.push_back(node_ids.at(joint));
+            inst.palette.resize(inst.joints.size());
+        }
+        for (auto shp : nde->msh->shapes) {
+            auto skinned = nde->skn && !shp->skin_weights.empty() &&
+                           !shp->skin_joints.empty();
+            if (!skinned && shp->morph_targets.empty()) continue;
+            if (!stream_ids.count(shp)) {
+                stream_ids[shp] = (int)batch->streams.size();
+                batch->streams.push_back(make_deformation_stream(shp));
+            }
+            auto dshp = deformed_shape();
+            dshp.ist = nde;
+            dshp.shp = shp;
+            dshp.pos = shp->pos;
+            dshp.norm = shp->norm;
+            inst.shapes.push_back((int)batch->shapes.size());
+            batch->shapes.push_back(dshp);
+            batch->shape_streams.push_back(stream_ids.at(shp));
+        }
+        if (!inst.shapes.empty()) batch->instances.push_back(inst);
+    }
+
+    return batch;
+}
+
+//
+// Free a deformation batch
+//
+void free_deformation_batch(deformation_batch*& batch) {
+    if (batch) delete batch;
+    batch = nullptr;
+}
+
+//
+// Deform the shapes of an instance. Morph targets are accumulated only on
+// the vertices they move, then skinning blends the 4x3 joint matrices of
+// each vertex and applies the result once.
+//
+static void update_deformation_instance(
+    deformation_batch* batch, deformation_instance& inst) {
+    auto nde = batch->nodes[inst.nid];
+    if (inst.skn) {
+        auto inv_xform = ym::inverse(batch->xforms[inst.nid]);
+        for (auto j = 0; j < inst.joints.size(); j++) {
+            auto xform = inv_xform * batch->xforms[inst.joints[j]];
+            if (!inst.skn->pose_matrices.empty())
+                xform = xform * inst.skn->pose_matrices[j];
+            inst.palette[j] = ym::to_frame(xform);
+        }
+    }
+
+    for (auto sid : inst.shapes) {
+        auto stream = batch->streams[batch->shape_streams[sid]];
+        auto& dshp = batch->shapes[sid];
+        auto nverts = stream->nverts;
+        auto has_norm = !stream->shp->norm.empty();
+
+        // morphing
+        const float* pos[3] = {stream->pos[0].data(), stream->pos[1].data(),
+            stream->pos[2].data()};
+        const float* norm[3] = {stream->norm[0].data(),
+            stream->norm[1].data(), stream->norm[2].data()};
+        auto morphed = false;
+        for (auto& smorph : stream->morphs) {
+            auto weight = (smorph.target < nde->morph_weights.size()) ?
+                              nde->morph_weights[smorph.target] :
+                              stream->shp->morph_targets[smorph.target]->weight;
+            if (weight == 0) continue;
+            if (!morphed) {
+                for (auto c = 0; c < 3; c++) {
+                    inst.pos[c].assign(
+                        stream->pos[c].begin(), stream->pos[c].end());
+                    inst.norm[c].assign(
+                        stream->norm[c].begin(), stream->norm[c].end());
+                    pos[c] = inst.pos[c].data();
+                    norm[c] = inst.norm[c].data();
+                }
+                morphed = true;
+            }
+            auto nmorph = (int)smorph.vids.size();
+            auto vids = smorph.vids.data();
+            for (auto c = 0; c < 3; c++) {
+                auto mpos = inst.pos[c].data(), mnorm = inst.norm[c].data();
+                auto dpos = smorph.dpos[c].data();
+                auto dnorm = smorph.dnorm[c].data();
+                for (auto i = 0; i < nmorph; i++) {
+                    mpos[vids[i]] += weight * dpos[i];
+                    mnorm[vids[i]] += weight * dnorm[i];
+                }
+            }
+        }
+
+        // skinning
+        auto out_pos = dshp.pos.data();
+        auto out_norm = dshp.norm.data();
+        if (inst.skn && stream->skinned) {
+            auto palette = (const float*)inst.palette.data();
+            const float* weights[4] = {stream->weights[0].data(),
+                stream->weights[1].data(), stream->weights[2].data(),
+                stream->weights[3].data()};
+            const int* joints[4] = {stream->joints[0].data(),
+                stream->joints[1].data(), stream->joints[2].data(),
+                stream->joints[3].data()};
+            for (auto i = 0; i < nverts; i++) {
+                float m[12];
+                auto m0 = palette + joints[0][i] * 12;
+                auto w0 = weights[0][i];
+                for (auto c = 0; c < 12; c++) m[c] = m0[c] * w0;
+                for (auto k = 1; k < 4; k++) {
+                    auto mk = palette + joints[k][i] * 12;
+                    auto wk = weights[k][i];
+                    for (auto c = 0; c < 12; c++) m[c] += mk[c] * wk;
+                }
+                auto px = pos[0][i], py = pos[1][i], pz = pos[2][i];
+                out_pos[i] = {m[0] * px + m[3] * py + m[6] * pz + m[9],
+                    m[1] * px + m[4] * py + m[7] * pz + m[10],
+                    m[2] * px + m[5] * py + m[8] * pz + m[11]};
+                if (!has_norm) continue;
+                auto nx = norm[0][i], ny = norm[1][i], nz = norm[2][i];
+                out_norm[i] = ym::normalize(
+                    ym::vec3f{m[0] * nx + m[3] * ny + m[6] * nz,
+                        m[1] * nx + m[4] * ny + m[7] * nz,
+                        m[2] * nx + m[5] * ny + m[8] * nz});
+            }
+        } else {
+            for (auto i = 0; i < nverts; i++) {
+                out_pos[i] = {pos[0][i], pos[1][i], pos[2][i]};
+            }
+            if (has_norm) {
+                for (auto i = 0; i < nverts; i++) {
+                    out_norm[i] = {norm[0][i], norm[1][i], norm[2][i]};
+                }
+            }
+        }
+    }
+}
+
+//
+// Update a deformation batch
+//
+void update_deformation_batch(deformation_batch* batch, bool parallel) {
+    for (auto nid = 0; nid < batch->nodes.size(); nid++) {
+        auto xform = node_transform(batch->nodes[nid]);
+        if (batch->parents[nid] >= 0)
+            xform = batch->xforms[batch->parents[nid]] * xform;
+        batch->xforms[nid] = xform;
+    }
+    auto ninstances = (int)batch->instances.size();
+    if (parallel && ninstances > 1) {
+        yu::concurrent::parallel_for(ninstances, [batch](int idx) {
+            update_deformation_instance(batch, batch->instances[idx]);
+        });
+    } else {
+        for (auto& inst : batch->instances)
+            update_deformation_instance(batch, inst);
+    }
+}
+
+//
+// Deformed shapes
+//
+const std::vector<deformed_shape>& get_deformed_shapes(
+    const deformation_batch* batch) {
+    return batch->shapes;
+}
+
 //
 // Animation times
 //
@@ -7,10 +7,10 @@
 /// Supports glTF version 2.0 and the following extensions: `KHR_binary_glTF`,
 /// `KHR_specular_glossiness`.
 ///
-/// This library depends in yocto_math.h, JSON loading/writing depends on
-/// json.hpp. Texture loading/saving depends on yocto_image.h. If the texture
-/// loading/saving dependency is not desired, it can be disabled by defining
-/// YGLTF_NO_IMAGE before including this file.
+/// This library depends in yocto_math.h and yocto_utils.h for concurrency,
+/// JSON loading/writing depends on json.hpp. Texture loading/saving depends on
+/// yocto_image.h. If the texture loading/saving dependency is not desired, it
+/// can be disabled by defining YGLTF_NO_IMAGE before including this file.
 ///
 /// The library provides two interfaces. A low-level interface is a direct
 /// C++ translation of the glTF schemas and should be used if one wants
@@ -33,7 +33,9 @@
 /// 2. look at the `scene` data structures for access to individual elements
 /// 3. to support animation, use `update_animated_transforms()`
 /// 4. to support skinning, use `get_skin_transforms()`
-/// 5. for morphing, use `compute_morphing_deformation()`
+/// 5. for morphing, use `compute_morphing_deformation()`; to skin and morph
+///    many instances every frame, use `make_deformation_batch()` and
+///    `update_deformation_batch()`
 /// 6. can also manipulate the scene by adding missing data with `add_XXX()`
 ///    functions
 /// 7. for rendering scenes, use `get_scene_cameras()` and
@@ -74,6 +76,8 @@
 ///
 /// ## History
 ///
+/// - v 0.24: batched skinning and morphing of many instances
+/// - v 0.23: faster json loading without building a nlohmann::json tree
 /// - v 0.22: conversion to spec gloss
 /// - v 0.21: use reference interface for textures
 /// - v 0.20: removal of buggy shape splitting function
@@ -700,6 +704,54 @@ void compute_morphing_deformation(const shape* shp,
     const std::vector<float>& weights, std::vector<ym::vec3f>& pos,
     std::vector<ym::vec3f>& norm, std::vector<ym::vec4f>& tangsp);
 
+///
+/// Shape instance deformed by skinning and morphing in a deformation batch.
+///
+struct deformed_shape {
+    /// node instancing the shape
+    const node* ist = nullptr;
+    /// shape
+    const shape* shp = nullptr;
+    /// deformed positions (in the node coordinate frame)
+    std::vector<ym::vec3f> pos;
+    /// deformed normals (in the node coordinate frame)
+    std::vector<ym::vec3f> norm;
+};
+
+///
+/// Batch of skinned and morphed shape instances deformed on the CPU.
+///
+struct deformation_batch;
+
+///
+/// Make a deformation batch for all the skinned or morphed shape instances in
+/// the scene group. Joint hierarchies are flattened in topological order,
+/// vertex data is stored as structure-of-arrays and morph targets are kept
+/// only for the vertices they move. The scene structure must not change while
+/// the batch is in use, but node transforms and morph weights can.
+///
+deformation_batch* make_deformation_batch(const scene_group* scns);
+
+///
+/// Free a deformation batch.
+///
+void free_deformation_batch(deformation_batch*& batch);
+
+///
+/// Deform all shapes in the batch using the current node transforms and
+/// morph weights, e.g. after `update_animated_transforms()`. Instances are
+/// deformed in parallel if requested. Results are equivalent to
+/// `compute_morphing_deformation()` followed by skinning with
+/// `get_skin_transforms()`.
+///
+void update_deformation_batch(deformation_batch* batch, bool parallel = true);
+
+///
+/// Deformed shapes in the batch, updated by `update_deformation_batch()`.
+///
+const std::vector<deformed_shape>& get_deformed_shapes(
+    const deformation_batch* batch);
+
 ///
 /// Computes a scene bounding box
 ///
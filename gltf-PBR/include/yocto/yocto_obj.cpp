@@ -33,11 +33,15 @@
 #include "yocto_obj.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cfloat>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <thread>
 #include <unordered_map>
 
 #ifndef YOBJ_NO_IMAGE
@@ -86,37 +90,113 @@ inline int splitws(char* str, char** splits, int maxsplits) {
     return n;
 }
 
+//
+// Converts a string to an int as atoi().
+//
+inline int fast_atoi(const char* str) {
+    auto neg = false;
+    if (*str == '-' || *str == '+') neg = *str++ == '-';
+    auto value = 0ll;
+    while (*str >= '0' && *str <= '9') value = value * 10 + (*str++ - '0');
+    return (int)(neg ? -value : value);
+}
+
+//
+// Converts a string to a double as atof(). Decimal numbers with at most 19
+// significant digits and small exponents are computed exactly from their
+// integer mantissa, since both the mantissa and the power of ten are exact
+// doubles. All other numbers are handled by atof(), so that results are
+// always the same.
+//
+inline double fast_atof(const char* str) {
+    static const double exp10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+        1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+        1e21, 1e22};
+    auto ptr = str;
+    auto neg = false;
+    if (*ptr == '-' || *ptr == '+') neg = *ptr++ == '-';
+    if (ptr[0] == '0' && (ptr[1] == 'x' || ptr[1] == 'X')) return atof(str);
+    auto mantissa = 0ull;
+    auto digits = 0, exponent = 0;
+    auto has_digits = false;
+    while (*ptr == '0') {
+        has_digits = true;
+        ptr++;
+    }
+    while (*ptr >= '0' && *ptr <= '9') {
+        mantissa = mantissa * 10 + (*ptr++ - '0');
+        has_digits = true;
+        digits += 1;
+    }
+    if (*ptr == '.') {
+        ptr++;
+        if (!digits) {
+            while (*ptr == '0') {
+                has_digits = true;
+                exponent -= 1;
+                ptr++;
+            }
+        }
+        while (*ptr >= '0' && *ptr <= '9') {
+            mantissa = mantissa * 10 + (*ptr++ - '0');
+            has_digits = true;
+            digits += 1;
+            exponent -= 1;
+        }
+    }
+    if (!has_digits || digits > 19) return atof(str);
+    if (*ptr == 'e' || *ptr == 'E') {
+        auto exp_ptr = ptr + 1;
+        auto exp_neg = false;
+        if (*exp_ptr == '-' || *exp_ptr == '+') exp_neg = *exp_ptr++ == '-';
+        if (*exp_ptr >= '0' && *exp_ptr <= '9') {
+            auto exp_value = 0;
+            while (*exp_ptr >= '0' && *exp_ptr <= '9') {
+                if (exp_value < 10000)
+                    exp_value = exp_value * 10 + (*exp_ptr - '0');
+                exp_ptr++;
+            }
+            exponent += exp_neg ? -exp_value : exp_value;
+        }
+    }
+    if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+        return atof(str);
+    auto value = (exponent < 0) ? (double)mantissa / exp10[-exponent] :
+                                  (double)mantissa * exp10[exponent];
+    return neg ? -value : value;
+}
+
 //
 // Parses one int.
 //
-inline int parse_int(char** tok) { return atoi(tok[0]); }
+inline int parse_int(char** tok) { return fast_atoi(tok[0]); }
 
 //
 // Parses one float.
 //
-inline float parse_float(char** tok) { return atof(tok[0]); }
+inline float parse_float(char** tok) { return fast_atof(tok[0]); }
 
 //
 // Parses two floats.
 //
 inline ym::vec2f parse_float2(char** tok) {
-    return ym::vec2f{(float)atof(tok[0]), (float)atof(tok[1])};
+    return ym::vec2f{(float)fast_atof(tok[0]), (float)fast_atof(tok[1])};
 }
 
 //
 // Parses three floats.
 //
 inline ym::vec3f parse_float3(char** tok) {
-    return ym::vec3f{
-        (float)atof(tok[0]), (float)atof(tok[1]), (float)atof(tok[2])};
+    return ym::vec3f{(float)fast_atof(tok[0]), (float)fast_atof(tok[1]),
+        (float)fast_atof(tok[2])};
 }
 
 //
 // Parses four floats.
 //
 inline ym::vec4f parse_float4(char** tok) {
-    return ym::vec4f{(float)atof(tok[0]), (float)atof(tok[1]),
-        (float)atof(tok[2]), (float)atof(tok[3])};
+    return ym::vec4f{(float)fast_atof(tok[0]), (float)fast_atof(tok[1]),
+        (float)fast_atof(tok[2]), (float)fast_atof(tok[3])};
 }
 
 //
@@ -125,7 +205,7 @@ inline ym::vec4f parse_float4(char** tok) {
 inline ym::mat4f parse_float16(char** tok) {
     ym::mat4f m;
     auto mm = (float*)&m;
-    for (auto i = 0; i < 16; i++) mm[i] = (float)atof(tok[i]);
+    for (auto i = 0; i < 16; i++) mm[i] = (float)fast_atof(tok[i]);
     return m;
 }
 
@@ -154,7 +234,7 @@ inline void parse_vertlist(char** tok, int ntoks,
                 v_ptr[i] = -1;
                 continue;
             }
-            v_ptr[i] = (int)atoi(splits[i]);
+            v_ptr[i] = fast_atoi(splits[i]);
             v_ptr[i] = (v_ptr[i] < 0) ? vs_ptr[i] + v_ptr[i] : v_ptr[i] - 1;
         }
         elems.push_back(v);
@@ -162,16 +242,342 @@ inline void parse_vertlist(char** tok, int ntoks,
 }
 
 //
-// Loads an OBJ
+// Reads a whole file in memory.
+//
+inline bool read_file(const std::string& filename, std::vector<char>& buffer) {
+    auto file = fopen(filename.c_str(), "rb");
+    if (!file) return false;
+    buffer.clear();
+    auto block = (size_t)(1 << 24);
+    while (true) {
+        auto size = buffer.size();
+        buffer.resize(size + block);
+        auto nread = fread(buffer.data() + size, 1, block, file);
+        buffer.resize(size + nread);
+        if (nread < block) break;
+        if (block < ((size_t)1 << 28)) block *= 2;
+    }
+    auto ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+//
+// Gets the length of the next line in a buffer, including its newline.
+// As with fgets(), lines are split every 4095 characters.
+//
+inline size_t next_line(const char* str, const char* end) {
+    auto max_len = std::min((size_t)(end - str), (size_t)4095);
+    auto nl = (const char*)memchr(str, '\n', max_len);
+    return nl ? (size_t)(nl - str) + 1 : max_len;
+}
+
+//
+// OBJ parsing state. When parsing chunks of a file in parallel, each chunk
+// starts by appending to the last group of the previous chunk, whose material
+// name and smoothing are not known yet.
+//
+struct obj_parse_state {
+    // vertex counts, used to resolve negative indices
+    obj_vertex vert_size = {0, 0, 0, 0, 0};
+    // current material name
+    std::string matname;
+    // material libraries
+    std::vector<std::string> mtllibs;
+    // buffer of element vertices
+    std::vector<obj_vertex> elems;
+
+    // whether the material name is known
+    bool matname_known = true;
+    // number of groups created before the material name is known
+    int unknown_matnames = 0;
+    // whether elements are added to the last group of the previous chunk
+    bool continuation = false;
+};
+
+//
+// Parses one OBJ line. Returns false if the line depends on the state of
+// previous chunks, leaving the state unchanged.
+//
+inline bool parse_obj_line(
+    obj* asset, obj_parse_state& state, char* line, bool flip_texcoord) {
+    char* toks[1024];
+    int ntok = splitws(line, toks, 1024);
+
+    // skip empty and comments
+    if (!ntok) return true;
+    if (toks[0][0] == '#') return true;
+
+    // set up code
+    auto tok_s = toks[0];
+    auto cur_tok = toks + 1;
+    auto cur_ntok = ntok - 1;
+    auto& vert_size = state.vert_size;
+    auto& cur_elems = state.elems;
+    auto& cur_matname = state.matname;
+    auto add_group = [&state](std::vector<obj_group>& groups,
+                         const std::string& name, bool smoothing) {
+        if (!state.matname_known) state.unknown_matnames += 1;
+        groups.emplace_back();
+        groups.back().matname = state.matname;
+        groups.back().groupname = name;
+        groups.back().smoothing = smoothing;
+        state.continuation = false;
+    };
+    auto add_elems = [asset, &cur_elems](obj_element_type type) {
+        auto& g = asset->objects.back().groups.back();
+        g.elems.push_back(
+            {(uint32_t)g.verts.size(), type, (uint16_t)cur_elems.size()});
+        g.verts.insert(g.verts.end(), cur_elems.begin(), cur_elems.end());
+    };
+
+    // possible token values
+    if (!strcmp(tok_s, "v")) {
+        vert_size.pos += 1;
+        asset->pos.push_back(parse_float3(cur_tok));
+    } else if (!strcmp(tok_s, "vn")) {
+        vert_size.norm += 1;
+        asset->norm.push_back(parse_float3(cur_tok));
+    } else if (!strcmp(tok_s, "vt")) {
+        vert_size.texcoord += 1;
+        asset->texcoord.push_back(parse_float2(cur_tok));
+        if (flip_texcoord)
+            asset->texcoord.back()[1] = 1 - asset->texcoord.back()[1];
+    } else if (!strcmp(tok_s, "vc")) {
+        vert_size.color += 1;
+        asset->color.push_back(parse_float4(cur_tok));
+    } else if (!strcmp(tok_s, "vr")) {
+        vert_size.radius += 1;
+        asset->radius.push_back(parse_float(cur_tok));
+    } else if (!strcmp(tok_s, "f")) {
+        parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
+        add_elems(obj_element_type::face);
+    } else if (!strcmp(tok_s, "l")) {
+        parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
+        add_elems(obj_element_type::line);
+    } else if (!strcmp(tok_s, "p")) {
+        parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
+        add_elems(obj_element_type::point);
+    } else if (!strcmp(tok_s, "t")) {
+        parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
+        add_elems(obj_element_type::tetra);
+    } else if (!strcmp(tok_s, "o")) {
+        auto name = (cur_ntok) ? cur_tok[0] : "";
+        asset->objects.push_back({name, {}});
+        add_group(asset->objects.back().groups, "", true);
+    } else if (!strcmp(tok_s, "usemtl")) {
+        auto name = (cur_ntok) ? cur_tok[0] : "";
+        cur_matname = name;
+        state.matname_known = true;
+        add_group(asset->objects.back().groups, "", true);
+    } else if (!strcmp(tok_s, "g")) {
+        auto name = (cur_ntok) ? cur_tok[0] : "";
+        add_group(asset->objects.back().groups, name, true);
+    } else if (!strcmp(tok_s, "s")) {
+        if (state.continuation) return false;
+        auto name = (cur_ntok) ? cur_tok[0] : "";
+        auto smoothing = name == std::string("on");
+        if (asset->objects.back().groups.back().smoothing != smoothing) {
+            add_group(asset->objects.back().groups, name, smoothing);
+        }
+    } else if (!strcmp(tok_s, "mtllib")) {
+        auto name = (cur_ntok) ? cur_tok[0] : "";
+        if (name != std::string("")) {
+            auto found = false;
+            for (auto lib : state.mtllibs) {
+                if (lib == name) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) state.mtllibs.push_back(name);
+        }
+    } else if (!strcmp(tok_s, "c")) {
+        asset->cameras.emplace_back();
+        auto& cam = asset->cameras.back();
+        cam.name = (cur_ntok) ? cur_tok[0] : "";
+        cam.ortho = parse_int(cur_tok + 1);
+        cam.yfov = parse_float(cur_tok + 2);
+        cam.aspect = parse_float(cur_tok + 3);
+        cam.aperture = parse_float(cur_tok + 4);
+        cam.focus = parse_float(cur_tok + 5);
+        cam.translation = parse_float3(cur_tok + 6);
+        cam.rotation = (ym::quat4f)parse_float4(cur_tok + 9);
+        if (cur_ntok > 13) cam.matrix = parse_float16(cur_tok + 13);
+    } else if (!strcmp(tok_s, "e")) {
+        asset->environments.emplace_back();
+        auto& env = asset->environments.back();
+        env.name = (cur_ntok) ? cur_tok[0] : "<unnamed>";
+        env.matname = (cur_ntok - 1) ? cur_tok[1] : "<unnamed_material>";
+        env.rotation = (ym::quat4f)parse_float4(cur_tok + 2);
+        if (cur_ntok > 6) env.matrix = parse_float16(cur_tok + 6);
+    } else if (!strcmp(tok_s, "i")) {
+        asset->instances.emplace_back();
+        auto& ist = asset->instances.back();
+        ist.name = (cur_ntok) ? cur_tok[0] : "<unnamed>";
+        ist.meshname = (cur_ntok - 1) ? cur_tok[1] : "<unnamed_mesh>";
+        ist.translation = parse_float3(cur_tok + 2);
+        ist.rotation = (ym::quat4f)parse_float4(cur_tok + 5);
+        ist.scale = parse_float3(cur_tok + 9);
+        if (cur_ntok > 12) ist.matrix = parse_float16(cur_tok + 12);
+    } else {
+        // unused
+    }
+    return true;
+}
+
+//
+// Parses the lines of a buffer. Returns false if a line depends on the
+// state of previous chunks.
+//
+inline bool parse_obj_lines(obj* asset, obj_parse_state& state,
+    const char* start, const char* end, bool flip_texcoord) {
+    char line[4096];
+    while (start < end) {
+        auto len = next_line(start, end);
+        memcpy(line, start, len);
+        line[len] = 0;
+        start += len;
+        if (!parse_obj_line(asset, state, line, flip_texcoord)) return false;
+    }
+    return true;
+}
+
+//
+// Counts the vertex data lines in a buffer.
+//
+inline obj_vertex count_obj_vertices(const char* start, const char* end) {
+    auto count = obj_vertex{0, 0, 0, 0, 0};
+    while (start < end) {
+        auto len = next_line(start, end);
+        auto str = start, line_end = start + len;
+        start += len;
+        while (str < line_end && *str && isspace(*str)) str++;
+        if (str == line_end || *str != 'v') continue;
+        str++;
+        auto next = (str < line_end) ? *str : 0;
+        if (next && !isspace(next)) {
+            str++;
+            if (str < line_end && *str && !isspace(*str)) continue;
+        }
+        switch (next) {
+            case 'n': count.norm += 1; break;
+            case 't': count.texcoord += 1; break;
+            case 'c': count.color += 1; break;
+            case 'r': count.radius += 1; break;
+            default:
+                if (!next || isspace(next)) count.pos += 1;
+                break;
+        }
+    }
+    return count;
+}
+
+//
+// Chunk of an OBJ file parsed in parallel.
+//
+struct obj_chunk {
+    const char* start = nullptr;
+    const char* end = nullptr;
+    obj_vertex vert_size = {0, 0, 0, 0, 0};
+    obj asset;
+    obj_parse_state state;
+    bool parsed = false;
+};
+
+//
+// Appends an array to another, moving it if the latter is empty.
+//
+template <typename T>
+inline void append_vector(std::vector<T>& vec, std::vector<T>& other) {
+    if (vec.empty()) {
+        std::swap(vec, other);
+    } else {
+        vec.insert(vec.end(), other.begin(), other.end());
+    }
+}
+
+//
+// Appends a parsed chunk to an OBJ, setting the material names that were
+// not known when parsing.
+//
+inline void merge_obj_chunk(
+    obj* asset, obj_parse_state& state, obj_chunk& chunk) {
+    auto& cobj = chunk.asset;
+    auto unknown = chunk.state.unknown_matnames;
+    for (auto oid = 0; oid < cobj.objects.size() && unknown; oid++) {
+        auto& groups = cobj.objects[oid].groups;
+        for (auto gid = (oid) ? 0 : 1; gid < groups.size() && unknown; gid++) {
+            groups[gid].matname = state.matname;
+            unknown -= 1;
+        }
+    }
+
+    // vertex data
+    state.vert_size.pos += (int)cobj.pos.size();
+    state.vert_size.norm += (int)cobj.norm.size();
+    state.vert_size.texcoord += (int)cobj.texcoord.size();
+    state.vert_size.color += (int)cobj.color.size();
+    state.vert_size.radius += (int)cobj.radius.size();
+    append_vector(asset->pos, cobj.pos);
+    append_vector(asset->norm, cobj.norm);
+    append_vector(asset->texcoord, cobj.texcoord);
+    append_vector(asset->color, cobj.color);
+    append_vector(asset->radius, cobj.radius);
+
+    // continue the last group and object
+    auto& first = cobj.objects.front().groups.front();
+    auto& last = asset->objects.back().groups.back();
+    auto offset = (uint32_t)last.verts.size();
+    for (auto& elem : first.elems) elem.start += offset;
+    append_vector(last.elems, first.elems);
+    append_vector(last.verts, first.verts);
+    auto& groups = asset->objects.back().groups;
+    groups.insert(groups.end(),
+        std::make_move_iterator(cobj.objects.front().groups.begin() + 1),
+        std::make_move_iterator(cobj.objects.front().groups.end()));
+    asset->objects.insert(asset->objects.end(),
+        std::make_move_iterator(cobj.objects.begin() + 1),
+        std::make_move_iterator(cobj.objects.end()));
+
+    // scene data
+    asset->cameras.insert(
+        asset->cameras.end(), cobj.cameras.begin(), cobj.cameras.end());
+    asset->environments.insert(asset->environments.end(),
+        cobj.environments.begin(), cobj.environments.end());
+    asset->instances.insert(
+        asset->instances.end(), cobj.instances.begin(), cobj.instances.end());
+
+    // parsing state
+    if (chunk.state.matname_known) state.matname = chunk.state.matname;
+    for (auto& lib : chunk.state.mtllibs) {
+        if (std::find(state.mtllibs.begin(), state.mtllibs.end(), lib) ==
+            state.mtllibs.end())
+            state.mtllibs.push_back(lib);
+    }
+    chunk.asset = obj();
+}
+
+//
+// Minimum size of the chunks parsed in parallel
+//
+const auto obj_chunk_size = (size_t)(1 << 22);
+
+//
+// Loads an OBJ. The file is read in memory and split into chunks of lines,
+// whose vertex counts are computed first to resolve negative indices. Chunks
+// are then parsed in parallel and appended in order, so that the result is
+// the same as parsing the file line by line. Chunks that depend on the state
+// of the previous ones are parsed again after merging the previous ones.
 //
 obj* load_obj(const std::string& filename, bool flip_texcoord, bool flip_tr,
     std::string* err) {
     // clear obj
     auto asset = std::unique_ptr<obj>(new obj());
 
-    // open file
-    auto file = fopen(filename.c_str(), "rt");
-    if (!file) {
+    // read file
+    auto buffer = std::vector<char>();
+    if (!read_file(filename, buffer)) {
         if (err) *err = "cannot open filename " + filename;
         return nullptr;
     }
@@ -180,135 +586,85 @@ obj* load_obj(const std::string& filename, bool flip_texcoord, bool flip_tr,
     asset->objects.push_back({});
     asset->objects.back().groups.push_back({});
 
-    // allocate buffers to avoid re-allocing
-    auto cur_elems = std::vector<obj_vertex>();
-    auto cur_matname = std::string();
-    auto cur_mtllibs = std::vector<std::string>();
-
-    // keep track of array lengths
-    auto vert_size = obj_vertex{0, 0, 0, 0, 0};
-
-    // read the file line by line
-    char line[4096];
-    char* toks[1024];
-    auto linenum = 0;
-    while (fgets(line, 4096, file)) {
-        linenum += 1;
-        int ntok = splitws(line, toks, 1024);
+    // split the file into chunks at line boundaries
+    auto nthreads = std::max((int)std::thread::hardware_concurrency(), 1);
+    auto chunk_size = buffer.size();
+    if (nthreads > 1)
+        chunk_size = std::max(buffer.size() / (nthreads * 4), obj_chunk_size);
+    auto chunks = std::vector<obj_chunk>();
+    auto start = (const char*)buffer.data(), end = start + buffer.size();
+    while (start < end) {
+        auto chunk_end = start + std::min(chunk_size, (size_t)(end - start));
+        if (chunk_end < end) {
+            auto nl = (const char*)memchr(chunk_end, '\n', end - chunk_end);
+            chunk_end = (nl) ? nl + 1 : end;
+        }
+        chunks.emplace_back();
+        chunks.back().start = start;
+        chunks.back().end = chunk_end;
+        start = chunk_end;
+    }
 
-        // skip empty and comments
-        if (!ntok) continue;
-        if (toks[0][0] == '#') continue;
+    // run a function over chunks in parallel
+    auto parallel_chunks = [&chunks, nthreads](
+                               const std::function<void(obj_chunk&)>& func) {
+        if (chunks.size() <= 1 || nthreads <= 1) {
+            for (auto& chunk : chunks) func(chunk);
+            return;
+        }
+        std::atomic<int> next(0);
+        auto threads = std::vector<std::thread>();
+        for (auto tid = 0; tid < std::min(nthreads, (int)chunks.size());
+             tid++) {
+            threads.emplace_back([&chunks, &next, &func]() {
+                while (true) {
+                    auto idx = next.fetch_add(1);
+                    if (idx >= chunks.size()) break;
+                    func(chunks[idx]);
+                }
+            });
+        }
+        for (auto& thread : threads) thread.join();
+    };
 
-        // set up code
-        auto tok_s = std::string(toks[0]);
-        auto cur_tok = toks + 1;
-        auto cur_ntok = ntok - 1;
+    // count vertices to resolve negative indices
+    parallel_chunks([](obj_chunk& chunk) {
+        chunk.vert_size = count_obj_vertices(chunk.start, chunk.end);
+    });
+    auto vert_size = obj_vertex{0, 0, 0, 0, 0};
+    for (auto& chunk : chunks) {
+        auto count = chunk.vert_size;
+        chunk.vert_size = vert_size;
+        vert_size.pos += count.pos;
+        vert_size.norm += count.norm;
+        vert_size.texcoord += count.texcoord;
+        vert_size.color += count.color;
+        vert_size.radius += count.radius;
+    }
 
-        // possible token values
-        if (tok_s == "v") {
-            vert_size.pos += 1;
-            asset->pos.push_back(parse_float3(cur_tok));
-        } else if (tok_s == "vn") {
-            vert_size.norm += 1;
-            asset->norm.push_back(parse_float3(cur_tok));
-        } else if (tok_s == "vt") {
-            vert_size.texcoord += 1;
-            asset->texcoord.push_back(parse_float2(cur_tok));
-            if (flip_texcoord)
-                asset->texcoord.back()[1] = 1 - asset->texcoord.back()[1];
-        } else if (tok_s == "vc") {
-            vert_size.color += 1;
-            asset->color.push_back(parse_float4(cur_tok));
-        } else if (tok_s == "vr") {
-            vert_size.radius += 1;
-            asset->radius.push_back(parse_float(cur_tok));
-        } else if (tok_s == "f") {
-            parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
-            auto& g = asset->objects.back().groups.back();
-            g.elems.push_back({(uint32_t)g.verts.size(), obj_element_type::face,
-                (uint16_t)cur_elems.size()});
-            g.verts.insert(g.verts.end(), cur_elems.begin(), cur_elems.end());
-        } else if (tok_s == "l") {
-            parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
-            auto& g = asset->objects.back().groups.back();
-            g.elems.push_back({(uint32_t)g.verts.size(), obj_element_type::line,
-                (uint16_t)cur_elems.size()});
-            g.verts.insert(g.verts.end(), cur_elems.begin(), cur_elems.end());
-        } else if (tok_s == "p") {
-            parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
-            auto& g = asset->objects.back().groups.back();
-            g.elems.push_back({(uint32_t)g.verts.size(),
-                obj_element_type::point, (uint16_t)cur_elems.size()});
-            g.verts.insert(g.verts.end(), cur_elems.begin(), cur_elems.end());
-        } else if (tok_s == "t") {
-            parse_vertlist(cur_tok, cur_ntok, cur_elems, vert_size);
-            auto& g = asset->objects.back().groups.back();
-            g.elems.push_back({(uint32_t)g.verts.size(),
-                obj_element_type::tetra, (uint16_t)cur_elems.size()});
-            g.verts.insert(g.verts.end(), cur_elems.begin(), cur_elems.end());
-        } else if (tok_s == "o") {
-            auto name = (cur_ntok) ? cur_tok[0] : "";
-            asset->objects.push_back({name, {}});
-            asset->objects.back().groups.push_back({cur_matname, ""});
-        } else if (tok_s == "usemtl") {
-            auto name = (cur_ntok) ? cur_tok[0] : "";
-            cur_matname = name;
-            asset->objects.back().groups.push_back({cur_matname, ""});
-        } else if (tok_s == "g") {
-            auto name = (cur_ntok) ? cur_tok[0] : "";
-            asset->objects.back().groups.push_back({cur_matname, name});
-        } else if (tok_s == "s") {
-            auto name = (cur_ntok) ? cur_tok[0] : "";
-            auto smoothing = name == std::string("on");
-            if (asset->objects.back().groups.back().smoothing != smoothing) {
-                asset->objects.back().groups.push_back(
-                    {cur_matname, name, smoothing});
-            }
-        } else if (tok_s == "mtllib") {
-            auto name = (cur_ntok) ? cur_tok[0] : "";
-            if (name != std::string("")) {
-                auto found = false;
-                for (auto lib : cur_mtllibs) {
-                    if (lib == name) {
-                        found = true;
-                        break;
-                    }
-                }
-                if (!found) cur_mtllibs.push_back(name);
-            }
-        } else if (tok_s == "c") {
-            asset->cameras.emplace_back();
-            auto& cam = asset->cameras.back();
-            cam.name = (cur_ntok) ? cur_tok[0] : "";
-            cam.ortho = parse_int(cur_tok + 1);
-            cam.yfov = parse_float(cur_tok + 2);
-            cam.aspect = parse_float(cur_tok + 3);
-            cam.aperture = parse_float(cur_tok + 4);
-            cam.focus = parse_float(cur_tok + 5);
-            cam.translation = parse_float3(cur_tok + 6);
-            cam.rotation = (ym::quat4f)parse_float4(cur_tok + 9);
-            if (cur_ntok > 13) cam.matrix = parse_float16(cur_tok + 13);
-        } else if (tok_s == "e") {
-            asset->environments.emplace_back();
-            auto& env = asset->environments.back();
-            env.name = (cur_ntok) ? cur_tok[0] : "<unnamed>";
-            env.matname = (cur_ntok - 1) ? cur_tok[1] : "<unnamed_material>";
-            env.rotation = (ym::quat4f)parse_float4(cur_tok + 2);
-            if (cur_ntok > 6) env.matrix = parse_float16(cur_tok + 6);
-        } else if (tok_s == "i") {
-            asset->instances.emplace_back();
-            auto& ist = asset->instances.back();
-            ist.name = (cur_ntok) ? cur_tok[0] : "<unnamed>";
-            ist.meshname = (cur_ntok - 1) ? cur_tok[1] : "<unnamed_mesh>";
-            ist.translation = parse_float3(cur_tok + 2);
-            ist.rotation = (ym::quat4f)parse_float4(cur_tok + 5);
-            ist.scale = parse_float3(cur_tok + 9);
-            if (cur_ntok > 12) ist.matrix = parse_float16(cur_tok + 12);
+    // parse chunks
+    parallel_chunks([flip_texcoord](obj_chunk& chunk) {
+        chunk.asset.objects.push_back({});
+        chunk.asset.objects.back().groups.push_back({});
+        chunk.state.vert_size = chunk.vert_size;
+        chunk.state.matname_known = false;
+        chunk.state.continuation = true;
+        chunk.parsed = parse_obj_lines(&chunk.asset, chunk.state, chunk.start,
+            chunk.end, flip_texcoord);
+        if (!chunk.parsed) chunk.asset = obj();
+    });
+
+    // merge chunks, parsing the remaining ones in order
+    auto state = obj_parse_state();
+    for (auto& chunk : chunks) {
+        if (chunk.parsed) {
+            merge_obj_chunk(asset.get(), state, chunk);
         } else {
-            // unused
+            parse_obj_lines(
+                asset.get(), state, chunk.start, chunk.end, flip_texcoord);
         }
     }
+    buffer = {};
 
     // cleanup unused
     for (auto&& o : asset->objects) {
@@ -316,12 +672,12 @@ obj* load_obj(const std::string& filename, bool flip_texcoord, bool flip_tr,
             [](const obj_group& x) { return x.verts.empty(); });
         o.groups.erase(end, o.groups.end());
     }
-    auto end = std::remove_if(asset->objects.begin(), asset->objects.end(),
+    auto end_obj = std::remove_if(asset->objects.begin(), asset->objects.end(),
         [](const obj_object& x) { return x.groups.empty(); });
-    asset->objects.erase(end, asset->objects.end());
+    asset->objects.erase(end_obj, asset->objects.end());
 
     // parse materials
-    for (auto mtllib : cur_mtllibs) {
+    for (auto mtllib : state.mtllibs) {
         auto mtlname = get_dirname(filename) + mtllib;
         std::string errm;
         auto materials = load_mtl(mtlname, flip_tr, &errm);
@@ -58,6 +58,7 @@
 ///
 /// ## History
 ///
+/// - v 0.31: faster loading by parsing chunks of OBJ files in parallel
 /// - v 0.30: support for smoothing groups
 /// - v 0.29: use reference interface for textures
 /// - v 0.28: add function to split meshes into single shapes
@@ -32,8 +32,13 @@
 #include "yocto_bvh.h"
 #endif
 
+#include "yocto_utils.h"
+
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <thread>
+#include <unordered_map>
 
 //
 // TODO: cleanup: frame -> pos/rot
@@ -57,6 +62,7 @@ struct shape {
     ym::mat3f _inertia_local = ym::identity_mat3f;      // inertia
     ym::vec3f _centroid_local = ym::zero3f;             // center
     ym::mat3f _inertia_inv_local = ym::identity_mat3f;  // inverse of inertia
+    ym::bbox3f _bbox_local = ym::invalid_bbox3f;         // vertex bounds
 };
 
 //
@@ -100,6 +106,70 @@ struct collision {
     ym::vec3f meff_inv = ym::zero3f;  // effective mass
     float depth = 0;                  // penetration depth
     ym::vec3f r1 = ym::zero3f, r2 = ym::zero3f;
+    int bid1 = -1, bid2 = -1, vid = -1;  // bodies and vertex (contact id)
+};
+
+//
+// Body state copied for the solver [private]
+//
+struct solver_body {
+    ym::vec3f lin_vel = ym::zero3f;  // linear velocity
+    ym::vec3f ang_vel = ym::zero3f;  // angular velocity
+    float mass_inv = 0;              // mass inverse
+    bool simulated = false;          // simulated
+};
+
+//
+// Contact prepared for the solver [private]. The angular response is
+// premultiplied by the inverse inertia, so that iterations only need one
+// matrix-vector product per body.
+//
+struct solver_contact {
+    int bid1 = 0, bid2 = 0;                      // island bodies
+    ym::frame3f frame = ym::identity_frame3f;    // collision frame
+    ym::vec3f r1 = ym::zero3f, r2 = ym::zero3f;  // offsets from centroids
+    ym::vec3f meff_inv = ym::zero3f;             // effective mass
+    ym::vec3f local_impulse = ym::zero3f;        // accumulated impulse
+    ym::mat3f ang1 = ym::identity_mat3f;  // angular velocity per impulse
+    ym::mat3f ang2 = ym::identity_mat3f;  // angular velocity per impulse
+};
+
+//
+// Set of bodies connected by contacts, solved independently [private].
+// Large islands are split in batches of contacts that do not share simulated
+// bodies; batches are further split in manifolds, i.e. the contacts between
+// the same pair of bodies.
+//
+struct island {
+    std::vector<int> bodies;               // scene body ids
+    std::vector<solver_body> sbodies;      // solver bodies
+    std::vector<int> collisions;           // collision ids
+    std::vector<solver_contact> contacts;  // solver contacts
+    std::vector<int> manifolds;            // manifold contact offsets
+    std::vector<int> batches;              // batch manifold offsets
+    int overflow = -1;                     // overflow batch manifold offset
+};
+
+//
+// Broad phase bounds endpoint [private]. The value is cached so that sorting
+// does not need to access the bounds.
+//
+struct broad_endpoint {
+    float val = 0;  // coordinate along the sorted axis
+    int id = 0;     // (bid << 1) | is_max
+};
+
+//
+// Persistent sweep and prune broad phase [private]. Body bounds endpoints are
+// kept sorted along each axis and updated with insertion sort, so that
+// overlapping pairs only change when two endpoints swap.
+//
+struct broad_phase {
+    std::vector<ym::bbox3f> bounds;            // world bounds per body
+    std::vector<ym::bbox3f> last_bounds;       // bounds at the last update
+    std::vector<broad_endpoint> endpoints[3];  // sorted endpoints per axis
+    std::vector<ym::vec2i> pairs;              // overlapping pairs
+    std::unordered_map<unsigned long long, int> pair_ids;  // pair index
 };
 
 //
@@ -116,6 +186,7 @@ struct scene {
     overlap_shapes_cb overlap_shapes = nullptr;  // overlap callbacks
     overlap_shape_cb overlap_shape = nullptr;    // overlap callbacks
     overlap_refit_cb overlap_refit = nullptr;    // overlap callbacks
+    broad_phase overlap_broad;  // internal broad phase if no overlap_shapes
 #ifndef YSYM_NO_BVH
     ybvh::scene* overlap_bvh = nullptr;  // overlapoverlap internal bvh
 #endif
@@ -256,11 +327,7 @@ void init_overlap(scene* scn) {
             scn->overlap_bvh, bdy->frame, shape_map.at(bdy->shp));
     }
     ybvh::build_scene_bvh(scn->overlap_bvh);
-    set_overlap_callbacks(scn,
-        [scn](std::vector<ym::vec2i>* overlaps) {
-            ybvh::overlap_instance_bounds(
-                scn->overlap_bvh, scn->overlap_bvh, true, true, overlaps);
-        },
+    set_overlap_callbacks(scn, nullptr,
         [scn](int iid, const ym::vec3f& pt, float max_dist) {
             auto overlap = ybvh::overlap_instance(
                 scn->overlap_bvh, iid, pt, max_dist, false);
@@ -272,7 +339,7 @@ void init_overlap(scene* scn) {
             opt.euv = overlap.euv;
             return opt;
         },
-        [scn](const scene* scn, int nshapes) {
+        [](const scene* scn, int nshapes) {
             for (auto iid = 0; iid < nshapes; iid++) {
                 ybvh::set_instance_frame(
                     scn->overlap_bvh, iid, get_rigid_body_frame(scn, iid));
@@ -408,8 +475,13 @@ static void compute_collision(const scene* scn, const ym::vec2i& sids,
     std::vector<collision>* collisions) {
     auto bdy1 = scn->bodies[sids.x];
     auto bdy2 = scn->bodies[sids.y];
+    auto bbox1 = bdy1->shp->_bbox_local;
+    bbox1.min -= ym::vec3f{1, 1, 1} * scn->overlap_max_radius;
+    bbox1.max += ym::vec3f{1, 1, 1} * scn->overlap_max_radius;
     for (auto vid = 0; vid < bdy2->shp->nverts; vid++) {
         auto p2 = transform_point(bdy2->frame, bdy2->shp->pos[vid]);
+        if (!contains(bbox1, transform_point_inverse(bdy1->frame, p2)))
+            continue;
         auto overlap = scn->overlap_shape(sids.x, p2, scn->overlap_max_radius);
         if (!overlap) continue;
         auto triangle = bdy1->shp->triangles[overlap.eid];
@@ -423,97 +495,515 @@ static void compute_collision(const scene* scn, const ym::vec2i& sids,
         auto col = collision();
         col.bdy1 = bdy1;
         col.bdy2 = bdy2;
+        col.bid1 = sids.x;
+        col.bid2 = sids.y;
+        col.vid = vid;
         col.depth = overlap.dist;
         col.frame = ym::make_frame3_fromz(p2, n1);
         collisions->push_back(col);
     }
 }
 
+//
+// Broad phase pair key.
+//
+static inline unsigned long long pair_key(int bid1, int bid2) {
+    return ((unsigned long long)bid1 << 32) | (unsigned long long)bid2;
+}
+
+//
+// Broad phase endpoint ordering. Minimums come before maximums with the same
+// value, so that touching bounds are considered overlapping.
+//
+static inline bool endpoint_less(
+    const broad_endpoint& ep1, const broad_endpoint& ep2) {
+    return ep1.val < ep2.val ||
+           (ep1.val == ep2.val && !(ep1.id & 1) && (ep2.id & 1));
+}
+
+//
+// Add a broad phase pair if the bounds overlap and it can collide.
+//
+static inline void add_pair(
+    const scene* scn, broad_phase& bp, int bid1, int bid2) {
+    if (bid1 == bid2) return;
+    if (!ym::overlap_bbox(bp.bounds[bid1], bp.bounds[bid2])) return;
+    if (bid1 > bid2) std::swap(bid1, bid2);
+    if (!scn->bodies[bid1]->simulated && !scn->bodies[bid2]->simulated)
+        return;
+    auto key = pair_key(bid1, bid2);
+    if (bp.pair_ids.find(key) != bp.pair_ids.end()) return;
+    bp.pair_ids[key] = (int)bp.pairs.size();
+    bp.pairs.push_back({bid1, bid2});
+}
+
+//
+// Remove a broad phase pair, if present. Pairs are present only if their
+// bounds overlapped at the last update, which avoids most lookups.
+//
+static inline void remove_pair(broad_phase& bp, int bid1, int bid2) {
+    if (!ym::overlap_bbox(bp.last_bounds[bid1], bp.last_bounds[bid2])) return;
+    if (bid1 > bid2) std::swap(bid1, bid2);
+    auto it = bp.pair_ids.find(pair_key(bid1, bid2));
+    if (it == bp.pair_ids.end()) return;
+    auto idx = it->second;
+    bp.pair_ids.erase(it);
+    if (idx != (int)bp.pairs.size() - 1) {
+        bp.pairs[idx] = bp.pairs.back();
+        bp.pair_ids[pair_key(bp.pairs[idx].x, bp.pairs[idx].y)] = idx;
+    }
+    bp.pairs.pop_back();
+}
+
+//
+// Update the broad phase with the current body frames. The first time, or
+// when bodies are added, endpoints are sorted and pairs found by sweeping;
+// afterwards endpoints are insertion sorted, which is linear for coherent
+// motion, and pairs are added or removed only when endpoints cross.
+//
+static void update_broad_phase(const scene* scn, broad_phase& bp) {
+    auto nbodies = (int)scn->bodies.size();
+    auto rebuild = (int)bp.bounds.size() != nbodies;
+    std::swap(bp.bounds, bp.last_bounds);
+    bp.bounds.resize(nbodies);
+    for (auto bid = 0; bid < nbodies; bid++) {
+        auto bdy = scn->bodies[bid];
+        bp.bounds[bid] = ym::transform_bbox(bdy->frame, bdy->shp->_bbox_local);
+    }
+
+    for (auto axis = 0; axis < 3; axis++) {
+        auto& eps = bp.endpoints[axis];
+        if (rebuild) {
+            eps.resize(nbodies * 2);
+            for (auto i = 0; i < nbodies * 2; i++) eps[i].id = i;
+        }
+        for (auto& ep : eps) {
+            auto& bbox = bp.bounds[ep.id >> 1];
+            ep.val = (ep.id & 1) ? bbox.max[axis] : bbox.min[axis];
+        }
+    }
+
+    if (rebuild) {
+        bp.pairs.clear();
+        bp.pair_ids.clear();
+        for (auto axis = 0; axis < 3; axis++) {
+            std::sort(bp.endpoints[axis].begin(), bp.endpoints[axis].end(),
+                endpoint_less);
+        }
+        auto active = std::vector<int>();
+        for (auto& ep : bp.endpoints[0]) {
+            auto bid = ep.id >> 1;
+            if (ep.id & 1) {
+                active.erase(std::find(active.begin(), active.end(), bid));
+            } else {
+                for (auto abid : active) add_pair(scn, bp, abid, bid);
+                active.push_back(bid);
+            }
+        }
+        return;
+    }
+
+    for (auto axis = 0; axis < 3; axis++) {
+        auto& eps = bp.endpoints[axis];
+        for (auto i = 1; i < (int)eps.size(); i++) {
+            if (!endpoint_less(eps[i], eps[i - 1])) continue;
+            auto ep = eps[i];
+            auto j = i;
+            for (; j > 0 && endpoint_less(ep, eps[j - 1]); j--) {
+                auto oep = eps[j - 1];
+                if (!(ep.id & 1) && (oep.id & 1))
+                    add_pair(scn, bp, ep.id >> 1, oep.id >> 1);
+                if ((ep.id & 1) && !(oep.id & 1))
+                    remove_pair(bp, ep.id >> 1, oep.id >> 1);
+                eps[j] = oep;
+            }
+            eps[j] = ep;
+        }
+    }
+}
+
+//
+// Compute collisions. Pairs are split in chunks processed in parallel and
+// concatenated in order, so results do not depend on the number of threads.
+//
 static void compute_collisions(
-    scene* scene, std::vector<collision>* collisions) {
+    scene* scene, std::vector<collision>* collisions, bool parallel) {
     // check which shapes might overlap
     auto body_collisions = std::vector<ym::vec2i>();
-    scene->overlap_shapes(&body_collisions);
-    // test all pair-wise objects
-    collisions->clear();
-    for (auto& sc : body_collisions) {
+    if (scene->overlap_shapes) {
+        scene->overlap_shapes(&body_collisions);
+    } else {
+        update_broad_phase(scene, scene->overlap_broad);
+    }
+    auto& candidates = (scene->overlap_shapes) ? body_collisions :
+                                                 scene->overlap_broad.pairs;
+    // remove pairs that cannot collide
+    auto pairs = std::vector<ym::vec2i>();
+    pairs.reserve(candidates.size());
+    for (auto& sc : candidates) {
         auto bd1 = scene->bodies[sc.x], bd2 = scene->bodies[sc.y];
         if (!bd1->simulated && !bd2->simulated) continue;
         if (!bd1->shp->triangles) continue;
         if (!bd2->shp->triangles) continue;
-        compute_collision(scene, sc, collisions);
-        compute_collision(scene, {sc.y, sc.x}, collisions);
+        pairs.push_back(sc);
     }
+    // test all pair-wise objects
+    auto npairs = (int)pairs.size();
+    auto nchunks =
+        (parallel) ? (int)std::thread::hardware_concurrency() * 4 : 1;
+    nchunks = ym::clamp(nchunks, 1, ym::max(npairs, 1));
+    auto chunks = std::vector<std::vector<collision>>(nchunks);
+    auto compute_chunk = [&](int cid) {
+        auto start = npairs * cid / nchunks, end = npairs * (cid + 1) / nchunks;
+        for (auto i = start; i < end; i++) {
+            compute_collision(scene, pairs[i], &chunks[cid]);
+            compute_collision(scene, {pairs[i].y, pairs[i].x}, &chunks[cid]);
+        }
+    };
+    if (nchunks > 1) {
+        yu::concurrent::parallel_for(nchunks, compute_chunk);
+    } else {
+        compute_chunk(0);
+    }
+    collisions->clear();
+    for (auto& chunk : chunks)
+        collisions->insert(collisions->end(), chunk.begin(), chunk.end());
+}
+
+//
+// Union-find root of a body in the contact graph.
+//
+static inline int find_island(std::vector<int>& parent, int bid) {
+    while (parent[bid] != bid) bid = parent[bid] = parent[parent[bid]];
+    return bid;
 }
 
 //
-// Apply an impulse where the position is relative to the center of mass.
+// Key used to match contacts between steps for warm starting.
 //
-static inline void apply_rel_impulse(
-    rigid_body* bdy, const ym::vec3f impulse, const ym::vec3f rel_pos) {
-    if (!bdy->simulated) return;
-    bdy->lin_vel += impulse * bdy->_mass_inv;
-    bdy->ang_vel += bdy->_inertia_inv_world * ym::cross(rel_pos, impulse);
+static inline unsigned long long contact_key(const collision& col) {
+    return ((unsigned long long)col.bid1 << 44) |
+           ((unsigned long long)col.bid2 << 24) | (unsigned long long)col.vid;
 }
 
 //
-// Solve constraints with PGS.
+// Group contacts in islands of simulated bodies connected by contacts. Non
+// simulated bodies do not connect islands and are copied in each of them.
+//
+static std::vector<island> make_islands(
+    const scene* scn, const std::vector<collision>& collisions) {
+    auto nbodies = (int)scn->bodies.size();
+    auto parent = std::vector<int>(nbodies);
+    for (auto bid = 0; bid < nbodies; bid++) parent[bid] = bid;
+    for (auto& col : collisions) {
+        if (!col.bdy1->simulated || !col.bdy2->simulated) continue;
+        auto r1 = find_island(parent, col.bid1);
+        auto r2 = find_island(parent, col.bid2);
+        if (r1 != r2) parent[ym::max(r1, r2)] = ym::min(r1, r2);
+    }
+
+    // islands are numbered in order of their first contact
+    auto islands = std::vector<island>();
+    auto island_id = std::vector<int>(nbodies, -1);
+    for (auto cid = 0; cid < (int)collisions.size(); cid++) {
+        auto& col = collisions[cid];
+        auto root = find_island(
+            parent, (col.bdy1->simulated) ? col.bid1 : col.bid2);
+        if (island_id[root] < 0) {
+            island_id[root] = (int)islands.size();
+            islands.emplace_back();
+        }
+        islands[island_id[root]].collisions.push_back(cid);
+    }
+
+    // assign island bodies and contacts
+    auto body_island = std::vector<int>(nbodies, -1);
+    auto body_slot = std::vector<int>(nbodies, -1);
+    for (auto iid = 0; iid < (int)islands.size(); iid++) {
+        auto& isl = islands[iid];
+        auto slot = [&](int bid) {
+            if (body_island[bid] != iid) {
+                body_island[bid] = iid;
+                body_slot[bid] = (int)isl.bodies.size();
+                isl.bodies.push_back(bid);
+            }
+            return body_slot[bid];
+        };
+        isl.contacts.resize(isl.collisions.size());
+        for (auto i = 0; i < (int)isl.collisions.size(); i++) {
+            auto& col = collisions[isl.collisions[i]];
+            isl.contacts[i].bid1 = slot(col.bid1);
+            isl.contacts[i].bid2 = slot(col.bid2);
+        }
+    }
+
+    return islands;
+}
+
+//
+// Computes the solver bodies and contacts of an island.
+//
+static void init_island(const scene* scn,
+    const std::vector<collision>& collisions, island& isl,
+    const std::unordered_map<unsigned long long, ym::vec3f>& warm_impulses) {
+    isl.sbodies.resize(isl.bodies.size());
+    for (auto i = 0; i < (int)isl.bodies.size(); i++) {
+        auto bdy = scn->bodies[isl.bodies[i]];
+        auto& sbd = isl.sbodies[i];
+        sbd.lin_vel = bdy->lin_vel;
+        sbd.ang_vel = bdy->ang_vel;
+        sbd.mass_inv = bdy->_mass_inv;
+        sbd.simulated = bdy->simulated;
+    }
+
+    for (auto i = 0; i < (int)isl.contacts.size(); i++) {
+        auto& col = collisions[isl.collisions[i]];
+        auto& ct = isl.contacts[i];
+        ct.frame = col.frame;
+        ct.r1 = col.frame.o - col.bdy1->_centroid_world;
+        ct.r2 = col.frame.o - col.bdy2->_centroid_world;
+        for (auto k = 0; k < 3; k++) {
+            auto c1 = cross(ct.r1, ct.frame[k]), c2 = cross(ct.r2, ct.frame[k]);
+            auto a1 = col.bdy1->_inertia_inv_world * c1,
+                 a2 = col.bdy2->_inertia_inv_world * c2;
+            ct.meff_inv[k] = 1 / (col.bdy1->_mass_inv + col.bdy2->_mass_inv +
+                                     dot(c1, a1) + dot(c2, a2));
+            ct.ang1[k] = (col.bdy1->simulated) ? a1 : ym::zero3f;
+            ct.ang2[k] = (col.bdy2->simulated) ? a2 : ym::zero3f;
+        }
+
+        // warm start from the impulse of the same contact in the last step
+        auto warm = warm_impulses.find(contact_key(col));
+        if (warm == warm_impulses.end()) continue;
+        ct.local_impulse = warm->second;
+        auto impulse = transform_vector(ct.frame, ct.local_impulse);
+        auto &bd1 = isl.sbodies[ct.bid1], &bd2 = isl.sbodies[ct.bid2];
+        if (bd1.simulated) {
+            bd1.lin_vel -= impulse * bd1.mass_inv;
+            bd1.ang_vel -= ct.ang1 * ct.local_impulse;
+        }
+        if (bd2.simulated) {
+            bd2.lin_vel += impulse * bd2.mass_inv;
+            bd2.ang_vel += ct.ang2 * ct.local_impulse;
+        }
+    }
+}
+
+//
+// Splits a large island in batches of manifolds that do not share simulated
+// bodies, using greedy graph coloring. Contacts are reordered by batch. The
+// last batch collects manifolds that did not fit and is solved serially.
+//
+static void batch_island(island& isl) {
+    const auto max_batches = 64;
+
+    // find manifolds
+    auto manifolds = std::vector<int>();
+    for (auto i = 0; i < (int)isl.contacts.size(); i++) {
+        auto &ct = isl.contacts[i], &prev = isl.contacts[ym::max(i - 1, 0)];
+        if (i && ym::min(ct.bid1, ct.bid2) == ym::min(prev.bid1, prev.bid2) &&
+            ym::max(ct.bid1, ct.bid2) == ym::max(prev.bid1, prev.bid2))
+            continue;
+        manifolds.push_back(i);
+    }
+    manifolds.push_back((int)isl.contacts.size());
+
+    // color manifolds
+    auto nmanifolds = (int)manifolds.size() - 1;
+    auto used = std::vector<unsigned long long>(isl.sbodies.size(), 0);
+    auto colors = std::vector<int>(nmanifolds);
+    auto batch_size = std::vector<int>(max_batches, 0);
+    for (auto mid = 0; mid < nmanifolds; mid++) {
+        auto& ct = isl.contacts[manifolds[mid]];
+        auto sim1 = isl.sbodies[ct.bid1].simulated,
+             sim2 = isl.sbodies[ct.bid2].simulated;
+        auto mask = ((sim1) ? used[ct.bid1] : 0) | ((sim2) ? used[ct.bid2] : 0);
+        auto color = 0;
+        while (color < max_batches - 1 && (mask & (1ull << color))) color++;
+        if (sim1) used[ct.bid1] |= 1ull << color;
+        if (sim2) used[ct.bid2] |= 1ull << color;
+        colors[mid] = color;
+        batch_size[color]++;
+    }
+
+    // reorder contacts by batch
+    auto contacts = std::vector<solver_contact>();
+    auto collisions = std::vector<int>();
+    contacts.reserve(isl.contacts.size());
+    collisions.reserve(isl.collisions.size());
+    isl.manifolds.clear();
+    isl.batches.clear();
+    isl.overflow = -1;
+    for (auto color = 0; color < max_batches; color++) {
+        if (!batch_size[color]) continue;
+        if (color < max_batches - 1) {
+            isl.batches.push_back((int)isl.manifolds.size());
+        } else {
+            // overflow manifolds may share bodies and are kept last
+            isl.overflow = (int)isl.manifolds.size();
+        }
+        for (auto mid = 0; mid < nmanifolds; mid++) {
+            if (colors[mid] != color) continue;
+            isl.manifolds.push_back((int)contacts.size());
+            for (auto i = manifolds[mid]; i < manifolds[mid + 1]; i++) {
+                contacts.push_back(isl.contacts[i]);
+                collisions.push_back(isl.collisions[i]);
+            }
+        }
+    }
+    isl.manifolds.push_back((int)contacts.size());
+    isl.batches.push_back(
+        (isl.overflow >= 0) ? isl.overflow : (int)isl.manifolds.size() - 1);
+    isl.contacts = std::move(contacts);
+    isl.collisions = std::move(collisions);
+}
+
+//
+// Solve one contact with PGS.
+//
+static inline void solve_contact(
+    solver_contact& ct, std::vector<solver_body>& bodies) {
+    auto &bd1 = bodies[ct.bid1], &bd2 = bodies[ct.bid2];
+    auto v1 = bd1.lin_vel + cross(bd1.ang_vel, ct.r1),
+         v2 = bd2.lin_vel + cross(bd2.ang_vel, ct.r2);
+    auto vr = v2 - v1;
+    // auto offset = col.depth * 0.8f / params.dt;
+    auto offset = 0.0f;
+    auto local_impulse =
+        ct.meff_inv *
+        transform_vector_inverse(ct.frame, {-vr.x, -vr.y, -vr.z + offset});
+    auto old_impulse = ct.local_impulse;
+    ct.local_impulse += local_impulse;
+    ct.local_impulse.z = ym::clamp(
+        ct.local_impulse.z, 0.0f, std::numeric_limits<float>::max());
+    ct.local_impulse.x = ym::clamp(ct.local_impulse.x,
+        -ct.local_impulse.z * 0.6f, ct.local_impulse.z * 0.6f);
+    ct.local_impulse.y = ym::clamp(ct.local_impulse.y,
+        -ct.local_impulse.z * 0.6f, ct.local_impulse.z - offset * 0.6f);
+    auto delta = ct.local_impulse - old_impulse;
+    auto impulse = transform_vector(ct.frame, delta);
+    if (bd1.simulated) {
+        bd1.lin_vel -= impulse * bd1.mass_inv;
+        bd1.ang_vel -= ct.ang1 * delta;
+    }
+    if (bd2.simulated) {
+        bd2.lin_vel += impulse * bd2.mass_inv;
+        bd2.ang_vel += ct.ang2 * delta;
+    }
+}
+
+//
+// Solve the contacts of an island with PGS. Batched islands solve manifolds
+// of the same batch in parallel.
+//
+static void solve_island(island& isl, int iterations, bool parallel) {
+    if (isl.batches.empty()) {
+        for (auto i = 0; i < iterations; i++) {
+            for (auto& ct : isl.contacts) solve_contact(ct, isl.sbodies);
+        }
+        return;
+    }
+
+    auto nthreads = (parallel) ? (int)std::thread::hardware_concurrency() : 1;
+    auto solve_manifolds = [&isl](int start, int end) {
+        for (auto i = isl.manifolds[start]; i < isl.manifolds[end]; i++)
+            solve_contact(isl.contacts[i], isl.sbodies);
+    };
+    for (auto i = 0; i < iterations; i++) {
+        for (auto b = 0; b < (int)isl.batches.size() - 1; b++) {
+            auto start = isl.batches[b], end = isl.batches[b + 1];
+            auto nchunks = ym::min(nthreads, (end - start) / 16);
+            if (nchunks <= 1) {
+                solve_manifolds(start, end);
+                continue;
+            }
+            yu::concurrent::parallel_for(nchunks, [&](int cid) {
+                solve_manifolds(start + (end - start) * cid / nchunks,
+                    start + (end - start) * (cid + 1) / nchunks);
+            });
+        }
+        // the overflow batch is solved serially
+        if (isl.overflow >= 0)
+            solve_manifolds(isl.overflow, (int)isl.manifolds.size() - 1);
+    }
+}
+
+//
+// Solve constraints with PGS. Contacts are grouped in independent islands,
+// solved in parallel. Islands with many contacts are split in batches that
+// are solved in parallel instead. Results do not depend on the number of
+// threads.
 //
 void solve_constraints(scene* scn, std::vector<collision>& collisions,
     const simulation_params& params) {
-    // initialize computation
-    for (auto& col : collisions) {
-        col.local_impulse = ym::zero3f;
-        col.impulse = ym::zero3f;
-        col.r1 = col.frame.o - col.bdy1->_centroid_world,
-        col.r2 = col.frame.o - col.bdy2->_centroid_world;
-        col.meff_inv.z =
-            1 /
-            (col.bdy1->_mass_inv + col.bdy2->_mass_inv +
-                dot(cross(col.r1, col.frame.z),
-                    col.bdy1->_inertia_inv_world * cross(col.r1, col.frame.z)) +
-                dot(cross(col.r2, col.frame.z),
-                    col.bdy2->_inertia_inv_world * cross(col.r2, col.frame.z)));
-        col.meff_inv.x =
-            1 /
-            (col.bdy1->_mass_inv + col.bdy2->_mass_inv +
-                dot(cross(col.r1, col.frame.x),
-                    col.bdy1->_inertia_inv_world * cross(col.r1, col.frame.x)) +
-                dot(cross(col.r2, col.frame.x),
-                    col.bdy2->_inertia_inv_world * cross(col.r2, col.frame.x)));
-        col.meff_inv.y =
-            1 /
-            (col.bdy1->_mass_inv + col.bdy2->_mass_inv +
-                dot(cross(col.r1, col.frame.y),
-                    col.bdy1->_inertia_inv_world * cross(col.r1, col.frame.y)) +
-                dot(cross(col.r2, col.frame.y),
-                    col.bdy2->_inertia_inv_world * cross(col.r2, col.frame.y)));
+    const auto min_batched_contacts = 1024;
+
+    // impulses from the last step
+    auto warm_impulses = std::unordered_map<unsigned long long, ym::vec3f>();
+    auto max_verts = 0;
+    for (auto shp : scn->shapes) max_verts = ym::max(max_verts, shp->nverts);
+    if (params.warm_start && scn->bodies.size() < (1 << 20) &&
+        max_verts < (1 << 24)) {
+        warm_impulses.reserve(scn->__collisions.size());
+        for (auto& col : scn->__collisions) {
+            if (col.bid1 < 0) continue;
+            warm_impulses[contact_key(col)] = col.local_impulse;
+        }
     }
 
-    // solve constraints
-    for (int i = 0; i < params.solver_iterations; i++) {
-        for (auto& col : collisions) {
-            auto v1 = col.bdy1->lin_vel + cross(col.bdy1->ang_vel, col.r1),
-                 v2 = col.bdy2->lin_vel + cross(col.bdy2->ang_vel, col.r2);
-            auto vr = v2 - v1;
-            apply_rel_impulse(col.bdy1, col.impulse, col.r1);
-            apply_rel_impulse(col.bdy2, -col.impulse, col.r2);
-            // auto offset = col.depth * 0.8f / params.dt;
-            auto offset = 0.0f;
-            auto local_impulse =
-                col.meff_inv * transform_vector_inverse(
-                                   col.frame, {-vr.x, -vr.y, -vr.z + offset});
-            col.local_impulse += local_impulse;
-            col.local_impulse.z = ym::clamp(
-                col.local_impulse.z, 0.0f, std::numeric_limits<float>::max());
-            col.local_impulse.x = ym::clamp(col.local_impulse.x,
-                -col.local_impulse.z * 0.6f, col.local_impulse.z * 0.6f);
-            col.local_impulse.y =
-                ym::clamp(col.local_impulse.y, -col.local_impulse.z * 0.6f,
-                    col.local_impulse.z - offset * 0.6f);
-            col.impulse = transform_vector(col.frame, col.local_impulse);
-            apply_rel_impulse(col.bdy1, -col.impulse, col.r1);
-            apply_rel_impulse(col.bdy2, col.impulse, col.r2);
+    // build islands
+    auto islands = make_islands(scn, collisions);
+    auto small_islands = std::vector<island*>();
+    auto large_islands = std::vector<island*>();
+    for (auto& isl : islands) {
+        if (isl.contacts.size() < min_batched_contacts) {
+            small_islands.push_back(&isl);
+        } else {
+            large_islands.push_back(&isl);
+        }
+    }
+
+    // solve small islands in parallel
+    auto nchunks =
+        (params.parallel) ? (int)std::thread::hardware_concurrency() * 4 : 1;
+    nchunks = ym::clamp(nchunks, 1, ym::max((int)small_islands.size(), 1));
+    auto solve_chunk = [&](int cid) {
+        auto start = (int)small_islands.size() * cid / nchunks,
+             end = (int)small_islands.size() * (cid + 1) / nchunks;
+        for (auto i = start; i < end; i++) {
+            init_island(scn, collisions, *small_islands[i], warm_impulses);
+            solve_island(*small_islands[i], params.solver_iterations, false);
+        }
+    };
+    if (nchunks > 1) {
+        yu::concurrent::parallel_for(nchunks, solve_chunk);
+    } else {
+        solve_chunk(0);
+    }
+
+    // solve large islands one at a time
+    for (auto isl : large_islands) {
+        init_island(scn, collisions, *isl, warm_impulses);
+        batch_island(*isl);
+        solve_island(*isl, params.solver_iterations, params.parallel);
+    }
+
+    // copy back velocities and impulses
+    for (auto& isl : islands) {
+        for (auto i = 0; i < (int)isl.bodies.size(); i++) {
+            if (!isl.sbodies[i].simulated) continue;
+            auto bdy = scn->bodies[isl.bodies[i]];
+            bdy->lin_vel = isl.sbodies[i].lin_vel;
+            bdy->ang_vel = isl.sbodies[i].ang_vel;
+        }
+        for (auto i = 0; i < (int)isl.contacts.size(); i++) {
+            auto& ct = isl.contacts[i];
+            auto& col = collisions[isl.collisions[i]];
+            col.r1 = ct.r1;
+            col.r2 = ct.r2;
+            col.meff_inv = ct.meff_inv;
+            col.local_impulse = ct.local_impulse;
+            col.impulse = transform_vector(ct.frame, ct.local_impulse);
         }
     }
 }
@@ -527,7 +1017,11 @@ void init_simulation(scene* scn) {
             ysym::compute_moments(
                 shp->nelems, shp->triangles, shp->nverts, shp->pos);
         shp->_inertia_inv_local = ym::inverse(shp->_inertia_local);
+        shp->_bbox_local = ym::invalid_bbox3f;
+        for (auto vid = 0; vid < shp->nverts; vid++)
+            shp->_bbox_local += shp->pos[vid];
     }
+    scn->overlap_broad = broad_phase();
 
     for (auto bdy : scn->bodies) {
         if (bdy->simulated) {
@@ -565,7 +1059,7 @@ void advance_simulation(scene* scn, const simulation_params& params) {
 
     // compute collisions
     auto collisions = std::vector<collision>();
-    compute_collisions(scn, &collisions);
+    compute_collisions(scn, &collisions, params.parallel);
 
     // apply external forces
     ym::vec3f gravity_impulse = ym::vec3f(params.gravity) * params.dt;
@@ -578,7 +1072,7 @@ void advance_simulation(scene* scn, const simulation_params& params) {
     solve_constraints(scn, collisions, params);
 
     // copy for visualization
-    scn->__collisions = collisions;
+    scn->__collisions = std::move(collisions);
 
     // apply drag
     for (auto bdy : scn->bodies) {
@@ -614,7 +1108,7 @@ void advance_simulation(scene* scn, const simulation_params& params) {
     }
 
     // update acceleartion for collisions
-    scn->overlap_refit(scn, (int)scn->shapes.size());
+    scn->overlap_refit(scn, (int)scn->bodies.size());
 }
 
 }  // namespace ysym
@@ -12,10 +12,13 @@
 ///
 /// The solver is based on the sequential impulse techniques, more correctly
 /// known as Projected Guass-Sidel. Friction is grossly approximated now,
-/// waiting for a refactoring before getting better.
+/// waiting for a refactoring before getting better. Contacts are split in
+/// islands of connected bodies that are solved in parallel and warm started
+/// from the previous step. Results do not depend on the number of threads.
 ///
-/// This library depends in yocto_math.h Optionally depend on yocto_bvh.h/.cpp
-/// for internal acceleration. Disable this by setting YSYM_NO_BVH.
+/// This library depends in yocto_math.h and yocto_utils.h for concurrency.
+/// Optionally depend on yocto_bvh.h/.cpp for internal acceleration. Disable
+/// this by setting YSYM_NO_BVH.
 ///
 ///
 /// ## Usage for Scene Creation
@@ -28,7 +31,9 @@
 /// ## Usage for Simulation
 ///
 /// 1. either build the point-overlap acceleration structure with
-///   `init_overlap()` or supply your own with `set_overlap_callbacks()`
+///   `init_overlap()` or supply your own with `set_overlap_callbacks()`;
+///   if no shape-shape overlap callback is given, an internal persistent
+///   sweep-and-prune broad phase is used
 /// 2. prepare simuation internal data `init_simulation()`
 /// 3. define simulation params with the `simulation_params` structure
 /// 4. advance the simiulation with `advance_simulation()`
@@ -37,6 +42,8 @@
 ///
 /// ## History
 ///
+/// - v 0.18: persistent sweep-and-prune broad phase
+/// - v 0.17: parallel island solver with warm starting
 /// - v 0.16: simpler logging
 /// - v 0.15: removal of group overlap
 /// - v 0.14: use yocto_math in the interface and remove inline compilation
@@ -219,7 +226,8 @@ struct overlap_point {
 };
 
 ///
-/// Shape-shape intersection (conservative)
+/// Shape-shape intersection (conservative). If null, the internal
+/// sweep-and-prune broad phase is used, which updates pairs incrementally.
 ///
 /// - Out Parameters:
 ///     - overlaps: overlaps array
@@ -308,6 +316,10 @@ struct simulation_params {
     float lin_drag = 0.01;
     /// global angular velocity drag
     float ang_drag = 0.01;
+    /// start contacts from the impulses of the previous step
+    bool warm_start = true;
+    /// run collision detection and solver in parallel
+    bool parallel = true;
 };
 
 ///
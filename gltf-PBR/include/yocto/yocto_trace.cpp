@@ -34,7 +34,10 @@
 
 #include "yocto_utils.h"
 
+#include <algorithm>
+#include <atomic>
 #include <map>
+#include <mutex>
 
 //
 // BUG: gltf normalization
@@ -2586,12 +2589,25 @@ struct trace_state {
     // progressive state
     int cur_sample = 0;
     std::vector<ym::bbox2i> blocks;
+    // samples accumulated in each block
+    std::vector<std::atomic<int>> block_samples;
+    // rows of the next sample already traced in a cancelled block
+    std::vector<int> block_rows;
+    // locks serializing work on the same block
+    std::vector<std::mutex> block_locks;
 
     // pool
     yu::concurrent::thread_pool* pool = nullptr;
     /// lock for access to image
     std::mutex image_mutex;
 
+    // asynchronous rendering tasks
+    yu::concurrent::task_group* async_group = nullptr;
+    // next asynchronous job, counting blocks in pass order
+    std::atomic<int> async_next{0};
+    // cancellation flag checked by blocks every scanline
+    std::atomic<bool> async_stop{false};
+
     // render scene
     const scene* scn = nullptr;
     // render options
@@ -2609,12 +2625,22 @@ struct trace_state {
     // cleanup
     ~trace_state() {
         if (pool) {
+            async_stop = true;
             yu::concurrent::clear_pool(pool);
+            if (async_group) yu::concurrent::wait_group(pool, async_group);
             yu::concurrent::free_pool(pool);
         }
+        if (async_group) yu::concurrent::free_group(async_group);
     }
 };
 
+//
+// Preview cell sizes of the coarse passes run before the first sample of
+// each block by the asynchronous renderer.
+//
+static const int async_preview_sizes[] = {8, 4};
+static const int async_npreviews = 2;
+
 //
 // Make image blocks
 //
@@ -2629,6 +2655,31 @@ std::vector<ym::bbox2i> make_blocks(int w, int h, int bs) {
     return blocks;
 }
 
+//
+// Sort image blocks from the image center outwards, in rings of increasing
+// distance walked by angle, so that progressive results show up where the
+// viewer is looking first.
+//
+void sort_blocks_center_first(std::vector<ym::bbox2i>& blocks, int w, int h) {
+    auto center = ym::vec2f{w / 2.0f, h / 2.0f};
+    auto keys = std::vector<std::pair<float, float>>(blocks.size());
+    for (auto idx = 0; idx < (int)blocks.size(); idx++) {
+        auto d = ym::vec2f{(blocks[idx].min.x + blocks[idx].max.x) / 2.0f,
+                     (blocks[idx].min.y + blocks[idx].max.y) / 2.0f} -
+                 center;
+        keys[idx] = {ym::max(std::abs(d.x), std::abs(d.y)),
+            std::atan2(d.y, d.x)};
+    }
+    auto order = std::vector<int>(blocks.size());
+    for (auto idx = 0; idx < (int)blocks.size(); idx++) order[idx] = idx;
+    std::sort(order.begin(), order.end(),
+        [&keys](int a, int b) { return keys[a] < keys[b]; });
+    auto sorted = std::vector<ym::bbox2i>(blocks.size());
+    for (auto idx = 0; idx < (int)blocks.size(); idx++)
+        sorted[idx] = blocks[order[idx]];
+    blocks = sorted;
+}
+
 //
 // Initialize state
 //
@@ -2639,6 +2690,7 @@ trace_state* make_state() { return new trace_state(); }
 //
 void init_state(
     trace_state* state, const scene* scn, const trace_params& params) {
+    trace_async_stop(state);
     if (state->pool) {
         if (params.parallel)
             yu::concurrent::clear_pool(state->pool);
@@ -2661,6 +2713,12 @@ void init_state(
     }
     state->cur_sample = 0;
     state->blocks = make_blocks(params.width, params.height, 32);
+    sort_blocks_center_first(state->blocks, params.width, params.height);
+    state->block_samples =
+        std::vector<std::atomic<int>>(state->blocks.size());
+    for (auto& samples : state->block_samples) samples = 0;
+    state->block_rows = std::vector<int>(state->blocks.size(), 0);
+    state->block_locks = std::vector<std::mutex>(state->blocks.size());
     state->scn = scn;
     state->params = params;
 
@@ -2733,9 +2791,15 @@ void get_aux_buffers(const trace_state* state, ym::image4f& norm,
 }
 
 //
-// Grt the current sample count
+// Grt the current sample count, i.e. the samples completed by all blocks
 //
-int get_cur_sample(const trace_state* state) { return state->cur_sample; }
+int get_cur_sample(const trace_state* state) {
+    if (state->block_samples.empty()) return state->cur_sample;
+    auto cur_sample = state->params.nsamples;
+    for (auto& samples : state->block_samples)
+        cur_sample = ym::min(cur_sample, samples.load());
+    return cur_sample;
+}
 
 //
 // Trace a single sample
@@ -2761,10 +2825,11 @@ void trace_sample(ytrace::trace_state* state, int i, int j, int s, ym::vec3f& l,
 //
 // Trace a block of samples
 //
-void trace_block_box(
-    trace_state* state, int block_idx, int samples_min, int samples_max) {
+int trace_block_box(trace_state* state, int block_idx, int samples_min,
+    int samples_max, int start_row) {
     auto& block = state->blocks[block_idx];
-    for (auto j = block.min.y; j < block.max.y; j++) {
+    for (auto j = block.min.y + start_row; j < block.max.y; j++) {
+        if (state->async_stop) return j - block.min.y;
         for (auto i = block.min.x; i < block.max.x; i++) {
             for (auto s = samples_min; s < samples_max; s++) {
                 ytrace::point pt;
@@ -2783,13 +2848,14 @@ void trace_block_box(
             }
         }
     }
+    return block.max.y - block.min.y;
 }
 
 //
 // Trace a block of samples
 //
-void trace_block_filtered(
-    trace_state* state, int block_idx, int samples_min, int samples_max) {
+int trace_block_filtered(trace_state* state, int block_idx, int samples_min,
+    int samples_max, int start_row) {
     static constexpr const int pad = 2;
     auto& block = state->blocks[block_idx];
     auto block_size = ym::diagonal(block);
@@ -2797,7 +2863,9 @@ void trace_block_filtered(
         ym::image4f(block_size.x + pad * 2, block_size.y + pad * 2);
     auto weight_buffer =
         ym::imagef(block_size.x + pad * 2, block_size.y + pad * 2);
-    for (auto j = block.min.y; j < block.max.y; j++) {
+    for (auto j = block.min.y + start_row; j < block.max.y; j++) {
+        // a cancelled block is dropped before touching the image
+        if (state->async_stop) return start_row;
         for (auto i = block.min.x; i < block.max.x; i++) {
             for (auto s = samples_min; s < samples_max; s++) {
                 ytrace::point pt;
@@ -2848,18 +2916,54 @@ void trace_block_filtered(
             }
         }
     }
+    return block.max.y - block.min.y;
 }
 
 //
-// Trace a block of samples
+// Trace a block of samples starting at row start_row of the block. Returns
+// the number of rows traced, which is less than the block height only if
+// cancelled.
 //
-void trace_block(
-    trace_state* state, int block_idx, int samples_min, int samples_max) {
+int trace_block(trace_state* state, int block_idx, int samples_min,
+    int samples_max, int start_row = 0) {
     if (state->filter)
-        return trace_block_filtered(state, block_idx, samples_min, samples_max);
+        return trace_block_filtered(
+            state, block_idx, samples_min, samples_max, start_row);
     else
-        return trace_block_box(state, block_idx, samples_min, samples_max);
+        return trace_block_box(
+            state, block_idx, samples_min, samples_max, start_row);
+}
+
+//
+// Trace a low resolution preview of a block, one sample per cell, filling
+// only pixels that have no samples yet.
+//
+void trace_block_preview(trace_state* state, int block_idx, int cell_size) {
+    auto& block = state->blocks[block_idx];
+    for (auto cj = block.min.y; cj < block.max.y; cj += cell_size) {
+        if (state->async_stop) return;
+        for (auto ci = block.min.x; ci < block.max.x; ci += cell_size) {
+            auto cell = ym::bbox2i{{ci, cj},
+                {ym::min(ci + cell_size, block.max.x),
+                    ym::min(cj + cell_size, block.max.y)}};
+            ytrace::point pt;
+            auto l = ym::zero3f;
+            auto uv = ym::zero2f;
+            trace_sample(state, (cell.min.x + cell.max.x) / 2,
+                (cell.min.y + cell.max.y) / 2, 0, l, pt, uv);
+            // filtered blocks splat into their neighbours under the lock
+            std::unique_lock<std::mutex> lock_guard(
+                state->image_mutex, std::defer_lock);
+            if (state->filter) lock_guard.lock();
+            for (auto j = cell.min.y; j < cell.max.y; j++) {
+                for (auto i = cell.min.x; i < cell.max.x; i++) {
+                    if (state->weight[{i, j}] == 0) state->img[{i, j}] = {l, 1};
+                }
+            }
+        }
+    }
 }
+
 //
 // Clear state
 //
@@ -2869,51 +2973,109 @@ void free_state(trace_state*& state) {
 }
 
 //
-// Trace a batch of samples.
+// Bring a block up to samples_max samples, starting from its own sample
+// count and finishing first the sample left partial by a cancelled pass.
+//
+void trace_block_samples(trace_state* state, int block_idx, int samples_max) {
+    auto& samples = state->block_samples[block_idx];
+    auto& rows = state->block_rows[block_idx];
+    if (samples >= samples_max) return;
+    if (rows) {
+        trace_block(state, block_idx, samples, samples + 1, rows);
+        rows = 0;
+        samples++;
+    }
+    if (samples >= samples_max) return;
+    trace_block(state, block_idx, samples, samples_max);
+    samples = samples_max;
+}
+
+//
+// Trace a batch of samples. Blocks resume from their own sample counts, so
+// this can follow an asynchronous render that was stopped.
 //
 bool trace_next_samples(trace_state* state, int nsamples) {
+    state->cur_sample = get_cur_sample(state);
     if (state->cur_sample >= state->params.nsamples) return false;
     nsamples = ym::min(nsamples, state->params.nsamples - state->cur_sample);
+    auto samples_max = state->cur_sample + nsamples;
     if (state->pool) {
-        yu::concurrent::parallel_for(
-            state->pool, (int)state->blocks.size(), [state, nsamples](int idx) {
-                ytrace::trace_block(state, idx, state->cur_sample,
-                    state->cur_sample + nsamples);
-            });
+        // blocks are heavy enough to be scheduled one by one
+        yu::concurrent::parallel_for(state->pool, (int)state->blocks.size(),
+            [state, samples_max](int idx) {
+                ytrace::trace_block_samples(state, idx, samples_max);
+            },
+            1);
     } else {
         for (auto idx = 0; idx < (int)state->blocks.size(); idx++) {
-            ytrace::trace_block(
-                state, idx, state->cur_sample, state->cur_sample + nsamples);
+            ytrace::trace_block_samples(state, idx, samples_max);
         }
     }
-    state->cur_sample += nsamples;
+    state->cur_sample = samples_max;
     return true;
 }
 
 //
-// Starts an anyncrhounous renderer with a maximum of 256 samples.
+// Asynchronous rendering loop. Jobs are numbered pass by pass, with blocks
+// in center-first order within a pass. The first passes are coarse previews
+// of blocks without samples, the following ones add one sample to a block.
+// Blocks keep their own sample count, so the image is correct whenever it is
+// displayed and a cancelled pass does not hold back the others.
+//
+void trace_async_jobs(trace_state* state) {
+    auto nblocks = (int)state->blocks.size();
+    auto njobs = (async_npreviews + state->params.nsamples) * nblocks;
+    while (!state->async_stop) {
+        auto job = state->async_next++;
+        if (job >= njobs) break;
+        auto pass = job / nblocks, block_idx = job % nblocks;
+        auto& samples = state->block_samples[block_idx];
+        std::lock_guard<std::mutex> lock_guard(state->block_locks[block_idx]);
+        if (pass < async_npreviews) {
+            if (samples) continue;
+            trace_block_preview(state, block_idx, async_preview_sizes[pass]);
+        } else {
+            auto sample = samples.load();
+            if (sample >= state->params.nsamples) continue;
+            auto& rows = state->block_rows[block_idx];
+            rows = trace_block(state, block_idx, sample, sample + 1, rows);
+            if (rows < ym::diagonal(state->blocks[block_idx]).y) continue;
+            rows = 0;
+            samples++;
+        }
+    }
+}
+
+//
+// Starts an anyncrhounous renderer with a maximum of params.nsamples samples.
+// Rendering resumes from the per-block sample counts, so a stopped render
+// can be restarted without losing work.
 //
 void trace_async_start(trace_state* state) {
-    for (auto sample = 0; sample < state->params.nsamples; sample++) {
-        for (auto block_idx = 0; block_idx < state->blocks.size();
-             block_idx++) {
-            yu::concurrent::run_async(
-                state->pool, [state, sample, block_idx]() {
-                    ytrace::trace_block(state, block_idx, sample, sample + 1);
-                    if (block_idx == state->blocks.size() - 1) {
-                        state->cur_sample++;
-                    }
-                });
-        }
+    trace_async_stop(state);
+    if (!state->pool) state->pool = yu::concurrent::make_pool(1);
+    if (!state->async_group) state->async_group = yu::concurrent::make_group();
+    auto nblocks = (int)state->blocks.size();
+    auto cur_sample = get_cur_sample(state);
+    auto first_pass = (cur_sample) ? async_npreviews + cur_sample : 0;
+    state->async_next = first_pass * nblocks;
+    auto nworkers = ym::max(1, (int)std::thread::hardware_concurrency());
+    for (auto worker = 0; worker < nworkers; worker++) {
+        yu::concurrent::run_async(state->pool, state->async_group,
+            [state]() { trace_async_jobs(state); });
     }
 }
 
 //
-// Stop the asynchronous renderer.
+// Stop the asynchronous renderer. Running blocks stop at their next
+// scanline, so the call returns quickly and the state can be reinitialized
+// right away, e.g. after a camera move.
 //
 void trace_async_stop(trace_state* state) {
-    if (!state->pool) return;
-    yu::concurrent::clear_pool(state->pool);
+    if (!state->pool || !state->async_group) return;
+    state->async_stop = true;
+    yu::concurrent::wait_group(state->pool, state->async_group);
+    state->async_stop = false;
 }
 
 }  // namespace ytrace
@@ -74,12 +74,17 @@
 /// 4. define rendering params with the `trace_params` structure
 /// 5. initoialize the prograssive rendering state with `init_state()`
 /// 6. either render sames successively with `trace_next_samples()`
-///    or starts an asynchronousn renderer
+///    or starts an asynchronousn renderer with `trace_async_start()`;
+///    the asynchronous renderer traces blocks from the image center outwards,
+///    with coarse previews before the first sample of each block
 /// 7. get the rendered image with `get_traced_image()`
+/// 8. on scene or camera changes, call `trace_async_stop()`, which cancels
+///    running blocks at the next scanline, and `init_state()`
 ///
 ///
 /// ## History
 ///
+/// - v 0.28: progressive center-first asynchronous rendering with cancellation
 /// - v 0.27: debug renderers
 /// - v 0.26: thin glass material
 /// - v 0.25: added refraction (still buggy in some cases)
@@ -695,7 +700,7 @@ void get_aux_buffers(const trace_state* state, ym::image4f& norm,
     ym::image4f& albedo, ym::image4f& depth);
 
 ///
-/// Gets the current sample number
+/// Gets the current sample number, i.e. the samples completed by all blocks
 ///
 int get_cur_sample(const trace_state* state);
 
@@ -717,12 +722,17 @@ inline ym::image4f trace_image(const scene* scn, const trace_params& params) {
 }
 
 ///
-/// Starts an anyncrhounous renderer with a maximum of 256 samples.
+/// Starts an anyncrhounous renderer with a maximum of params.nsamples samples.
+/// Blocks are traced from the image center outwards. Blocks without samples
+/// are first previewed at 1/8 and 1/4 resolution. Each block keeps its own
+/// sample count, so the image can be displayed at any time. Rendering
+/// resumes from the current samples if the state was not reinitialized.
 ///
 void trace_async_start(trace_state* state);
 
 ///
-/// Stop the asynchronous renderer.
+/// Stop the asynchronous renderer. Running blocks are cancelled at the next
+/// scanline and the call waits for them to exit.
 ///
 void trace_async_stop(trace_state* state);
 
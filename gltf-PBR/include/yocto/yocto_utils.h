@@ -48,9 +48,12 @@
 /// ## Usage for Concurrent Execution
 ///
 /// 1. namespace concurrent
-/// 2. either create a thread pool `make_thread_pool` or use the global one
-/// 3. run tasks in parallel `thread_pool_for()`
-/// 4. run tasks asynchronously `thread_pool_async()`
+/// 2. either create a thread pool `make_pool()` or use the global one
+/// 3. run tasks in parallel with `parallel_for()`, either per index or over
+///    ranges of a given grain size
+/// 4. run tasks asynchronously with `run_async()`
+/// 5. group tasks with `make_group()`, chain them with `run_after()` and wait
+///    for them with `wait_group()`; the waiting thread runs queued tasks
 ///
 /// ## Utilities
 ///
@@ -64,6 +67,7 @@
 ///
 /// ## History
 ///
+/// - v 0.23: work-stealing thread pool, task groups and range parallel for
 /// - v 0.22: simpler logging
 /// - v 0.21: move to header-only mode
 /// - v 0.20: simpler logging
@@ -114,61 +118,27 @@ namespace yu {}
 // SOFTWARE.
 //
 
-//
-// LICENSE OF INCLUDED SOFTWARE for ThreadPool code from LLVM code base
-//
-// Copyright (c) 2003-2016 University of Illinois at Urbana-Champaign.
-// All rights reserved.
-//
-// Developed by:
-//
-//     LLVM Team
-//
-//     University of Illinois at Urbana-Champaign
-//
-//     http://llvm.org
-//
-// Permission is hereby granted, free of charge, to any person obtaining a copy
-// of this software and associated documentation files (the "Software"), to deal
-// with the Software without restriction, including without limitation the
-// rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
-// sell copies of the Software, and to permit persons to whom the Software is
-// furnished to do so, subject to the following conditions:
-//
-//     * Redistributions of source code must retain the above copyright notice,
-//       this list of conditions and the following disclaimers.
-//
-//     * Redistributions in binary form must reproduce the above copyright
-//     notice,
-//       this list of conditions and the following disclaimers in the
-//       documentation and/or other materials provided with the distribution.
-//
-//     * Neither the names of the LLVM Team, University of Illinois at
-//       Urbana-Champaign, nor the names of its contributors may be used to
-//       endorse or promote products derived from this Software without specific
-//       prior written permission.
-//
-// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
-// CONTRIBUTORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS WITH
-// THE SOFTWARE.
-
 #ifndef _YU_H_
 #define _YU_H_
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -966,6 +936,125 @@ namespace concurrent {
 ///
 struct thread_pool;
 
+///
+/// Forward declaration of a task group. Groups count their outstanding tasks
+/// so that callers can wait on a subset of the pool work and chain
+/// dependent tasks.
+///
+struct task_group;
+
+///
+/// Move-only callable run by the thread pool. Small callables are stored
+/// inline to avoid a heap allocation per task.
+///
+struct async_task {
+    /// empty task
+    async_task() {}
+
+    /// task from callable
+    template <typename F, typename = typename std::enable_if<!std::is_same<
+                              typename std::decay<F>::type,
+                              async_task>::value>::type>
+    async_task(F&& fn) {
+        using T = typename std::decay<F>::type;
+        init<T>(std::forward<F>(fn),
+            std::integral_constant<bool,
+                sizeof(T) <= sizeof(storage) &&
+                    alignof(T) <= alignof(storage) &&
+                    std::is_nothrow_move_constructible<T>::value>());
+    }
+
+    /// move constructor
+    async_task(async_task&& other) { move_from(other); }
+
+    /// move assignment
+    async_task& operator=(async_task&& other) {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    /// destructor
+    ~async_task() { reset(); }
+
+    /// no copies
+    async_task(const async_task&) = delete;
+    async_task& operator=(const async_task&) = delete;
+
+    /// check whether the task is empty
+    explicit operator bool() const { return ops != nullptr; }
+
+    /// run the task
+    void operator()() { ops->call(&buffer); }
+
+    /// destroy the stored callable
+    void reset() {
+        if (!ops) return;
+        ops->destroy(&buffer);
+        ops = nullptr;
+    }
+
+    // implementation -------------------------------------------------
+   private:
+    struct vtable {
+        void (*call)(void* buf);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* buf);
+    };
+
+    template <typename T>
+    struct inline_ops {
+        static void call(void* buf) { (*(T*)buf)(); }
+        static void move(void* dst, void* src) {
+            new (dst) T(std::move(*(T*)src));
+            ((T*)src)->~T();
+        }
+        static void destroy(void* buf) { ((T*)buf)->~T(); }
+        static const vtable table;
+    };
+
+    template <typename T>
+    struct heap_ops {
+        static void call(void* buf) { (**(T**)buf)(); }
+        static void move(void* dst, void* src) { *(T**)dst = *(T**)src; }
+        static void destroy(void* buf) { delete *(T**)buf; }
+        static const vtable table;
+    };
+
+    template <typename T, typename F>
+    void init(F&& fn, std::true_type) {
+        new (&buffer) T(std::forward<F>(fn));
+        ops = &inline_ops<T>::table;
+    }
+    template <typename T, typename F>
+    void init(F&& fn, std::false_type) {
+        *(T**)&buffer = new T(std::forward<F>(fn));
+        ops = &heap_ops<T>::table;
+    }
+
+    void move_from(async_task& other) {
+        if (!other.ops) return;
+        other.ops->move(&buffer, &other.buffer);
+        ops = other.ops;
+        other.ops = nullptr;
+    }
+
+    using storage =
+        typename std::aligned_storage<48, alignof(std::max_align_t)>::type;
+    storage buffer;
+    const vtable* ops = nullptr;
+};
+
+template <typename T>
+const async_task::vtable async_task::inline_ops<T>::table = {
+    &inline_ops<T>::call, &inline_ops<T>::move, &inline_ops<T>::destroy};
+
+template <typename T>
+const async_task::vtable async_task::heap_ops<T>::table = {
+    &heap_ops<T>::call, &heap_ops<T>::move, &heap_ops<T>::destroy};
+
 ///
 /// Initialize a thread pool with a certain number of threads (0 for
 /// defatul).
@@ -988,10 +1077,18 @@ inline void wait_pool(thread_pool* pool);
 inline void clear_pool(thread_pool* pool);
 
 ///
-/// Parallel for implementation
+/// Parallel for implementation. Indices are split in ranges of `grain`
+/// elements (0 for automatic) that are load balanced across threads.
 ///
-inline void parallel_for(
-    thread_pool* pool, int count, const std::function<void(int idx)>& task);
+inline void parallel_for(thread_pool* pool, int count,
+    const std::function<void(int idx)>& task, int grain = 0);
+
+///
+/// Parallel for over ranges `[begin, end)` of at most `grain` elements (0 for
+/// automatic).
+///
+inline void parallel_for(thread_pool* pool, int count, int grain,
+    const std::function<void(int begin, int end)>& task);
 
 ///
 /// Runs a task asynchronously onto a thread pool
@@ -999,6 +1096,33 @@ inline void parallel_for(
 inline std::shared_future<void> run_async(
     thread_pool* pool, const std::function<void()>& task);
 
+///
+/// Initialize a task group
+///
+inline task_group* make_group();
+
+///
+/// Free a task group; all its tasks have to be completed
+///
+inline void free_group(task_group*& group);
+
+///
+/// Runs a task asynchronously as part of a task group
+///
+inline void run_async(thread_pool* pool, task_group* group, async_task&& task);
+
+///
+/// Runs a task as part of `group` once all tasks in `dependency` completed
+///
+inline void run_after(thread_pool* pool, task_group* dependency,
+    task_group* group, async_task&& task);
+
+///
+/// Wait for all tasks of a group to finish. The calling thread helps
+/// running queued tasks while waiting.
+///
+inline void wait_group(thread_pool* pool, task_group* group);
+
 ///
 /// Wait for all jobs to finish on a global thread pool
 ///
@@ -1017,7 +1141,14 @@ inline std::shared_future<void> run_async(const std::function<void()>& task);
 ///
 /// Parallel for implementation on a global thread pool
 ///
-inline void parallel_for(int count, const std::function<void(int idx)>& task);
+inline void parallel_for(
+    int count, const std::function<void(int idx)>& task, int grain = 0);
+
+///
+/// Parallel for over ranges on a global thread pool
+///
+inline void parallel_for(
+    int count, int grain, const std::function<void(int begin, int end)>& task);
 
 }  // namespace concurrent
 
@@ -1618,123 +1749,221 @@ inline void log_msg(logger& lgr, log_level level, const std::string& name,
 namespace concurrent {
 
 //
-// Thread pool code derived from LLVM codebase
+// Spin lock guarding the per-thread task queues. Critical sections only move
+// a task in or out of a deque.
 //
+struct spin_lock {
+    std::atomic_flag flag = ATOMIC_FLAG_INIT;
 
-// thread pool
-struct ThreadPool {
-    // thread pool initialized with nthreads
-    ThreadPool(int nthreads = std::thread::hardware_concurrency())
-        : working_threads(0), stop_flag(false) {
-        threads.reserve(nthreads);
-        for (auto tid = 0; tid < nthreads; tid++) {
-            threads.emplace_back([this] { thread_proc(); });
-        }
+    void lock() {
+        while (flag.test_and_set(std::memory_order_acquire))
+            std::this_thread::yield();
     }
+    void unlock() { flag.clear(std::memory_order_release); }
+};
 
-    // destructor
-    ~ThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock_guard(queue_lock);
-            stop_flag = true;
-        }
-        queue_condition.notify_all();
-        for (auto& Worker : threads) Worker.join();
-    }
+//
+// Queued task with the group it counts against.
+//
+struct pool_item {
+    async_task task;
+    task_group* group = nullptr;
+};
 
-    // empty the queue
-    void clear() {
-        {
-            std::unique_lock<std::mutex> lock_guard(queue_lock);
-            tasks.clear();
-        }
-        queue_condition.notify_all();
-    }
+//
+// Task queue. The owner pushes and pops at the back, thieves take from the
+// front, so stolen work is the oldest and usually the largest.
+//
+struct pool_queue {
+    spin_lock lock;
+    std::deque<pool_item> items;
+};
+
+//
+// Task group
+//
+struct task_group {
+    // tasks queued or running in the group
+    std::atomic<int> pending{0};
+    // guards continuations and the final decrement of pending
+    std::mutex lock;
+    // tasks released once pending drops to zero
+    std::vector<pool_item> continuations;
+};
 
-    // schedule an asynchronous taks
-    std::shared_future<void> async(std::function<void()> task) {
-        // Wrap the Task in a packaged_task to return a future object.
-        std::packaged_task<void()> packaged_task(std::move(task));
-        auto future = packaged_task.get_future();
+//
+// Thread pool with one queue per worker plus a shared queue for tasks
+// submitted from outside the pool. Idle threads steal from the others.
+//
+struct thread_pool {
+    // worker threads
+    std::vector<std::thread> threads;
+    // per-worker queues, the last one is shared by external threads
+    std::vector<std::unique_ptr<pool_queue>> queues;
+    // tasks sitting in the queues
+    std::atomic<int> queued{0};
+    // tasks queued or running
+    std::atomic<int> pending{0};
+    // threads waiting on sleep_condition
+    std::atomic<int> sleeping{0};
+    // set on destruction
+    std::atomic<bool> stop_flag{false};
+    // sleep support
+    std::mutex sleep_lock;
+    std::condition_variable sleep_condition;
+
+    ~thread_pool() {
         {
-            std::unique_lock<std::mutex> lock_guard(queue_lock);
-            assert(
-                !stop_flag && "Queuing a thread during ThreadPool destruction");
-            tasks.push_back(std::move(packaged_task));
+            std::lock_guard<std::mutex> lock_guard(sleep_lock);
+            stop_flag = true;
         }
-        queue_condition.notify_one();
-        return future.share();
+        sleep_condition.notify_all();
+        for (auto& worker : threads) worker.join();
     }
+};
 
-    // wait for all tasks to finish
-    void wait() {
-        std::unique_lock<std::mutex> lock_guard(completion_lock);
-        completion_condition.wait(
-            lock_guard, [&] { return tasks.empty() && !working_threads; });
-    }
+//
+// Pool and queue of the current thread, if it is a pool worker.
+//
+struct pool_worker {
+    thread_pool* pool = nullptr;
+    int qid = -1;
+};
 
-    // implementation -------------------------------------------------
-   private:
-    void thread_proc() {
-        while (true) {
-            std::packaged_task<void()> task;
-            {
-                std::unique_lock<std::mutex> lock_guard(queue_lock);
-                queue_condition.wait(
-                    lock_guard, [&] { return stop_flag || !tasks.empty(); });
-
-                if (stop_flag && tasks.empty()) return;
-
-                {
-                    working_threads++;
-                    std::unique_lock<std::mutex> lock_guard(completion_lock);
-                }
-                task = std::move(tasks.front());
-                tasks.pop_front();
-            }
+//
+// Per-thread worker info
+//
+inline pool_worker& get_pool_worker() {
+    static thread_local pool_worker worker;
+    return worker;
+}
 
-            task();
+//
+// Wake sleeping threads
+//
+inline void notify_pool(thread_pool* pool, bool all) {
+    if (!pool->sleeping) return;
+    std::lock_guard<std::mutex> lock_guard(pool->sleep_lock);
+    if (all)
+        pool->sleep_condition.notify_all();
+    else
+        pool->sleep_condition.notify_one();
+}
 
-            {
-                std::unique_lock<std::mutex> lock_guard(completion_lock);
-                working_threads--;
-            }
+//
+// Push a task on the queue of the calling thread
+//
+inline void push_item(thread_pool* pool, pool_item&& item) {
+    auto& worker = get_pool_worker();
+    auto qid =
+        (worker.pool == pool) ? worker.qid : (int)pool->queues.size() - 1;
+    auto queue = pool->queues[qid].get();
+    queue->lock.lock();
+    queue->items.push_back(std::move(item));
+    queue->lock.unlock();
+    pool->queued++;
+    notify_pool(pool, false);
+}
 
-            completion_condition.notify_all();
+//
+// Pop a task from the own queue or steal one from the others
+//
+inline bool pop_item(thread_pool* pool, pool_item& item) {
+    if (pool->queued <= 0) return false;
+    auto& worker = get_pool_worker();
+    auto nqueues = (int)pool->queues.size();
+    auto own = (worker.pool == pool) ? worker.qid : nqueues - 1;
+    for (auto i = 0; i < nqueues; i++) {
+        auto queue = pool->queues[(own + i) % nqueues].get();
+        queue->lock.lock();
+        if (queue->items.empty()) {
+            queue->lock.unlock();
+            continue;
         }
+        if (i == 0) {
+            item = std::move(queue->items.back());
+            queue->items.pop_back();
+        } else {
+            item = std::move(queue->items.front());
+            queue->items.pop_front();
+        }
+        queue->lock.unlock();
+        pool->queued--;
+        return true;
     }
+    return false;
+}
 
-    std::vector<std::thread> threads;
-    std::deque<std::packaged_task<void()>> tasks;
-    std::mutex queue_lock;
-    std::condition_variable queue_condition;
-    std::mutex completion_lock;
-    std::condition_variable completion_condition;
-    std::atomic<unsigned> working_threads;
-    bool stop_flag = false;
-};
+//
+// Mark a task as done, releasing its group continuations
+//
+inline void finish_item(thread_pool* pool, task_group* group) {
+    auto group_done = false;
+    if (group) {
+        auto ready = std::vector<pool_item>();
+        {
+            std::lock_guard<std::mutex> lock_guard(group->lock);
+            if (--group->pending == 0) {
+                ready.swap(group->continuations);
+                group_done = true;
+            }
+        }
+        for (auto& item : ready) push_item(pool, std::move(item));
+    }
+    if (--pool->pending == 0 || group_done) notify_pool(pool, true);
+}
 
 //
-// End of thread pool code derived from LLVM codebase
+// Run a task
 //
+inline void run_item(thread_pool* pool, pool_item& item) {
+    item.task();
+    item.task.reset();
+    finish_item(pool, item.group);
+}
 
 //
-// Forward declaration of thread pool.
+// Run tasks until done() returns true. Sleeps when there is nothing to do.
 //
-struct thread_pool {
-    ThreadPool* tp = nullptr;
-    ~thread_pool() {
-        if (tp) delete tp;
+template <typename Func>
+inline void run_until(thread_pool* pool, const Func& done) {
+    auto item = pool_item();
+    while (!done()) {
+        if (pop_item(pool, item)) {
+            run_item(pool, item);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock_guard(pool->sleep_lock);
+        pool->sleeping++;
+        pool->sleep_condition.wait(
+            lock_guard, [&] { return done() || pool->queued > 0; });
+        pool->sleeping--;
     }
-};
+}
+
+//
+// Worker thread loop
+//
+inline void run_worker(thread_pool* pool, int qid) {
+    auto& worker = get_pool_worker();
+    worker.pool = pool;
+    worker.qid = qid;
+    run_until(pool, [pool] { return pool->stop_flag && pool->queued <= 0; });
+}
 
 //
 // Initialize a thread pool with a certain number of threads (0 for defatul).
 //
 inline thread_pool* make_pool(int nthread) {
     if (!nthread) nthread = std::thread::hardware_concurrency();
+    if (!nthread) nthread = 1;
     auto pool = new thread_pool();
-    pool->tp = new ThreadPool(nthread);
+    for (auto qid = 0; qid < nthread + 1; qid++)
+        pool->queues.push_back(std::unique_ptr<pool_queue>(new pool_queue()));
+    pool->threads.reserve(nthread);
+    for (auto qid = 0; qid < nthread; qid++) {
+        pool->threads.emplace_back([pool, qid] { run_worker(pool, qid); });
+    }
     return pool;
 }
 
@@ -1754,28 +1983,140 @@ inline void free_pool(thread_pool*& pool) {
 //
 inline std::shared_future<void> run_async(
     thread_pool* pool, const std::function<void()>& task) {
-    return pool->tp->async(task);
+    auto packaged_task = std::packaged_task<void()>(task);
+    auto future = packaged_task.get_future().share();
+    run_async(pool, nullptr, std::move(packaged_task));
+    return future;
 }
 
 //
 // Wait for jobs to finish
 //
-inline void wait_pool(thread_pool* pool) { pool->tp->wait(); }
+inline void wait_pool(thread_pool* pool) {
+    run_until(pool, [pool] { return pool->pending <= 0; });
+}
 
 //
-// Wait for jobs to finish
+// Clear jobs. Tasks not yet started are dropped and count as completed for
+// their groups. Dropped asynchronous tasks leave their futures with a
+// broken_promise error.
 //
-inline void clear_pool(thread_pool* pool) { pool->tp->clear(); }
+inline void clear_pool(thread_pool* pool) {
+    auto dropped = std::vector<pool_item>();
+    while (true) {
+        for (auto& queue : pool->queues) {
+            queue->lock.lock();
+            for (auto& item : queue->items) dropped.push_back(std::move(item));
+            queue->items.clear();
+            queue->lock.unlock();
+        }
+        if (dropped.empty()) break;
+        pool->queued -= (int)dropped.size();
+        // continuations released here are queued and dropped on the next pass
+        for (auto& item : dropped) {
+            item.task.reset();
+            finish_item(pool, item.group);
+        }
+        dropped.clear();
+    }
+}
 
 //
-// Parallel for implementation
+// Initialize a task group
 //
-inline void parallel_for(
-    thread_pool* pool, int count, const std::function<void(int idx)>& task) {
-    for (auto idx = 0; idx < count; idx++) {
-        run_async(pool, [&task, idx]() { task(idx); });
+inline task_group* make_group() { return new task_group(); }
+
+//
+// Free a task group
+//
+inline void free_group(task_group*& group) {
+    if (group) delete group;
+    group = nullptr;
+}
+
+//
+// Enqueue a job in a group
+//
+inline void run_async(thread_pool* pool, task_group* group, async_task&& task) {
+    if (group) group->pending++;
+    pool->pending++;
+    auto item = pool_item();
+    item.task = std::move(task);
+    item.group = group;
+    push_item(pool, std::move(item));
+}
+
+//
+// Enqueue a job once a group completes
+//
+inline void run_after(thread_pool* pool, task_group* dependency,
+    task_group* group, async_task&& task) {
+    if (group) group->pending++;
+    pool->pending++;
+    auto item = pool_item();
+    item.task = std::move(task);
+    item.group = group;
+    {
+        std::lock_guard<std::mutex> lock_guard(dependency->lock);
+        if (dependency->pending > 0) {
+            dependency->continuations.push_back(std::move(item));
+            return;
+        }
     }
-    wait_pool(pool);
+    push_item(pool, std::move(item));
+}
+
+//
+// Wait for a group to finish
+//
+inline void wait_group(thread_pool* pool, task_group* group) {
+    run_until(pool, [group] { return group->pending <= 0; });
+    // the last task may still hold the group lock; acquire it so that the
+    // group can be safely freed on return
+    std::lock_guard<std::mutex> lock_guard(group->lock);
+}
+
+//
+// Split a range in halves, queueing the upper ones, until it is within
+// grain size.
+//
+inline void split_range(thread_pool* pool, task_group* group, int begin,
+    int end, int grain, const std::function<void(int, int)>* task) {
+    while (end - begin > grain) {
+        auto mid = begin + (end - begin) / 2;
+        run_async(pool, group, [pool, group, mid, end, grain, task]() {
+            split_range(pool, group, mid, end, grain, task);
+        });
+        end = mid;
+    }
+    (*task)(begin, end);
+}
+
+//
+// Parallel for over ranges
+//
+inline void parallel_for(thread_pool* pool, int count, int grain,
+    const std::function<void(int begin, int end)>& task) {
+    if (count <= 0) return;
+    if (grain <= 0)
+        grain = std::max(1, count / (8 * (int)pool->queues.size()));
+    if (count <= grain) {
+        task(0, count);
+        return;
+    }
+    task_group group;
+    split_range(pool, &group, 0, count, grain, &task);
+    wait_group(pool, &group);
+}
+
+//
+// Parallel for implementation
+//
+inline void parallel_for(thread_pool* pool, int count,
+    const std::function<void(int idx)>& task, int grain) {
+    parallel_for(pool, count, grain, [&task](int begin, int end) {
+        for (auto idx = begin; idx < end; idx++) task(idx);
+    });
 }
 
 //
@@ -1802,7 +2143,7 @@ inline std::shared_future<void> run_async(const std::function<void()>& task) {
 // Wait for jobs to finish
 //
 inline void wait_pool() {
-    if (global_pool) global_pool->tp->wait();
+    if (global_pool) wait_pool(global_pool);
 }
 
 //
@@ -1815,9 +2156,19 @@ inline void clear_pool() {
 //
 // Parallel for implementation
 //
-inline void parallel_for(int count, const std::function<void(int idx)>& task) {
+inline void parallel_for(
+    int count, const std::function<void(int idx)>& task, int grain) {
+    if (!global_pool) make_global_thread_pool();
+    parallel_for(global_pool, count, task, grain);
+}
+
+//
+// Parallel for over ranges
+//
+inline void parallel_for(
+    int count, int grain, const std::function<void(int begin, int end)>& task) {
     if (!global_pool) make_global_thread_pool();
-    parallel_for(global_pool, count, task);
+    parallel_for(global_pool, count, grain, task);
 }
 
 }  // namespace concurrent
@@ -44,7 +44,8 @@ struct BufferViewGLTF
     typedef shared_ptr<BufferViewGLTF> Ref;
     ygltf::bufferView_t property;
 
-    BufferRef cpuBuffer;
+    BufferGLTF::Ref buffer; // owns the memory cpuData points to
+    const uint8_t* cpuData = nullptr; // non-owning slice of BufferGLTF::cpuBuffer
     gl::VboRef gpuBuffer;
 
     static Ref create(RootGLTFRef rootGLTF, const ygltf::bufferView_t& property);
@@ -285,7 +286,7 @@ struct RootGLTF
 
         try
         {
-            bool load_bin = true;
+            bool load_bin = false; // BufferGLTF owns the binary data
             bool load_shaders = true;
             bool load_img = false;
             bool skip_missing = false;
@@ -298,28 +299,30 @@ struct RootGLTF
         }
 
         RootGLTFRef ref = make_shared<RootGLTF>();
-        ref->property = *glTF_t;
+        ref->property = move(*glTF_t);
         ref->gltfPath = gltfPath;
+        glTF_t = nullptr;
 
-        for (auto& item : glTF_t->buffers) ref->buffers.emplace_back(BufferGLTF::create(ref, item));
-        for (auto& item : glTF_t->bufferViews) ref->bufferViews.emplace_back(BufferViewGLTF::create(ref, item));
-        for (auto& item : glTF_t->animations) ref->animations.emplace_back(AnimationGLTF::create(ref, item));
-        for (auto& item : glTF_t->accessors) ref->accessors.emplace_back(AccessorGLTF::create(ref, item));
+        auto& property = ref->property;
+        for (auto& item : property.buffers) ref->buffers.emplace_back(BufferGLTF::create(ref, item));
+        for (auto& item : property.bufferViews) ref->bufferViews.emplace_back(BufferViewGLTF::create(ref, item));
+        for (auto& item : property.animations) ref->animations.emplace_back(AnimationGLTF::create(ref, item));
+        for (auto& item : property.accessors) ref->accessors.emplace_back(AccessorGLTF::create(ref, item));
 
-        for (auto& item : glTF_t->images) ref->images.emplace_back(ImageGLTF::create(ref, item));
-        for (auto& item : glTF_t->samplers) ref->samplers.emplace_back(SamplerGLTF::create(ref, item));
-        for (auto& item : glTF_t->textures) ref->textures.emplace_back(TextureGLTF::create(ref, item));
-        for (auto& item : glTF_t->materials) ref->materials.emplace_back(MaterialGLTF::create(ref, item));
+        for (auto& item : property.images) ref->images.emplace_back(ImageGLTF::create(ref, item));
+        for (auto& item : property.samplers) ref->samplers.emplace_back(SamplerGLTF::create(ref, item));
+        for (auto& item : property.textures) ref->textures.emplace_back(TextureGLTF::create(ref, item));
+        for (auto& item : property.materials) ref->materials.emplace_back(MaterialGLTF::create(ref, item));
 
-        for (auto& item : glTF_t->meshes) ref->meshes.emplace_back(MeshGLTF::create(ref, item));
-        for (auto& item : glTF_t->skins) ref->skins.emplace_back(SkinGLTF::create(ref, item));
-        for (auto& item : glTF_t->cameras) ref->cameras.emplace_back(CameraGLTF::create(ref, item));
+        for (auto& item : property.meshes) ref->meshes.emplace_back(MeshGLTF::create(ref, item));
+        for (auto& item : property.skins) ref->skins.emplace_back(SkinGLTF::create(ref, item));
+        for (auto& item : property.cameras) ref->cameras.emplace_back(CameraGLTF::create(ref, item));
 
-        for (auto& item : glTF_t->nodes) ref->nodes.emplace_back(NodeGLTF::create(ref, item));
-        for (auto& item : glTF_t->scenes) ref->scenes.emplace_back(SceneGLTF::create(ref, item));
+        for (auto& item : property.nodes) ref->nodes.emplace_back(NodeGLTF::create(ref, item));
+        for (auto& item : property.scenes) ref->scenes.emplace_back(SceneGLTF::create(ref, item));
 
-        if (glTF_t->scene == -1) glTF_t->scene = 0;
-        ref->scene = ref->scenes[glTF_t->scene];
+        if (property.scene == -1) property.scene = 0;
+        ref->scene = ref->scenes[property.scene];
 
         return ref;
     }
@@ -563,18 +566,16 @@ BufferViewGLTF::Ref BufferViewGLTF::create(RootGLTFRef rootGLTF, const ygltf::bu
     CI_ASSERT(property.buffer != -1);
     CI_ASSERT(property.byteLength != -1);
     CI_ASSERT(property.byteOffset != -1);
-    CI_ASSERT_MSG(property.byteStride == 0, "TODO");
 
     BufferViewGLTF::Ref ref = make_shared<BufferViewGLTF>();
     ref->property = property;
 
-    auto buffer = rootGLTF->buffers[property.buffer];
-    auto cpuBuffer = buffer->cpuBuffer;
-    auto offsetedData = (uint8_t*)cpuBuffer->getData() + property.byteOffset;
+    ref->buffer = rootGLTF->buffers[property.buffer];
+    auto cpuBuffer = ref->buffer->cpuBuffer;
     CI_ASSERT(property.byteOffset + property.byteLength <= cpuBuffer->getSize());
-    
-    ref->cpuBuffer = Buffer::create(offsetedData, property.byteLength);
-    ref->gpuBuffer = gl::Vbo::create((GLenum)property.target, ref->cpuBuffer->getSize(), ref->cpuBuffer->getData());
+
+    ref->cpuData = (const uint8_t*)cpuBuffer->getData() + property.byteOffset;
+    ref->gpuBuffer = gl::Vbo::create((GLenum)property.target, property.byteLength, ref->cpuData);
 
     return ref;
 }